@@ -31,6 +31,7 @@ using namespace std;
 #include "mon/MonMap.h"
 
 #include "msg/Messenger.h"
+#include "compressor/AsyncCompressor.h"
 
 #include "common/Timer.h"
 #include "common/TracepointProvider.h"
@@ -517,12 +518,21 @@ int main(int argc, const char **argv)
 
   ms_cluster->set_default_policy(Messenger::Policy::stateless_server(0, 0));
   ms_cluster->set_policy(entity_name_t::TYPE_MON, Messenger::Policy::lossy_client(0,0));
-  ms_cluster->set_policy(entity_name_t::TYPE_OSD,
-			 Messenger::Policy::lossless_peer(supported,
-							  osd_required));
+  Messenger::Policy osd_policy = Messenger::Policy::lossless_peer(supported,
+								   osd_required);
+  osd_policy.compress = g_conf->osd_cluster_compress;
+  ms_cluster->set_policy(entity_name_t::TYPE_OSD, osd_policy);
   ms_cluster->set_policy(entity_name_t::TYPE_CLIENT,
 			 Messenger::Policy::stateless_server(0, 0));
 
+  // lets peer osds send us compressed messages, and lets us compress
+  // ours if osd_cluster_compress is set
+  AsyncCompressor *compressor = NULL;
+  if (g_conf->async_compressor_enabled) {
+    compressor = new AsyncCompressor(g_ceph_context);
+    ms_cluster->set_compressor(compressor);
+  }
+
   ms_hbclient->set_policy(entity_name_t::TYPE_OSD,
 			  Messenger::Policy::lossy_client(0, 0));
   ms_hb_back_server->set_policy(entity_name_t::TYPE_OSD,
@@ -603,6 +613,8 @@ int main(int argc, const char **argv)
   ms_hbclient->start();
   ms_hb_front_server->start();
   ms_hb_back_server->start();
+  if (compressor)
+    compressor->init();
   ms_cluster->start();
   ms_objecter->start();
 
@@ -631,6 +643,8 @@ int main(int argc, const char **argv)
   ms_hb_back_server->wait();
   ms_cluster->wait();
   ms_objecter->wait();
+  if (compressor)
+    compressor->terminate();
 
   unregister_async_signal_handler(SIGHUP, sighup_handler);
   unregister_async_signal_handler(SIGINT, handle_osd_signal);
@@ -645,6 +659,7 @@ int main(int argc, const char **argv)
   delete ms_hb_back_server;
   delete ms_cluster;
   delete ms_objecter;
+  delete compressor;
 
   client_byte_throttler.reset();
   client_msg_throttler.reset();
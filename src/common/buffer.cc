@@ -218,6 +218,32 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
       crc_lock.unlock();
       return true;
     }
+    /**
+     * Look for the longest cached range that starts at @a from and ends
+     * by @a to.  On a miss, *end is set to where the next cached range
+     * starts (or @a to), i.e. how far the caller has to scan itself.
+     */
+    bool get_crc_from(size_t from, size_t to, size_t *end,
+		      pair<uint32_t, uint32_t> *crc) const {
+      crc_lock.get_read();
+      map<pair<size_t, size_t>, pair<uint32_t, uint32_t> >::const_iterator i =
+	crc_map.upper_bound(make_pair(from, to));
+      if (i != crc_map.begin()) {
+	map<pair<size_t, size_t>, pair<uint32_t, uint32_t> >::const_iterator p = i;
+	--p;
+	if (p->first.first == from) {
+	  *end = p->first.second;
+	  *crc = p->second;
+	  crc_lock.unlock();
+	  return true;
+	}
+      }
+      while (i != crc_map.end() && i->first.first == from)
+	++i;  // longer than we want
+      *end = (i != crc_map.end() && i->first.first < to) ? i->first.first : to;
+      crc_lock.unlock();
+      return false;
+    }
     void set_crc(const pair<size_t, size_t> &fromto,
          const pair<uint32_t, uint32_t> &crc) {
       crc_lock.get_write();
@@ -573,6 +599,23 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     }
   };
 
+  class buffer::raw_pooled : public buffer::raw {
+    pool *owner;
+  public:
+    raw_pooled(char *d, unsigned l, pool *p) : raw(d, l), owner(p) {
+      inc_total_alloc(len);
+      bdout << "raw_pooled " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
+    }
+    ~raw_pooled() {
+      owner->put(data, len);
+      dec_total_alloc(len);
+      bdout << "raw_pooled " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+    }
+    raw* clone_empty() {
+      return new buffer::raw_char(len);
+    }
+  };
+
   class buffer::raw_static : public buffer::raw {
   public:
     raw_static(const char *d, unsigned l) : raw((char*)d, l) { }
@@ -685,6 +728,10 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     return new raw_unshareable(len);
   }
 
+  buffer::raw* buffer::claim_pooled(unsigned len, char *buf, pool *p) {
+    return new raw_pooled(buf, len, p);
+  }
+
   buffer::ptr::ptr(raw *r) : _raw(r), _off(0), _len(r->len)   // no lock needed; this is an unref raw.
   {
     r->nref.inc();
@@ -2034,6 +2081,10 @@ int buffer::list::write_fd_zero_copy(int fd) const
   return 0;
 }
 
+// below this, scanning a piece again is cheaper than shifting its
+// cached crc to a different initial value
+static const size_t buffer_crc_adjust_min = 4096;
+
 __u32 buffer::list::crc32c(__u32 crc) const
 {
   for (std::list<ptr>::const_iterator it = _buffers.begin();
@@ -2058,13 +2109,37 @@ __u32 buffer::list::crc32c(__u32 crc) const
 	   * http://crcutil.googlecode.com/files/crc-doc.1.0.pdf
 	   * note, u for our crc32c implementation is 0
 	   */
-	  crc = ccrc.second ^ ceph_crc32c(ccrc.first ^ crc, NULL, it->length());
+	  crc = ccrc.second ^ ceph_crc32c_zeros(ccrc.first ^ crc, it->length());
 	  if (buffer_track_crc)
 	    buffer_cached_crc_adjusted.inc();
 	}
       } else {
+	/* Not this exact range, but other ptrs into the raw may have
+	 * cached pieces of it (e.g. the reads a message was received
+	 * with, now appended into one ptr).  Chain those and only scan
+	 * what no piece covers.
+	 */
 	uint32_t base = crc;
-	crc = ceph_crc32c(crc, (unsigned char*)it->c_str(), it->length());
+	size_t pos = ofs.first;
+	while (pos < ofs.second) {
+	  size_t end;
+	  if (r->get_crc_from(pos, ofs.second, &end, &ccrc) &&
+	      (ccrc.first == crc || end - pos >= buffer_crc_adjust_min)) {
+	    if (ccrc.first == crc) {
+	      crc = ccrc.second;
+	      if (buffer_track_crc)
+		buffer_cached_crc.inc();
+	    } else {
+	      crc = ccrc.second ^ ceph_crc32c_zeros(ccrc.first ^ crc, end - pos);
+	      if (buffer_track_crc)
+		buffer_cached_crc_adjusted.inc();
+	    }
+	  } else {
+	    crc = ceph_crc32c(crc, (unsigned char*)it->c_str() + (pos - ofs.first),
+			      end - pos);
+	  }
+	  pos = end;
+	}
 	r->set_crc(ofs, make_pair(base, crc));
       }
     }
@@ -85,6 +85,9 @@ OPTION(xio_portal_threads, OPT_INT, 2) // xio portal threads per messenger
 OPTION(xio_transport_type, OPT_STR, "rdma") // xio transport type: {rdma or tcp}
 OPTION(xio_max_send_inline, OPT_INT, 512) // xio maximum threshold to send inline
 
+// start a compressor pool for the osd cluster messenger, which then takes
+// compressed messages from peers (async messenger only); peers have to
+// agree on async_compressor_type
 OPTION(async_compressor_enabled, OPT_BOOL, false)
 OPTION(async_compressor_type, OPT_STR, "snappy")
 OPTION(async_compressor_threads, OPT_INT, 2)
@@ -143,6 +146,7 @@ SUBSYS(bdev, 1, 5)
 SUBSYS(kstore, 1, 5)
 SUBSYS(rocksdb, 4, 5)
 SUBSYS(leveldb, 4, 5)
+SUBSYS(memdb, 4, 5)
 
 OPTION(key, OPT_STR, "")
 OPTION(keyfile, OPT_STR, "")
@@ -190,6 +194,29 @@ OPTION(ms_async_set_affinity, OPT_BOOL, true)
 // If ms_async_affinity_cores is empty, all threads will be bind to current running
 // core
 OPTION(ms_async_affinity_cores, OPT_STR, "")
+// place new connections on the least loaded worker instead of round-robin
+OPTION(ms_async_worker_balance, OPT_BOOL, true)
+// seconds between attempts to move a busy connection to an idle worker, 0 to disable
+OPTION(ms_async_rebalance_interval, OPT_DOUBLE, 5)
+// only rebalance once the busiest worker carries this many times the average load
+OPTION(ms_async_rebalance_ratio, OPT_DOUBLE, 1.5)
+// message data is read straight into page aligned buffers pooled per worker;
+// the largest pooled buffer, and the free bytes each worker keeps for reuse
+OPTION(ms_async_rx_buffer_max, OPT_U64, 4 << 20)
+OPTION(ms_async_rx_buffer_cache, OPT_U64, 32 << 20)
+// hand messages sent from other threads to the connection's worker, which
+// writes whatever has queued up with as few syscalls as it can, instead of
+// writing each one from the sender's thread
+OPTION(ms_async_send_coalesce, OPT_BOOL, true)
+// how much the worker gathers before each sendmsg; a single message may exceed it
+OPTION(ms_async_send_batch_bytes, OPT_U64, 1 << 20)
+OPTION(ms_async_send_batch_iovs, OPT_INT, 1024)
+// pass MSG_MORE while more of the batch is still to come
+OPTION(ms_async_send_more, OPT_BOOL, true)
+// smallest message segment worth compressing, where the policy asks for it
+OPTION(ms_async_compress_min_size, OPT_U64, 8192)
+// largest message we accept to decompress to
+OPTION(ms_async_decompress_max_size, OPT_U64, 128 << 20)
 
 OPTION(inject_early_sigterm, OPT_BOOL, false)
 
@@ -521,6 +548,9 @@ OPTION(mds_max_scrub_ops_in_progress, OPT_INT, 5) // the number of simultaneous
 
 // If true, compact leveldb store on mount
 OPTION(osd_compact_leveldb_on_mount, OPT_BOOL, false)
+// compress replication and recovery traffic to peer osds; needs
+// async_compressor_enabled on both ends
+OPTION(osd_cluster_compress, OPT_BOOL, false)
 
 // Maximum number of backfills to or from a single osd
 OPTION(osd_max_backfills, OPT_U64, 1)
@@ -769,6 +799,10 @@ OPTION(leveldb_paranoid, OPT_BOOL, false) // leveldb paranoid flag
 OPTION(leveldb_log, OPT_STR, "/dev/null")  // enable leveldb log file
 OPTION(leveldb_compact_on_mount, OPT_BOOL, false)
 
+OPTION(memdb_shards, OPT_INT, 8) // memdb key space shards, each with its own lock
+OPTION(memdb_dump_interval, OPT_DOUBLE, 0) // seconds between memdb dumps to disk; 0 to only dump on close
+OPTION(memdb_dump_on_close, OPT_BOOL, true) // dump memdb to disk when it is closed
+
 OPTION(kinetic_host, OPT_STR, "") // hostname or ip address of a kinetic drive to use
 OPTION(kinetic_port, OPT_INT, 8123) // port number of the kinetic drive
 OPTION(kinetic_user_id, OPT_INT, 1) // kinetic user to authenticate as
@@ -779,6 +813,8 @@ OPTION(kinetic_use_ssl, OPT_BOOL, false) // whether to secure kinetic traffic wi
 OPTION(rocksdb_separate_wal_dir, OPT_BOOL, false) // use $path.wal for wal
 OPTION(rocksdb_db_paths, OPT_STR, "")   // path,size( path,size)*
 OPTION(rocksdb_log_to_ceph_log, OPT_BOOL, true)  // log to ceph log
+OPTION(rocksdb_cache_size, OPT_U64, 128*1024*1024)  // block cache, when using column families
+OPTION(rocksdb_iterator_readahead_size, OPT_U64, 2*1024*1024)  // for prefetching iterators
 // rocksdb options that will be used for keyvaluestore(if backend is rocksdb)
 OPTION(keyvaluestore_rocksdb_options, OPT_STR, "")
 // rocksdb options that will be used for omap(if omap_backend is rocksdb)
@@ -832,12 +868,18 @@ OPTION(osd_bench_duration, OPT_U32, 30) // duration of 'osd bench', capped at 30
 OPTION(memstore_device_bytes, OPT_U64, 1024*1024*1024)
 OPTION(memstore_page_set, OPT_BOOL, true)
 OPTION(memstore_page_size, OPT_U64, 64 << 10)
+OPTION(memstore_page_pool, OPT_BOOL, true) // take pages from per-thread slab caches rather than new/delete
 
 OPTION(bdev_debug_inflight_ios, OPT_BOOL, false)
 OPTION(bdev_inject_crash, OPT_INT, 0)  // if N>0, then ~ 1/N IOs will complete before we crash on flush.
 OPTION(bdev_aio, OPT_BOOL, true)
 OPTION(bdev_aio_poll_ms, OPT_INT, 250)  // milliseconds
-OPTION(bdev_aio_max_queue_depth, OPT_INT, 4096)
+OPTION(bdev_aio_max_queue_depth, OPT_INT, 4096)  // per aio queue
+OPTION(bdev_aio_queues, OPT_INT, 2)  // aio contexts, each with its own completion thread
+OPTION(bdev_aio_submit_batch_us, OPT_INT, 0)  // wait this long for other submitters to share an io_submit
+OPTION(bdev_type, OPT_STR, "kernel")  // kernel (libaio) or nvme (userspace, polled)
+OPTION(bdev_nvme_queue_pairs, OPT_INT, 4)  // one poller thread each; submitters pick by cpu
+OPTION(bdev_nvme_poll_spins, OPT_INT, 10000)  // idle polls before a poller sleeps until the next submission
 
 OPTION(bluefs_alloc_size, OPT_U64, 1048576)
 OPTION(bluefs_max_prefetch, OPT_U64, 1048576)
@@ -846,6 +888,9 @@ OPTION(bluefs_max_log_runway, OPT_U64, 4194304)  // alloc this much at a time
 OPTION(bluefs_log_compact_min_ratio, OPT_FLOAT, 5.0)      // before we consider
 OPTION(bluefs_log_compact_min_size, OPT_U64, 16*1048576)  // before we consider
 OPTION(bluefs_min_flush_size, OPT_U64, 65536)  // ignore flush until its this big
+OPTION(bluefs_spill_back_interval, OPT_DOUBLE, 5)  // seconds between spill-back passes; 0 to disable
+OPTION(bluefs_spill_back_min_free_ratio, OPT_FLOAT, .2)  // leave this much of the preferred bdev free
+OPTION(bluefs_spill_back_max_bytes, OPT_U64, 256*1048576)  // max bytes moved back per pass
 
 OPTION(bluestore_bluefs, OPT_BOOL, true)
 OPTION(bluestore_bluefs_env_mirror, OPT_BOOL, false) // mirror to normal Env for debug
@@ -864,8 +909,26 @@ OPTION(bluestore_max_dir_size, OPT_U32, 1000000)
 OPTION(bluestore_min_alloc_size, OPT_U32, 64*1024)
 OPTION(bluestore_onode_map_size, OPT_U32, 1024)   // onodes per collection
 OPTION(bluestore_cache_tails, OPT_BOOL, true)   // cache tail blocks in Onode
+OPTION(bluestore_cache_type, OPT_STR, "2q")   // lru, 2q
+OPTION(bluestore_buffer_cache_size, OPT_U64, 16*1024*1024)  // data bytes per collection
+OPTION(bluestore_2q_cache_kin_ratio, OPT_DOUBLE, .5)    // share of cache for A1in
+OPTION(bluestore_2q_cache_kout_ratio, OPT_DOUBLE, .5)   // A1out history, relative to cached buffer count
+OPTION(bluestore_default_buffered_read, OPT_BOOL, true) // cache data read from disk
+OPTION(bluestore_csum_type, OPT_STR, "crc32c") // none, crc32c, xxhash32, xxhash64
+OPTION(bluestore_csum_block_size, OPT_U32, 4096) // power of 2, 4k..64k, divides min_alloc_size
+OPTION(bluestore_compression, OPT_STR, "none")  // none, passive, aggressive, force
+OPTION(bluestore_compression_algorithm, OPT_STR, "snappy") // snappy, zlib
+OPTION(bluestore_compression_required_ratio, OPT_DOUBLE, .875) // store raw unless compressed/raw <= this
+OPTION(bluestore_allocator, OPT_STR, "stupid")  // stupid, bitmap
+OPTION(bluestore_bitmapallocator_blocks_per_zone, OPT_U32, 32768) // multiple of 512
+OPTION(bluestore_bitmapallocator_zone_lock_stripes, OPT_U32, 64)
+OPTION(bluestore_freelist_type, OPT_STR, "extent")  // extent, bitmap; fixed at mkfs
+OPTION(bluestore_freelist_blocks_per_key, OPT_INT, 128)  // bitmap freelist; power of 2, >= 8
 OPTION(bluestore_backend, OPT_STR, "rocksdb")
 OPTION(bluestore_rocksdb_options, OPT_STR, "compression=kNoCompression,max_write_buffer_number=16,min_write_buffer_number_to_merge=3,recycle_log_file_num=16")
+// rocksdb column families, e.g. "omap=M:bloom_bits=10;block_cache_share=.25 meta=O+C+S";
+// the family layout is fixed at mkfs, their options may be changed later
+OPTION(bluestore_rocksdb_column_families, OPT_STR, "")
 OPTION(bluestore_fsck_on_mount, OPT_BOOL, false)
 OPTION(bluestore_fsck_on_umount, OPT_BOOL, false)
 OPTION(bluestore_fail_eio, OPT_BOOL, true)
@@ -873,6 +936,10 @@ OPTION(bluestore_sync_io, OPT_BOOL, false)  // perform initial io synchronously
 OPTION(bluestore_sync_transaction, OPT_BOOL, false)  // perform kv txn synchronously
 OPTION(bluestore_sync_submit_transaction, OPT_BOOL, false)
 OPTION(bluestore_sync_wal_apply, OPT_BOOL, true)     // perform initial wal work synchronously (possibly in combination with aio so we only *queue* ios)
+OPTION(bluestore_shard_finishers, OPT_INT, 4)  // completion finishers, sharded by sequencer
+OPTION(bluestore_wal_batch_max_bytes, OPT_U64, 4*1024*1024)  // apply wal batch once it holds this much data
+OPTION(bluestore_wal_batch_max_txc, OPT_INT, 64)  // ... or this many txcs
+OPTION(bluestore_wal_batch_max_age, OPT_DOUBLE, .005)  // ... or it is this old (seconds); 0 applies each txc's wal immediately
 OPTION(bluestore_wal_threads, OPT_INT, 4)
 OPTION(bluestore_wal_thread_timeout, OPT_INT, 30)
 OPTION(bluestore_wal_thread_suicide_timeout, OPT_INT, 120)
@@ -933,6 +1000,7 @@ OPTION(filestore_debug_inject_read_err, OPT_BOOL, false)
 
 OPTION(filestore_debug_omap_check, OPT_BOOL, 0) // Expensive debugging check on sync
 OPTION(filestore_omap_header_cache_size, OPT_INT, 1024)
+OPTION(filestore_omap_header_cache_shards, OPT_INT, 8)
 
 // Use omap for xattrs for attrs over
 // filestore_max_inline_xattr_size or
@@ -978,12 +1046,17 @@ OPTION(filestore_queue_max_bytes, OPT_INT, 100 << 20)
 OPTION(filestore_queue_committing_max_ops, OPT_INT, 500)        // this is ON TOP of filestore_queue_max_*
 OPTION(filestore_queue_committing_max_bytes, OPT_INT, 100 << 20) //  "
 OPTION(filestore_op_threads, OPT_INT, 2)
+OPTION(filestore_parallel_apply, OPT_BOOL, false) // apply ops of one sequencer in parallel when they touch different objects
 OPTION(filestore_op_thread_timeout, OPT_INT, 60)
 OPTION(filestore_op_thread_suicide_timeout, OPT_INT, 180)
 OPTION(filestore_commit_timeout, OPT_FLOAT, 600)
 OPTION(filestore_fiemap_threshold, OPT_INT, 4096)
 OPTION(filestore_merge_threshold, OPT_INT, 10)
 OPTION(filestore_split_multiple, OPT_INT, 2)
+OPTION(filestore_split_in_background, OPT_BOOL, false) // split directories from a background thread instead of the write that crossed the threshold
+OPTION(filestore_split_objects_per_sec, OPT_INT, 1000)   // background split rate limit; 0 for no limit
+OPTION(filestore_split_batch_objects, OPT_INT, 128)      // objects moved per background split step
+OPTION(filestore_split_inline_multiple, OPT_INT, 2)      // split inline anyway once a directory is this many times over the split threshold
 OPTION(filestore_update_to, OPT_INT, 1000)
 OPTION(filestore_blackhole, OPT_BOOL, false)     // drop any new transactions on the floor
 OPTION(filestore_fd_cache_size, OPT_INT, 128)    // FD lru size
@@ -998,6 +1071,7 @@ OPTION(filestore_debug_verify_split, OPT_BOOL, false)
 OPTION(journal_dio, OPT_BOOL, true)
 OPTION(journal_aio, OPT_BOOL, true)
 OPTION(journal_force_aio, OPT_BOOL, false)
+OPTION(journal_aio_queue_depth, OPT_INT, 128)  // max aios in flight to the journal
 
 OPTION(keyvaluestore_queue_max_ops, OPT_INT, 50)
 OPTION(keyvaluestore_queue_max_bytes, OPT_INT, 100 << 20)
@@ -45,3 +45,54 @@ ceph_crc32c_func_t ceph_choose_crc32(void)
  */
 ceph_crc32c_func_t ceph_crc32c_func = ceph_choose_crc32();
 
+
+/*
+ * Feeding zeros into a crc32c (no pre/post inversion) is multiplication
+ * by x^(8*len) modulo the crc32c polynomial, so we can do it in
+ * O(log(len)) instead of running over len bytes.  Polynomials are
+ * bit-reflected, like the crc itself: x^0 is the top bit.  See
+ * http://crcutil.googlecode.com/files/crc-doc.1.0.pdf
+ */
+#define CRC32C_POLY 0x82f63b78
+
+// a * b modulo the crc32c polynomial
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+  uint32_t m = (uint32_t)1 << 31;
+  uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+	break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+  }
+  return p;
+}
+
+namespace {
+// x^(2^n) modulo the crc32c polynomial, for all 8*length < 2^35
+struct crc32c_x2n_table {
+  uint32_t t[35];
+  crc32c_x2n_table() {
+    uint32_t p = (uint32_t)1 << 30;  // x^1
+    t[0] = p;
+    for (int n = 1; n < 35; n++)
+      t[n] = p = crc32c_multmodp(p, p);
+  }
+};
+}
+
+uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned length)
+{
+  static const crc32c_x2n_table x2n;
+  // x^(8*length): one table entry per bit set in length, from 2^3 up
+  uint32_t p = (uint32_t)1 << 31;  // x^0
+  for (unsigned k = 3; length; length >>= 1, k++) {
+    if (length & 1)
+      p = crc32c_multmodp(x2n.t[k], p);
+  }
+  return crc32c_multmodp(p, crc);
+}
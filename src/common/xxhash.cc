@@ -0,0 +1,176 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * xxHash - fast non-cryptographic hash algorithm
+ *
+ * Copyright (C) 2012-2014, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * This is a compact re-implementation of the XXH32 and XXH64 one-shot
+ * functions.
+ */
+
+#include <string.h>
+
+#include "include/xxhash.h"
+#include "include/byteorder.h"
+
+static const uint32_t PRIME32_1 = 2654435761U;
+static const uint32_t PRIME32_2 = 2246822519U;
+static const uint32_t PRIME32_3 = 3266489917U;
+static const uint32_t PRIME32_4 =  668265263U;
+static const uint32_t PRIME32_5 =  374761393U;
+
+static const uint64_t PRIME64_1 = 11400714785074694791ULL;
+static const uint64_t PRIME64_2 = 14029467366897019727ULL;
+static const uint64_t PRIME64_3 =  1609587929392839161ULL;
+static const uint64_t PRIME64_4 =  9650029242287828579ULL;
+static const uint64_t PRIME64_5 =  2870177450012600261ULL;
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return mswab32(v);
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return mswab64(v);
+}
+
+static inline uint32_t round32(uint32_t acc, uint32_t input)
+{
+  acc += input * PRIME32_2;
+  acc = rotl32(acc, 13);
+  acc *= PRIME32_1;
+  return acc;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc = rotl64(acc, 31);
+  acc *= PRIME64_1;
+  return acc;
+}
+
+static inline uint64_t merge_round64(uint64_t acc, uint64_t val)
+{
+  val = round64(0, val);
+  acc ^= val;
+  acc = acc * PRIME64_1 + PRIME64_4;
+  return acc;
+}
+
+uint32_t ceph_xxhash32(uint32_t seed, const void *data, size_t length)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const uint8_t *end = p + length;
+  uint32_t h32;
+
+  if (length >= 16) {
+    const uint8_t *limit = end - 16;
+    uint32_t v1 = seed + PRIME32_1 + PRIME32_2;
+    uint32_t v2 = seed + PRIME32_2;
+    uint32_t v3 = seed + 0;
+    uint32_t v4 = seed - PRIME32_1;
+    do {
+      v1 = round32(v1, read32(p));
+      v2 = round32(v2, read32(p + 4));
+      v3 = round32(v3, read32(p + 8));
+      v4 = round32(v4, read32(p + 12));
+      p += 16;
+    } while (p <= limit);
+    h32 = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+  } else {
+    h32 = seed + PRIME32_5;
+  }
+
+  h32 += (uint32_t)length;
+
+  while (p + 4 <= end) {
+    h32 += read32(p) * PRIME32_3;
+    h32 = rotl32(h32, 17) * PRIME32_4;
+    p += 4;
+  }
+  while (p < end) {
+    h32 += (*p) * PRIME32_5;
+    h32 = rotl32(h32, 11) * PRIME32_1;
+    ++p;
+  }
+
+  h32 ^= h32 >> 15;
+  h32 *= PRIME32_2;
+  h32 ^= h32 >> 13;
+  h32 *= PRIME32_3;
+  h32 ^= h32 >> 16;
+  return h32;
+}
+
+uint64_t ceph_xxhash64(uint64_t seed, const void *data, size_t length)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const uint8_t *end = p + length;
+  uint64_t h64;
+
+  if (length >= 32) {
+    const uint8_t *limit = end - 32;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed + 0;
+    uint64_t v4 = seed - PRIME64_1;
+    do {
+      v1 = round64(v1, read64(p));
+      v2 = round64(v2, read64(p + 8));
+      v3 = round64(v3, read64(p + 16));
+      v4 = round64(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h64 = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h64 = merge_round64(h64, v1);
+    h64 = merge_round64(h64, v2);
+    h64 = merge_round64(h64, v3);
+    h64 = merge_round64(h64, v4);
+  } else {
+    h64 = seed + PRIME64_5;
+  }
+
+  h64 += (uint64_t)length;
+
+  while (p + 8 <= end) {
+    uint64_t k1 = round64(0, read64(p));
+    h64 ^= k1;
+    h64 = rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    h64 ^= (uint64_t)read32(p) * PRIME64_1;
+    h64 = rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  while (p < end) {
+    h64 ^= (*p) * PRIME64_5;
+    h64 = rotl64(h64, 11) * PRIME64_1;
+    ++p;
+  }
+
+  h64 ^= h64 >> 33;
+  h64 *= PRIME64_2;
+  h64 ^= h64 >> 29;
+  h64 *= PRIME64_3;
+  h64 ^= h64 >> 32;
+  return h64;
+}
@@ -26,6 +26,7 @@ AsyncCompressor::AsyncCompressor(CephContext *c):
   compress_tp(g_ceph_context, "AsyncCompressor::compressor_tp", cct->_conf->async_compressor_threads, "async_compressor_threads"),
   job_lock("AsyncCompressor::job_lock"),
   compress_wq(this, c->_conf->async_compressor_thread_timeout, c->_conf->async_compressor_thread_suicide_timeout, &compress_tp) {
+  assert(compressor);
 }
 
 void AsyncCompressor::init()
@@ -38,36 +39,87 @@ void AsyncCompressor::terminate()
 {
   ldout(cct, 10) << __func__ << dendl;
   compress_tp.stop();
+
+  // nobody will pick up jobs with a completion, so cancel them here
+  list<Completion*> cancelled;
+  compress_tp.lock();
+  job_lock.Lock();
+  for (deque<Job*>::iterator it = compress_wq.job_queue.begin();
+       it != compress_wq.job_queue.end(); ) {
+    if ((*it)->onfinish && (*it)->status.compare_and_swap(WAIT, DONE)) {
+      cancelled.push_back((*it)->onfinish);
+      jobs.erase((*it)->id);
+      it = compress_wq.job_queue.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  job_lock.Unlock();
+  compress_tp.unlock();
+  ldout(cct, 10) << __func__ << " cancelled " << cancelled.size() << " jobs" << dendl;
+  for (list<Completion*>::iterator it = cancelled.begin(); it != cancelled.end(); ++it)
+    (*it)->complete(-ECANCELED);
 }
 
-uint64_t AsyncCompressor::async_compress(bufferlist &data)
+uint64_t AsyncCompressor::_queue(bool compress, bufferlist &data, Completion *onfinish,
+                                 size_t max_len)
 {
   uint64_t id = job_id.inc();
   pair<unordered_map<uint64_t, Job>::iterator, bool> it;
   {
     Mutex::Locker l(job_lock);
-    it = jobs.insert(make_pair(id, Job(id, true)));
+    it = jobs.insert(make_pair(id, Job(id, compress, onfinish, max_len)));
     it.first->second.data = data;
   }
   compress_wq.queue(&it.first->second);
-  ldout(cct, 10) << __func__ << " insert async compress job id=" << id << dendl;
   return id;
 }
 
-uint64_t AsyncCompressor::async_decompress(bufferlist &data)
+void AsyncCompressor::_finish(Job *item, int r, bufferlist &out, utime_t elapsed)
 {
-  uint64_t id = job_id.inc();
-  pair<unordered_map<uint64_t, Job>::iterator, bool> it;
+  Completion *c = item->onfinish;
+  ldout(cct, 20) << __func__ << " job id=" << item->id << " r=" << r
+                 << " took " << elapsed << dendl;
+  if (!r)
+    c->data.swap(out);
+  else
+    r = -EIO;
+  c->elapsed = elapsed;
   {
     Mutex::Locker l(job_lock);
-    it = jobs.insert(make_pair(id, Job(id, false)));
-    it.first->second.data = data;
+    jobs.erase(item->id);
   }
-  compress_wq.queue(&it.first->second);
+  c->complete(r);
+}
+
+uint64_t AsyncCompressor::async_compress(bufferlist &data)
+{
+  uint64_t id = _queue(true, data, NULL);
+  ldout(cct, 10) << __func__ << " insert async compress job id=" << id << dendl;
+  return id;
+}
+
+uint64_t AsyncCompressor::async_decompress(bufferlist &data)
+{
+  uint64_t id = _queue(false, data, NULL);
   ldout(cct, 10) << __func__ << " insert async decompress job id=" << id << dendl;
   return id;
 }
 
+void AsyncCompressor::async_compress(bufferlist &data, Completion *onfinish)
+{
+  uint64_t id = _queue(true, data, onfinish);
+  ldout(cct, 10) << __func__ << " insert async compress job id=" << id << dendl;
+}
+
+void AsyncCompressor::async_decompress(bufferlist &data, Completion *onfinish,
+                                       size_t max_len)
+{
+  uint64_t id = _queue(false, data, onfinish, max_len);
+  ldout(cct, 10) << __func__ << " insert async decompress job id=" << id
+                 << " max_len=" << max_len << dendl;
+}
+
 int AsyncCompressor::get_compress_data(uint64_t compress_id, bufferlist &data, bool blocking, bool *finished)
 {
   assert(finished);
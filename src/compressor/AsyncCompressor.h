@@ -19,11 +19,25 @@
 
 #include "include/atomic.h"
 #include "include/str_list.h"
+#include "common/Clock.h"
 #include "Compressor.h"
 #include "common/WorkQueue.h"
 
 
 class AsyncCompressor {
+ public:
+  /**
+   * Completion for the callback flavour of async_compress/async_decompress.
+   * The pool thread stores the result in data and the time it spent in
+   * elapsed, then completes it with 0, -EIO if the compressor failed (or
+   * the data would decompress to more than the job's max_len), or
+   * -ECANCELED if the pool was stopped first.
+   */
+  struct Completion : public Context {
+    bufferlist data;
+    utime_t elapsed;
+  };
+
  private:
   Compressor *compressor;
   CephContext *cct;
@@ -42,8 +56,12 @@ class AsyncCompressor {
     atomic_t status;
     bool is_compress;
     bufferlist data;
-    Job(uint64_t i, bool compress): id(i), status(WAIT), is_compress(compress) {}
-    Job(const Job &j): id(j.id), status(j.status.read()), is_compress(j.is_compress), data(j.data) {}
+    Completion *onfinish;  // NULL if the result is picked up by id
+    size_t max_len;        // most bytes a decompression may produce; 0 for no limit
+    Job(uint64_t i, bool compress, Completion *c = NULL, size_t m = 0)
+      : id(i), status(WAIT), is_compress(compress), onfinish(c), max_len(m) {}
+    Job(const Job &j): id(j.id), status(j.status.read()), is_compress(j.is_compress), data(j.data),
+                       onfinish(j.onfinish), max_len(j.max_len) {}
   };
   Mutex job_lock;
   // only when job.status == DONE && with job_lock holding, we can insert/erase element in jobs
@@ -89,10 +107,17 @@ class AsyncCompressor {
       assert(item->status.read() == WORKING);
       bufferlist out;
       int r;
+      utime_t start = ceph_clock_now(async_compressor->cct);
       if (item->is_compress)
         r = async_compressor->compressor->compress(item->data, out);
+      else if (item->max_len)
+        r = async_compressor->compressor->decompress(item->data, out, item->max_len);
       else
         r = async_compressor->compressor->decompress(item->data, out);
+      if (item->onfinish) {
+        async_compressor->_finish(item, r, out, ceph_clock_now(async_compressor->cct) - start);
+        return;
+      }
       if (!r) {
         item->data.swap(out);
         assert(item->status.compare_and_swap(WORKING, DONE));
@@ -106,6 +131,9 @@ class AsyncCompressor {
   friend class CompressWQ;
   void _compress(bufferlist &in, bufferlist &out);
   void _decompress(bufferlist &in, bufferlist &out);
+  uint64_t _queue(bool compress, bufferlist &data, Completion *onfinish,
+                  size_t max_len = 0);
+  void _finish(Job *item, int r, bufferlist &out, utime_t elapsed);
 
  public:
   AsyncCompressor(CephContext *c);
@@ -123,6 +151,16 @@ class AsyncCompressor {
   uint64_t async_decompress(bufferlist &data);
   int get_compress_data(uint64_t compress_id, bufferlist &data, bool blocking, bool *finished);
   int get_decompress_data(uint64_t decompress_id, bufferlist &data, bool blocking, bool *finished);
+  /**
+   * (de)compress @a data on the pool and complete @a onfinish from there.
+   * A decompression that would produce more than @a max_len bytes fails
+   * without allocating them; 0 means no limit.
+   * These are virtual so that the messenger, which lives in libcommon, can
+   * call them without linking against us.
+   */
+  virtual void async_compress(bufferlist &data, Completion *onfinish);
+  virtual void async_decompress(bufferlist &data, Completion *onfinish,
+                                size_t max_len = 0);
 };
 
 #endif
@@ -14,12 +14,15 @@
 
 #include "Compressor.h"
 #include "SnappyCompressor.h"
+#include "ZlibCompressor.h"
 
 
 Compressor* Compressor::create(const string &type)
 {
   if (type == "snappy")
     return new SnappyCompressor();
+  if (type == "zlib")
+    return new ZlibCompressor();
 
-  assert(0);
+  return NULL;
 }
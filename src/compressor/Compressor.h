@@ -23,6 +23,8 @@ class Compressor {
   virtual ~Compressor() {}
   virtual int compress(bufferlist &in, bufferlist &out) = 0;
   virtual int decompress(bufferlist &in, bufferlist &out) = 0;
+  /// as above, but fail rather than produce more than max_len bytes
+  virtual int decompress(bufferlist &in, bufferlist &out, size_t max_len) = 0;
 
   static Compressor *create(const string &type);
 };
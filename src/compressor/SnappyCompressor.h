@@ -61,11 +61,16 @@ class SnappyCompressor : public Compressor {
     return 0;
   }
   virtual int decompress(bufferlist &src, bufferlist &dst) {
+    return decompress(src, dst, SIZE_MAX);
+  }
+  virtual int decompress(bufferlist &src, bufferlist &dst, size_t max_len) {
     BufferlistSource source(src);
     size_t res_len = 0;
     // Trick, decompress only need first 32bits buffer
     if (!snappy::GetUncompressedLength(src.get_contiguous(0, 8), 8, &res_len))
       return -1;
+    if (res_len > max_len)
+      return -1;
     bufferptr ptr(res_len);
     if (snappy::RawUncompress(&source, ptr.c_str())) {
       dst.append(ptr);
@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_ZLIBCOMPRESSOR_H
+#define CEPH_ZLIBCOMPRESSOR_H
+
+#include <zlib.h>
+#include "include/buffer.h"
+#include "Compressor.h"
+
+class ZlibCompressor : public Compressor {
+  static const int CHUNK = 16384;
+  int level;
+
+ public:
+  ZlibCompressor(int l = Z_DEFAULT_COMPRESSION) : level(l) {}
+  virtual ~ZlibCompressor() {}
+
+  virtual int compress(bufferlist &src, bufferlist &dst) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit(&strm, level) != Z_OK)
+      return -1;
+    list<bufferptr>::const_iterator p = src.buffers().begin();
+    while (p != src.buffers().end()) {
+      strm.next_in = (Bytef *)p->c_str();
+      strm.avail_in = p->length();
+      ++p;
+      int flush = p == src.buffers().end() ? Z_FINISH : Z_NO_FLUSH;
+      do {
+	bufferptr ptr(CHUNK);
+	strm.next_out = (Bytef *)ptr.c_str();
+	strm.avail_out = CHUNK;
+	if (deflate(&strm, flush) == Z_STREAM_ERROR) {
+	  deflateEnd(&strm);
+	  return -1;
+	}
+	dst.append(ptr, 0, CHUNK - strm.avail_out);
+      } while (strm.avail_out == 0);
+    }
+    deflateEnd(&strm);
+    return 0;
+  }
+
+  virtual int decompress(bufferlist &src, bufferlist &dst) {
+    return decompress(src, dst, SIZE_MAX);
+  }
+
+  virtual int decompress(bufferlist &src, bufferlist &dst, size_t max_len) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit(&strm) != Z_OK)
+      return -1;
+    int ret = Z_OK;
+    list<bufferptr>::const_iterator p = src.buffers().begin();
+    while (p != src.buffers().end() && ret != Z_STREAM_END) {
+      strm.next_in = (Bytef *)p->c_str();
+      strm.avail_in = p->length();
+      ++p;
+      do {
+	bufferptr ptr(CHUNK);
+	strm.next_out = (Bytef *)ptr.c_str();
+	strm.avail_out = CHUNK;
+	ret = inflate(&strm, Z_NO_FLUSH);
+	if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+	  inflateEnd(&strm);
+	  return -1;
+	}
+	dst.append(ptr, 0, CHUNK - strm.avail_out);
+	if (dst.length() > max_len) {
+	  inflateEnd(&strm);
+	  return -1;
+	}
+      } while (strm.avail_out == 0 && ret != Z_STREAM_END);
+    }
+    inflateEnd(&strm);
+    return ret == Z_STREAM_END ? 0 : -1;
+  }
+};
+
+#endif
@@ -134,11 +134,22 @@ namespace buffer CEPH_BUFFER_API {
   class raw_char;
   class raw_pipe;
   class raw_unshareable; // diagnostic, unshareable char buffer
+  class raw_pooled;
 
 
   class xio_mempool;
   class xio_msg_buffer;
 
+  /*
+   * where the memory of a claim_pooled() buffer goes once nothing
+   * references it; put() may be called from any thread
+   */
+  class CEPH_BUFFER_API pool {
+  public:
+    virtual ~pool() {}
+    virtual void put(char *buf, unsigned len) = 0;
+  };
+
   /*
    * named constructors 
    */
@@ -152,6 +163,7 @@ namespace buffer CEPH_BUFFER_API {
   raw* create_page_aligned(unsigned len);
   raw* create_zero_copy(unsigned len, int fd, int64_t *offset);
   raw* create_unshareable(unsigned len);
+  raw* claim_pooled(unsigned len, char *buf, pool *p);
 
 #if defined(HAVE_XIO)
   raw* create_msg(unsigned len, char *buf, XioDispatchHook *m_hook);
@@ -372,6 +384,14 @@ namespace buffer CEPH_BUFFER_API {
       return *this;
     }
 
+    /// make room for the next prealloc bytes of small appends in one buffer
+    void reserve(size_t prealloc) {
+      if (append_buffer.unused_tail_length() < prealloc) {
+	append_buffer = buffer::create(prealloc);
+	append_buffer.set_length(0);   // unused, so far.
+      }
+    }
+
     unsigned get_memcopy_count() const {return _memcopy_count; }
     const std::list<ptr>& buffers() const { return _buffers; }
     void swap(list& other);
@@ -14,6 +14,12 @@ extern ceph_crc32c_func_t ceph_crc32c_func;
 
 extern ceph_crc32c_func_t ceph_choose_crc32(void);
 
+/**
+ * crc32c of @a length zero bytes, starting from @a crc, in
+ * O(log(length)) time
+ */
+extern uint32_t ceph_crc32c_zeros(uint32_t crc, unsigned length);
+
 /**
  * calculate crc32c
  *
@@ -26,7 +32,24 @@ extern ceph_crc32c_func_t ceph_choose_crc32(void);
  */
 static inline uint32_t ceph_crc32c(uint32_t crc, unsigned char const *data, unsigned length)
 {
+	if (!data && length > 64)
+		return ceph_crc32c_zeros(crc, length);
 	return ceph_crc32c_func(crc, data, length);
 }
 
+/**
+ * combine crcs of adjacent buffers
+ *
+ * Given crc_a = crc32c(crc, a) and crc_b = crc32c(0, b), return
+ * crc32c(crc, a followed by b) without looking at the data again.
+ *
+ * @param crc_a crc of the first buffer, with whatever initial value
+ * @param crc_b crc of the second buffer, with initial value 0
+ * @param length_b length of the second buffer
+ */
+static inline uint32_t ceph_crc32c_combine(uint32_t crc_a, uint32_t crc_b, unsigned length_b)
+{
+	return ceph_crc32c_zeros(crc_a, length_b) ^ crc_b;
+}
+
 #endif
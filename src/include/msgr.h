@@ -188,6 +188,14 @@ struct ceph_msg_footer {
 #define CEPH_MSG_FOOTER_COMPLETE  (1<<0)   /* msg wasn't aborted */
 #define CEPH_MSG_FOOTER_NOCRC     (1<<1)   /* no data crc */
 #define CEPH_MSG_FOOTER_SIGNED	  (1<<2)   /* msg was signed */
+/* segment was compressed; header lengths and crcs cover what was sent */
+#define CEPH_MSG_FOOTER_FRONT_COMPRESSED   (1<<3)
+#define CEPH_MSG_FOOTER_MIDDLE_COMPRESSED  (1<<4)
+#define CEPH_MSG_FOOTER_DATA_COMPRESSED    (1<<5)
+#define CEPH_MSG_FOOTER_COMPRESSED	\
+	(CEPH_MSG_FOOTER_FRONT_COMPRESSED |	\
+	 CEPH_MSG_FOOTER_MIDDLE_COMPRESSED |	\
+	 CEPH_MSG_FOOTER_DATA_COMPRESSED)
 
 
 #endif
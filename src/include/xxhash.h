@@ -0,0 +1,33 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_XXHASH_H
+#define CEPH_XXHASH_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * xxHash (XXH32 and XXH64), Yann Collet's fast non-cryptographic
+ * hash.  Output matches the reference implementation (little-endian
+ * canonical input), so values are stable across architectures.
+ */
+
+/**
+ * calculate xxhash32
+ *
+ * @param seed initial value
+ * @param data pointer to data buffer
+ * @param length length of buffer
+ */
+extern uint32_t ceph_xxhash32(uint32_t seed, const void *data, size_t length);
+
+/**
+ * calculate xxhash64
+ *
+ * @param seed initial value
+ * @param data pointer to data buffer
+ * @param length length of buffer
+ */
+extern uint64_t ceph_xxhash64(uint64_t seed, const void *data, size_t length);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "KeyValueDB.h"
 #include "LevelDBStore.h"
+#include "MemDB.h"
+#include "include/str_list.h"
+#include "common/debug.h"
 #ifdef HAVE_LIBROCKSDB
 #include "RocksDBStore.h"
 #endif
@@ -10,6 +13,91 @@
 #include "KineticStore.h"
 #endif
 
+namespace {
+
+struct Uint64AddMergeOperator : public KeyValueDB::MergeOperator {
+  static uint64_t decode_u64(const char *data, size_t len) {
+    if (len != sizeof(uint64_t)) {
+      // merges cannot fail; do not take the store down over one value
+      derr << "uint64_add: bad value length " << len << ", using 0" << dendl;
+      return 0;
+    }
+    ceph_le64 v;
+    memcpy(&v, data, sizeof(v));
+    return v;
+  }
+  static void encode_u64(uint64_t v, std::string *out) {
+    ceph_le64 e;
+    e = v;
+    out->assign(reinterpret_cast<const char*>(&e), sizeof(e));
+  }
+  void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) {
+    encode_u64(decode_u64(rdata, rlen), new_value);
+  }
+  void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) {
+    encode_u64(decode_u64(ldata, llen) + decode_u64(rdata, rlen), new_value);
+  }
+  string name() const {
+    return "uint64_add";
+  }
+};
+
+struct XorMergeOperator : public KeyValueDB::MergeOperator {
+  void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) {
+    *new_value = std::string(rdata, rlen);
+  }
+  void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) {
+    assert(llen == rlen);
+    *new_value = std::string(ldata, llen);
+    for (size_t i = 0; i < rlen; ++i) {
+      (*new_value)[i] ^= rdata[i];
+    }
+  }
+  string name() const {
+    return "bitwise_xor";
+  }
+};
+
+struct AppendMergeOperator : public KeyValueDB::MergeOperator {
+  void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) {
+    *new_value = std::string(rdata, rlen);
+  }
+  void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) {
+    new_value->reserve(llen + rlen);
+    new_value->assign(ldata, llen);
+    new_value->append(rdata, rlen);
+  }
+  string name() const {
+    return "append";
+  }
+};
+
+}
+
+ceph::shared_ptr<KeyValueDB::MergeOperator> KeyValueDB::create_merge_operator(
+  const string& name)
+{
+  if (name == "uint64_add")
+    return ceph::shared_ptr<MergeOperator>(new Uint64AddMergeOperator);
+  if (name == "bitwise_xor")
+    return ceph::shared_ptr<MergeOperator>(new XorMergeOperator);
+  if (name == "append")
+    return ceph::shared_ptr<MergeOperator>(new AppendMergeOperator);
+  return ceph::shared_ptr<MergeOperator>();
+}
+
 KeyValueDB *KeyValueDB::create(CephContext *cct, const string& type,
 			       const string& dir,
 			       void *p)
@@ -17,6 +105,9 @@ KeyValueDB *KeyValueDB::create(CephContext *cct, const string& type,
   if (type == "leveldb") {
     return new LevelDBStore(cct, dir);
   }
+  if (type == "memdb") {
+    return new MemDB(cct, dir, p);
+  }
 #ifdef HAVE_KINETIC
   if (type == "kinetic" &&
       cct->check_experimental_feature_enabled("kinetic")) {
@@ -37,6 +128,9 @@ int KeyValueDB::test_init(const string& type, const string& dir)
   if (type == "leveldb") {
     return LevelDBStore::_test_init(dir);
   }
+  if (type == "memdb") {
+    return MemDB::_test_init(dir);
+  }
 #ifdef HAVE_KINETIC
   if (type == "kinetic") {
     return KineticStore::_test_init(g_ceph_context);
@@ -49,3 +143,34 @@ int KeyValueDB::test_init(const string& type, const string& dir)
 #endif
   return -EINVAL;
 }
+
+int KeyValueDB::parse_column_families(const string& spec,
+				      std::vector<ColumnFamily> *cfs)
+{
+  list<string> items;
+  get_str_list(spec, " \t\n", items);
+  for (auto& i : items) {
+    size_t eq = i.find('=');
+    if (eq == string::npos || eq == 0)
+      return -EINVAL;
+    ColumnFamily cf;
+    cf.name = i.substr(0, eq);
+    string prefixes = i.substr(eq + 1);
+    size_t colon = prefixes.find(':');
+    if (colon != string::npos) {
+      cf.options = prefixes.substr(colon + 1);
+      prefixes.resize(colon);
+    }
+    list<string> pl;
+    get_str_list(prefixes, "+", pl);
+    if (pl.empty())
+      return -EINVAL;
+    cf.prefixes.assign(pl.begin(), pl.end());
+    for (auto& c : *cfs) {
+      if (c.name == cf.name)
+	return -EINVAL;
+    }
+    cfs->push_back(cf);
+  }
+  return 0;
+}
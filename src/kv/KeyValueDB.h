@@ -8,6 +8,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <vector>
 #include "include/memory.h"
 #include <boost/scoped_ptr.hpp>
 #include "include/encoding.h"
@@ -93,6 +94,13 @@ public:
       const std::string &prefix ///< [in] Prefix by which to remove keys
       ) = 0;
 
+    /// Merge value into key using the prefix's MergeOperator
+    virtual void merge(
+      const std::string &prefix,   ///< [in] Prefix ==> MUST match some established merge operator
+      const std::string &key,      ///< [in] Key to be merged
+      const bufferlist  &value     ///< [in] value to be merged into key
+    ) { assert(0 == "Not implemented"); }
+
     virtual ~TransactionImpl() {}
   };
   typedef ceph::shared_ptr< TransactionImpl > Transaction;
@@ -102,6 +110,85 @@ public:
 			    const std::string& dir,
 			    void *p = NULL);
 
+  /**
+   * Combines a value already stored under a key with a value being
+   * merged into it.  Operators are registered per prefix and must be
+   * associative: the backend may fold several merges together before
+   * applying them to the stored value.
+   */
+  class MergeOperator {
+  public:
+    /// Merge into a key that doesn't exist
+    virtual void merge_nonexistent(
+      const char *rdata, size_t rlen,
+      std::string *new_value) = 0;
+    /// Merge into a key that does exist
+    virtual void merge(
+      const char *ldata, size_t llen,
+      const char *rdata, size_t rlen,
+      std::string *new_value) = 0;
+    /// name of the operator; backends may persist it to detect mismatches
+    virtual string name() const = 0;
+
+    virtual ~MergeOperator() {}
+  };
+
+  /**
+   * Built-in merge operators:
+   *
+   *  uint64_add  - values are encoded uint64_t; merges add them
+   *  bitwise_xor - merges xor equal-length values together
+   *  append      - merges append to the stored value
+   *
+   * @returns NULL if name is unknown
+   */
+  static ceph::shared_ptr<MergeOperator> create_merge_operator(
+    const std::string& name);
+
+  /// Register a merge operator for prefix; must be done BEFORE the db is opened
+  virtual int set_merge_operator(const std::string& prefix,
+				 ceph::shared_ptr<MergeOperator> mop) {
+    return -EOPNOTSUPP;
+  }
+
+  /**
+   * A column family is an independent keyspace within the db, with its
+   * own memtables, sst files and compactions.  Keys of the prefixes
+   * mapped to a family are stored there; all other prefixes share the
+   * default family.  A transaction may span families and still commits
+   * atomically.
+   */
+  struct ColumnFamily {
+    std::string name;
+    std::vector<std::string> prefixes;
+    std::string options;  ///< backend-specific tuning for this family
+
+    ColumnFamily() {}
+    ColumnFamily(const std::string& n, const std::vector<std::string>& p,
+		 const std::string& o = std::string())
+      : name(n), prefixes(p), options(o) {}
+  };
+
+  /**
+   * Parse a list of column families of the form
+   *
+   *   <name>=<prefix>[+<prefix>...][:<opt>=<val>[;<opt>=<val>...]] ...
+   *
+   * with families separated by whitespace.
+   */
+  static int parse_column_families(const std::string& spec,
+				   std::vector<ColumnFamily> *cfs);
+
+  /**
+   * Map prefixes to column families; must be done BEFORE the db is
+   * opened.  An existing db must be opened with the families it was
+   * created with, and a prefix must not move between families once it
+   * holds data.
+   */
+  virtual int set_column_families(const std::vector<ColumnFamily>& cfs) {
+    return -EOPNOTSUPP;
+  }
+
   /// test whether we can successfully initialize; may have side effects (e.g., create)
   static int test_init(const std::string& type, const std::string& dir);
   virtual int init(string option_str="") = 0;
@@ -136,6 +223,28 @@ public:
     return r;
   }
 
+  /**
+   * Retrieve several keys of one prefix in a single call.  (*values)[i]
+   * holds the value of keys[i] and, if rs is given, (*rs)[i] is 0 or
+   * -ENOENT.  Backends without a batched lookup fall back to get().
+   */
+  virtual int get_many(const std::string &prefix,
+		       const std::vector<std::string> &keys,
+		       std::vector<bufferlist> *values,
+		       std::vector<int> *rs = NULL) {
+    values->resize(keys.size());
+    if (rs)
+      rs->resize(keys.size());
+    for (unsigned i = 0; i < keys.size(); ++i) {
+      int r = get(prefix, keys[i], &(*values)[i]);
+      if (r < 0 && r != -ENOENT)
+	return r;
+      if (rs)
+	(*rs)[i] = r;
+    }
+    return 0;
+  }
+
   class GenericIteratorImpl {
   public:
     virtual int seek_to_first() = 0;
@@ -235,9 +344,15 @@ public:
     return _get_iterator();
   }
 
-  Iterator get_iterator(const std::string &prefix) {
+  /// hints for iterators that walk a long range
+  enum {
+    ITERATOR_NOCACHE = 1,   ///< don't fill the block cache with what we read
+    ITERATOR_PREFETCH = 2,  ///< read ahead of the iterator position
+  };
+
+  Iterator get_iterator(const std::string &prefix, unsigned flags = 0) {
     return ceph::shared_ptr<IteratorImpl>(
-      new IteratorImpl(prefix, get_iterator())
+      new IteratorImpl(prefix, _get_prefix_iterator(prefix, flags))
     );
   }
 
@@ -247,7 +362,7 @@ public:
 
   Iterator get_snapshot_iterator(const std::string &prefix) {
     return ceph::shared_ptr<IteratorImpl>(
-      new IteratorImpl(prefix, get_snapshot_iterator())
+      new IteratorImpl(prefix, _get_snapshot_prefix_iterator(prefix))
     );
   }
 
@@ -273,6 +388,17 @@ public:
 protected:
   virtual WholeSpaceIterator _get_iterator() = 0;
   virtual WholeSpaceIterator _get_snapshot_iterator() = 0;
+
+  /// iterator that need only be positioned within prefix; backends that
+  /// keep prefixes apart may return one over a narrower keyspace
+  virtual WholeSpaceIterator _get_prefix_iterator(const std::string &prefix,
+						  unsigned flags) {
+    return _get_iterator();
+  }
+  virtual WholeSpaceIterator _get_snapshot_prefix_iterator(
+    const std::string &prefix) {
+    return _get_snapshot_iterator();
+  }
 };
 
 #endif
@@ -166,30 +166,57 @@ void LevelDBStore::close()
     cct->get_perfcounters_collection()->remove(logger);
 }
 
-int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
+int LevelDBStore::_submit_transaction(KeyValueDB::Transaction t,
+				      const leveldb::WriteOptions& options)
 {
-  utime_t start = ceph_clock_now(g_ceph_context);
   LevelDBTransactionImpl * _t =
     static_cast<LevelDBTransactionImpl *>(t.get());
-  leveldb::Status s = db->Write(leveldb::WriteOptions(), &(_t->bat));
+  if (_t->merge_ops.empty()) {
+    leveldb::Status s = db->Write(options, &(_t->bat));
+    return s.ok() ? 0 : -1;
+  }
+
+  // hold the lock until the write lands so that nobody merges into
+  // the values we are about to write
+  Mutex::Locker l(merge_emulator.lock);
+  map<MergeEmulator::key_t,bufferlist> sets;
+  set<MergeEmulator::key_t> rms;
+  int r = merge_emulator.resolve(this, _t->merge_ops, &sets, &rms);
+  if (r < 0)
+    return r;
+  for (auto& p : sets) {
+    bufferlist& bl = p.second;
+    string key = combine_strings(p.first.first, p.first.second);
+    _t->bat.Put(leveldb::Slice(key), leveldb::Slice(bl.c_str(), bl.length()));
+  }
+  for (auto& p : rms) {
+    _t->bat.Delete(combine_strings(p.first, p.second));
+  }
+  _t->merge_ops.clear();
+  leveldb::Status s = db->Write(options, &(_t->bat));
+  return s.ok() ? 0 : -1;
+}
+
+int LevelDBStore::submit_transaction(KeyValueDB::Transaction t)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  int r = _submit_transaction(t, leveldb::WriteOptions());
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
   logger->tinc(l_leveldb_submit_latency, lat);
-  return s.ok() ? 0 : -1;
+  return r;
 }
 
 int LevelDBStore::submit_transaction_sync(KeyValueDB::Transaction t)
 {
   utime_t start = ceph_clock_now(g_ceph_context);
-  LevelDBTransactionImpl * _t =
-    static_cast<LevelDBTransactionImpl *>(t.get());
   leveldb::WriteOptions options;
   options.sync = true;
-  leveldb::Status s = db->Write(options, &(_t->bat));
+  int r = _submit_transaction(t, options);
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_leveldb_txns);
   logger->tinc(l_leveldb_submit_sync_latency, lat);
-  return s.ok() ? 0 : -1;
+  return r;
 }
 
 void LevelDBStore::LevelDBTransactionImpl::set(
@@ -197,6 +224,11 @@ void LevelDBStore::LevelDBTransactionImpl::set(
   const string &k,
   const bufferlist &to_set_bl)
 {
+  if (db->merge_emulator.has_merge_operator(prefix)) {
+    merge_ops.push_back(MergeEmulator::Op(MergeEmulator::Op::OP_SET,
+					  prefix, k, to_set_bl));
+    return;
+  }
   string key = combine_strings(prefix, k);
   size_t bllen = to_set_bl.length();
   // bufferlist::c_str() is non-constant, so we can't call c_str()
@@ -226,6 +258,11 @@ void LevelDBStore::LevelDBTransactionImpl::set(
 void LevelDBStore::LevelDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
+  if (db->merge_emulator.has_merge_operator(prefix)) {
+    merge_ops.push_back(MergeEmulator::Op(MergeEmulator::Op::OP_RM,
+					  prefix, k));
+    return;
+  }
   string key = combine_strings(prefix, k);
   bat.Delete(leveldb::Slice(key));
 }
@@ -236,11 +273,20 @@ void LevelDBStore::LevelDBTransactionImpl::rmkeys_by_prefix(const string &prefix
   for (it->seek_to_first();
        it->valid();
        it->next()) {
-    string key = combine_strings(prefix, it->key());
-    bat.Delete(key);
+    rmkey(prefix, it->key());
   }
 }
 
+void LevelDBStore::LevelDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_set_bl)
+{
+  assert(db->merge_emulator.has_merge_operator(prefix));
+  merge_ops.push_back(MergeEmulator::Op(MergeEmulator::Op::OP_MERGE,
+					prefix, k, to_set_bl));
+}
+
 int LevelDBStore::get(
     const string &prefix,
     const std::set<string> &keys,
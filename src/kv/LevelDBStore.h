@@ -6,6 +6,7 @@
 #include "include/types.h"
 #include "include/buffer_fwd.h"
 #include "KeyValueDB.h"
+#include "MergeEmulator.h"
 #include <set>
 #include <map>
 #include <string>
@@ -65,6 +66,11 @@ class LevelDBStore : public KeyValueDB {
 
   int do_open(ostream &out, bool create_if_missing);
 
+  /// leveldb has no merge; resolve merges ourselves at submit time
+  MergeEmulator merge_emulator;
+  int _submit_transaction(KeyValueDB::Transaction t,
+			  const leveldb::WriteOptions& options);
+
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
@@ -181,9 +187,18 @@ public:
 
   void close();
 
+  int set_merge_operator(const std::string& prefix,
+			 ceph::shared_ptr<KeyValueDB::MergeOperator> mop) {
+    // If you fail here, it's because you can't do this on an open database
+    assert(!db);
+    merge_emulator.set_merge_operator(prefix, mop);
+    return 0;
+  }
+
   class LevelDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     leveldb::WriteBatch bat;
+    MergeEmulator::OpList merge_ops;  ///< ops on prefixes with a merge operator
     LevelDBStore *db;
     LevelDBTransactionImpl(LevelDBStore *db) : db(db) {}
     void set(
@@ -196,6 +211,10 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void merge(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
   };
 
   KeyValueDB::Transaction get_transaction() {
@@ -403,6 +422,19 @@ protected:
     );
   }
 
+  WholeSpaceIterator _get_prefix_iterator(const string &prefix,
+					  unsigned flags) {
+    // leveldb has no readahead knob; ITERATOR_PREFETCH is ignored
+    leveldb::ReadOptions options;
+    if (flags & ITERATOR_NOCACHE)
+      options.fill_cache = false;
+    return ceph::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new LevelDBWholeSpaceIteratorImpl(
+	db->NewIterator(options)
+      )
+    );
+  }
+
   WholeSpaceIterator _get_snapshot_iterator() {
     const leveldb::Snapshot *snapshot;
     leveldb::ReadOptions options;
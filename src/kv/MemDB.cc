@@ -0,0 +1,622 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include "MemDB.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "include/ceph_hash.h"
+#include "include/compat.h"
+#include "include/encoding.h"
+#include "common/errno.h"
+#include "common/debug.h"
+#include "common/perf_counters.h"
+
+#define dout_subsys ceph_subsys_memdb
+#undef dout_prefix
+#define dout_prefix *_dout << "memdb: "
+
+MemDB::MemDB(CephContext *c, const string &path, void *p)
+  : cct(c),
+    logger(NULL),
+    path(path),
+    opened(false),
+    dump_lock("MemDB::dump_lock"),
+    dump_stop(false),
+    dump_thread(this)
+{
+  int n = cct->_conf->memdb_shards;
+  if (n < 1)
+    n = 1;
+  for (int i = 0; i < n; ++i)
+    shards.push_back(new Shard);
+}
+
+MemDB::~MemDB()
+{
+  close();
+  for (auto s : shards)
+    delete s;
+}
+
+int MemDB::_test_init(const string& dir)
+{
+  int r = ::mkdir(dir.c_str(), 0755);
+  if (r < 0 && errno != EEXIST)
+    return -errno;
+  return 0;
+}
+
+int MemDB::init(string option_str)
+{
+  return 0;
+}
+
+int MemDB::do_open(ostream &out, bool create_if_missing)
+{
+  if (create_if_missing) {
+    int r = _test_init(path);
+    if (r < 0) {
+      out << "unable to create " << path << ": " << cpp_strerror(r)
+	  << std::endl;
+      return r;
+    }
+  }
+  int r = _load();
+  if (r == -ENOENT && create_if_missing)
+    r = 0;
+  if (r < 0) {
+    out << "unable to load " << dump_path() << ": " << cpp_strerror(r)
+	<< std::endl;
+    return r;
+  }
+
+  PerfCountersBuilder plb(g_ceph_context, "memdb", l_memdb_first, l_memdb_last);
+  plb.add_u64_counter(l_memdb_gets, "memdb_get", "Gets");
+  plb.add_u64_counter(l_memdb_txns, "memdb_transaction", "Transactions");
+  plb.add_time_avg(l_memdb_get_latency, "memdb_get_latency", "Get Latency");
+  plb.add_time_avg(l_memdb_submit_latency, "memdb_submit_latency", "Submit Latency");
+  plb.add_u64_counter(l_memdb_dumps, "memdb_dump", "Dumps to disk");
+  plb.add_time_avg(l_memdb_dump_latency, "memdb_dump_latency", "Dump Latency");
+  plb.add_u64(l_memdb_bytes, "memdb_bytes", "Size of keys and values");
+  logger = plb.create_perf_counters();
+  cct->get_perfcounters_collection()->add(logger);
+  map<string,uint64_t> extra;
+  logger->set(l_memdb_bytes, get_estimated_size(extra));
+
+  opened = true;
+  if (cct->_conf->memdb_dump_interval > 0) {
+    dump_stop = false;  // we may have been closed before
+    dump_thread.create();
+  }
+  return 0;
+}
+
+void MemDB::close()
+{
+  if (!opened)
+    return;
+
+  dump_lock.Lock();
+  if (dump_thread.is_started()) {
+    dump_stop = true;
+    dump_cond.Signal();
+    dump_lock.Unlock();
+    dump_thread.join();
+  } else {
+    dump_lock.Unlock();
+  }
+
+  if (cct->_conf->memdb_dump_on_close) {
+    int r = _dump();
+    if (r < 0)
+      derr << __func__ << " dump failed: " << cpp_strerror(r) << dendl;
+  }
+
+  cct->get_perfcounters_collection()->remove(logger);
+  delete logger;
+  logger = NULL;
+  opened = false;
+}
+
+void MemDB::dump_thread_entry()
+{
+  utime_t interval;
+  interval.set_from_double(cct->_conf->memdb_dump_interval);
+  dump_lock.Lock();
+  while (!dump_stop) {
+    dump_cond.WaitInterval(cct, dump_lock, interval);
+    if (dump_stop)
+      break;
+    dump_lock.Unlock();
+    int r = _dump();
+    if (r < 0)
+      derr << __func__ << " dump failed: " << cpp_strerror(r) << dendl;
+    dump_lock.Lock();
+  }
+  dump_lock.Unlock();
+}
+
+/*
+ * The dump is a magic string, a format version and the number of
+ * entries, then each entry's key and value, and last the crc32c of
+ * everything before it.
+ */
+
+int MemDB::_dump()
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  vector<map_ref> maps;
+  get_snapshot(&maps);
+
+  uint64_t n = 0;
+  for (auto& m : maps)
+    n += m->size();
+  bufferlist bl;
+  ::encode(string("memdb"), bl);
+  ::encode((__u32)1, bl);
+  ::encode(n, bl);
+  for (auto& m : maps) {
+    for (auto& p : *m) {
+      ::encode(p.first, bl);
+      ::encode(p.second, bl);
+    }
+  }
+  ::encode(bl.crc32c(-1), bl);
+
+  string fn = dump_path();
+  string tmp = fn + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0)
+    return -errno;
+  int r = bl.write_fd(fd);
+  if (r == 0 && ::fsync(fd) < 0)
+    r = -errno;
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  if (r == 0 && ::rename(tmp.c_str(), fn.c_str()) < 0)
+    r = -errno;
+  if (r < 0) {
+    ::unlink(tmp.c_str());
+    return r;
+  }
+
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  dout(10) << __func__ << " " << n << " keys, " << bl.length()
+	   << " bytes in " << lat << dendl;
+  if (logger) {
+    logger->inc(l_memdb_dumps);
+    logger->tinc(l_memdb_dump_latency, lat);
+  }
+  return 0;
+}
+
+int MemDB::_load()
+{
+  string fn = dump_path();
+  struct stat st;
+  if (::stat(fn.c_str(), &st) < 0)
+    return -errno;
+
+  bufferlist bl;
+  string err;
+  int r = bl.read_file(fn.c_str(), &err);
+  if (r < 0) {
+    derr << __func__ << " " << fn << ": " << err << dendl;
+    return r;
+  }
+  if (bl.length() < sizeof(__u32))
+    return -EIO;
+
+  unsigned len = bl.length() - sizeof(__u32);
+  bufferlist body;
+  body.substr_of(bl, 0, len);
+  try {
+    bufferlist::iterator p = bl.begin();
+    p.advance(len);
+    __u32 crc;
+    ::decode(crc, p);
+    if (crc != body.crc32c(-1)) {
+      derr << __func__ << " " << fn << ": bad crc" << dendl;
+      return -EIO;
+    }
+
+    p = body.begin();
+    string magic;
+    __u32 v;
+    uint64_t n;
+    ::decode(magic, p);
+    ::decode(v, p);
+    if (magic != "memdb" || v != 1) {
+      derr << __func__ << " " << fn << ": not a memdb dump" << dendl;
+      return -EIO;
+    }
+    ::decode(n, p);
+    while (n--) {
+      string key;
+      bufferlist value;
+      ::decode(key, p);
+      ::decode(value, p);
+      Shard *s = shards[get_shard_id(key)];
+      s->bytes += key.length() + value.length();
+      (*s->data)[key].claim(value);
+    }
+  } catch (buffer::error& e) {
+    derr << __func__ << " " << fn << ": " << e.what() << dendl;
+    return -EIO;
+  }
+  dout(10) << __func__ << " " << bl.length() << " bytes from " << fn << dendl;
+  return 0;
+}
+
+unsigned MemDB::get_shard_id(const string& key) const
+{
+  return ceph_str_hash_rjenkins(key.data(), key.length()) % shards.size();
+}
+
+void MemDB::get_snapshot(vector<map_ref> *maps)
+{
+  for (auto s : shards)
+    s->lock.Lock();
+  for (auto s : shards)
+    maps->push_back(s->data);
+  for (auto s : shards)
+    s->lock.Unlock();
+}
+
+void MemDB::_apply(const list<MemDBTransactionImpl::Op>& ops)
+{
+  // lock what we touch in shard order, so that readers and snapshots
+  // see all of the transaction or none of it
+  set<unsigned> touched;
+  for (auto& op : ops)
+    touched.insert(get_shard_id(op.key));
+  for (auto i : touched)
+    shards[i]->lock.Lock();
+  for (auto& op : ops) {
+    Shard *s = shards[get_shard_id(op.key)];
+    map_t& m = s->get_writeable();
+    map_t::iterator p = m.find(op.key);
+    if (p != m.end()) {
+      s->bytes -= p->first.length() + p->second.length();
+      if (op.rm)
+	m.erase(p);
+      else
+	p->second = op.bl;
+    } else if (!op.rm) {
+      m[op.key] = op.bl;
+    }
+    if (!op.rm)
+      s->bytes += op.key.length() + op.bl.length();
+  }
+  for (auto i : touched)
+    shards[i]->lock.Unlock();
+}
+
+int MemDB::submit_transaction(KeyValueDB::Transaction t)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  MemDBTransactionImpl *_t =
+    static_cast<MemDBTransactionImpl *>(t.get());
+
+  if (_t->merge_ops.empty()) {
+    _apply(_t->ops);
+  } else {
+    // hold the lock until the write lands so that nobody merges into
+    // the values we are about to write
+    Mutex::Locker l(merge_emulator.lock);
+    map<MergeEmulator::key_t,bufferlist> sets;
+    set<MergeEmulator::key_t> rms;
+    int r = merge_emulator.resolve(this, _t->merge_ops, &sets, &rms);
+    if (r < 0)
+      return r;
+    for (auto& p : sets)
+      _t->ops.push_back(MemDBTransactionImpl::Op(
+			  combine_strings(p.first.first, p.first.second),
+			  false, p.second));
+    for (auto& p : rms)
+      _t->ops.push_back(MemDBTransactionImpl::Op(
+			  combine_strings(p.first, p.second), true));
+    _t->merge_ops.clear();
+    _apply(_t->ops);
+  }
+
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  logger->inc(l_memdb_txns);
+  logger->tinc(l_memdb_submit_latency, lat);
+  return 0;
+}
+
+void MemDB::MemDBTransactionImpl::set(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_set_bl)
+{
+  if (db->merge_emulator.has_merge_operator(prefix)) {
+    merge_ops.push_back(MergeEmulator::Op(MergeEmulator::Op::OP_SET,
+					  prefix, k, to_set_bl));
+    return;
+  }
+  // values are kept; copy rather than pin the caller's buffers
+  bufferptr bp(to_set_bl.length());
+  to_set_bl.copy(0, bp.length(), bp.c_str());
+  bufferlist bl;
+  bl.append(bp);
+  ops.push_back(Op(combine_strings(prefix, k), false, bl));
+}
+
+void MemDB::MemDBTransactionImpl::rmkey(const string &prefix,
+					const string &k)
+{
+  if (db->merge_emulator.has_merge_operator(prefix)) {
+    merge_ops.push_back(MergeEmulator::Op(MergeEmulator::Op::OP_RM,
+					  prefix, k));
+    return;
+  }
+  ops.push_back(Op(combine_strings(prefix, k), true));
+}
+
+void MemDB::MemDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
+{
+  KeyValueDB::Iterator it = db->get_iterator(prefix);
+  for (it->seek_to_first();
+       it->valid();
+       it->next()) {
+    rmkey(prefix, it->key());
+  }
+}
+
+void MemDB::MemDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_set_bl)
+{
+  assert(db->merge_emulator.has_merge_operator(prefix));
+  merge_ops.push_back(MergeEmulator::Op(MergeEmulator::Op::OP_MERGE,
+					prefix, k, to_set_bl));
+}
+
+int MemDB::get(
+    const string &prefix,
+    const std::set<string> &keys,
+    std::map<string, bufferlist> *out)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (auto& k : keys) {
+    string key = combine_strings(prefix, k);
+    Shard *s = shards[get_shard_id(key)];
+    Mutex::Locker l(s->lock);
+    map_t::iterator p = s->data->find(key);
+    if (p != s->data->end())
+      out->insert(make_pair(k, p->second));
+  }
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  logger->inc(l_memdb_gets);
+  logger->tinc(l_memdb_get_latency, lat);
+  return 0;
+}
+
+int MemDB::get(const string &prefix,
+	       const string &k,
+	       bufferlist *value)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  int r = 0;
+  string key = combine_strings(prefix, k);
+  Shard *s = shards[get_shard_id(key)];
+  s->lock.Lock();
+  map_t::iterator p = s->data->find(key);
+  if (p != s->data->end())
+    *value = p->second;
+  else
+    r = -ENOENT;
+  s->lock.Unlock();
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  logger->inc(l_memdb_gets);
+  logger->tinc(l_memdb_get_latency, lat);
+  return r;
+}
+
+uint64_t MemDB::get_estimated_size(map<string,uint64_t> &extra)
+{
+  uint64_t total = 0;
+  for (auto s : shards) {
+    Mutex::Locker l(s->lock);
+    total += s->bytes;
+  }
+  extra["total"] = total;
+  if (logger)
+    logger->set(l_memdb_bytes, total);
+  return total;
+}
+
+string MemDB::combine_strings(const string &prefix, const string &value)
+{
+  string out = prefix;
+  out.push_back(0);
+  out.append(value);
+  return out;
+}
+
+int MemDB::split_key(const string &in, string *prefix, string *key)
+{
+  size_t sep = in.find('\0');
+  if (sep == string::npos)
+    return -EINVAL;
+  if (prefix)
+    *prefix = in.substr(0, sep);
+  if (key)
+    *key = in.substr(sep + 1);
+  return 0;
+}
+
+// MemDBIteratorImpl
+
+MemDB::MemDBIteratorImpl::MemDBIteratorImpl(MemDB *db,
+					    const vector<map_ref>& maps)
+  : db(db),
+    maps(maps),
+    cursors(db ? db->shards.size() : maps.size()),
+    cur(-1),
+    forward(true)
+{
+}
+
+void MemDB::MemDBIteratorImpl::seek(unsigned i, seek_t how, const string& k)
+{
+  Mutex *lock = NULL;
+  const map_t *m;
+  if (db) {
+    lock = &db->shards[i]->lock;
+    lock->Lock();
+    m = db->shards[i]->data.get();
+  } else {
+    m = maps[i].get();
+  }
+
+  map_t::const_iterator p;
+  switch (how) {
+  case SEEK_GE:
+    p = m->lower_bound(k);
+    break;
+  case SEEK_GT:
+    p = m->upper_bound(k);
+    break;
+  case SEEK_LT:
+    p = m->lower_bound(k);
+    if (p == m->begin())
+      p = m->end();
+    else
+      --p;
+    break;
+  case SEEK_LAST:
+    p = m->end();
+    if (!m->empty())
+      --p;
+    break;
+  }
+
+  Cursor& c = cursors[i];
+  c.valid = p != m->end();
+  if (c.valid) {
+    c.key = p->first;
+    c.value = p->second;
+  } else {
+    c.key.clear();
+    c.value.clear();
+  }
+  if (lock)
+    lock->Unlock();
+}
+
+void MemDB::MemDBIteratorImpl::seek_all(seek_t how, const string& k)
+{
+  for (unsigned i = 0; i < cursors.size(); ++i)
+    seek(i, how, k);
+  forward = how == SEEK_GE || how == SEEK_GT;
+  pick();
+}
+
+void MemDB::MemDBIteratorImpl::pick()
+{
+  cur = -1;
+  for (unsigned i = 0; i < cursors.size(); ++i) {
+    if (!cursors[i].valid)
+      continue;
+    if (cur < 0 ||
+	(forward && cursors[i].key < cursors[cur].key) ||
+	(!forward && cursors[i].key > cursors[cur].key))
+      cur = i;
+  }
+}
+
+int MemDB::MemDBIteratorImpl::seek_to_first()
+{
+  seek_all(SEEK_GE, string());
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::seek_to_first(const string &prefix)
+{
+  seek_all(SEEK_GE, prefix);
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::seek_to_last()
+{
+  seek_all(SEEK_LAST, string());
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::seek_to_last(const string &prefix)
+{
+  seek_all(SEEK_LT, past_prefix(prefix));
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::upper_bound(const string &prefix,
+					  const string &after)
+{
+  seek_all(SEEK_GT, combine_strings(prefix, after));
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::lower_bound(const string &prefix,
+					  const string &to)
+{
+  seek_all(SEEK_GE, combine_strings(prefix, to));
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::next()
+{
+  if (!valid())
+    return 0;
+  string k = cursors[cur].key;
+  if (forward) {
+    seek(cur, SEEK_GT, k);
+    pick();
+  } else {
+    seek_all(SEEK_GT, k);
+  }
+  return 0;
+}
+
+int MemDB::MemDBIteratorImpl::prev()
+{
+  if (!valid())
+    return 0;
+  string k = cursors[cur].key;
+  if (!forward) {
+    seek(cur, SEEK_LT, k);
+    pick();
+  } else {
+    seek_all(SEEK_LT, k);
+  }
+  return 0;
+}
+
+string MemDB::MemDBIteratorImpl::key()
+{
+  assert(valid());
+  string out_key;
+  split_key(cursors[cur].key, 0, &out_key);
+  return out_key;
+}
+
+pair<string,string> MemDB::MemDBIteratorImpl::raw_key()
+{
+  assert(valid());
+  string prefix, key;
+  split_key(cursors[cur].key, &prefix, &key);
+  return make_pair(prefix, key);
+}
+
+bool MemDB::MemDBIteratorImpl::raw_key_is_prefixed(const string &prefix)
+{
+  assert(valid());
+  const string& key = cursors[cur].key;
+  return key.length() > prefix.length() &&
+    key[prefix.length()] == '\0' &&
+    key.compare(0, prefix.length(), prefix) == 0;
+}
@@ -0,0 +1,273 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_KV_MEMDB_H
+#define CEPH_KV_MEMDB_H
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "include/memory.h"
+#include "KeyValueDB.h"
+#include "MergeEmulator.h"
+#include <set>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
+#include "common/ceph_context.h"
+
+class PerfCounters;
+
+enum {
+  l_memdb_first = 34500,
+  l_memdb_gets,
+  l_memdb_txns,
+  l_memdb_get_latency,
+  l_memdb_submit_latency,
+  l_memdb_dumps,
+  l_memdb_dump_latency,
+  l_memdb_bytes,
+  l_memdb_last,
+};
+
+/**
+ * Keeps the whole key space in memory, for tests, benchmarks and
+ * RAM-only OSDs.
+ *
+ * Keys are spread over memdb_shards ordered maps by hash, each with its
+ * own lock, so writers to different keys rarely contend; iterators
+ * merge the shards back into key order.  A transaction locks every
+ * shard it touches (in shard order) for the time it takes to apply, so
+ * readers see all of it or none of it.
+ *
+ * Snapshots pin the current map of every shard; a writer that finds its
+ * shard's map pinned copies it before changing it.  Plain iterators pin
+ * nothing and see writes made while they are open.
+ *
+ * The contents are written to <path>/MemDB.db on close() and, if
+ * memdb_dump_interval is set, periodically, and are loaded again by
+ * open().
+ */
+class MemDB : public KeyValueDB {
+public:
+  typedef std::map<std::string, bufferlist> map_t;  ///< combined key -> value
+  typedef ceph::shared_ptr<map_t> map_ref;
+
+private:
+  CephContext *cct;
+  PerfCounters *logger;
+  string path;
+  bool opened;
+
+  struct Shard {
+    Mutex lock;
+    map_ref data;     ///< may be shared with snapshots
+    uint64_t bytes;   ///< keys plus values
+
+    Shard() : lock("MemDB::Shard::lock"), data(new map_t), bytes(0) {}
+
+    /// the map, copied first if a snapshot holds it
+    map_t& get_writeable() {
+      assert(lock.is_locked());
+      if (data.use_count() > 1)
+	data.reset(new map_t(*data));
+      return *data;
+    }
+  };
+  vector<Shard*> shards;
+
+  unsigned get_shard_id(const string& key) const;
+  /// pin the current map of every shard, atomically wrt transactions
+  void get_snapshot(vector<map_ref> *maps);
+
+  /// memdb has no merge; resolve merges ourselves at submit time
+  MergeEmulator merge_emulator;
+
+  // periodic dumps
+  Mutex dump_lock;
+  Cond dump_cond;
+  bool dump_stop;
+  class DumpThread : public Thread {
+    MemDB *db;
+  public:
+    DumpThread(MemDB *d) : db(d) {}
+    void *entry() {
+      db->dump_thread_entry();
+      return NULL;
+    }
+  } dump_thread;
+
+  void dump_thread_entry();
+  string dump_path() const {
+    return path + "/MemDB.db";
+  }
+  int _load();
+  int _dump();
+
+  int do_open(ostream &out, bool create_if_missing);
+
+public:
+  MemDB(CephContext *c, const string &path, void *p);
+  ~MemDB();
+
+  static int _test_init(const string& dir);
+  int init(string option_str="");
+
+  /// Loads the db from its last dump
+  int open(ostream &out) {
+    return do_open(out, false);
+  }
+  /// Creates the db directory if missing, and loads the db if dumped
+  int create_and_open(ostream &out) {
+    return do_open(out, true);
+  }
+
+  void close();
+
+  /// write the db out now
+  int dump() {
+    return _dump();
+  }
+
+  int set_merge_operator(const std::string& prefix,
+			 ceph::shared_ptr<KeyValueDB::MergeOperator> mop) {
+    // If you fail here, it's because you can't do this on an open database
+    assert(!opened);
+    merge_emulator.set_merge_operator(prefix, mop);
+    return 0;
+  }
+
+  class MemDBTransactionImpl : public KeyValueDB::TransactionImpl {
+  public:
+    struct Op {
+      string key;       ///< combined key
+      bool rm;
+      bufferlist bl;
+      Op(const string& k, bool r, const bufferlist& b = bufferlist())
+	: key(k), rm(r), bl(b) {}
+    };
+    list<Op> ops;
+    MergeEmulator::OpList merge_ops;  ///< ops on prefixes with a merge operator
+    MemDB *db;
+    MemDBTransactionImpl(MemDB *db) : db(db) {}
+    void set(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
+    void rmkey(
+      const string &prefix,
+      const string &k);
+    void rmkeys_by_prefix(
+      const string &prefix
+      );
+    void merge(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
+  };
+
+private:
+  void _apply(const list<MemDBTransactionImpl::Op>& ops);
+
+public:
+  KeyValueDB::Transaction get_transaction() {
+    return ceph::shared_ptr< MemDBTransactionImpl >(
+      new MemDBTransactionImpl(this));
+  }
+
+  int submit_transaction(KeyValueDB::Transaction t);
+  int get(
+    const string &prefix,
+    const std::set<string> &key,
+    std::map<string, bufferlist> *out
+    );
+  int get(const string &prefix,
+	  const string &key,
+	  bufferlist *value);
+
+  /**
+   * Walks the shards in key order.  Each shard has a cursor holding the
+   * next entry it would return; stepping moves only the cursor that was
+   * returned, under that shard's lock, unless the direction changes.
+   * Live iterators (db != NULL) re-find their place in a shard on every
+   * step, so concurrent writes never invalidate them, though an entry
+   * already in a cursor may be returned after it was changed.
+   */
+  class MemDBIteratorImpl : public KeyValueDB::WholeSpaceIteratorImpl {
+    MemDB *db;              ///< live shards, or NULL for a snapshot
+    vector<map_ref> maps;   ///< pinned shards, for a snapshot
+
+    struct Cursor {
+      bool valid;
+      string key;
+      bufferlist value;
+      Cursor() : valid(false) {}
+    };
+    vector<Cursor> cursors;
+    int cur;                ///< cursor we are on, or -1
+    bool forward;
+
+    typedef enum {
+      SEEK_GE,
+      SEEK_GT,
+      SEEK_LT,
+      SEEK_LAST,
+    } seek_t;
+    void seek(unsigned i, seek_t how, const string& k);
+    void seek_all(seek_t how, const string& k);
+    void pick();
+
+  public:
+    MemDBIteratorImpl(MemDB *db, const vector<map_ref>& maps);
+
+    int seek_to_first();
+    int seek_to_first(const string &prefix);
+    int seek_to_last();
+    int seek_to_last(const string &prefix);
+    int upper_bound(const string &prefix, const string &after);
+    int lower_bound(const string &prefix, const string &to);
+    bool valid() {
+      return cur >= 0;
+    }
+    int next();
+    int prev();
+    string key();
+    pair<string,string> raw_key();
+    bool raw_key_is_prefixed(const string &prefix);
+    bufferlist value() {
+      assert(valid());
+      return cursors[cur].value;
+    }
+    int status() {
+      return 0;
+    }
+  };
+
+  /// Utility
+  static string combine_strings(const string &prefix, const string &value);
+  static int split_key(const string &in, string *prefix, string *key);
+  static string past_prefix(const string &prefix) {
+    string limit = prefix;
+    limit.push_back(1);
+    return limit;
+  }
+
+  uint64_t get_estimated_size(map<string,uint64_t> &extra);
+
+protected:
+  WholeSpaceIterator _get_iterator() {
+    return ceph::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new MemDBIteratorImpl(this, vector<map_ref>()));
+  }
+
+  WholeSpaceIterator _get_snapshot_iterator() {
+    vector<map_ref> maps;
+    get_snapshot(&maps);
+    return ceph::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new MemDBIteratorImpl(NULL, maps));
+  }
+};
+
+#endif
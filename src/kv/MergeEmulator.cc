@@ -0,0 +1,58 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "MergeEmulator.h"
+
+int MergeEmulator::resolve(KeyValueDB *db, const OpList& q,
+			   std::map<key_t,bufferlist> *sets,
+			   std::set<key_t> *rms)
+{
+  assert(lock.is_locked());
+  for (auto& op : q) {
+    key_t k(op.prefix, op.key);
+    switch (op.type) {
+    case Op::OP_SET:
+      (*sets)[k] = op.bl;
+      rms->erase(k);
+      break;
+
+    case Op::OP_RM:
+      sets->erase(k);
+      rms->insert(k);
+      break;
+
+    case Op::OP_MERGE:
+      {
+	auto mop = ops.find(op.prefix);
+	assert(mop != ops.end());
+	bufferlist r = op.bl;
+	string out;
+	bool exists;
+	bufferlist l;
+	auto p = sets->find(k);
+	if (p != sets->end()) {
+	  l = p->second;
+	  exists = true;
+	} else if (rms->count(k)) {
+	  exists = false;
+	} else {
+	  int ret = db->get(op.prefix, op.key, &l);
+	  if (ret < 0 && ret != -ENOENT)
+	    return ret;
+	  exists = ret == 0;
+	}
+	if (exists)
+	  mop->second->merge(l.c_str(), l.length(), r.c_str(), r.length(),
+			     &out);
+	else
+	  mop->second->merge_nonexistent(r.c_str(), r.length(), &out);
+	bufferlist v;
+	v.append(out);
+	(*sets)[k] = v;
+	rms->erase(k);
+      }
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,61 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_KV_MERGEEMULATOR_H
+#define CEPH_KV_MERGEEMULATOR_H
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include "KeyValueDB.h"
+#include "common/Mutex.h"
+
+/**
+ * Merge for backends without native support.  Transactions queue their
+ * ops on prefixes that have a merge operator, in order, instead of
+ * writing them; at submit time the queue is resolved against the db
+ * into plain sets and removes.  Submitters hold lock from resolve()
+ * until their write lands, so concurrent merges into a key serialize
+ * rather than lose updates.
+ */
+class MergeEmulator {
+public:
+  struct Op {
+    typedef enum {
+      OP_SET,
+      OP_RM,
+      OP_MERGE,
+    } op_t;
+    op_t type;
+    std::string prefix, key;
+    bufferlist bl;
+    Op(op_t t, const std::string& p, const std::string& k,
+       const bufferlist& b = bufferlist())
+      : type(t), prefix(p), key(k), bl(b) {}
+  };
+  typedef std::list<Op> OpList;
+  typedef std::pair<std::string,std::string> key_t;  ///< (prefix, key)
+
+  Mutex lock;
+
+  MergeEmulator() : lock("MergeEmulator::lock") {}
+
+  void set_merge_operator(const std::string& prefix,
+			  ceph::shared_ptr<KeyValueDB::MergeOperator> mop) {
+    ops[prefix] = mop;
+  }
+  bool has_merge_operator(const std::string& prefix) const {
+    return !ops.empty() && ops.count(prefix);
+  }
+
+  /// resolve q against db into the final value of each key it touches
+  int resolve(KeyValueDB *db, const OpList& q,
+	      std::map<key_t,bufferlist> *sets,
+	      std::set<key_t> *rms);
+
+private:
+  std::map<std::string, ceph::shared_ptr<KeyValueDB::MergeOperator> > ops;
+};
+
+#endif
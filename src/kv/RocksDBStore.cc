@@ -3,6 +3,7 @@
 
 #include <set>
 #include <map>
+#include <algorithm>
 #include <string>
 #include <memory>
 #include <errno.h>
@@ -17,6 +18,7 @@
 #include "rocksdb/slice.h"
 #include "rocksdb/cache.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/merge_operator.h"
 #include "rocksdb/utilities/convenience.h"
 using std::string;
 #include "common/perf_counters.h"
@@ -171,6 +173,153 @@ int RocksDBStore::create_and_open(ostream &out)
   return do_open(out, true);
 }
 
+/**
+ * RocksDB takes a single merge operator for the whole db; route each
+ * merge to the operator registered for the key's prefix.
+ */
+class RocksDBStore::MergeOperatorRouter : public rocksdb::AssociativeMergeOperator {
+  RocksDBStore& store;
+  string name;
+public:
+  MergeOperatorRouter(RocksDBStore &s) : store(s) {
+    // compose the name from the registered prefixes and operators so
+    // that rocksdb can tell if they change across opens
+    for (auto& p : store.merge_ops) {
+      name += p.first + ":" + p.second->name() + ".";
+    }
+  }
+
+  const char *Name() const {
+    return name.c_str();
+  }
+
+  bool Merge(const rocksdb::Slice& key,
+	     const rocksdb::Slice* existing_value,
+	     const rocksdb::Slice& value,
+	     std::string* new_value,
+	     rocksdb::Logger* logger) const {
+    // keys are prefix + '\0' + key; find the operator for this prefix
+    for (auto& p : store.merge_ops) {
+      if (key.size() > p.first.length() &&
+	  key[p.first.length()] == 0 &&
+	  memcmp(key.data(), p.first.c_str(), p.first.length()) == 0) {
+	if (existing_value) {
+	  p.second->merge(existing_value->data(), existing_value->size(),
+			  value.data(), value.size(),
+			  new_value);
+	} else {
+	  p.second->merge_nonexistent(value.data(), value.size(), new_value);
+	}
+	return true;
+      }
+    }
+    return false;  // no operator for this prefix; fail the merge
+  }
+};
+
+int RocksDBStore::set_merge_operator(
+  const string& prefix,
+  std::shared_ptr<KeyValueDB::MergeOperator> mop)
+{
+  // If you fail here, it's because you can't do this on an open database
+  assert(db == nullptr);
+  merge_ops.push_back(std::make_pair(prefix, mop));
+  return 0;
+}
+
+int RocksDBStore::set_column_families(
+  const std::vector<KeyValueDB::ColumnFamily>& cfs)
+{
+  // If you fail here, it's because you can't do this on an open database
+  assert(db == nullptr);
+  set<string> names, prefixes;
+  for (auto& cf : cfs) {
+    if (cf.name == rocksdb::kDefaultColumnFamilyName ||
+	!names.insert(cf.name).second) {
+      derr << __func__ << " invalid or duplicate column family " << cf.name
+	   << dendl;
+      return -EINVAL;
+    }
+    for (auto& p : cf.prefixes) {
+      if (!prefixes.insert(p).second) {
+	derr << __func__ << " prefix " << p << " mapped to more than one"
+	     << " column family" << dendl;
+	return -EINVAL;
+      }
+    }
+  }
+  cf_specs = cfs;
+  return 0;
+}
+
+/**
+ * Options for a column family are rocksdb ColumnFamilyOptions, plus
+ *
+ *  block_cache_share = fraction of rocksdb_cache_size to give the family
+ *                      its own block cache; otherwise it shares what is
+ *                      left with the default family
+ *  bloom_bits = bits per key for a bloom filter on the family's tables
+ */
+int RocksDBStore::parse_cf_options(const string& opt_str,
+				   rocksdb::ColumnFamilyOptions *cf_opt,
+				   double *cache_share, int *bloom_bits)
+{
+  map<string, string> str_map;
+  int r = get_str_map(opt_str, ",\n;", &str_map);
+  if (r < 0)
+    return r;
+  for (auto& p : str_map) {
+    string err;
+    if (p.first == "block_cache_share") {
+      *cache_share = strict_strtod(p.second.c_str(), &err);
+      if (!err.empty() || *cache_share <= 0 || *cache_share >= 1)
+	return -EINVAL;
+    } else if (p.first == "bloom_bits") {
+      *bloom_bits = strict_strtol(p.second.c_str(), 10, &err);
+      if (!err.empty() || *bloom_bits < 0)
+	return -EINVAL;
+    } else {
+      rocksdb::Status status = rocksdb::GetColumnFamilyOptionsFromString(
+	*cf_opt, p.first + "=" + p.second, cf_opt);
+      if (!status.ok()) {
+	derr << status.ToString() << dendl;
+	return -EINVAL;
+      }
+    }
+  }
+  return 0;
+}
+
+/// the block based table options a factory was set up with, if any
+static rocksdb::BlockBasedTableOptions get_bbt_options(
+  const std::shared_ptr<rocksdb::TableFactory>& tf)
+{
+  if (tf && string(tf->Name()) == "BlockBasedTable") {
+    rocksdb::BlockBasedTableOptions *o =
+      static_cast<rocksdb::BlockBasedTableOptions*>(tf->GetOptions());
+    if (o)
+      return *o;
+  }
+  return rocksdb::BlockBasedTableOptions();
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle(const string& prefix)
+{
+  if (!cf_by_prefix.empty()) {
+    auto p = cf_by_prefix.find(prefix);
+    if (p != cf_by_prefix.end())
+      return p->second;
+  }
+  return default_cf;
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_cf_handle_for_key(
+  const string& key)
+{
+  // keys are prefix + '\0' + key, or prefix + '\1' for past_prefix()
+  return get_cf_handle(key.substr(0, key.find_first_of(string("\0\1", 2))));
+}
+
 int RocksDBStore::do_open(ostream &out, bool create_if_missing)
 {
   rocksdb::Options opt;
@@ -218,16 +367,121 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing)
     opt.env = static_cast<rocksdb::Env*>(priv);
   }
 
-  status = rocksdb::DB::Open(opt, path, &db);
-  if (!status.ok()) {
-    derr << status.ToString() << dendl;
-    return -EINVAL;
+  if (!merge_ops.empty()) {
+    opt.merge_operator.reset(new MergeOperatorRouter(*this));
+  }
+
+  if (cf_specs.empty()) {
+    status = rocksdb::DB::Open(opt, path, &db);
+    if (!status.ok()) {
+      derr << status.ToString() << dendl;
+      return -EINVAL;
+    }
+    default_cf = db->DefaultColumnFamily();
+  } else {
+    // all families of an existing db must be opened, and a family we
+    // have not seen before may hide keys already in the default family
+    std::vector<string> existing;
+    status = rocksdb::DB::ListColumnFamilies(rocksdb::DBOptions(opt), path,
+					     &existing);
+    if (!status.ok() && !create_if_missing) {
+      derr << status.ToString() << dendl;
+      return -EINVAL;
+    }
+    for (auto& name : existing) {
+      bool found = name == rocksdb::kDefaultColumnFamilyName;
+      for (auto& cf : cf_specs)
+	found = found || cf.name == name;
+      if (!found) {
+	derr << __func__ << " column family " << name
+	     << " exists but is not configured" << dendl;
+	return -EINVAL;
+      }
+    }
+    if (!create_if_missing) {
+      for (auto& cf : cf_specs) {
+	if (std::find(existing.begin(), existing.end(), cf.name) ==
+	    existing.end()) {
+	  derr << __func__ << " column family " << cf.name
+	       << " does not exist" << dendl;
+	  return -EINVAL;
+	}
+      }
+    }
+    opt.create_missing_column_families = true;
+
+    // families without a cache share of their own split what is left
+    // with the default family
+    std::vector<rocksdb::ColumnFamilyOptions> cf_opts;
+    std::vector<double> cache_shares;
+    std::vector<int> bloom_bits;
+    double shared = 1.0;
+    for (auto& cf : cf_specs) {
+      cf_opts.push_back(rocksdb::ColumnFamilyOptions(opt));
+      cache_shares.push_back(0);
+      bloom_bits.push_back(0);
+      int r = parse_cf_options(cf.options, &cf_opts.back(),
+			       &cache_shares.back(), &bloom_bits.back());
+      if (r < 0) {
+	derr << __func__ << " invalid options '" << cf.options
+	     << "' for column family " << cf.name << dendl;
+	return r;
+      }
+      shared -= cache_shares.back();
+    }
+    if (shared <= 0) {
+      derr << __func__ << " column family block_cache_shares add up to 1"
+	   << " or more" << dendl;
+      return -EINVAL;
+    }
+    std::shared_ptr<rocksdb::Cache> shared_cache =
+      rocksdb::NewLRUCache(g_conf->rocksdb_cache_size * shared);
+    // keep whatever block_based_table_factory options we were given
+    rocksdb::BlockBasedTableOptions bbt_opts =
+      get_bbt_options(opt.table_factory);
+    bbt_opts.block_cache = shared_cache;
+    opt.table_factory.reset(rocksdb::NewBlockBasedTableFactory(bbt_opts));
+
+    std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+    cfds.push_back(rocksdb::ColumnFamilyDescriptor(
+		     rocksdb::kDefaultColumnFamilyName,
+		     rocksdb::ColumnFamilyOptions(opt)));
+    for (unsigned i = 0; i < cf_specs.size(); ++i) {
+      rocksdb::BlockBasedTableOptions t =
+	get_bbt_options(cf_opts[i].table_factory);
+      if (cache_shares[i] > 0)
+	t.block_cache = rocksdb::NewLRUCache(
+	  g_conf->rocksdb_cache_size * cache_shares[i]);
+      else
+	t.block_cache = shared_cache;
+      if (bloom_bits[i])
+	t.filter_policy.reset(rocksdb::NewBloomFilterPolicy(bloom_bits[i]));
+      cf_opts[i].table_factory.reset(rocksdb::NewBlockBasedTableFactory(t));
+      cfds.push_back(rocksdb::ColumnFamilyDescriptor(cf_specs[i].name,
+						     cf_opts[i]));
+      dout(10) << __func__ << " column family " << cf_specs[i].name
+	       << " prefixes " << cf_specs[i].prefixes
+	       << " options '" << cf_specs[i].options << "'" << dendl;
+    }
+
+    status = rocksdb::DB::Open(rocksdb::DBOptions(opt), path, cfds,
+			       &cf_handles, &db);
+    if (!status.ok()) {
+      derr << status.ToString() << dendl;
+      return -EINVAL;
+    }
+    default_cf = cf_handles[0];
+    for (unsigned i = 0; i < cf_specs.size(); ++i) {
+      for (auto& p : cf_specs[i].prefixes)
+	cf_by_prefix[p] = cf_handles[i + 1];
+    }
   }
 
   PerfCountersBuilder plb(g_ceph_context, "rocksdb", l_rocksdb_first, l_rocksdb_last);
   plb.add_u64_counter(l_rocksdb_gets, "rocksdb_get", "Gets");
   plb.add_u64_counter(l_rocksdb_txns, "rocksdb_transaction", "Transactions");
   plb.add_time_avg(l_rocksdb_get_latency, "rocksdb_get_latency", "Get latency");
+  plb.add_u64_counter(l_rocksdb_get_many_keys, "rocksdb_get_many_keys", "Keys fetched by batched gets");
   plb.add_time_avg(l_rocksdb_submit_latency, "rocksdb_submit_latency", "Submit Latency");
   plb.add_time_avg(l_rocksdb_submit_sync_latency, "rocksdb_submit_sync_latency", "Submit Sync Latency");
   plb.add_u64_counter(l_rocksdb_compact, "rocksdb_compact", "Compactions");
@@ -260,6 +514,12 @@ RocksDBStore::~RocksDBStore()
   close();
   delete logger;
 
+  // column family handles must go before the db
+  for (auto h : cf_handles)
+    delete h;
+  cf_handles.clear();
+  cf_by_prefix.clear();
+
   // Ensure db is destroyed before dependent db_cache and filterpolicy
   delete db;
 
@@ -348,13 +608,15 @@ void RocksDBStore::RocksDBTransactionImpl::set(
 
   // bufferlist::c_str() is non-constant, so we can't call c_str()
   if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
-    bat->Put(rocksdb::Slice(key),
+    bat->Put(db->get_cf_handle(prefix),
+	     rocksdb::Slice(key),
 	     rocksdb::Slice(to_set_bl.buffers().front().c_str(),
 			    to_set_bl.length()));
   } else {
     // make a copy
     bufferlist val = to_set_bl;
-    bat->Put(rocksdb::Slice(key),
+    bat->Put(db->get_cf_handle(prefix),
+	     rocksdb::Slice(key),
 	     rocksdb::Slice(val.c_str(), val.length()));
   }
 }
@@ -362,7 +624,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
 void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
-  bat->Delete(combine_strings(prefix, k));
+  bat->Delete(db->get_cf_handle(prefix), combine_strings(prefix, k));
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
@@ -371,7 +633,30 @@ void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix
   for (it->seek_to_first();
        it->valid();
        it->next()) {
-    bat->Delete(combine_strings(prefix, it->key()));
+    bat->Delete(db->get_cf_handle(prefix),
+		combine_strings(prefix, it->key()));
+  }
+}
+
+void RocksDBStore::RocksDBTransactionImpl::merge(
+  const string &prefix,
+  const string &k,
+  const bufferlist &to_set_bl)
+{
+  string key = combine_strings(prefix, k);
+
+  // bufferlist::c_str() is non-constant, so we can't call c_str()
+  if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
+    bat->Merge(db->get_cf_handle(prefix),
+	       rocksdb::Slice(key),
+	       rocksdb::Slice(to_set_bl.buffers().front().c_str(),
+			      to_set_bl.length()));
+  } else {
+    // make a copy
+    bufferlist val = to_set_bl;
+    bat->Merge(db->get_cf_handle(prefix),
+	       rocksdb::Slice(key),
+	       rocksdb::Slice(val.c_str(), val.length()));
   }
 }
 
@@ -380,20 +665,16 @@ int RocksDBStore::get(
     const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
-  utime_t start = ceph_clock_now(g_ceph_context);
-  KeyValueDB::Iterator it = get_iterator(prefix);
-  for (std::set<string>::const_iterator i = keys.begin();
-       i != keys.end();
-       ++i) {
-    it->lower_bound(*i);
-    if (it->valid() && it->key() == *i) {
-      out->insert(make_pair(*i, it->value()));
-    } else if (!it->valid())
-      break;
+  std::vector<string> v(keys.begin(), keys.end());
+  std::vector<bufferlist> values;
+  std::vector<int> rs;
+  int r = get_many(prefix, v, &values, &rs);
+  if (r < 0)
+    return r;
+  for (unsigned i = 0; i < v.size(); ++i) {
+    if (rs[i] == 0)
+      out->insert(make_pair(v[i], values[i]));
   }
-  utime_t lat = ceph_clock_now(g_ceph_context) - start;
-  logger->inc(l_rocksdb_gets);
-  logger->tinc(l_rocksdb_get_latency, lat);
   return 0;
 }
 
@@ -404,15 +685,66 @@ int RocksDBStore::get(
 {
   utime_t start = ceph_clock_now(g_ceph_context);
   int r = 0;
-  KeyValueDB::Iterator it = get_iterator(prefix);
-  it->lower_bound(key);
-  if (it->valid() && it->key() == key) {
-    *out = it->value();
-  } else {
+  string value;
+  rocksdb::Status s = db->Get(rocksdb::ReadOptions(), get_cf_handle(prefix),
+			      combine_strings(prefix, key), &value);
+  if (s.ok()) {
+    out->clear();
+    out->append(value);
+  } else if (s.IsNotFound()) {
     r = -ENOENT;
+  } else {
+    derr << __func__ << " " << s.ToString() << dendl;
+    r = -EIO;
+  }
+  utime_t lat = ceph_clock_now(g_ceph_context) - start;
+  logger->inc(l_rocksdb_gets);
+  logger->tinc(l_rocksdb_get_latency, lat);
+  return r;
+}
+
+int RocksDBStore::get_many(
+    const string &prefix,
+    const std::vector<string> &keys,
+    std::vector<bufferlist> *values,
+    std::vector<int> *rs)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  // the Slices point into combined; it must not reallocate
+  std::vector<string> combined;
+  combined.reserve(keys.size());
+  std::vector<rocksdb::Slice> slices;
+  slices.reserve(keys.size());
+  for (auto& k : keys) {
+    combined.push_back(combine_strings(prefix, k));
+    slices.push_back(rocksdb::Slice(combined.back()));
+  }
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs(keys.size(),
+						get_cf_handle(prefix));
+  std::vector<string> out;
+  std::vector<rocksdb::Status> status = db->MultiGet(rocksdb::ReadOptions(),
+						     cfs, slices, &out);
+  values->resize(keys.size());
+  if (rs)
+    rs->resize(keys.size());
+  int r = 0;
+  for (unsigned i = 0; i < keys.size(); ++i) {
+    int kr = 0;
+    (*values)[i].clear();
+    if (status[i].ok()) {
+      (*values)[i].append(out[i]);
+    } else if (status[i].IsNotFound()) {
+      kr = -ENOENT;
+    } else {
+      derr << __func__ << " " << status[i].ToString() << dendl;
+      r = -EIO;
+    }
+    if (rs)
+      (*rs)[i] = kr;
   }
   utime_t lat = ceph_clock_now(g_ceph_context) - start;
   logger->inc(l_rocksdb_gets);
+  logger->inc(l_rocksdb_get_many_keys, keys.size());
   logger->tinc(l_rocksdb_get_latency, lat);
   return r;
 }
@@ -455,7 +787,12 @@ int RocksDBStore::split_key(rocksdb::Slice in, string *prefix, string *key)
 void RocksDBStore::compact()
 {
   logger->inc(l_rocksdb_compact);
-  db->CompactRange(NULL, NULL);
+  if (cf_handles.empty()) {
+    db->CompactRange(NULL, NULL);
+  } else {
+    for (auto h : cf_handles)
+      db->CompactRange(rocksdb::CompactRangeOptions(), h, NULL, NULL);
+  }
 }
 
 
@@ -530,7 +867,8 @@ void RocksDBStore::compact_range(const string& start, const string& end)
 {
     rocksdb::Slice cstart(start);
     rocksdb::Slice cend(end);
-    db->CompactRange(&cstart, &cend);
+    db->CompactRange(rocksdb::CompactRangeOptions(),
+		     get_cf_handle_for_key(start), &cstart, &cend);
 }
 RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
 {
@@ -640,6 +978,12 @@ string RocksDBStore::past_prefix(const string &prefix)
 
 RocksDBStore::WholeSpaceIterator RocksDBStore::_get_iterator()
 {
+  if (!cf_handles.empty()) {
+    std::vector<rocksdb::Iterator*> iters;
+    db->NewIterators(rocksdb::ReadOptions(), cf_handles, &iters);
+    return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new RocksDBMergingIteratorImpl(db, NULL, iters));
+  }
   return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
     new RocksDBWholeSpaceIteratorImpl(
       db->NewIterator(rocksdb::ReadOptions())
@@ -655,6 +999,12 @@ RocksDBStore::WholeSpaceIterator RocksDBStore::_get_snapshot_iterator()
   snapshot = db->GetSnapshot();
   options.snapshot = snapshot;
 
+  if (!cf_handles.empty()) {
+    std::vector<rocksdb::Iterator*> iters;
+    db->NewIterators(options, cf_handles, &iters);
+    return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+      new RocksDBMergingIteratorImpl(db, snapshot, iters));
+  }
   return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
     new RocksDBSnapshotIteratorImpl(db, snapshot,
       db->NewIterator(options))
@@ -665,3 +1015,213 @@ RocksDBStore::RocksDBSnapshotIteratorImpl::~RocksDBSnapshotIteratorImpl()
 {
   db->ReleaseSnapshot(snapshot);
 }
+
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_prefix_iterator(
+  const string &prefix,
+  unsigned flags)
+{
+  rocksdb::ReadOptions options;
+  if (flags & ITERATOR_NOCACHE)
+    options.fill_cache = false;
+  if (flags & ITERATOR_PREFETCH)
+    options.readahead_size = g_conf->rocksdb_iterator_readahead_size;
+  return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+    new RocksDBWholeSpaceIteratorImpl(
+      db->NewIterator(options, get_cf_handle(prefix))
+    )
+  );
+}
+
+RocksDBStore::WholeSpaceIterator RocksDBStore::_get_snapshot_prefix_iterator(
+  const string &prefix)
+{
+  const rocksdb::Snapshot *snapshot;
+  rocksdb::ReadOptions options;
+
+  snapshot = db->GetSnapshot();
+  options.snapshot = snapshot;
+
+  return std::shared_ptr<KeyValueDB::WholeSpaceIteratorImpl>(
+    new RocksDBSnapshotIteratorImpl(db, snapshot,
+      db->NewIterator(options, get_cf_handle(prefix)))
+  );
+}
+
+RocksDBStore::RocksDBMergingIteratorImpl::~RocksDBMergingIteratorImpl()
+{
+  for (auto i : iters)
+    delete i;
+  if (snapshot)
+    db->ReleaseSnapshot(snapshot);
+}
+
+void RocksDBStore::RocksDBMergingIteratorImpl::find_smallest()
+{
+  cur = NULL;
+  for (auto i : iters) {
+    if (i->Valid() && (!cur || i->key().compare(cur->key()) < 0))
+      cur = i;
+  }
+}
+
+void RocksDBStore::RocksDBMergingIteratorImpl::find_largest()
+{
+  cur = NULL;
+  for (auto i : iters) {
+    if (i->Valid() && (!cur || i->key().compare(cur->key()) > 0))
+      cur = i;
+  }
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::seek_to_first()
+{
+  for (auto i : iters)
+    i->SeekToFirst();
+  forward = true;
+  find_smallest();
+  return status();
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::seek_to_first(const string &prefix)
+{
+  rocksdb::Slice slice_prefix(prefix);
+  for (auto i : iters)
+    i->Seek(slice_prefix);
+  forward = true;
+  find_smallest();
+  return status();
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::seek_to_last()
+{
+  for (auto i : iters)
+    i->SeekToLast();
+  forward = false;
+  find_largest();
+  return status();
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::seek_to_last(const string &prefix)
+{
+  string limit = past_prefix(prefix);
+  rocksdb::Slice slice_limit(limit);
+  for (auto i : iters) {
+    i->Seek(slice_limit);
+    if (!i->Valid())
+      i->SeekToLast();
+    else
+      i->Prev();
+  }
+  forward = false;
+  find_largest();
+  return status();
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::upper_bound(const string &prefix,
+							   const string &after)
+{
+  lower_bound(prefix, after);
+  if (valid()) {
+    pair<string,string> key = raw_key();
+    if (key.first == prefix && key.second == after)
+      next();
+  }
+  return status();
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::lower_bound(const string &prefix,
+							   const string &to)
+{
+  string bound = combine_strings(prefix, to);
+  rocksdb::Slice slice_bound(bound);
+  for (auto i : iters)
+    i->Seek(slice_bound);
+  forward = true;
+  find_smallest();
+  return status();
+}
+
+bool RocksDBStore::RocksDBMergingIteratorImpl::valid()
+{
+  return cur != NULL;
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::next()
+{
+  if (!cur)
+    return status();
+  if (!forward) {
+    // the other iterators sit before the current key; move them past it
+    string k = cur->key().ToString();
+    for (auto i : iters) {
+      if (i != cur)
+	i->Seek(k);
+    }
+    forward = true;
+  }
+  cur->Next();
+  find_smallest();
+  return status();
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::prev()
+{
+  if (!cur)
+    return status();
+  if (forward) {
+    // the other iterators sit past the current key; move them before it
+    string k = cur->key().ToString();
+    for (auto i : iters) {
+      if (i == cur)
+	continue;
+      i->Seek(k);
+      if (i->Valid())
+	i->Prev();
+      else
+	i->SeekToLast();
+    }
+    forward = false;
+  }
+  cur->Prev();
+  find_largest();
+  return status();
+}
+
+string RocksDBStore::RocksDBMergingIteratorImpl::key()
+{
+  string out_key;
+  split_key(cur->key(), 0, &out_key);
+  return out_key;
+}
+
+pair<string,string> RocksDBStore::RocksDBMergingIteratorImpl::raw_key()
+{
+  string prefix, key;
+  split_key(cur->key(), &prefix, &key);
+  return make_pair(prefix, key);
+}
+
+bool RocksDBStore::RocksDBMergingIteratorImpl::raw_key_is_prefixed(
+  const string &prefix)
+{
+  rocksdb::Slice key = cur->key();
+  if ((key.size() > prefix.length()) && (key[prefix.length()] == '\0')) {
+    return memcmp(key.data(), prefix.c_str(), prefix.length()) == 0;
+  } else {
+    return false;
+  }
+}
+
+bufferlist RocksDBStore::RocksDBMergingIteratorImpl::value()
+{
+  return to_bufferlist(cur->value());
+}
+
+int RocksDBStore::RocksDBMergingIteratorImpl::status()
+{
+  for (auto i : iters) {
+    if (!i->status().ok())
+      return -1;
+  }
+  return 0;
+}
@@ -33,6 +33,7 @@ enum {
   l_rocksdb_compact_range,
   l_rocksdb_compact_queue_merge,
   l_rocksdb_compact_queue_len,
+  l_rocksdb_get_many_keys,
   l_rocksdb_last,
 };
 
@@ -45,6 +46,8 @@ namespace rocksdb{
   class Slice;
   class WriteBatch;
   class Iterator;
+  class ColumnFamilyHandle;
+  struct ColumnFamilyOptions;
   class Logger;
   struct Options;
 }
@@ -64,6 +67,24 @@ class RocksDBStore : public KeyValueDB {
   string options_str;
   int do_open(ostream &out, bool create_if_missing);
 
+  /// registered merge operators, by prefix
+  std::vector<std::pair<std::string,
+			std::shared_ptr<KeyValueDB::MergeOperator> > > merge_ops;
+  class MergeOperatorRouter;
+  friend class MergeOperatorRouter;
+
+  /// column families, if any; handle 0 is the default family
+  std::vector<KeyValueDB::ColumnFamily> cf_specs;
+  std::vector<rocksdb::ColumnFamilyHandle*> cf_handles;
+  std::map<std::string, rocksdb::ColumnFamilyHandle*> cf_by_prefix;
+  rocksdb::ColumnFamilyHandle *default_cf;
+
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const string& prefix);
+  rocksdb::ColumnFamilyHandle *get_cf_handle_for_key(const string& key);
+  int parse_cf_options(const string& opt_str,
+		       rocksdb::ColumnFamilyOptions *cf_opt,
+		       double *cache_share, int *bloom_bits);
+
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
@@ -118,6 +139,7 @@ public:
     priv(p),
     db(NULL),
     env(static_cast<rocksdb::Env*>(p)),
+    default_cf(NULL),
     compact_queue_lock("RocksDBStore::compact_thread_lock"),
     compact_queue_stop(false),
     compact_thread(this),
@@ -137,6 +159,10 @@ public:
 
   void close();
 
+  int set_merge_operator(const std::string& prefix,
+			 std::shared_ptr<KeyValueDB::MergeOperator> mop);
+  int set_column_families(const std::vector<KeyValueDB::ColumnFamily>& cfs);
+
   class RocksDBTransactionImpl : public KeyValueDB::TransactionImpl {
   public:
     rocksdb::WriteBatch *bat;
@@ -154,6 +180,10 @@ public:
     void rmkeys_by_prefix(
       const string &prefix
       );
+    void merge(
+      const string &prefix,
+      const string &k,
+      const bufferlist &bl);
   };
 
   KeyValueDB::Transaction get_transaction() {
@@ -173,6 +203,12 @@ public:
     const string &key,
     bufferlist *out
     );
+  int get_many(
+    const string &prefix,
+    const std::vector<string> &keys,
+    std::vector<bufferlist> *values,
+    std::vector<int> *rs = NULL
+    );
 
   class RocksDBWholeSpaceIteratorImpl :
     public KeyValueDB::WholeSpaceIteratorImpl {
@@ -211,6 +247,43 @@ public:
     ~RocksDBSnapshotIteratorImpl();
   };
 
+  /**
+   * Iterates over the union of all column families.  Each prefix lives
+   * in exactly one family, so keys never collide and this is a plain
+   * bytewise merge of one iterator per family.
+   */
+  class RocksDBMergingIteratorImpl :
+    public KeyValueDB::WholeSpaceIteratorImpl {
+    rocksdb::DB *db;
+    const rocksdb::Snapshot *snapshot;  ///< released with us, if set
+    std::vector<rocksdb::Iterator*> iters;
+    rocksdb::Iterator *cur;             ///< NULL when not valid
+    bool forward;                       ///< direction of the last move
+
+    void find_smallest();
+    void find_largest();
+  public:
+    RocksDBMergingIteratorImpl(rocksdb::DB *db, const rocksdb::Snapshot *s,
+			       const std::vector<rocksdb::Iterator*>& i) :
+      db(db), snapshot(s), iters(i), cur(NULL), forward(true) { }
+    ~RocksDBMergingIteratorImpl();
+
+    int seek_to_first();
+    int seek_to_first(const string &prefix);
+    int seek_to_last();
+    int seek_to_last(const string &prefix);
+    int upper_bound(const string &prefix, const string &after);
+    int lower_bound(const string &prefix, const string &to);
+    bool valid();
+    int next();
+    int prev();
+    string key();
+    pair<string,string> raw_key();
+    bool raw_key_is_prefixed(const string &prefix);
+    bufferlist value();
+    int status();
+  };
+
   /// Utility
   static string combine_strings(const string &prefix, const string &value);
   static int split_key(rocksdb::Slice in, string *prefix, string *key);
@@ -289,6 +362,11 @@ protected:
 
   WholeSpaceIterator _get_snapshot_iterator();
 
+  WholeSpaceIterator _get_prefix_iterator(const string &prefix,
+					  unsigned flags);
+
+  WholeSpaceIterator _get_snapshot_prefix_iterator(const string &prefix);
+
 };
 
 #endif
@@ -35,6 +35,7 @@ using namespace std;
 #define SOCKET_PRIORITY_MIN_DELAY 6
 
 class Timer;
+class AsyncCompressor;
 
 
 class Messenger {
@@ -86,20 +87,25 @@ public:
     uint64_t features_supported;
     /// Specify features any remotes must have to talk to this endpoint.
     uint64_t features_required;
+    /// If true, compress large message segments for remotes that can
+    /// decompress them (see CEPH_FEATURE_MSG_COMPRESS).
+    bool compress;
 
     Policy()
       : lossy(false), server(false), standby(false), resetcheck(true),
 	throttler_bytes(NULL),
 	throttler_messages(NULL),
 	features_supported(CEPH_FEATURES_SUPPORTED_DEFAULT),
-	features_required(0) {}
+	features_required(0),
+	compress(false) {}
   private:
     Policy(bool l, bool s, bool st, bool r, uint64_t sup, uint64_t req)
       : lossy(l), server(s), standby(st), resetcheck(r),
 	throttler_bytes(NULL),
 	throttler_messages(NULL),
 	features_supported(sup | CEPH_FEATURES_SUPPORTED_DEFAULT),
-	features_required(req) {}
+	features_required(req),
+	compress(false) {}
 
   public:
     static Policy stateful_server(uint64_t sup, uint64_t req) {
@@ -315,6 +321,19 @@ public:
    * you must not destroy them before you destroy the Messenger.
    */
   virtual void set_policy_throttlers(int type, Throttle *bytes, Throttle *msgs=NULL) = 0;
+  /**
+   * Set the compressor pool used for messages to and from peers that
+   * support CEPH_FEATURE_MSG_COMPRESS. Messengers that can't compress
+   * on the wire ignore it.
+   *
+   * This is an init-time function and must be called *before* calling
+   * start().
+   *
+   * @param c The compressor. The Messenger does not take ownership of it,
+   * but you must not terminate or destroy it before the Messenger is
+   * shut down.
+   */
+  virtual void set_compressor(AsyncCompressor *c) {}
   /**
    * Set the default send priority
    *
@@ -20,6 +20,7 @@
 
 #include "include/Context.h"
 #include "common/errno.h"
+#include "compressor/AsyncCompressor.h"
 #include "AsyncMessenger.h"
 #include "AsyncConnection.h"
 
@@ -46,6 +47,13 @@ ostream& AsyncConnection::_conn_prefix(std::ostream *_dout) {
 
 const int AsyncConnection::TCP_PREFETCH_MIN_SIZE = 512;
 
+// footer flags of the front, middle and data segments when compressed
+static const int compress_seg_flags[3] = {
+  CEPH_MSG_FOOTER_FRONT_COMPRESSED,
+  CEPH_MSG_FOOTER_MIDDLE_COMPRESSED,
+  CEPH_MSG_FOOTER_DATA_COMPRESSED
+};
+
 class C_time_wakeup : public EventCallback {
   AsyncConnectionRef conn;
 
@@ -141,48 +149,73 @@ class C_local_deliver : public EventCallback {
 };
 
 
-class C_clean_handler : public EventCallback {
+class C_migrate : public EventCallback {
   AsyncConnectionRef conn;
+  Worker *worker;
  public:
-  C_clean_handler(AsyncConnectionRef c): conn(c) {}
+  C_migrate(AsyncConnectionRef c, Worker *w): conn(c), worker(w) {}
   void do_request(int id) {
-    conn->cleanup_handler();
+    conn->_migrate(worker);
     delete this;
   }
 };
 
-static void alloc_aligned_buffer(bufferlist& data, unsigned len, unsigned off)
-{
-  // create a buffer to read into that matches the data alignment
-  unsigned left = len;
-  if (off & ~CEPH_PAGE_MASK) {
-    // head
-    unsigned head = 0;
-    head = MIN(CEPH_PAGE_SIZE - (off & ~CEPH_PAGE_MASK), left);
-    bufferptr bp = buffer::create(head);
-    data.push_back(bp);
-    left -= head;
-  }
-  unsigned middle = left & CEPH_PAGE_MASK;
-  if (middle > 0) {
-    bufferptr bp = buffer::create_page_aligned(middle);
-    data.push_back(bp);
-    left -= middle;
-  }
-  if (left) {
-    bufferptr bp = buffer::create(left);
-    data.push_back(bp);
+class C_migrate_drained : public EventCallback {
+  AsyncConnectionRef conn;
+ public:
+  C_migrate_drained(AsyncConnectionRef c): conn(c) {}
+  void do_request(int id) {
+    conn->migrate_drained();
+    delete this;
   }
-}
+};
+
+class C_compressed : public AsyncCompressor::Completion {
+  AsyncConnectionRef conn;
+  uint64_t gen;
+  int seg;
+  uint64_t raw_len;
+ public:
+  C_compressed(AsyncConnectionRef c, uint64_t g, int s, uint64_t l)
+    : conn(c), gen(g), seg(s), raw_len(l) {}
+  void finish(int r) {
+    conn->compressed(gen, seg, r, data, raw_len, elapsed);
+  }
+};
+
+class C_decompressed : public AsyncCompressor::Completion {
+  AsyncConnectionRef conn;
+  uint64_t gen;
+  int seg;
+ public:
+  C_decompressed(AsyncConnectionRef c, uint64_t g, int s): conn(c), gen(g), seg(s) {}
+  void finish(int r) {
+    conn->decompressed(gen, seg, r, data, elapsed);
+  }
+};
 
-AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, EventCenter *c, PerfCounters *p)
-  : Connection(cct, m), async_msgr(m), logger(p), global_seq(0), connect_seq(0), peer_global_seq(0),
+class C_clean_handler : public EventCallback {
+  AsyncConnectionRef conn;
+ public:
+  C_clean_handler(AsyncConnectionRef c): conn(c) {}
+  void do_request(int id) {
+    if (conn->can_cleanup_handler())
+      conn->cleanup_handler();
+    delete this;
+  }
+};
+
+AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, Worker *w)
+  : Connection(cct, m), async_msgr(m), logger(w->get_perf_counter()), global_seq(0), connect_seq(0), peer_global_seq(0),
     out_seq(0), ack_left(0), in_seq(0), state(STATE_NONE), state_after_send(0), sd(-1), port(-1),
     write_lock("AsyncConnection::write_lock"), can_write(NOWRITE),
-    open_write(false), keepalive(false), lock("AsyncConnection::lock"), recv_buf(NULL),
+    open_write(false), keepalive(false), write_scheduled(false), compress_msg(NULL), compress_pending(0),
+    compress_flags(0), compress_gen(0), lock("AsyncConnection::lock"), recv_buf(NULL),
     recv_max_prefetch(MIN(msgr->cct->_conf->ms_tcp_prefetch_max_size, TCP_PREFETCH_MIN_SIZE)),
-    recv_start(0), recv_end(0), got_bad_auth(false), authorizer(NULL), replacing(false),
-    is_reset_from_peer(false), once_ready(false), state_buffer(NULL), state_offset(0), net(cct), center(c)
+    recv_start(0), recv_end(0), msg_throttle_bytes(0), decompress_pending(0), decompress_failed(false), decompress_gen(0),
+    got_bad_auth(false), authorizer(NULL), replacing(false),
+    is_reset_from_peer(false), once_ready(false), state_buffer(NULL), state_offset(0), net(cct), worker(w), center(&w->center),
+    migrate_draining(0), cleanup_deferred(false), load(0), balance_load(0)
 {
   read_handler = new C_handle_read(this);
   write_handler = new C_handle_write(this);
@@ -196,6 +229,7 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, EventCente
   recv_buf = new char[2*recv_max_prefetch];
   state_buffer = new char[4096];
   logger->inc(l_msgr_created_connections);
+  worker->add_connection();
 }
 
 AsyncConnection::~AsyncConnection()
@@ -207,6 +241,7 @@ AsyncConnection::~AsyncConnection()
     delete[] recv_buf;
   if (state_buffer)
     delete[] state_buffer;
+  worker->remove_connection();
 }
 
 /* return -1 means `fd` occurs error or closed, it should be closed
@@ -299,13 +334,18 @@ int AsyncConnection::do_sendmsg(struct msghdr &msg, int len, bool more)
 {
   suppress_sigpipe();
 
-  while (len > 0) {
-    int r;
+  int flags = 0;
 #if defined(MSG_NOSIGNAL)
-    r = ::sendmsg(sd, &msg, MSG_NOSIGNAL);
-#else
-    r = ::sendmsg(sd, &msg, 0);
+  flags |= MSG_NOSIGNAL;
 #endif /* defined(MSG_NOSIGNAL) */
+#if defined(MSG_MORE)
+  if (more)
+    flags |= MSG_MORE;
+#endif /* defined(MSG_MORE) */
+
+  while (len > 0) {
+    int r = ::sendmsg(sd, &msg, flags);
+    logger->inc(l_msgr_send_syscalls);
 
     if (r == 0) {
       ldout(async_msgr->cct, 10) << __func__ << " sendmsg got r==0!" << dendl;
@@ -344,7 +384,7 @@ int AsyncConnection::do_sendmsg(struct msghdr &msg, int len, bool more)
 
 // return the remaining bytes, it may larger than the length of ptr
 // else return < 0 means error
-int AsyncConnection::_try_send(bufferlist &send_bl, bool send)
+int AsyncConnection::_try_send(bufferlist &send_bl, bool send, bool more)
 {
   ldout(async_msgr->cct, 20) << __func__ << " send bl length is " << send_bl.length() << dendl;
   if (send_bl.length()) {
@@ -384,7 +424,8 @@ int AsyncConnection::_try_send(bufferlist &send_bl, bool send)
       size--;
     }
 
-    int r = do_sendmsg(msg, msglen, false);
+    int r = do_sendmsg(msg, msglen, async_msgr->cct->_conf->ms_async_send_more &&
+                                    (more || left_pbrs));
     if (r < 0)
       return r;
 
@@ -449,6 +490,8 @@ int AsyncConnection::read_until(uint64_t len, char *p)
   if (recv_end > recv_start) {
     uint64_t to_read = MIN(recv_end - recv_start, left);
     memcpy(p, recv_buf+recv_start, to_read);
+    if (p != state_buffer)
+      logger->inc(l_msgr_recv_copies);
     recv_start += to_read;
     left -= to_read;
     ldout(async_msgr->cct, 25) << __func__ << " got " << to_read << " in buffer "
@@ -490,12 +533,16 @@ int AsyncConnection::read_until(uint64_t len, char *p)
       if (r >= static_cast<int>(left)) {
         recv_start = len - state_offset;
         memcpy(p+state_offset, recv_buf, recv_start);
+        if (p != state_buffer)
+          logger->inc(l_msgr_recv_copies);
         state_offset = 0;
         return 0;
       }
       left -= r;
     } while (r > 0);
     memcpy(p+state_offset, recv_buf, recv_end-recv_start);
+    if (p != state_buffer)
+      logger->inc(l_msgr_recv_copies);
     state_offset += (recv_end - recv_start);
     recv_end = recv_start = 0;
   }
@@ -511,6 +558,8 @@ void AsyncConnection::process()
   int prev_state = state;
   bool already_dispatch_writer = false;
   Mutex::Locker l(lock);
+  if (state != STATE_CLOSED && forward_to_owner(read_handler))
+    return ;
   do {
     ldout(async_msgr->cct, 20) << __func__ << " state is " << get_state_name(state)
                                << ", prev state is " << get_state_name(prev_state) << dendl;
@@ -519,7 +568,7 @@ void AsyncConnection::process()
       case STATE_OPEN:
         {
           char tag = -1;
-          r = read_until(sizeof(tag), &tag);
+          r = read_until(sizeof(tag), state_buffer);
           if (r < 0) {
             ldout(async_msgr->cct, 1) << __func__ << " read tag failed, state is "
                                       << get_state_name(state) << dendl;
@@ -527,6 +576,7 @@ void AsyncConnection::process()
           } else if (r > 0) {
             break;
           }
+          tag = state_buffer[0];
 
           if (tag == CEPH_MSGR_TAG_KEEPALIVE) {
             ldout(async_msgr->cct, 20) << __func__ << " got KEEPALIVE" << dendl;
@@ -713,6 +763,7 @@ void AsyncConnection::process()
               }
             }
           }
+          msg_throttle_bytes = message_size;
 
           throttle_stamp = ceph_clock_now(msgr->cct);
           state = STATE_OPEN_MESSAGE_READ_FRONT;
@@ -784,7 +835,7 @@ void AsyncConnection::process()
               data_blp = data_buf.begin();
             } else {
               ldout(async_msgr->cct,20) << __func__ << " allocating new rx buffer at offset " << data_off << dendl;
-              alloc_aligned_buffer(data_buf, data_len, data_off);
+              data_buf.push_back(worker->get_rx_buffers()->get(data_len, data_off));
               data_blp = data_buf.begin();
             }
           }
@@ -813,14 +864,14 @@ void AsyncConnection::process()
           }
 
           if (msg_left == 0)
-            state = STATE_OPEN_MESSAGE_READ_FOOTER_AND_DISPATCH;
+            state = STATE_OPEN_MESSAGE_READ_FOOTER;
 
           break;
         }
 
-      case STATE_OPEN_MESSAGE_READ_FOOTER_AND_DISPATCH:
+      case STATE_OPEN_MESSAGE_READ_FOOTER:
         {
-          ceph_msg_footer footer;
+          ceph_msg_footer& footer = current_footer;
           ceph_msg_footer_old old_footer;
           int len;
           // footer
@@ -857,7 +908,71 @@ void AsyncConnection::process()
 
           ldout(async_msgr->cct, 20) << __func__ << " got " << front.length() << " + " << middle.length()
                               << " + " << data.length() << " byte message" << dendl;
-          Message *message = decode_message(async_msgr->cct, async_msgr->crcflags, current_header, footer, front, middle, data);
+          if (footer.flags & CEPH_MSG_FOOTER_COMPRESSED) {
+            if (_start_decompress() < 0)
+              goto fail;
+            state = STATE_OPEN_MESSAGE_DECOMPRESS;
+          } else {
+            state = STATE_OPEN_MESSAGE_DISPATCH;
+          }
+          break;
+        }
+
+      case STATE_OPEN_MESSAGE_DECOMPRESS:
+        {
+          // C_decompressed calls us again once the compressor is done
+          if (decompress_pending)
+            break;
+          if (decompress_failed) {
+            ldout(async_msgr->cct, 1) << __func__ << " decompress message failed" << dendl;
+            goto fail;
+          }
+
+          uint64_t raw_size = front.length() + middle.length() + data.length();
+          if (raw_size > async_msgr->cct->_conf->ms_async_decompress_max_size) {
+            ldout(async_msgr->cct, 1) << __func__ << " decompressed message is " << raw_size
+                                      << " bytes, more than we accept" << dendl;
+            goto fail;
+          }
+          // what we took from the byte throttler covers the compressed
+          // size, while the message will put back its raw size.  trade
+          // the one for the other, so we don't wait on our own budget.
+          if (raw_size != msg_throttle_bytes && policy.throttler_bytes) {
+            if (msg_throttle_bytes) {
+              policy.throttler_bytes->put(msg_throttle_bytes);
+              msg_throttle_bytes = 0;
+            }
+            ldout(async_msgr->cct, 10) << __func__ << " wants " << raw_size
+                                       << " decompressed bytes from policy throttler "
+                                       << policy.throttler_bytes->get_current() << "/"
+                                       << policy.throttler_bytes->get_max() << dendl;
+            if (!policy.throttler_bytes->get_or_fail(raw_size)) {
+              if (register_time_events.empty())
+                register_time_events.insert(center->create_time_event(1000, wakeup_handler));
+              break;
+            }
+          }
+          msg_throttle_bytes = raw_size;
+
+          ldout(async_msgr->cct, 20) << __func__ << " decompressed to " << front.length() << " + "
+                                     << middle.length() << " + " << data.length() << " bytes" << dendl;
+          state = STATE_OPEN_MESSAGE_DISPATCH;
+          break;
+        }
+
+      case STATE_OPEN_MESSAGE_DISPATCH:
+        {
+          // the crcs of a compressed message cover what was sent, and
+          // _start_decompress() has checked them already
+          ceph_msg_header header = current_header;
+          int crcflags = async_msgr->crcflags;
+          if (current_footer.flags & CEPH_MSG_FOOTER_COMPRESSED) {
+            header.front_len = front.length();
+            header.middle_len = middle.length();
+            header.data_len = data.length();
+            crcflags = 0;
+          }
+          Message *message = decode_message(async_msgr->cct, crcflags, header, current_footer, front, middle, data);
           if (!message) {
             ldout(async_msgr->cct, 1) << __func__ << " decode message failed " << dendl;
             goto fail;
@@ -881,8 +996,7 @@ void AsyncConnection::process()
 
           // store reservation size in message, so we don't get confused
           // by messages entering the dispatch queue through other paths.
-          uint64_t message_size = current_header.front_len + current_header.middle_len + current_header.data_len;
-          message->set_dispatch_throttle_size(message_size);
+          message->set_dispatch_throttle_size(msg_throttle_bytes);
 
           message->set_recv_stamp(recv_stamp);
           message->set_throttle_stamp(throttle_stamp);
@@ -901,6 +1015,7 @@ void AsyncConnection::process()
             message->put();
             if (has_feature(CEPH_FEATURE_RECONNECT_SEQ) && async_msgr->cct->_conf->ms_die_on_old_message)
               assert(0 == "old msgs despite reconnect_seq feature");
+            state = STATE_OPEN;
             break;
           }
           if (message->get_seq() > cur_seq + 1) {
@@ -935,8 +1050,10 @@ void AsyncConnection::process()
           } else {
             center->dispatch_event_external(EventCallbackRef(new C_handle_dispatch(async_msgr, message)));
           }
+          uint64_t message_size = current_header.front_len + current_header.middle_len + current_header.data_len;
           logger->inc(l_msgr_recv_messages);
           logger->inc(l_msgr_recv_bytes, message_size + sizeof(ceph_msg_header) + sizeof(ceph_msg_footer));
+          account_bytes(message_size + sizeof(ceph_msg_header) + sizeof(ceph_msg_footer));
 
           break;
         }
@@ -990,7 +1107,7 @@ void AsyncConnection::process()
   }
 
   if (state > STATE_OPEN_MESSAGE_THROTTLE_MESSAGE &&
-      state <= STATE_OPEN_MESSAGE_READ_FOOTER_AND_DISPATCH
+      state <= STATE_OPEN_MESSAGE_DISPATCH
       && policy.throttler_messages) {
     ldout(async_msgr->cct,10) << __func__ << " releasing " << 1
                         << " message to policy throttler "
@@ -999,14 +1116,13 @@ void AsyncConnection::process()
     policy.throttler_messages->put();
   }
   if (state > STATE_OPEN_MESSAGE_THROTTLE_BYTES &&
-      state <= STATE_OPEN_MESSAGE_READ_FOOTER_AND_DISPATCH) {
-    uint64_t message_size = current_header.front_len + current_header.middle_len + current_header.data_len;
+      state <= STATE_OPEN_MESSAGE_DISPATCH) {
     if (policy.throttler_bytes) {
-      ldout(async_msgr->cct,10) << __func__ << " releasing " << message_size
+      ldout(async_msgr->cct,10) << __func__ << " releasing " << msg_throttle_bytes
                           << " bytes to policy throttler "
                           << policy.throttler_bytes->get_current() << "/"
                           << policy.throttler_bytes->get_max() << dendl;
-      policy.throttler_bytes->put(message_size);
+      policy.throttler_bytes->put(msg_throttle_bytes);
     }
   }
   fault();
@@ -1194,7 +1310,7 @@ int AsyncConnection::_process_connection()
         }
         bufferlist bl;
 
-        connect_msg.features = policy.features_supported;
+        connect_msg.features = policy.features_supported | async_msgr->get_msgr_features();
         connect_msg.host_type = async_msgr->get_myinst().name.type();
         connect_msg.global_seq = global_seq;
         connect_msg.connect_seq = connect_seq;
@@ -1903,7 +2019,7 @@ int AsyncConnection::handle_connect_msg(ceph_msg_connect &connect, bufferlist &a
   }
 
   // send READY reply
-  reply.features = policy.features_supported;
+  reply.features = policy.features_supported | async_msgr->get_msgr_features();
   reply.global_seq = async_msgr->get_global_seq();
   reply.connect_seq = connect_seq;
   reply.flags = 0;
@@ -2032,10 +2148,6 @@ int AsyncConnection::send_message(Message *m)
    return 0;
   }
 
-  // we don't want to consider local message here, it's too lightweight which
-  // may disturb users
-  logger->inc(l_msgr_send_messages);
-
   bufferlist bl;
   uint64_t f = get_features();
 
@@ -2046,6 +2158,9 @@ int AsyncConnection::send_message(Message *m)
     prepare_send_message(f, m, bl);
 
   Mutex::Locker l(write_lock);
+  // we don't want to consider local message here, it's too lightweight which
+  // may disturb users
+  logger->inc(l_msgr_send_messages);
   // "features" changes will change the payload encoding
   if (can_fast_prepare && (can_write == NOWRITE || get_features() != f)) {
     // ensure the correctness of message encoding
@@ -2054,7 +2169,8 @@ int AsyncConnection::send_message(Message *m)
     ldout(async_msgr->cct, 5) << __func__ << " clear encoded buffer, can_write=" << can_write << " previous "
                               << f << " != " << get_features() << dendl;
   }
-  if (!is_queued() && can_write == CANWRITE) {
+  if (!async_msgr->cct->_conf->ms_async_send_coalesce &&
+      !is_queued() && can_write == CANWRITE) {
     if (!can_fast_prepare)
       prepare_send_message(get_features(), m, bl);
     if (write_message(m, bl) < 0) {
@@ -2068,8 +2184,12 @@ int AsyncConnection::send_message(Message *m)
     m->put();
   } else {
     out_q[m->get_priority()].push_back(make_pair(bl, m));
-    ldout(async_msgr->cct, 15) << __func__ << " inline write is denied, reschedule m=" << m << dendl;
-    center->dispatch_event_external(write_handler);
+    // one wakeup sends everything that queues up until the worker gets to it
+    if (!write_scheduled) {
+      ldout(async_msgr->cct, 15) << __func__ << " inline write is denied, reschedule m=" << m << dendl;
+      write_scheduled = true;
+      center->dispatch_event_external(write_handler);
+    }
   }
   return 0;
 }
@@ -2077,6 +2197,10 @@ int AsyncConnection::send_message(Message *m)
 void AsyncConnection::requeue_sent()
 {
   assert(write_lock.is_locked());
+  // it goes after whatever was sent already
+  Message *m = _cancel_compress();
+  if (m)
+    out_q[m->get_priority()].push_front(make_pair(bufferlist(), m));
   if (sent.empty())
     return;
 
@@ -2131,6 +2255,11 @@ void AsyncConnection::discard_out_queue()
     }
   out_q.clear();
   outcoming_bl.clear();
+  Message *m = _cancel_compress();
+  if (m) {
+    ldout(async_msgr->cct, 20) << __func__ << " discard " << m << dendl;
+    m->put();
+  }
 }
 
 int AsyncConnection::randomize_out_seq()
@@ -2179,6 +2308,7 @@ void AsyncConnection::fault()
   requeue_sent();
   recv_start = recv_end = 0;
   state_offset = 0;
+  decompress_gen++;
   replacing = false;
   is_reset_from_peer = false;
   outcoming_bl.clear();
@@ -2265,6 +2395,7 @@ void AsyncConnection::_stop()
   discard_out_queue();
   async_msgr->unregister_conn(this);
 
+  decompress_gen++;
   state = STATE_CLOSED;
   open_write = false;
   can_write = CLOSED;
@@ -2301,7 +2432,7 @@ void AsyncConnection::prepare_send_message(uint64_t features, Message *m, buffer
   bl.append(m->get_data());
 }
 
-int AsyncConnection::write_message(Message *m, bufferlist& bl)
+int AsyncConnection::write_message(Message *m, bufferlist& bl, bool more)
 {
   assert(can_write == CANWRITE);
   m->set_seq(out_seq.inc());
@@ -2335,13 +2466,15 @@ int AsyncConnection::write_message(Message *m, bufferlist& bl)
     }
   }
 
-  bufferlist complete_bl;
+  // framing goes straight into outcoming_bl, where this message's tag and
+  // header land next to the previous one's footer and share its iovec
+  uint64_t start_len = outcoming_bl.length();
   // send tag
   char tag = CEPH_MSGR_TAG_MSG;
-  complete_bl.append(&tag, sizeof(tag));
+  outcoming_bl.append(&tag, sizeof(tag));
 
   if (has_feature(CEPH_FEATURE_NOSRCADDR)) {
-    complete_bl.append((char*)&header, sizeof(header));
+    outcoming_bl.append((char*)&header, sizeof(header));
   } else {
     ceph_msg_header_old oldheader;
     memcpy(&oldheader, &header, sizeof(header));
@@ -2351,7 +2484,7 @@ int AsyncConnection::write_message(Message *m, bufferlist& bl)
     oldheader.reserved = header.reserved;
     oldheader.crc = ceph_crc32c(0, (unsigned char*)&oldheader,
                                 sizeof(oldheader) - sizeof(oldheader.crc));
-    complete_bl.append((char*)&oldheader, sizeof(oldheader));
+    outcoming_bl.append((char*)&oldheader, sizeof(oldheader));
   }
 
   ldout(async_msgr->cct, 20) << __func__ << " sending message type=" << header.type
@@ -2360,12 +2493,12 @@ int AsyncConnection::write_message(Message *m, bufferlist& bl)
                              << " data=" << header.data_len
                              << " off " << header.data_off << dendl;
 
-  complete_bl.claim_append(bl);
+  outcoming_bl.claim_append(bl);
 
   // send footer; if receiver doesn't support signatures, use the old footer format
   ceph_msg_footer_old old_footer;
   if (has_feature(CEPH_FEATURE_MSG_AUTH)) {
-    complete_bl.append((char*)&footer, sizeof(footer));
+    outcoming_bl.append((char*)&footer, sizeof(footer));
   } else {
     if (msgr->crcflags & MSG_CRC_HEADER) {
       old_footer.front_crc = footer.front_crc;
@@ -2376,13 +2509,23 @@ int AsyncConnection::write_message(Message *m, bufferlist& bl)
     }
     old_footer.data_crc = msgr->crcflags & MSG_CRC_DATA ? footer.data_crc : 0;
     old_footer.flags = footer.flags;
-    complete_bl.append((char*)&old_footer, sizeof(old_footer));
+    outcoming_bl.append((char*)&old_footer, sizeof(old_footer));
+  }
+
+  uint64_t len = outcoming_bl.length() - start_len;
+  logger->inc(l_msgr_send_bytes, len);
+  account_bytes(len);
+  if (more) {
+    ldout(async_msgr->cct, 20) << __func__ << " queued " << m->get_seq()
+                               << " " << m << dendl;
+    m->put();
+    return 0;
   }
 
-  logger->inc(l_msgr_send_bytes, complete_bl.length());
   ldout(async_msgr->cct, 20) << __func__ << " sending " << m->get_seq()
                              << " " << m << dendl;
-  int rc = _try_send(complete_bl);
+  bufferlist none;
+  int rc = _try_send(none);
   if (rc < 0) {
     ldout(async_msgr->cct, 1) << __func__ << " error sending " << m << ", "
                               << cpp_strerror(errno) << dendl;
@@ -2396,6 +2539,195 @@ int AsyncConnection::write_message(Message *m, bufferlist& bl)
   return rc;
 }
 
+bool AsyncConnection::_start_compress(Message *m, bufferlist &bl)
+{
+  assert(write_lock.is_locked());
+  AsyncCompressor *compressor = async_msgr->get_compressor();
+  if (!compressor || !policy.compress || !has_feature(CEPH_FEATURE_MSG_COMPRESS))
+    return false;
+
+  uint64_t min_size = MAX(async_msgr->cct->_conf->ms_async_compress_min_size, 1);
+  const ceph_msg_header& header = m->get_header();
+  uint64_t lens[3] = {header.front_len, header.middle_len, header.data_len};
+  if (lens[0] < min_size && lens[1] < min_size && lens[2] < min_size)
+    return false;
+
+  compress_msg = m;
+  compress_flags = 0;
+  uint64_t off = 0;
+  for (int i = 0; i < 3; ++i) {
+    compress_segs[i].clear();
+    if (lens[i])
+      compress_segs[i].substr_of(bl, off, lens[i]);
+    off += lens[i];
+  }
+  for (int i = 0; i < 3; ++i) {
+    if (lens[i] < min_size)
+      continue;
+    ++compress_pending;
+    compressor->async_compress(compress_segs[i], new C_compressed(this, compress_gen, i, lens[i]));
+  }
+  ldout(async_msgr->cct, 20) << __func__ << " " << m << " " << compress_pending
+                             << " segments" << dendl;
+  return true;
+}
+
+void AsyncConnection::compressed(uint64_t gen, int seg, int r, bufferlist &bl,
+                                 uint64_t raw_len, utime_t elapsed)
+{
+  Mutex::Locker l(write_lock);
+  if (gen != compress_gen) {
+    ldout(async_msgr->cct, 20) << __func__ << " drop stale segment " << seg << dendl;
+    return;
+  }
+
+  logger->inc(l_msgr_compress_raw_bytes, raw_len);
+  if (r == 0 && bl.length() < raw_len) {
+    compress_segs[seg].swap(bl);
+    compress_flags |= compress_seg_flags[seg];
+    logger->inc(l_msgr_compress_bytes, compress_segs[seg].length());
+  } else {
+    // it failed or didn't shrink, so it goes out as it is
+    ldout(async_msgr->cct, 20) << __func__ << " segment " << seg << " r=" << r
+                               << " not compressed" << dendl;
+    logger->inc(l_msgr_compress_bytes, raw_len);
+  }
+  if (r != -ECANCELED)
+    logger->tinc(l_msgr_compress_lat, elapsed);
+
+  if (--compress_pending == 0 && !write_scheduled) {
+    write_scheduled = true;
+    center->dispatch_event_external(write_handler);
+  }
+}
+
+Message *AsyncConnection::_finish_compress(bufferlist &bl)
+{
+  assert(write_lock.is_locked());
+  assert(compress_msg && !compress_pending);
+  Message *m = compress_msg;
+  compress_msg = NULL;
+  ++compress_gen;
+
+  // from here on the header and footer describe what goes on the wire
+  ceph_msg_header& header = m->get_header();
+  ceph_msg_footer& footer = m->get_footer();
+  if (compress_flags & CEPH_MSG_FOOTER_FRONT_COMPRESSED) {
+    header.front_len = compress_segs[0].length();
+    if (msgr->crcflags & MSG_CRC_HEADER)
+      footer.front_crc = compress_segs[0].crc32c(0);
+  }
+  if (compress_flags & CEPH_MSG_FOOTER_MIDDLE_COMPRESSED) {
+    header.middle_len = compress_segs[1].length();
+    if (msgr->crcflags & MSG_CRC_HEADER)
+      footer.middle_crc = compress_segs[1].crc32c(0);
+  }
+  if (compress_flags & CEPH_MSG_FOOTER_DATA_COMPRESSED) {
+    header.data_len = compress_segs[2].length();
+    if (msgr->crcflags & MSG_CRC_DATA)
+      footer.data_crc = compress_segs[2].crc32c(0);
+  }
+  footer.flags = (unsigned)footer.flags | compress_flags;
+  compress_flags = 0;
+
+  for (int i = 0; i < 3; ++i)
+    bl.claim_append(compress_segs[i]);
+  ldout(async_msgr->cct, 20) << __func__ << " " << m << " front=" << header.front_len
+                             << " middle=" << header.middle_len
+                             << " data=" << header.data_len << dendl;
+  return m;
+}
+
+Message *AsyncConnection::_cancel_compress()
+{
+  assert(write_lock.is_locked());
+  Message *m = compress_msg;
+  if (m) {
+    ldout(async_msgr->cct, 10) << __func__ << " " << m << dendl;
+    compress_msg = NULL;
+    compress_pending = 0;
+    compress_flags = 0;
+    ++compress_gen;
+    for (int i = 0; i < 3; ++i)
+      compress_segs[i].clear();
+  }
+  return m;
+}
+
+int AsyncConnection::_start_decompress()
+{
+  assert(lock.is_locked());
+  AsyncCompressor *compressor = async_msgr->get_compressor();
+  if (!compressor) {
+    ldout(async_msgr->cct, 0) << __func__ << " got a compressed message but we can't decompress"
+                              << dendl;
+    return -EINVAL;
+  }
+
+  // the crcs cover the compressed bytes
+  if (async_msgr->crcflags & MSG_CRC_HEADER &&
+      (front.crc32c(0) != current_footer.front_crc ||
+       middle.crc32c(0) != current_footer.middle_crc)) {
+    ldout(async_msgr->cct, 0) << __func__ << " bad crc in front or middle" << dendl;
+    return -EINVAL;
+  }
+  if (async_msgr->crcflags & MSG_CRC_DATA &&
+      (current_footer.flags & CEPH_MSG_FOOTER_NOCRC) == 0 &&
+      data.crc32c(0) != current_footer.data_crc) {
+    ldout(async_msgr->cct, 0) << __func__ << " bad crc in data" << dendl;
+    return -EINVAL;
+  }
+
+  bufferlist *segs[3] = {&front, &middle, &data};
+  // bound what the compressor may allocate, not just what we dispatch:
+  // each compressed segment may use what the plain ones leave over
+  uint64_t max_size = async_msgr->cct->_conf->ms_async_decompress_max_size;
+  for (int i = 0; i < 3; ++i) {
+    if (current_footer.flags & compress_seg_flags[i])
+      continue;
+    if (segs[i]->length() >= max_size) {
+      ldout(async_msgr->cct, 1) << __func__ << " message is more than "
+                                << async_msgr->cct->_conf->ms_async_decompress_max_size
+                                << " bytes decompressed" << dendl;
+      return -EINVAL;
+    }
+    max_size -= segs[i]->length();
+  }
+  decompress_pending = 0;
+  decompress_failed = false;
+  ++decompress_gen;
+  for (int i = 0; i < 3; ++i) {
+    if (!(current_footer.flags & compress_seg_flags[i]))
+      continue;
+    logger->inc(l_msgr_decompress_bytes, segs[i]->length());
+    ++decompress_pending;
+    compressor->async_decompress(*segs[i], new C_decompressed(this, decompress_gen, i),
+                                 max_size);
+  }
+  ldout(async_msgr->cct, 20) << __func__ << " " << decompress_pending << " segments" << dendl;
+  return 0;
+}
+
+void AsyncConnection::decompressed(uint64_t gen, int seg, int r, bufferlist &bl, utime_t elapsed)
+{
+  Mutex::Locker l(lock);
+  if (gen != decompress_gen) {
+    ldout(async_msgr->cct, 20) << __func__ << " drop stale segment " << seg << dendl;
+    return;
+  }
+
+  bufferlist *segs[3] = {&front, &middle, &data};
+  if (r == 0) {
+    segs[seg]->swap(bl);
+    logger->tinc(l_msgr_decompress_lat, elapsed);
+  } else {
+    ldout(async_msgr->cct, 1) << __func__ << " segment " << seg << " r=" << r << dendl;
+    decompress_failed = true;
+  }
+  if (--decompress_pending == 0)
+    center->dispatch_event_external(read_handler);
+}
+
 void AsyncConnection::handle_ack(uint64_t seq)
 {
   ldout(async_msgr->cct, 15) << __func__ << " got ack seq " << seq << dendl;
@@ -2461,23 +2793,51 @@ void AsyncConnection::handle_write()
   int r = 0;
 
   write_lock.Lock();
+  if (can_write != CLOSED && forward_to_owner(write_handler)) {
+    write_lock.Unlock();
+    return ;
+  }
+  write_scheduled = false;
   if (can_write == CANWRITE) {
     if (keepalive) {
       _send_keepalive_or_ack();
       keepalive = false;
     }
 
+    // gather messages into outcoming_bl up to the batch limits and send
+    // each batch with as few sendmsg calls as the iovecs allow
+    uint64_t batch_bytes = async_msgr->cct->_conf->ms_async_send_batch_bytes;
+    uint64_t batch_iovs = MIN(async_msgr->cct->_conf->ms_async_send_batch_iovs, IOV_MAX);
     while (1) {
-      bufferlist data;
-      Message *m = _get_next_outgoing(&data);
-      if (!m)
-        break;
+      uint64_t iovs = outcoming_bl.buffers().size();
+      while (outcoming_bl.length() < batch_bytes && iovs < batch_iovs) {
+        bufferlist data;
+        Message *m;
+        if (compress_msg) {
+          // C_compressed wakes us up again once it's ready
+          if (compress_pending)
+            break;
+          m = _finish_compress(data);
+        } else {
+          m = _get_next_outgoing(&data);
+          if (!m)
+            break;
 
-      // send_message or requeue messages may not encode message
-      if (!data.length())
-        prepare_send_message(get_features(), m, data);
+          // send_message or requeue messages may not encode message
+          if (!data.length())
+            prepare_send_message(get_features(), m, data);
+          if (_start_compress(m, data))
+            continue;
+        }
 
-      r = write_message(m, data);
+        // the payload, plus at most two for the framing
+        iovs += data.buffers().size() + 2;
+        write_message(m, data, true);
+      }
+      if (compress_pending || (out_q.empty() && !compress_msg))
+        break;
+
+      r = _try_send(bl, true, true);
       if (r < 0) {
         ldout(async_msgr->cct, 1) << __func__ << " send msg failed" << dendl;
         write_lock.Unlock();
@@ -2487,6 +2847,8 @@ void AsyncConnection::handle_write()
       }
     }
 
+    // the ack rides along with the last batch; if the socket is full
+    // already, all of it goes once it's writable again
     uint64_t left = ack_left.read();
     if (left) {
       ceph_le64 s;
@@ -2495,8 +2857,8 @@ void AsyncConnection::handle_write()
       bl.append((char*)&s, sizeof(s));
       ldout(async_msgr->cct, 10) << __func__ << " try send msg ack, acked " << left << " messages" << dendl;
       ack_left.sub(left);
-      r = _try_send(bl);
-    } else if (is_queued()) {
+      r = _try_send(bl, r == 0);
+    } else if (is_queued() && r == 0) {
       r = _try_send(bl);
     }
 
@@ -2563,3 +2925,83 @@ void AsyncConnection::local_deliver()
     write_lock.Lock();
   }
 }
+
+void AsyncConnection::account_bytes(uint64_t bytes)
+{
+  load.add(1 + bytes / Worker::LoadEventBytes);
+  center->add_bytes(bytes);
+}
+
+bool AsyncConnection::forward_to_owner(EventCallbackRef handler)
+{
+  if (center->get_owner() == pthread_self())
+    return false;
+  ldout(async_msgr->cct, 10) << __func__ << " migrated, forwarding" << dendl;
+  center->dispatch_event_external(handler);
+  return true;
+}
+
+void AsyncConnection::migrate(Worker *w)
+{
+  Mutex::Locker l(write_lock);
+  if (can_write == CLOSED)
+    return ;
+  center->dispatch_event_external(EventCallbackRef(new C_migrate(this, w)));
+}
+
+void AsyncConnection::_migrate(Worker *w)
+{
+  Mutex::Locker l(lock);
+  // anything mid-handshake or waiting on a timer stays where it is; the
+  // next rebalance can try again
+  if (w == worker || state != STATE_OPEN || sd < 0 ||
+      !register_time_events.empty()) {
+    ldout(async_msgr->cct, 10) << __func__ << " skipped, state is "
+                               << get_state_name(state) << dendl;
+    return ;
+  }
+
+  Mutex::Locker wl(write_lock);
+  ldout(async_msgr->cct, 1) << __func__ << " to " << w << dendl;
+  EventCenter *old_center = center;
+  center->delete_file_event(sd, EVENT_READABLE|EVENT_WRITABLE);
+  logger->dec(l_msgr_active_connections);
+  worker->remove_connection();
+  worker = w;
+  center = &w->center;
+  logger = w->get_perf_counter();
+  worker->add_connection();
+  logger->inc(l_msgr_active_connections);
+  logger->inc(l_msgr_migrated_connections);
+
+  // handlers other threads queued on the old center before we switched
+  // will forward themselves; they must not outlive cleanup_handler()
+  ++migrate_draining;
+  old_center->dispatch_event_external(EventCallbackRef(new C_migrate_drained(this)));
+
+  center->create_file_event(sd, EVENT_READABLE, read_handler);
+  // the socket is edge triggered, so pick up whatever arrived meanwhile
+  center->dispatch_event_external(read_handler);
+  if (is_queued())
+    center->dispatch_event_external(write_handler);
+}
+
+void AsyncConnection::migrate_drained()
+{
+  lock.Lock();
+  assert(migrate_draining > 0);
+  bool cleanup = --migrate_draining == 0 && cleanup_deferred;
+  lock.Unlock();
+  if (cleanup)
+    cleanup_handler();
+}
+
+bool AsyncConnection::can_cleanup_handler()
+{
+  Mutex::Locker l(lock);
+  if (migrate_draining) {
+    cleanup_deferred = true;
+    return false;
+  }
+  return true;
+}
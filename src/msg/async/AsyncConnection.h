@@ -35,6 +35,7 @@ using namespace std;
 #include "net_handler.h"
 
 class AsyncMessenger;
+class Worker;
 
 /*
  * AsyncConnection maintains a logic session between two endpoints. In other
@@ -55,7 +56,8 @@ class AsyncConnection : public Connection {
   }
   // if "send" is false, it will only append bl to send buffer
   // the main usage is avoid error happen outside messenger threads
-  int _try_send(bufferlist &bl, bool send=true);
+  // "more" tells the kernel that we'll send again right after
+  int _try_send(bufferlist &bl, bool send=true, bool more=false);
   int _send(Message *m);
   void prepare_send_message(uint64_t features, Message *m, bufferlist &bl);
   int read_until(uint64_t needed, char *p);
@@ -72,7 +74,22 @@ class AsyncConnection : public Connection {
   int randomize_out_seq();
   void handle_ack(uint64_t seq);
   void _send_keepalive_or_ack(bool ack=false, utime_t *t=NULL);
-  int write_message(Message *m, bufferlist& bl);
+  // "more" leaves the message in outcoming_bl for a later _try_send
+  int write_message(Message *m, bufferlist& bl, bool more=false);
+  void account_bytes(uint64_t bytes);
+  /// if the connection has migrated away from the calling thread, hand
+  /// @a handler to the new center and return true
+  bool forward_to_owner(EventCallbackRef handler);
+  /// hand the large segments of @a m to the compressor, and return true
+  /// if it took them; @a bl holds the encoded message
+  bool _start_compress(Message *m, bufferlist &bl);
+  /// the compressed message once the compressor is done with it
+  Message *_finish_compress(bufferlist &bl);
+  /// forget the message being compressed, and return it
+  Message *_cancel_compress();
+  /// check the crcs of the compressed message just read and hand its
+  /// compressed segments to the compressor
+  int _start_decompress();
   int _reply_accept(char tag, ceph_msg_connect &connect, ceph_msg_connect_reply &reply,
                     bufferlist authorizer_reply) {
     bufferlist reply_bl;
@@ -92,7 +109,7 @@ class AsyncConnection : public Connection {
   }
   bool is_queued() {
     assert(write_lock.is_locked());
-    return !out_q.empty() || outcoming_bl.length();
+    return !out_q.empty() || outcoming_bl.length() || compress_msg;
   }
   void shutdown_socket() {
     if (sd >= 0)
@@ -117,7 +134,7 @@ class AsyncConnection : public Connection {
   }
 
  public:
-  AsyncConnection(CephContext *cct, AsyncMessenger *m, EventCenter *c, PerfCounters *p);
+  AsyncConnection(CephContext *cct, AsyncMessenger *m, Worker *w);
   ~AsyncConnection();
 
   ostream& _conn_prefix(std::ostream *_dout);
@@ -159,7 +176,9 @@ class AsyncConnection : public Connection {
     STATE_OPEN_MESSAGE_READ_MIDDLE,
     STATE_OPEN_MESSAGE_READ_DATA_PREPARE,
     STATE_OPEN_MESSAGE_READ_DATA,
-    STATE_OPEN_MESSAGE_READ_FOOTER_AND_DISPATCH,
+    STATE_OPEN_MESSAGE_READ_FOOTER,
+    STATE_OPEN_MESSAGE_DECOMPRESS,
+    STATE_OPEN_MESSAGE_DISPATCH,
     STATE_OPEN_TAG_CLOSE,
     STATE_WAIT_SEND,
     STATE_CONNECTING,
@@ -196,7 +215,9 @@ class AsyncConnection : public Connection {
                                         "STATE_OPEN_MESSAGE_READ_MIDDLE",
                                         "STATE_OPEN_MESSAGE_READ_DATA_PREPARE",
                                         "STATE_OPEN_MESSAGE_READ_DATA",
-                                        "STATE_OPEN_MESSAGE_READ_FOOTER_AND_DISPATCH",
+                                        "STATE_OPEN_MESSAGE_READ_FOOTER",
+                                        "STATE_OPEN_MESSAGE_DECOMPRESS",
+                                        "STATE_OPEN_MESSAGE_DISPATCH",
                                         "STATE_OPEN_TAG_CLOSE",
                                         "STATE_WAIT_SEND",
                                         "STATE_CONNECTING",
@@ -244,6 +265,14 @@ class AsyncConnection : public Connection {
   list<Message*> local_messages;    // local deliver
   bufferlist outcoming_bl;
   bool keepalive;
+  bool write_scheduled;  ///< write_handler is dispatched and hasn't run yet
+  // the next message to send, held back while the compressor works on its
+  // front, middle and data; see _start_compress()
+  Message *compress_msg;
+  bufferlist compress_segs[3];
+  int compress_pending;   ///< segments still with the compressor
+  int compress_flags;     ///< CEPH_MSG_FOOTER_*_COMPRESSED of the segments that shrank
+  uint64_t compress_gen;  ///< bumped when compress_msg goes, to ignore stale results
 
   Mutex lock;
   utime_t backoff;         // backoff time
@@ -266,11 +295,18 @@ class AsyncConnection : public Connection {
   // Open state
   utime_t recv_stamp;
   utime_t throttle_stamp;
+  uint64_t msg_throttle_bytes;  ///< taken from policy.throttler_bytes for the message we read
   uint64_t msg_left;
   ceph_msg_header current_header;
+  ceph_msg_footer current_footer;
   bufferlist data_buf;
   bufferlist::iterator data_blp;
   bufferlist front, middle, data;
+  // segments with the decompressor, under lock like the rest of the read
+  // side; see _start_decompress()
+  int decompress_pending;
+  bool decompress_failed;
+  uint64_t decompress_gen;
   ceph_msg_connect connect_msg;
   // Connecting state
   bool got_bad_auth;
@@ -293,7 +329,15 @@ class AsyncConnection : public Connection {
   // used only by "read_until"
   uint64_t state_offset;
   NetHandler net;
+  // the worker whose thread drives us; changed by _migrate() only, under
+  // both lock and write_lock
+  Worker *worker;
   EventCenter *center;
+  // old centers that may still hold our handlers, see _migrate()
+  int migrate_draining;
+  bool cleanup_deferred;
+  atomic64_t load;      ///< events, plus bytes in Worker::LoadEventBytes units
+  uint64_t balance_load;  ///< load at the last take_balance_load()
   ceph::shared_ptr<AuthSessionHandler> session_security;
 
 #if !defined(MSG_NOSIGNAL) && !defined(SO_NOSIGPIPE)
@@ -306,8 +350,13 @@ class AsyncConnection : public Connection {
   // used by eventcallback
   void handle_write();
   void process();
+  void compressed(uint64_t gen, int seg, int r, bufferlist &bl, uint64_t raw_len, utime_t elapsed);
+  void decompressed(uint64_t gen, int seg, int r, bufferlist &bl, utime_t elapsed);
   void wakeup_from(uint64_t id);
   void local_deliver();
+  void _migrate(Worker *w);
+  void migrate_drained();
+  bool can_cleanup_handler();
   void stop() {
     lock.Lock();
     if (state != STATE_CLOSED)
@@ -327,6 +376,23 @@ class AsyncConnection : public Connection {
   PerfCounters *get_perf_counter() {
     return logger;
   }
+  Worker *get_worker() {
+    Mutex::Locker l(lock);
+    return worker;
+  }
+  /// load since the previous call; AsyncMessenger calls it under its lock
+  uint64_t take_balance_load() {
+    uint64_t cur = load.read();
+    uint64_t delta = cur - balance_load;
+    balance_load = cur;
+    return delta;
+  }
+  /**
+   * Move a registered connection onto @a w's event loop. It happens later,
+   * on the current worker's thread, and only if the connection is open
+   * then; otherwise it stays where it is.
+   */
+  void migrate(Worker *w);
 }; /* AsyncConnection */
 
 typedef boost::intrusive_ptr<AsyncConnection> AsyncConnectionRef;
@@ -287,6 +287,7 @@ void *Worker::entry()
   }
 
   center.set_owner(pthread_self());
+  center.create_time_event(LoadUpdateUs, update_load_handler);
   while (!done) {
     ldout(cct, 20) << __func__ << " calling event process" << dendl;
 
@@ -301,6 +302,15 @@ void *Worker::entry()
   return 0;
 }
 
+void Worker::update_load()
+{
+  center.update_load(ceph_clock_now(cct));
+  perf_logger->set(l_msgr_connections, num_connections.read());
+  perf_logger->set(l_msgr_load_events, center.get_event_rate());
+  perf_logger->set(l_msgr_load_bytes, center.get_byte_rate());
+  center.create_time_event(LoadUpdateUs, update_load_handler);
+}
+
 /*******************
  * WorkerPool
  *******************/
@@ -350,6 +360,61 @@ void WorkerPool::start()
   }
 }
 
+Worker *WorkerPool::get_worker()
+{
+  uint64_t start = seq++;
+  if (!cct->_conf->ms_async_worker_balance)
+    return workers[start % workers.size()];
+
+  // a connection that has not done anything yet still costs its share
+  // of the load, or an idle pool would hand all of them to one worker
+  uint64_t total_load = 0, total_conns = 0;
+  for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+    total_load += (*it)->get_load();
+    total_conns += (*it)->get_num_connections();
+  }
+  uint64_t per_conn = MAX(1, total_conns ? total_load / total_conns : 0);
+
+  // start after the last pick so that ties rotate
+  Worker *best = NULL;
+  uint64_t best_load = 0;
+  for (uint64_t i = 0; i < workers.size(); ++i) {
+    Worker *w = workers[(start + i) % workers.size()];
+    uint64_t load = w->get_load() + w->get_num_connections() * per_conn;
+    if (!best || load < best_load) {
+      best = w;
+      best_load = load;
+    }
+  }
+  ldout(cct, 20) << __func__ << " " << best << " load " << best_load << dendl;
+  return best;
+}
+
+bool WorkerPool::get_imbalance(Worker **busiest, Worker **idlest)
+{
+  uint64_t total = 0, max_load = 0, min_load = 0;
+  *busiest = *idlest = NULL;
+  for (vector<Worker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+    uint64_t load = (*it)->get_load();
+    total += load;
+    if (!*busiest || load > max_load) {
+      *busiest = *it;
+      max_load = load;
+    }
+    if (!*idlest || load < min_load) {
+      *idlest = *it;
+      min_load = load;
+    }
+  }
+  if (*busiest == *idlest)
+    return false;
+  double average = (double)total / workers.size();
+  ldout(cct, 10) << __func__ << " busiest " << *busiest << " load " << max_load
+                 << ", idlest " << *idlest << " load " << min_load
+                 << ", average " << average << dendl;
+  return max_load > cct->_conf->ms_async_rebalance_ratio * average;
+}
+
 void WorkerPool::barrier()
 {
   ldout(cct, 10) << __func__ << " started." << dendl;
@@ -379,12 +444,15 @@ AsyncMessenger::AsyncMessenger(CephContext *cct, entity_name_t name,
     lock("AsyncMessenger::lock"),
     nonce(_nonce), need_addr(true), listen_sd(-1), did_bind(false),
     global_seq(0), deleted_lock("AsyncMessenger::deleted_lock"),
-    cluster_protocol(0), stopped(true)
+    cluster_protocol(0), compressor(NULL), stopped(true)
 {
+  rebalance_handler = new C_rebalance(this);
+  rebalance_worker = NULL;
+  rebalance_event = 0;
   ceph_spin_init(&global_seq_lock);
   cct->lookup_or_create_singleton_object<WorkerPool>(pool, WorkerPool::name);
   Worker *w = pool->get_worker();
-  local_connection = new AsyncConnection(cct, this, &w->center, w->get_perf_counter());
+  local_connection = new AsyncConnection(cct, this, w);
   local_features = features;
   init_local_connection();
 }
@@ -397,6 +465,7 @@ AsyncMessenger::~AsyncMessenger()
 {
   assert(!did_bind); // either we didn't bind or we shut down the Processor
   local_connection->mark_down();
+  delete rebalance_handler;
 }
 
 void AsyncMessenger::ready()
@@ -406,6 +475,11 @@ void AsyncMessenger::ready()
   Mutex::Locker l(lock);
   Worker *w = pool->get_worker();
   processor.start(w);
+  double interval = cct->_conf->ms_async_rebalance_interval;
+  if (interval > 0 && !rebalance_worker) {
+    rebalance_worker = w;
+    rebalance_event = w->center.create_time_event(interval * 1000000, rebalance_handler);
+  }
 }
 
 int AsyncMessenger::shutdown()
@@ -414,8 +488,15 @@ int AsyncMessenger::shutdown()
 
   // break ref cycles on the loopback connection
   processor.stop();
+  lock.Lock();
+  if (rebalance_worker) {
+    rebalance_worker->center.delete_time_event(rebalance_event);
+    rebalance_worker = NULL;
+  }
+  lock.Unlock();
   mark_down_all();
   local_connection->set_priv(NULL);
+  // also waits out a rebalance() that is already running
   pool->barrier();
   lock.Lock();
   stop_cond.Signal();
@@ -511,7 +592,7 @@ AsyncConnectionRef AsyncMessenger::add_accept(int sd)
 {
   lock.Lock();
   Worker *w = pool->get_worker();
-  AsyncConnectionRef conn = new AsyncConnection(cct, this, &w->center, w->get_perf_counter());
+  AsyncConnectionRef conn = new AsyncConnection(cct, this, w);
   conn->accept(sd);
   accepting_conns.insert(conn);
   lock.Unlock();
@@ -528,7 +609,7 @@ AsyncConnectionRef AsyncMessenger::create_connect(const entity_addr_t& addr, int
 
   // create connection
   Worker *w = pool->get_worker();
-  AsyncConnectionRef conn = new AsyncConnection(cct, this, &w->center, w->get_perf_counter());
+  AsyncConnectionRef conn = new AsyncConnection(cct, this, w);
   conn->connect(addr, type);
   assert(!conns.count(addr));
   conns[addr] = conn;
@@ -636,6 +717,53 @@ void AsyncMessenger::set_addr_unknowns(entity_addr_t &addr)
   }
 }
 
+void AsyncMessenger::rebalance()
+{
+  Mutex::Locker l(lock);
+  if (!rebalance_worker)
+    return ;
+  double interval = cct->_conf->ms_async_rebalance_interval;
+  if (interval <= 0) {
+    ldout(cct, 1) << __func__ << " disabled" << dendl;
+    rebalance_worker = NULL;
+    return ;
+  }
+  rebalance_event = rebalance_worker->center.create_time_event(interval * 1000000, rebalance_handler);
+
+  Worker *busiest, *idlest;
+  bool imbalanced = pool->get_imbalance(&busiest, &idlest);
+  uint64_t busiest_load = busiest->get_load(), idlest_load = idlest->get_load();
+  uint64_t gap = busiest_load > idlest_load ? busiest_load - idlest_load : 0;
+
+  // moving a connection with load rate r leaves the pair at (busiest - r,
+  // idlest + r), so the best one to move is the closest to half the gap
+  AsyncConnectionRef victim;
+  uint64_t victim_score = 0;
+  int on_busiest = 0;
+  for (ceph::unordered_map<entity_addr_t, AsyncConnectionRef>::iterator it = conns.begin();
+       it != conns.end(); ++it) {
+    // always taken, so that each sample covers one interval
+    uint64_t rate = it->second->take_balance_load() / interval;
+    if (!imbalanced || it->second->get_worker() != busiest)
+      continue;
+    ++on_busiest;
+    if (!rate || rate >= gap)
+      continue;
+    uint64_t score = 2 * rate > gap ? 2 * rate - gap : gap - 2 * rate;
+    if (!victim || score < victim_score) {
+      victim = it->second;
+      victim_score = score;
+    }
+  }
+  // a worker with a single hot connection is as balanced as it gets
+  if (victim && on_busiest > 1) {
+    ldout(cct, 1) << __func__ << " moving " << victim << " from " << busiest
+                  << " (load " << busiest_load << ") to " << idlest
+                  << " (load " << idlest_load << ")" << dendl;
+    victim->migrate(idlest);
+  }
+}
+
 int AsyncMessenger::send_keepalive(Connection *con)
 {
   con->send_keepalive();
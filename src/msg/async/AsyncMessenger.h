@@ -36,6 +36,7 @@ using namespace std;
 #include "include/assert.h"
 #include "AsyncConnection.h"
 #include "Event.h"
+#include "RxBufferPool.h"
 
 
 class AsyncMessenger;
@@ -49,6 +50,17 @@ enum {
   l_msgr_send_bytes,
   l_msgr_created_connections,
   l_msgr_active_connections,
+  l_msgr_connections,
+  l_msgr_load_events,
+  l_msgr_load_bytes,
+  l_msgr_migrated_connections,
+  l_msgr_recv_copies,
+  l_msgr_send_syscalls,
+  l_msgr_compress_raw_bytes,
+  l_msgr_compress_bytes,
+  l_msgr_compress_lat,
+  l_msgr_decompress_bytes,
+  l_msgr_decompress_lat,
   l_msgr_last,
 };
 
@@ -56,16 +68,38 @@ enum {
 class Worker : public Thread {
   static const uint64_t InitEventNumber = 5000;
   static const uint64_t EventMaxWaitUs = 30000000;
+  static const uint64_t LoadUpdateUs = 1000000;
   CephContext *cct;
   WorkerPool *pool;
   bool done;
   int id;
   PerfCounters *perf_logger;
+  atomic_t num_connections;
+  RxBufferPool *rx_buffers;
+
+  class C_update_load : public EventCallback {
+    Worker *worker;
+   public:
+    C_update_load(Worker *w): worker(w) {}
+    void do_request(int id) {
+      worker->update_load();
+    }
+  };
+  EventCallbackRef update_load_handler;
+  void update_load();
 
  public:
+  /// bytes moved that weigh as much as one event in get_load()
+  static const uint64_t LoadEventBytes = 4096;
+
   EventCenter center;
   Worker(CephContext *c, WorkerPool *p, int i)
-    : cct(c), pool(p), done(false), id(i), perf_logger(NULL), center(c) {
+    : cct(c), pool(p), done(false), id(i), perf_logger(NULL),
+      num_connections(0),
+      rx_buffers(new RxBufferPool(c, c->_conf->ms_async_rx_buffer_max,
+                                  c->_conf->ms_async_rx_buffer_cache)),
+      update_load_handler(new C_update_load(this)),
+      center(c) {
     center.init(InitEventNumber);
     char name[128];
     sprintf(name, "AsyncMessenger::Worker-%d", id);
@@ -78,6 +112,17 @@ class Worker : public Thread {
     plb.add_u64_counter(l_msgr_send_bytes, "msgr_send_bytes", "Network received bytes");
     plb.add_u64_counter(l_msgr_created_connections, "msgr_active_connections", "Active connection number");
     plb.add_u64_counter(l_msgr_active_connections, "msgr_created_connections", "Created connection number");
+    plb.add_u64(l_msgr_connections, "msgr_connections", "Connections driven by this worker");
+    plb.add_u64(l_msgr_load_events, "msgr_load_events", "Events per second handled by this worker");
+    plb.add_u64(l_msgr_load_bytes, "msgr_load_bytes", "Bytes per second moved by this worker");
+    plb.add_u64_counter(l_msgr_migrated_connections, "msgr_migrated_connections", "Connections migrated to this worker");
+    plb.add_u64_counter(l_msgr_recv_copies, "msgr_recv_copies", "Message segments copied out of the read-ahead buffer");
+    plb.add_u64_counter(l_msgr_send_syscalls, "msgr_send_syscalls", "Network send syscalls");
+    plb.add_u64_counter(l_msgr_compress_raw_bytes, "msgr_compress_raw_bytes", "Message bytes handed to the compressor");
+    plb.add_u64_counter(l_msgr_compress_bytes, "msgr_compress_bytes", "Bytes sent in place of msgr_compress_raw_bytes");
+    plb.add_time_avg(l_msgr_compress_lat, "msgr_compress_lat", "Compressor time per message segment");
+    plb.add_u64_counter(l_msgr_decompress_bytes, "msgr_decompress_bytes", "Compressed message bytes received");
+    plb.add_time_avg(l_msgr_decompress_lat, "msgr_decompress_lat", "Decompressor time per message segment");
 
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
@@ -87,10 +132,21 @@ class Worker : public Thread {
       cct->get_perfcounters_collection()->remove(perf_logger);
       delete perf_logger;
     }
+    delete update_load_handler;
+    rx_buffers->release();
   }
   void *entry();
   void stop();
   PerfCounters *get_perf_counter() { return perf_logger; }
+
+  void add_connection() { num_connections.inc(); }
+  void remove_connection() { num_connections.dec(); }
+  int get_num_connections() { return num_connections.read(); }
+  RxBufferPool *get_rx_buffers() { return rx_buffers; }
+  /// events/s plus bytes/s in LoadEventBytes units, updated every second
+  uint64_t get_load() {
+    return center.get_event_rate() + center.get_byte_rate() / LoadEventBytes;
+  }
 };
 
 /**
@@ -156,9 +212,16 @@ class WorkerPool {
   WorkerPool(CephContext *c);
   virtual ~WorkerPool();
   void start();
-  Worker *get_worker() {
-    return workers[(seq++)%workers.size()];
-  }
+  /// the worker a new connection should go to
+  Worker *get_worker();
+  /**
+   * Find the busiest and the idlest worker.
+   *
+   * @return true if the busiest one carries more than
+   * ms_async_rebalance_ratio times the average load
+   */
+  bool get_imbalance(Worker **busiest, Worker **idlest);
+  const vector<Worker*>& get_workers() const { return workers; }
   int get_cpuid(int id) {
     if (coreids.empty())
       return -1;
@@ -219,6 +282,11 @@ public:
     cluster_protocol = p;
   }
 
+  void set_compressor(AsyncCompressor *c) {
+    assert(!started);
+    compressor = c;
+  }
+
   int bind(const entity_addr_t& bind_addr);
   int rebind(const set<int>& avoid_ports);
 
@@ -265,7 +333,7 @@ public:
   Connection *create_anon_connection() {
     Mutex::Locker l(lock);
     Worker *w = pool->get_worker();
-    return new AsyncConnection(cct, this, &w->center, w->get_perf_counter());
+    return new AsyncConnection(cct, this, w);
   }
 
   /**
@@ -320,9 +388,28 @@ private:
 
   int _send_message(Message *m, const entity_inst_t& dest);
 
+  /**
+   * Move one of our connections off the busiest worker if the pool is out
+   * of balance. Runs every ms_async_rebalance_interval seconds.
+   */
+  void rebalance();
+
  private:
   WorkerPool *pool;
 
+  class C_rebalance : public EventCallback {
+    AsyncMessenger *msgr;
+   public:
+    C_rebalance(AsyncMessenger *m): msgr(m) {}
+    void do_request(int id) {
+      msgr->rebalance();
+    }
+  };
+  EventCallbackRef rebalance_handler;
+  /// the worker our rebalance timer runs on, NULL if it's not armed
+  Worker *rebalance_worker;
+  uint64_t rebalance_event;
+
   Processor processor;
   friend class Processor;
 
@@ -385,6 +472,9 @@ private:
   /// internal cluster protocol version, if any, for talking to entities of the same type.
   int cluster_protocol;
 
+  /// (de)compresses messages for peers with CEPH_FEATURE_MSG_COMPRESS; may be NULL
+  AsyncCompressor *compressor;
+
   Cond  stop_cond;
   bool stopped;
 
@@ -492,6 +582,17 @@ public:
    */
   int get_proto_version(int peer_type, bool connect);
 
+  AsyncCompressor *get_compressor() {
+    return compressor;
+  }
+  /**
+   * Get the features we offer on every connection on top of the policy's
+   * features_supported.
+   */
+  uint64_t get_msgr_features() {
+    return compressor ? CEPH_FEATURE_MSG_COMPRESS : 0;
+  }
+
   /**
    * Fill in the address and peer type for the local connection, which
    * is used for delivering messages back to ourself.
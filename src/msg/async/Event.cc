@@ -402,6 +402,7 @@ int EventCenter::process_events(int timeout_microseconds)
 
   if (trigger_time)
     numevents += process_time_events();
+  event_count += numevents;
 
   external_lock.Lock();
   if (external_events.empty()) {
@@ -410,6 +411,7 @@ int EventCenter::process_events(int timeout_microseconds)
     deque<EventCallbackRef> cur_process;
     cur_process.swap(external_events);
     external_lock.Unlock();
+    event_count += cur_process.size();
     while (!cur_process.empty()) {
       EventCallbackRef e = cur_process.front();
       if (e)
@@ -420,6 +422,23 @@ int EventCenter::process_events(int timeout_microseconds)
   return numevents;
 }
 
+void EventCenter::update_load(utime_t now)
+{
+  uint64_t bytes = byte_count.read();
+  if (last_load_update != utime_t() && now > last_load_update) {
+    double elapsed = now - last_load_update;
+    uint64_t events_per_sec = (event_count - last_event_count) / elapsed;
+    uint64_t bytes_per_sec = (bytes - last_byte_count) / elapsed;
+    event_rate.set((event_rate.read() + events_per_sec) / 2);
+    byte_rate.set((byte_rate.read() + bytes_per_sec) / 2);
+    ldout(cct, 20) << __func__ << " " << event_rate.read() << " events/s "
+                   << byte_rate.read() << " bytes/s" << dendl;
+  }
+  last_load_update = now;
+  last_event_count = event_count;
+  last_byte_count = bytes;
+}
+
 void EventCenter::dispatch_event_external(EventCallbackRef e)
 {
   external_lock.Lock();
@@ -115,6 +115,13 @@ class EventCenter {
   NetHandler net;
   pthread_t owner;
 
+  // load, see update_load()
+  uint64_t event_count;       ///< events processed, by the owner only
+  atomic64_t byte_count;      ///< bytes moved by our connections
+  uint64_t last_event_count, last_byte_count;
+  utime_t last_load_update;
+  atomic64_t event_rate, byte_rate;
+
   int process_time_events();
   FileEvent *_get_file_event(int fd) {
     assert(fd < nevent);
@@ -134,7 +141,9 @@ class EventCenter {
     time_lock("AsyncMessenger::time_lock"),
     file_events(NULL),
     driver(NULL), time_event_next_id(0),
-    notify_receive_fd(-1), notify_send_fd(-1), net(c), owner(0), already_wakeup(0) {
+    notify_receive_fd(-1), notify_send_fd(-1), net(c), owner(0),
+    event_count(0), byte_count(0), last_event_count(0), last_byte_count(0),
+    event_rate(0), byte_rate(0), already_wakeup(0) {
     last_time = time(NULL);
   }
   ~EventCenter();
@@ -154,6 +163,23 @@ class EventCenter {
 
   // Used by external thread
   void dispatch_event_external(EventCallbackRef e);
+
+  /// count bytes sent or received by a connection driven by this center
+  void add_bytes(uint64_t bytes) {
+    byte_count.add(bytes);
+  }
+  /**
+   * Fold the events and bytes since the last call into the per-second
+   * rates, which halve the weight of older samples on every call.
+   * Called periodically by the owner.
+   */
+  void update_load(utime_t now);
+  uint64_t get_event_rate() {
+    return event_rate.read();
+  }
+  uint64_t get_byte_rate() {
+    return byte_rate.read();
+  }
 };
 
 #endif
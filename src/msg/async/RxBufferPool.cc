@@ -0,0 +1,98 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+
+#include "RxBufferPool.h"
+#include "common/debug.h"
+#include "include/page.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "RxBufferPool "
+
+RxBufferPool::RxBufferPool(CephContext *c, unsigned max_size, uint64_t max_free)
+  : cct(c), free_bytes(0), max_free_bytes(max_free), nref(1)
+{
+  ceph_spin_init(&lock);
+  // a quarter more each step, in whole pages, so that rounding up wastes
+  // at most a page or a fifth of the buffer, whichever is more
+  for (unsigned size = CEPH_PAGE_SIZE; size <= max_size; ) {
+    sizes.push_back(size);
+    size += MAX(CEPH_PAGE_SIZE, (size / 4) & CEPH_PAGE_MASK);
+  }
+  free_buffers.resize(sizes.size());
+}
+
+RxBufferPool::~RxBufferPool()
+{
+  for (vector<vector<char*> >::iterator it = free_buffers.begin();
+       it != free_buffers.end(); ++it)
+    for (vector<char*>::iterator p = it->begin(); p != it->end(); ++p)
+      ::free(*p);
+  ceph_spin_destroy(&lock);
+}
+
+bufferptr RxBufferPool::get(unsigned len, unsigned off)
+{
+  unsigned head = off & ~CEPH_PAGE_MASK;
+  unsigned need = head + len;
+  if (len < CEPH_PAGE_SIZE) {
+    // not worth a page
+    return buffer::create(len);
+  }
+
+  vector<unsigned>::iterator it = std::lower_bound(sizes.begin(), sizes.end(), need);
+  if (it == sizes.end()) {
+    ldout(cct, 20) << __func__ << " " << need << " bytes is more than we pool" << dendl;
+    bufferptr bp = buffer::create_page_aligned((need + CEPH_PAGE_SIZE - 1) & CEPH_PAGE_MASK);
+    bp.set_offset(head);
+    bp.set_length(len);
+    return bp;
+  }
+
+  unsigned size = *it;
+  unsigned idx = it - sizes.begin();
+  char *buf = NULL;
+  ceph_spin_lock(&lock);
+  if (!free_buffers[idx].empty()) {
+    buf = free_buffers[idx].back();
+    free_buffers[idx].pop_back();
+    free_bytes -= size;
+  }
+  ceph_spin_unlock(&lock);
+  if (!buf && ::posix_memalign((void**)&buf, CEPH_PAGE_SIZE, size))
+    throw std::bad_alloc();
+
+  nref.inc();
+  bufferptr bp(buffer::claim_pooled(size, buf, this));
+  bp.set_offset(head);
+  bp.set_length(len);
+  return bp;
+}
+
+void RxBufferPool::put(char *buf, unsigned len)
+{
+  unsigned idx = std::lower_bound(sizes.begin(), sizes.end(), len) - sizes.begin();
+  assert(idx < sizes.size() && sizes[idx] == len);
+  ceph_spin_lock(&lock);
+  if (free_bytes + len <= max_free_bytes) {
+    free_buffers[idx].push_back(buf);
+    free_bytes += len;
+    buf = NULL;
+  }
+  ceph_spin_unlock(&lock);
+  if (buf)
+    ::free(buf);
+  drop();
+}
@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*- 
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_RXBUFFERPOOL_H
+#define CEPH_MSG_RXBUFFERPOOL_H
+
+#include "include/types.h"
+#include "include/atomic.h"
+#include "include/Spinlock.h"
+
+class CephContext;
+
+/*
+ * RxBufferPool keeps page aligned buffers, in size classes, that an
+ * AsyncConnection reads message data straight into. Each Worker owns one.
+ * Buffers are taken on the worker's thread but come back from whichever
+ * thread drops the last reference, so the free lists are locked. The pool
+ * goes away once its worker and every buffer it handed out are gone.
+ */
+class RxBufferPool : public buffer::pool {
+  CephContext *cct;
+  vector<unsigned> sizes;                 ///< size of each class, ascending
+  ceph_spinlock_t lock;
+  vector<vector<char*> > free_buffers;    ///< per class
+  uint64_t free_bytes;
+  uint64_t max_free_bytes;
+  atomic_t nref;    ///< the owner, plus one per buffer out
+
+  ~RxBufferPool();
+  void drop() {
+    if (nref.dec() == 0)
+      delete this;
+  }
+
+ public:
+  /**
+   * @param max_size the largest class; bigger buffers aren't pooled
+   * @param max_free bytes of free buffers to keep for reuse
+   */
+  RxBufferPool(CephContext *c, unsigned max_size, uint64_t max_free);
+
+  /**
+   * A single buffer for @a len bytes of data that belong at offset @a off
+   * of an object. Page boundaries in the object fall on page boundaries in
+   * memory, so the data can go to disk without being copied or realigned.
+   */
+  bufferptr get(unsigned len, unsigned off);
+  void put(char *buf, unsigned len);
+  /// the owner's delete
+  void release() {
+    drop();
+  }
+};
+
+#endif
@@ -20,8 +20,7 @@
 #include "include/memory.h"
 #include "kv/KeyValueDB.h"
 #include "common/hobject.h"
-
-class SequencerPosition;
+#include "os/filestore/SequencerPosition.h"
 
 /**
  * Encapsulates the FileStore key value store
@@ -124,6 +123,54 @@ public:
     ) = 0;
 
 
+  /// One update in a run applied by apply_updates
+  struct Update {
+    enum {
+      SET_KEYS,
+      RM_KEYS,
+      SET_HEADER,
+    } type;
+    map<string, bufferlist> to_set;     ///< SET_KEYS
+    set<string> to_rm;                  ///< RM_KEYS
+    bufferlist header;                  ///< SET_HEADER
+    SequencerPosition spos;             ///< position of the op in the journal
+    Update(const SequencerPosition &spos) : type(SET_KEYS), spos(spos) {}
+  };
+
+  /**
+   * Apply a run of updates to the omap of one object, in order
+   *
+   * Implementations may apply the whole run in one store transaction;
+   * the default just applies one update at a time.  Removing keys from
+   * an object without a map is not an error.
+   */
+  virtual int apply_updates(
+    const ghobject_t &oid,              ///< [in] object containing map
+    const list<Update> &updates         ///< [in] updates to apply
+    ) {
+    for (list<Update>::const_iterator p = updates.begin();
+	 p != updates.end();
+	 ++p) {
+      int r = 0;
+      switch (p->type) {
+      case Update::SET_KEYS:
+	r = set_keys(oid, p->to_set, &p->spos);
+	break;
+      case Update::RM_KEYS:
+	r = rm_keys(oid, p->to_rm, &p->spos);
+	if (r == -ENOENT)
+	  r = 0;
+	break;
+      case Update::SET_HEADER:
+	r = set_header(oid, p->header, &p->spos);
+	break;
+      }
+      if (r < 0)
+	return r;
+    }
+    return 0;
+  }
+
   /// Clone keys efficiently from oid map to target map
   virtual int clone(
     const ghobject_t &oid,             ///< [in] object containing map
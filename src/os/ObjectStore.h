@@ -440,6 +440,128 @@ public:
     } __attribute__ ((packed)) ;
 
   private:
+    /**
+     * Ids of the collections or objects the ops name, in id order.
+     *
+     * Transactions name a handful of them, so lookups scan the vector
+     * until it passes LINEAR_MAX entries and only then build a map.
+     * Encodes as the map<T, __le32> of value to id that older versions
+     * kept, and remembers its encoded size once measured.
+     */
+    template <typename T, typename Compare>
+    class Index {
+      static const unsigned LINEAR_MAX = 8;
+
+      vector<T> items;
+      map<T, __le32, Compare> lookup;   ///< empty until past LINEAR_MAX
+      mutable unsigned measured;        ///< items counted in bytes
+      mutable uint64_t bytes;           ///< encoded size of those items
+
+    public:
+      Index() : measured(0), bytes(sizeof(__u32)) {}
+
+      __le32 get_id(const T& v) {
+	if (lookup.empty()) {
+	  for (unsigned i = 0; i < items.size(); ++i)
+	    if (items[i] == v)
+	      return i;
+	} else {
+	  typename map<T, __le32, Compare>::iterator p = lookup.find(v);
+	  if (p != lookup.end())
+	    return p->second;
+	}
+	__le32 id = items.size();
+	items.push_back(v);
+	if (!lookup.empty()) {
+	  lookup[v] = id;
+	} else if (items.size() > LINEAR_MAX) {
+	  for (unsigned i = 0; i < items.size(); ++i)
+	    lookup[items[i]] = i;
+	}
+	return id;
+      }
+      /// ids here for each of other's items, adding those we lack;
+      /// true if every item keeps the id it had in other
+      bool merge(const Index& other, vector<__le32> *ids) {
+	bool same = true;
+	bool was_empty = items.empty();
+	ids->resize(other.items.size());
+	for (unsigned i = 0; i < other.items.size(); ++i) {
+	  (*ids)[i] = get_id(other.items[i]);
+	  same = same && (*ids)[i] == i;
+	}
+	if (was_empty) {
+	  measured = other.measured;
+	  bytes = other.bytes;
+	}
+	return same;
+      }
+      /// whether get_encoded_bytes() is known without encoding anything
+      bool is_measured() const {
+	return measured == items.size();
+      }
+      vector<T>& get_items() {
+	return items;
+      }
+      size_t size() const {
+	return items.size();
+      }
+      bool empty() const {
+	return items.empty();
+      }
+      void swap(Index& other) {
+	items.swap(other.items);
+	lookup.swap(other.lookup);
+	std::swap(measured, other.measured);
+	std::swap(bytes, other.bytes);
+      }
+
+      /// size of encode(), measuring only the items added since last time
+      uint64_t get_encoded_bytes() const {
+	if (measured < items.size()) {
+	  bufferlist bl;
+	  for (; measured < items.size(); ++measured)
+	    ::encode(items[measured], bl);
+	  bytes += bl.length();
+	}
+	return bytes + sizeof(__le32) * items.size();
+      }
+      void encode(bufferlist& bl) const {
+	unsigned start = bl.length();
+	__u32 n = items.size();
+	::encode(n, bl);
+	for (__u32 i = 0; i < n; ++i) {
+	  ::encode(items[i], bl);
+	  __le32 id = i;
+	  ::encode(id, bl);
+	}
+	measured = n;
+	bytes = bl.length() - start - sizeof(__le32) * n;
+      }
+      void decode(bufferlist::iterator& p) {
+	unsigned start = p.get_off();
+	__u32 n;
+	::decode(n, p);
+	items.clear();
+	lookup.clear();
+	items.resize(n);
+	for (__u32 i = 0; i < n; ++i) {
+	  T v;
+	  __le32 id;
+	  ::decode(v, p);
+	  ::decode(id, p);
+	  assert(id < n);
+	  items[id] = v;
+	}
+	if (n > LINEAR_MAX) {
+	  for (unsigned i = 0; i < n; ++i)
+	    lookup[items[i]] = i;
+	}
+	measured = n;
+	bytes = p.get_off() - start - sizeof(__le32) * n;
+      }
+    };
+
     TransactionData data;
 
     void *osr; // NULL on replay
@@ -447,11 +569,8 @@ public:
     bool use_tbl;   //use_tbl for encode/decode
     bufferlist tbl;
 
-    map<coll_t, __le32> coll_index;
-    map<ghobject_t, __le32, ghobject_t::BitwiseComparator> object_index;
-
-    __le32 coll_id;
-    __le32 object_id;
+    Index<coll_t, std::less<coll_t> > coll_index;
+    Index<ghobject_t, ghobject_t::BitwiseComparator> object_index;
 
     bufferlist data_bl;
     bufferlist op_bl;
@@ -539,10 +658,8 @@ public:
       std::swap(use_tbl, other.use_tbl);
       tbl.swap(other.tbl);
 
-      std::swap(coll_index, other.coll_index);
-      std::swap(object_index, other.object_index);
-      std::swap(coll_id, other.coll_id);
-      std::swap(object_id, other.object_id);
+      coll_index.swap(other.coll_index);
+      object_index.swap(other.object_index);
       op_bl.swap(other.op_bl);
       data_bl.swap(other.data_bl);
     }
@@ -665,37 +782,31 @@ public:
       on_applied_sync.splice(on_applied_sync.end(), other.on_applied_sync);
 
       //append coll_index & object_index
-      vector<__le32> cm(other.coll_index.size());
-      map<coll_t, __le32>::iterator coll_index_p;
-      for (coll_index_p = other.coll_index.begin();
-           coll_index_p != other.coll_index.end();
-           ++coll_index_p) {
-        cm[coll_index_p->second] = _get_coll_id(coll_index_p->first);
-      }
-
-      vector<__le32> om(other.object_index.size());
-      map<ghobject_t, __le32, ghobject_t::BitwiseComparator>::iterator object_index_p;
-      for (object_index_p = other.object_index.begin();
-           object_index_p != other.object_index.end();
-           ++object_index_p) {
-        om[object_index_p->second] = _get_object_id(object_index_p->first);
-      }      
-
-      //the other.op_bl SHOULD NOT be changes during append operation,
-      //we use additional bufferlist to avoid this problem
-      bufferptr other_op_bl_ptr(other.op_bl.length());
-      other.op_bl.copy(0, other.op_bl.length(), other_op_bl_ptr.c_str());
-      bufferlist other_op_bl;
-      other_op_bl.append(other_op_bl_ptr);
-
-      //update other_op_bl with cm & om
-      //When the other is appended to current transaction, all coll_index and
-      //object_index in other.op_buffer should be updated by new index of the
-      //combined transaction
-      _update_op_bl(other_op_bl, cm, om);
-
-      //append op_bl
-      op_bl.append(other_op_bl);
+      vector<__le32> cm, om;
+      bool same_colls = coll_index.merge(other.coll_index, &cm);
+      bool same_objects = object_index.merge(other.object_index, &om);
+
+      if (same_colls && same_objects) {
+        //the ops already name the right ids (always the case when appending
+        //to an empty transaction), so share other's op buffers
+        op_bl.append(other.op_bl);
+      } else {
+        //the other.op_bl SHOULD NOT be changes during append operation,
+        //we use additional bufferlist to avoid this problem
+        bufferptr other_op_bl_ptr(other.op_bl.length());
+        other.op_bl.copy(0, other.op_bl.length(), other_op_bl_ptr.c_str());
+        bufferlist other_op_bl;
+        other_op_bl.append(other_op_bl_ptr);
+
+        //update other_op_bl with cm & om
+        //When the other is appended to current transaction, all coll_index and
+        //object_index in other.op_buffer should be updated by new index of the
+        //combined transaction
+        _update_op_bl(other_op_bl, cm, om);
+
+        //append op_bl
+        op_bl.append(other_op_bl);
+      }
       //append data_bl
       data_bl.append(other.data_bl);
     }
@@ -708,14 +819,10 @@ public:
         return 1 + 8 + 8 + 4 + 4 + 4 + 4 + 4 + tbl.length();
       else {
         //layout: data_bl + op_bl + coll_index + object_index + data
-        //TODO: maybe we need better way to get encoded bytes;
-        bufferlist bl;
-        ::encode(coll_index, bl);
-        ::encode(object_index, bl);
-
         return data_bl.length() +
           op_bl.length() +
-          bl.length() +
+          coll_index.get_encoded_bytes() +
+          object_index.get_encoded_bytes() +
           sizeof(data);
       }
     }
@@ -787,36 +894,46 @@ public:
       Transaction *t;
 
       uint64_t ops;
+      std::list<bufferptr>::const_iterator op_buffer;
       char* op_buffer_p;
+      char* op_buffer_end;
 
       bufferlist::iterator data_bl_p;
 
     public:
-      vector<coll_t> colls;
-      vector<ghobject_t> objects;
+      vector<coll_t> &colls;
+      vector<ghobject_t> &objects;
 
     private:
       iterator(Transaction *t)
         : t(t),
+	  op_buffer_p(NULL),
+	  op_buffer_end(NULL),
 	  data_bl_p(t->data_bl.begin()),
-          colls(t->coll_index.size()),
-          objects(t->object_index.size()) {
+          colls(t->coll_index.get_items()),
+          objects(t->object_index.get_items()) {
 
         ops = t->data.ops;
-        op_buffer_p = t->op_bl.get_contiguous(0, t->data.ops * sizeof(Op));
-
-        map<coll_t, __le32>::iterator coll_index_p;
-        for (coll_index_p = t->coll_index.begin();
-             coll_index_p != t->coll_index.end();
-             ++coll_index_p) {
-          colls[coll_index_p->second] = coll_index_p->first;
+        // ops are walked in place, buffer by buffer, unless one was
+        // split across buffers (as a decoded op_bl may be)
+        const std::list<bufferptr>& buffers = t->op_bl.buffers();
+        for (op_buffer = buffers.begin(); op_buffer != buffers.end();
+             ++op_buffer) {
+          if (op_buffer->length() % sizeof(Op)) {
+            t->op_bl.rebuild();
+            break;
+          }
         }
+        op_buffer = t->op_bl.buffers().begin();
+        _next_buffer();
+      }
 
-        map<ghobject_t, __le32, ghobject_t::BitwiseComparator>::iterator object_index_p;
-        for (object_index_p = t->object_index.begin();
-             object_index_p != t->object_index.end();
-             ++object_index_p) {
-          objects[object_index_p->second] = object_index_p->first;
+      void _next_buffer() {
+        while (op_buffer_p == op_buffer_end &&
+               op_buffer != t->op_bl.buffers().end()) {
+          bufferptr bp = *op_buffer++;
+          op_buffer_p = bp.c_str();
+          op_buffer_end = op_buffer_p + bp.length();
         }
       }
 
@@ -829,13 +946,20 @@ public:
       }
       Op* decode_op() {
         assert(ops > 0);
+        assert(op_buffer_p < op_buffer_end);
 
         Op* op = reinterpret_cast<Op*>(op_buffer_p);
         op_buffer_p += sizeof(Op);
         ops--;
+        _next_buffer();
 
         return op;
       }
+      /// the op the next decode_op() will return
+      const Op* peek_op() const {
+        assert(ops > 0);
+        return reinterpret_cast<const Op*>(op_buffer_p);
+      }
       string decode_string() {
         string s;
         ::decode(s, data_bl_p);
@@ -893,34 +1017,24 @@ private:
      */
     Op* _get_next_op() {
       if (op_ptr.length() == 0 || op_ptr.offset() >= op_ptr.length()) {
-        op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
+        // the arena grows with the transaction, so op_bl stays a few
+        // buffers long however many ops it holds
+        op_ptr = bufferptr(sizeof(Op) * std::max<uint64_t>(OPS_PER_PTR, data.ops));
       }
-      bufferptr ptr(op_ptr, 0, sizeof(Op));
-      op_bl.append(ptr);
+      char* p = op_ptr.c_str();
+      // extends op_bl's last buffer in place while it is in this arena
+      op_bl.append(op_ptr, 0, sizeof(Op));
 
       op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
 
-      char* p = ptr.c_str();
       memset(p, 0, sizeof(Op));
       return reinterpret_cast<Op*>(p);
     }
     __le32 _get_coll_id(const coll_t& coll) {
-      map<coll_t, __le32>::iterator c = coll_index.find(coll);
-      if (c != coll_index.end())
-        return c->second;
-
-      __le32 index_id = coll_id++;
-      coll_index[coll] = index_id;
-      return index_id;
+      return coll_index.get_id(coll);
     }
     __le32 _get_object_id(const ghobject_t& oid) {
-      map<ghobject_t, __le32, ghobject_t::BitwiseComparator>::iterator o = object_index.find(oid);
-      if (o != object_index.end())
-        return o->second;
-
-      __le32 index_id = object_id++;
-      object_index[oid] = index_id;
-      return index_id;
+      return object_index.get_id(oid);
     }
 
 public:
@@ -1591,23 +1705,17 @@ public:
     // etc.
     Transaction() :
       osr(NULL),
-      use_tbl(false),
-      coll_id(0),
-      object_id(0) { }
+      use_tbl(false) { }
 
     Transaction(bufferlist::iterator &dp) :
       osr(NULL),
-      use_tbl(false),
-      coll_id(0),
-      object_id(0) {
+      use_tbl(false) {
       decode(dp);
     }
 
     Transaction(bufferlist &nbl) :
       osr(NULL),
-      use_tbl(false),
-      coll_id(0),
-      object_id(0) {
+      use_tbl(false) {
       bufferlist::iterator dp = nbl.begin();
       decode(dp);
     }
@@ -1633,11 +1741,18 @@ public:
         ENCODE_FINISH(bl);
       } else {
         //layout: data_bl + op_bl + coll_index + object_index + data
+        // the small fields and both indices go into one buffer, sized
+        // up front if we know how big they are; data_bl and op_bl are
+        // appended by reference
+        if (coll_index.is_measured() && object_index.is_measured())
+          bl.reserve(2 * sizeof(__u8) + 3 * sizeof(__u32) +
+                     coll_index.get_encoded_bytes() +
+                     object_index.get_encoded_bytes() + sizeof(data));
         ENCODE_START(9, 9, bl);
         ::encode(data_bl, bl);
         ::encode(op_bl, bl);
-        ::encode(coll_index, bl);
-        ::encode(object_index, bl);
+        coll_index.encode(bl);
+        object_index.encode(bl);
         data.encode(bl);
         ENCODE_FINISH(bl);
       }
@@ -1668,12 +1783,10 @@ public:
       if (!decoded && struct_v >= 8) {
         ::decode(data_bl, bl);
         ::decode(op_bl, bl);
-        ::decode(coll_index, bl);
-        ::decode(object_index, bl);
+        coll_index.decode(bl);
+        object_index.decode(bl);
         data.decode(bl);
         use_tbl = false;
-        coll_id = coll_index.size();
-        object_id = object_index.size();
 	decoded = true;
       }
 
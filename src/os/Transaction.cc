@@ -15,8 +15,6 @@ void ObjectStore::Transaction::_build_actions_from_tbl()
   //Now we assert each transaction should only be iterated once
   assert(coll_index.size() == 0);
   assert(object_index.size() == 0);
-  assert(coll_id == 0);
-  assert(object_id == 0);
   assert(data_bl.length() == 0);
   assert(op_bl.length() == 0);
 
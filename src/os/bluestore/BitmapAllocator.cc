@@ -0,0 +1,411 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "BitmapAllocator.h"
+#include "bluestore_types.h"
+#include "BlueStore.h"
+
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "bitmapalloc "
+
+#define BITS_PER_WORD 64
+#define WORDS_PER_LINE 8   // 64 byte cache line
+#define BITS_PER_LINE (BITS_PER_WORD * WORDS_PER_LINE)
+
+BitmapAllocator::BitmapAllocator(uint64_t device_size, uint64_t bsize)
+  : block_size(bsize),
+    block_order(__builtin_ctzll(bsize)),
+    num_blocks(device_size / bsize),
+    blocks_per_zone(g_conf->bluestore_bitmapallocator_blocks_per_zone),
+    bits(NULL),
+    l1(NULL),
+    zone_free(NULL),
+    num_free(0),
+    last_alloc(0),
+    lock("BitmapAllocator::lock"),
+    num_uncommitted(0),
+    num_committing(0),
+    num_reserved(0)
+{
+  assert(block_size && (block_size & (block_size - 1)) == 0);
+  assert(blocks_per_zone && blocks_per_zone % BITS_PER_LINE == 0);
+  words_per_zone = blocks_per_zone / BITS_PER_WORD;
+  lines_per_zone = words_per_zone / WORDS_PER_LINE;
+  l1_words_per_zone = ROUND_UP_TO(lines_per_zone, BITS_PER_WORD) /
+    BITS_PER_WORD;
+  num_zones = ROUND_UP_TO(num_blocks, blocks_per_zone) / blocks_per_zone;
+  if (num_zones == 0)
+    num_zones = 1;
+
+  void *p;
+  int r = ::posix_memalign(&p, WORDS_PER_LINE * sizeof(uint64_t),
+			   num_zones * words_per_zone * sizeof(uint64_t));
+  assert(r == 0);
+  bits = static_cast<uint64_t*>(p);
+  memset(bits, 0, num_zones * words_per_zone * sizeof(uint64_t));
+  l1 = new uint64_t[num_zones * l1_words_per_zone];
+  memset(l1, 0, num_zones * l1_words_per_zone * sizeof(uint64_t));
+  zone_free = new std::atomic<int64_t>[num_zones];
+  for (uint64_t i = 0; i < num_zones; ++i)
+    zone_free[i] = 0;
+
+  unsigned stripes = MIN(num_zones,
+			 MAX(1u, g_conf->bluestore_bitmapallocator_zone_lock_stripes));
+  for (unsigned i = 0; i < stripes; ++i)
+    zone_locks.push_back(new Mutex("BitmapAllocator::zone_lock"));
+
+  dout(10) << __func__ << " " << num_blocks << " blocks of " << block_size
+	   << " in " << num_zones << " zones of " << blocks_per_zone
+	   << " with " << stripes << " lock stripes" << dendl;
+}
+
+BitmapAllocator::~BitmapAllocator()
+{
+  for (auto l : zone_locks)
+    delete l;
+  delete[] zone_free;
+  delete[] l1;
+  ::free(bits);
+}
+
+/// return first free block in zone at or after pos, or blocks_per_zone
+uint64_t BitmapAllocator::_next_free(uint64_t zone, uint64_t pos)
+{
+  uint64_t *w = bits + zone * words_per_zone;
+  uint64_t *s = l1 + zone * l1_words_per_zone;
+  if (pos >= blocks_per_zone)
+    return blocks_per_zone;
+  uint64_t wi = pos / BITS_PER_WORD;
+  uint64_t word = w[wi] & (~0ull << (pos % BITS_PER_WORD));
+  while (!word) {
+    ++wi;
+    if (wi >= words_per_zone)
+      return blocks_per_zone;
+    if (wi % WORDS_PER_LINE == 0) {
+      // skip over full cache lines using the summary
+      uint64_t line = wi / WORDS_PER_LINE;
+      uint64_t si = line / BITS_PER_WORD;
+      uint64_t sword = s[si] & (~0ull << (line % BITS_PER_WORD));
+      while (!sword) {
+	if (++si >= l1_words_per_zone)
+	  return blocks_per_zone;
+	sword = s[si];
+      }
+      line = si * BITS_PER_WORD + __builtin_ctzll(sword);
+      if (line >= lines_per_zone)
+	return blocks_per_zone;
+      wi = line * WORDS_PER_LINE;
+    }
+    word = w[wi];
+  }
+  return wi * BITS_PER_WORD + __builtin_ctzll(word);
+}
+
+/// return first allocated block in zone in [pos, limit), or limit
+uint64_t BitmapAllocator::_next_used(uint64_t zone, uint64_t pos,
+				     uint64_t limit)
+{
+  uint64_t *w = bits + zone * words_per_zone;
+  while (pos < limit) {
+    uint64_t base = pos & ~(uint64_t)(BITS_PER_WORD - 1);
+    uint64_t word = ~w[pos / BITS_PER_WORD] &
+      (~0ull << (pos % BITS_PER_WORD));
+    if (word)
+      return MIN(base + __builtin_ctzll(word), limit);
+    pos = base + BITS_PER_WORD;
+  }
+  return limit;
+}
+
+/**
+ * find the first free run in zone starting on a unit boundary at or after
+ * from.  A run of want blocks is taken whole; otherwise the usable (unit
+ * multiple) part of the run is taken if it is at least min blocks.
+ *
+ * @return run length in blocks, or 0 if nothing suitable was found
+ */
+uint64_t BitmapAllocator::_find_run(uint64_t zone, uint64_t from,
+				    uint64_t unit, uint64_t want,
+				    uint64_t min, uint64_t *start)
+{
+  uint64_t pos = ROUND_UP_TO(from, unit);
+  while (pos < blocks_per_zone) {
+    pos = _next_free(zone, pos);
+    if (pos >= blocks_per_zone)
+      break;
+    uint64_t aligned = ROUND_UP_TO(pos, unit);
+    if (aligned != pos) {
+      pos = aligned;
+      continue;
+    }
+    uint64_t end = _next_used(zone, pos, MIN(pos + want, blocks_per_zone));
+    uint64_t len = end - pos;
+    uint64_t got = len >= want ? want : len - len % unit;
+    if (got && got >= min) {
+      *start = pos;
+      return got;
+    }
+    pos = end;
+  }
+  return 0;
+}
+
+void BitmapAllocator::_mark(uint64_t zone, uint64_t start, uint64_t len,
+			    bool free)
+{
+  uint64_t *w = bits + zone * words_per_zone;
+  uint64_t *s = l1 + zone * l1_words_per_zone;
+  uint64_t pos = start, end = start + len;
+  while (pos < end) {
+    uint64_t wi = pos / BITS_PER_WORD;
+    uint64_t first = pos % BITS_PER_WORD;
+    uint64_t n = MIN(end - pos, BITS_PER_WORD - first);
+    uint64_t mask = (n == BITS_PER_WORD ? ~0ull : ((1ull << n) - 1)) << first;
+    if (free) {
+      assert((w[wi] & mask) == 0);
+      w[wi] |= mask;
+    } else {
+      assert((w[wi] & mask) == mask);
+      w[wi] &= ~mask;
+    }
+    pos += n;
+  }
+
+  // refresh the summary bits for the lines we touched
+  uint64_t last_line = (end - 1) / BITS_PER_LINE;
+  for (uint64_t line = start / BITS_PER_LINE; line <= last_line; ++line) {
+    uint64_t *lw = w + line * WORDS_PER_LINE;
+    bool any = false;
+    for (unsigned i = 0; i < WORDS_PER_LINE && !any; ++i)
+      any = lw[i] != 0;
+    uint64_t bit = 1ull << (line % BITS_PER_WORD);
+    if (any)
+      s[line / BITS_PER_WORD] |= bit;
+    else
+      s[line / BITS_PER_WORD] &= ~bit;
+  }
+
+  if (free) {
+    zone_free[zone] += len;
+    num_free += len << block_order;
+  } else {
+    zone_free[zone] -= len;
+    num_free -= len << block_order;
+  }
+}
+
+void BitmapAllocator::_mark_range(uint64_t offset, uint64_t length, bool free)
+{
+  assert(offset % block_size == 0);
+  assert(length % block_size == 0);
+  uint64_t pos = offset >> block_order;
+  uint64_t end = (offset + length) >> block_order;
+  assert(end <= num_blocks);
+  while (pos < end) {
+    uint64_t zone = pos / blocks_per_zone;
+    uint64_t zstart = pos % blocks_per_zone;
+    uint64_t n = MIN(end - pos, blocks_per_zone - zstart);
+    Mutex::Locker l(_zone_lock(zone));
+    _mark(zone, zstart, n, free);
+    pos += n;
+  }
+}
+
+int BitmapAllocator::reserve(uint64_t need)
+{
+  Mutex::Locker l(lock);
+  dout(10) << __func__ << " need " << need << " num_free " << num_free
+	   << " num_reserved " << num_reserved << dendl;
+  if ((int64_t)need > num_free - num_reserved)
+    return -ENOSPC;
+  num_reserved += need;
+  return 0;
+}
+
+void BitmapAllocator::unreserve(uint64_t unused)
+{
+  Mutex::Locker l(lock);
+  dout(10) << __func__ << " unused " << unused << " num_free " << num_free
+	   << " num_reserved " << num_reserved << dendl;
+  assert((int64_t)unused <= num_reserved);
+  num_reserved -= unused;
+}
+
+int BitmapAllocator::allocate(
+  uint64_t need_size, uint64_t alloc_unit, int64_t hint,
+  uint64_t *offset, uint32_t *length)
+{
+  dout(10) << __func__ << " need_size " << need_size
+	   << " alloc_unit " << alloc_unit
+	   << " hint " << hint
+	   << dendl;
+  assert(alloc_unit % block_size == 0);
+  uint64_t unit = MAX(1ull, alloc_unit >> block_order);
+  assert(blocks_per_zone % unit == 0);
+  uint64_t want = ROUND_UP_TO(MAX(alloc_unit, need_size), block_size) >>
+    block_order;
+  want = MIN(want, blocks_per_zone);
+
+  if (!hint)
+    hint = last_alloc;
+  uint64_t hint_block = MIN((uint64_t)hint >> block_order, num_blocks);
+  uint64_t start_zone = (hint_block / blocks_per_zone) % num_zones;
+  uint64_t start_pos = hint_block % blocks_per_zone;
+
+  // first look for the whole request, skipping zones that are busy;
+  // then wait for busy zones; then settle for anything >= alloc_unit.
+  struct {
+    uint64_t min;
+    bool try_lock;
+  } passes[] = {
+    { want, true },
+    { want, false },
+    { unit, false },
+  };
+  uint64_t zone = 0, pos = 0, got = 0;
+  for (auto& pass : passes) {
+    // visit start zone from the hint, every other zone, then the part of
+    // the start zone before the hint.
+    for (uint64_t i = 0; i <= num_zones; ++i) {
+      zone = (start_zone + i) % num_zones;
+      uint64_t from = i == 0 ? start_pos : 0;
+      if (i == num_zones && start_pos == 0)
+	break;
+      if (zone_free[zone] < (int64_t)pass.min)
+	continue;
+      Mutex& zl = _zone_lock(zone);
+      if (pass.try_lock) {
+	if (!zl.TryLock())
+	  continue;
+      } else {
+	zl.Lock();
+      }
+      got = _find_run(zone, from, unit, want, pass.min, &pos);
+      if (got) {
+	if (g_conf->bluestore_debug_small_allocations) {
+	  uint64_t max =
+	    unit * (rand() % g_conf->bluestore_debug_small_allocations);
+	  if (max && got > max) {
+	    dout(10) << __func__ << " shortening allocation of "
+		     << (got << block_order) << " -> " << (max << block_order)
+		     << " due to debug_small_allocations" << dendl;
+	    got = max;
+	  }
+	}
+	_mark(zone, pos, got, false);
+	zl.Unlock();
+	goto found;
+      }
+      zl.Unlock();
+    }
+  }
+
+  assert(0 == "caller didn't reserve?");
+  return -ENOSPC;
+
+ found:
+  *offset = (zone * blocks_per_zone + pos) << block_order;
+  *length = got << block_order;
+  dout(30) << __func__ << " got " << *offset << "~" << *length
+	   << " from zone " << zone << dendl;
+  last_alloc = *offset + *length;
+
+  Mutex::Locker l(lock);
+  num_reserved -= *length;
+  assert(num_free >= 0);
+  assert(num_reserved >= 0);
+  return 0;
+}
+
+int BitmapAllocator::release(
+  uint64_t offset, uint64_t length)
+{
+  Mutex::Locker l(lock);
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  uncommitted.insert(offset, length);
+  num_uncommitted += length;
+  return 0;
+}
+
+uint64_t BitmapAllocator::get_free()
+{
+  return num_free;
+}
+
+void BitmapAllocator::dump(ostream& out)
+{
+  for (uint64_t zone = 0; zone < num_zones; ++zone) {
+    Mutex::Locker l(_zone_lock(zone));
+    if (zone_free[zone] == 0)
+      continue;
+    dout(30) << __func__ << " zone " << zone << ": "
+	     << zone_free[zone] << " free blocks" << dendl;
+    uint64_t pos = _next_free(zone, 0);
+    while (pos < blocks_per_zone) {
+      uint64_t end = _next_used(zone, pos, blocks_per_zone);
+      dout(30) << __func__ << "  "
+	       << ((zone * blocks_per_zone + pos) << block_order) << "~"
+	       << ((end - pos) << block_order) << dendl;
+      pos = _next_free(zone, end);
+    }
+  }
+  Mutex::Locker l(lock);
+  dout(30) << __func__ << " committing: "
+	   << committing.num_intervals() << " extents" << dendl;
+  for (interval_set<uint64_t>::iterator p = committing.begin();
+       p != committing.end();
+       ++p) {
+    dout(30) << __func__ << "  " << p.get_start() << "~" << p.get_len() << dendl;
+  }
+  dout(30) << __func__ << " uncommitted: "
+	   << uncommitted.num_intervals() << " extents" << dendl;
+  for (interval_set<uint64_t>::iterator p = uncommitted.begin();
+       p != uncommitted.end();
+       ++p) {
+    dout(30) << __func__ << "  " << p.get_start() << "~" << p.get_len() << dendl;
+  }
+}
+
+void BitmapAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  _mark_range(offset, length, true);
+}
+
+void BitmapAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  _mark_range(offset, length, false);
+  assert(num_free >= 0);
+}
+
+void BitmapAllocator::shutdown()
+{
+  dout(1) << __func__ << dendl;
+}
+
+void BitmapAllocator::commit_start()
+{
+  Mutex::Locker l(lock);
+  dout(10) << __func__ << " releasing " << num_uncommitted
+	   << " in extents " << uncommitted.num_intervals() << dendl;
+  assert(committing.empty());
+  committing.swap(uncommitted);
+  num_committing = num_uncommitted;
+  num_uncommitted = 0;
+}
+
+void BitmapAllocator::commit_finish()
+{
+  Mutex::Locker l(lock);
+  dout(10) << __func__ << " released " << num_committing
+	   << " in extents " << committing.num_intervals() << dendl;
+  for (interval_set<uint64_t>::iterator p = committing.begin();
+       p != committing.end();
+       ++p) {
+    _mark_range(p.get_start(), p.get_len(), true);
+  }
+  committing.clear();
+  num_committing = 0;
+}
@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_BITMAPALLOCATOR_H
+#define CEPH_OS_BLUESTORE_BITMAPALLOCATOR_H
+
+#include <atomic>
+
+#include "Allocator.h"
+#include "include/interval_set.h"
+#include "common/Mutex.h"
+
+/**
+ * Free space is tracked with one bit per device block (1 == free), so
+ * memory use is fixed by the device size rather than by fragmentation.
+ *
+ * The device is split into zones of bluestore_bitmapallocator_blocks_per_zone
+ * blocks.  Each zone's bitmap is cache-line aligned and summarized by a
+ * second bitmap with one bit per cache line that has any free block, so a
+ * search skips full lines without touching them.  Per-zone free counts let
+ * allocate() skip zones that cannot satisfy a request.  Zones are protected
+ * by a fixed set of striped locks; allocate() first try-locks its way past
+ * zones another thread is busy in, so concurrent callers spread out.
+ */
+class BitmapAllocator : public Allocator {
+  uint64_t block_size;
+  unsigned block_order;
+  uint64_t num_blocks;
+  uint64_t blocks_per_zone;
+  uint64_t words_per_zone;     ///< level 0 words per zone
+  uint64_t lines_per_zone;     ///< cache lines per zone
+  uint64_t l1_words_per_zone;  ///< level 1 words per zone
+  uint64_t num_zones;
+
+  uint64_t *bits;              ///< level 0: one bit per block
+  uint64_t *l1;                ///< level 1: one bit per cache line
+  std::atomic<int64_t> *zone_free;  ///< free blocks per zone
+  vector<Mutex*> zone_locks;   ///< striped across zones
+
+  std::atomic<int64_t> num_free;  ///< total bytes free in bitmap
+  std::atomic<uint64_t> last_alloc;
+
+  Mutex lock;                  ///< protects reservations and releases
+  int64_t num_uncommitted;
+  int64_t num_committing;
+  int64_t num_reserved;        ///< reserved bytes
+  interval_set<uint64_t> uncommitted; ///< released but not yet usable
+  interval_set<uint64_t> committing;  ///< released but not yet usable
+
+  Mutex& _zone_lock(uint64_t zone) {
+    return *zone_locks[zone % zone_locks.size()];
+  }
+
+  uint64_t _next_free(uint64_t zone, uint64_t pos);
+  uint64_t _next_used(uint64_t zone, uint64_t pos, uint64_t limit);
+  uint64_t _find_run(uint64_t zone, uint64_t from, uint64_t unit,
+		     uint64_t want, uint64_t min, uint64_t *start);
+  void _mark(uint64_t zone, uint64_t start, uint64_t len, bool free);
+  void _mark_range(uint64_t offset, uint64_t length, bool free);
+
+public:
+  BitmapAllocator(uint64_t device_size, uint64_t block_size);
+  ~BitmapAllocator();
+
+  int reserve(uint64_t need);
+  void unreserve(uint64_t unused);
+
+  int allocate(
+    uint64_t need_size, uint64_t alloc_unit, int64_t hint,
+    uint64_t *offset, uint32_t *length);
+
+  int release(
+    uint64_t offset, uint64_t length);
+
+  void commit_start();
+  void commit_finish();
+
+  uint64_t get_free();
+
+  void dump(ostream& out);
+
+  void init_add_free(uint64_t offset, uint64_t length);
+  void init_rm_free(uint64_t offset, uint64_t length);
+
+  void shutdown();
+};
+
+#endif
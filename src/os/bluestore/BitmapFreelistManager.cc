@@ -0,0 +1,282 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "BitmapFreelistManager.h"
+#include "kv/KeyValueDB.h"
+#include "kv.h"
+
+#include "common/debug.h"
+
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "freelist "
+
+BitmapFreelistManager::BitmapFreelistManager(KeyValueDB *db,
+					     string meta_prefix,
+					     string bitmap_prefix)
+  : kvdb(db),
+    meta_prefix(meta_prefix),
+    bitmap_prefix(bitmap_prefix),
+    size(0),
+    bytes_per_block(0),
+    blocks_per_key(0),
+    bytes_per_key(0),
+    key_mask(0),
+    lock("BitmapFreelistManager::lock"),
+    enumerate_offset(0),
+    enumerate_key_offset(0)
+{
+}
+
+int BitmapFreelistManager::setup_merge_operator(KeyValueDB *db, string prefix)
+{
+  return db->set_merge_operator(
+    prefix, KeyValueDB::create_merge_operator("bitwise_xor"));
+}
+
+int BitmapFreelistManager::create(uint64_t new_size, uint64_t block_size,
+				  KeyValueDB::Transaction txn)
+{
+  bytes_per_block = block_size;
+  assert((bytes_per_block & (bytes_per_block - 1)) == 0);
+  blocks_per_key = g_conf->bluestore_freelist_blocks_per_key;
+  size = new_size;
+  _init_misc();
+  dout(1) << __func__ << " size 0x" << std::hex << size
+	  << " bytes_per_block 0x" << bytes_per_block
+	  << " blocks_per_key 0x" << blocks_per_key << std::dec << dendl;
+  {
+    bufferlist bl;
+    ::encode(bytes_per_block, bl);
+    txn->set(meta_prefix, "bytes_per_block", bl);
+  }
+  {
+    bufferlist bl;
+    ::encode(blocks_per_key, bl);
+    txn->set(meta_prefix, "blocks_per_key", bl);
+  }
+  {
+    bufferlist bl;
+    ::encode(size, bl);
+    txn->set(meta_prefix, "size", bl);
+  }
+  return 0;
+}
+
+int BitmapFreelistManager::init()
+{
+  dout(1) << __func__ << dendl;
+
+  KeyValueDB::Iterator it = kvdb->get_iterator(meta_prefix);
+  it->lower_bound(string());
+
+  // load meta
+  while (it->valid()) {
+    string k = it->key();
+    if (k == "bytes_per_block") {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(bytes_per_block, p);
+    } else if (k == "blocks_per_key") {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(blocks_per_key, p);
+    } else if (k == "size") {
+      bufferlist bl = it->value();
+      bufferlist::iterator p = bl.begin();
+      ::decode(size, p);
+    } else {
+      derr << __func__ << " unrecognized meta " << k << dendl;
+      return -EIO;
+    }
+    it->next();
+  }
+  if (!bytes_per_block || !blocks_per_key || !size) {
+    derr << __func__ << " missing freelist meta" << dendl;
+    return -EIO;
+  }
+
+  dout(10) << __func__ << std::hex
+	   << " size 0x" << size
+	   << " bytes_per_block 0x" << bytes_per_block
+	   << " blocks_per_key 0x" << blocks_per_key
+	   << std::dec << dendl;
+  _init_misc();
+  return 0;
+}
+
+void BitmapFreelistManager::_init_misc()
+{
+  assert(blocks_per_key % 8 == 0);
+  assert((blocks_per_key & (blocks_per_key - 1)) == 0);
+  bytes_per_key = bytes_per_block * blocks_per_key;
+  key_mask = ~(bytes_per_key - 1);
+
+  bufferptr z(blocks_per_key >> 3);
+  memset(z.c_str(), 0xff, z.length());
+  all_set_bl.clear();
+  all_set_bl.append(z);
+}
+
+void BitmapFreelistManager::shutdown()
+{
+  dout(1) << __func__ << dendl;
+}
+
+void BitmapFreelistManager::dump()
+{
+  enumerate_reset();
+  uint64_t offset, length;
+  while (enumerate_next(&offset, &length)) {
+    dout(30) << __func__ << "  " << offset << "~" << length << dendl;
+  }
+}
+
+void BitmapFreelistManager::enumerate_reset()
+{
+  Mutex::Locker l(lock);
+  enumerate_offset = 0;
+  enumerate_key_offset = (uint64_t)-1;
+  enumerate_bl.clear();
+  enumerate_p = kvdb->get_iterator(bitmap_prefix);
+  enumerate_p->lower_bound(string());
+}
+
+/**
+ * position the enumeration on the key at key_offset, loading its bitmap
+ * into enumerate_bl.  Keys are visited in order, so the iterator only
+ * ever moves forward.
+ *
+ * @return false if the key is absent, i.e. all of its blocks are free
+ */
+bool BitmapFreelistManager::_enumerate_is_used(uint64_t key_offset)
+{
+  if (key_offset != enumerate_key_offset) {
+    enumerate_key_offset = key_offset;
+    enumerate_bl.clear();
+    while (enumerate_p->valid()) {
+      uint64_t k;
+      string key = enumerate_p->key();
+      _key_decode_u64(key.c_str(), &k);
+      if (k > key_offset)
+	break;
+      if (k == key_offset) {
+	enumerate_bl = enumerate_p->value();
+	assert(enumerate_bl.length() == blocks_per_key >> 3);
+	break;
+      }
+      enumerate_p->next();
+    }
+  }
+  return enumerate_bl.length() > 0;
+}
+
+bool BitmapFreelistManager::enumerate_next(uint64_t *offset, uint64_t *length)
+{
+  Mutex::Locker l(lock);
+  uint64_t start = size;
+  for (int want_used = 0; want_used < 2; ++want_used) {
+    // first find the start of a free run, then the next used block
+    uint64_t pos = want_used ? start : enumerate_offset;
+    while (pos < size) {
+      uint64_t key_offset = pos & key_mask;
+      if (!_enumerate_is_used(key_offset)) {
+	if (!want_used)
+	  break;
+	pos = key_offset + bytes_per_key;
+	continue;
+      }
+      const unsigned char *p =
+	(const unsigned char *)enumerate_bl.c_str();
+      uint64_t bit = (pos - key_offset) / bytes_per_block;
+      bool found = false;
+      while (bit < blocks_per_key) {
+	unsigned c = p[bit >> 3];
+	if (!want_used)
+	  c = ~c & 0xff;
+	c &= 0xff << (bit & 7);
+	if (c) {
+	  bit = (bit & ~7ull) + __builtin_ctz(c);
+	  found = true;
+	  break;
+	}
+	bit = (bit & ~7ull) + 8;
+      }
+      if (found) {
+	pos = key_offset + bit * bytes_per_block;
+	break;
+      }
+      pos = key_offset + bytes_per_key;
+    }
+    if (pos > size)
+      pos = size;
+    if (!want_used) {
+      if (pos >= size) {
+	enumerate_offset = size;
+	return false;
+      }
+      start = pos;
+    } else {
+      *offset = start;
+      *length = pos - start;
+      enumerate_offset = pos;
+    }
+  }
+  dout(30) << __func__ << " " << *offset << "~" << *length << dendl;
+  return true;
+}
+
+int BitmapFreelistManager::allocate(
+  uint64_t offset, uint64_t length,
+  KeyValueDB::Transaction txn)
+{
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  _xor(offset, length, txn);
+  return 0;
+}
+
+int BitmapFreelistManager::release(
+  uint64_t offset, uint64_t length,
+  KeyValueDB::Transaction txn)
+{
+  dout(10) << __func__ << " " << offset << "~" << length << dendl;
+  _xor(offset, length, txn);
+  return 0;
+}
+
+void BitmapFreelistManager::_xor(
+  uint64_t offset, uint64_t length,
+  KeyValueDB::Transaction txn)
+{
+  // must be block aligned
+  assert((offset & (bytes_per_block - 1)) == 0);
+  assert((length & (bytes_per_block - 1)) == 0);
+  assert(offset + length <= size);
+
+  uint64_t end = offset + length;
+  for (uint64_t k = offset & key_mask; k < end; k += bytes_per_key) {
+    string key;
+    _key_encode_u64(k, &key);
+    uint64_t s = MAX(offset, k);
+    uint64_t e = MIN(end, k + bytes_per_key);
+    if (s == k && e == k + bytes_per_key) {
+      dout(30) << __func__ << " 0x" << std::hex << k << std::dec
+	       << " all" << dendl;
+      txn->merge(bitmap_prefix, key, all_set_bl);
+      continue;
+    }
+    bufferptr p(blocks_per_key >> 3);
+    p.zero();
+    char *bits = p.c_str();
+    uint64_t last = (e - k) / bytes_per_block;
+    for (uint64_t b = (s - k) / bytes_per_block; b < last; ++b) {
+      bits[b >> 3] |= 1 << (b & 7);
+    }
+    bufferlist bl;
+    bl.append(p);
+    dout(30) << __func__ << " 0x" << std::hex << k << std::dec
+	     << " blocks " << (s - k) / bytes_per_block << "~"
+	     << (e - s) / bytes_per_block << dendl;
+    txn->merge(bitmap_prefix, key, bl);
+  }
+}
@@ -0,0 +1,71 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_BITMAPFREELISTMANAGER_H
+#define CEPH_OS_BLUESTORE_BITMAPFREELISTMANAGER_H
+
+#include "FreelistManager.h"
+
+#include <string>
+#include "common/Mutex.h"
+#include "include/buffer.h"
+
+/**
+ * The freelist is a bitmap with one bit per block (set == allocated),
+ * stored as fixed size values of blocks_per_key bits under bitmap_prefix,
+ * keyed by the byte offset of the first block.  Missing keys are all free.
+ *
+ * allocate() and release() both just flip bits, so they are written as
+ * blind XOR merges: no read, no in-memory mirror, and one small value per
+ * key touched regardless of how fragmented free space is.  Geometry
+ * (block size, blocks per key, device size) is fixed at create() and
+ * stored under meta_prefix.
+ */
+class BitmapFreelistManager : public FreelistManager {
+  KeyValueDB *kvdb;
+  std::string meta_prefix, bitmap_prefix;
+
+  uint64_t size;            ///< size of device (bytes)
+  uint64_t bytes_per_block; ///< bytes per block (bdev_block_size)
+  uint64_t blocks_per_key;  ///< blocks (bits) per key/value pair
+  uint64_t bytes_per_key;   ///< bytes per key/value pair
+  uint64_t key_mask;        ///< mask to convert offset to key offset
+
+  bufferlist all_set_bl;    ///< a value with every block bit set
+
+  Mutex lock;               ///< protects enumeration state
+  KeyValueDB::Iterator enumerate_p;
+  uint64_t enumerate_offset;     ///< next block to examine
+  uint64_t enumerate_key_offset; ///< offset of key in enumerate_bl
+  bufferlist enumerate_bl;       ///< current key's bitmap, if any
+
+  void _init_misc();
+  bool _enumerate_is_used(uint64_t offset);
+  void _xor(uint64_t offset, uint64_t length, KeyValueDB::Transaction txn);
+
+public:
+  BitmapFreelistManager(KeyValueDB *db, std::string meta_prefix,
+			std::string bitmap_prefix);
+
+  static int setup_merge_operator(KeyValueDB *db, std::string prefix);
+
+  int create(uint64_t size, uint64_t block_size,
+	     KeyValueDB::Transaction txn);
+
+  int init();
+  void shutdown();
+
+  void dump();
+
+  void enumerate_reset();
+  bool enumerate_next(uint64_t *offset, uint64_t *length);
+
+  int allocate(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn);
+  int release(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn);
+};
+
+#endif
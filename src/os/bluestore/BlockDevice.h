@@ -7,6 +7,8 @@
 #include "os/fs/FS.h"
 #include "include/interval_set.h"
 
+struct NVMETask;
+
 /// track in-flight io
 struct IOContext {
   void *priv;
@@ -15,8 +17,9 @@ struct IOContext {
   Cond cond;
   //interval_set<uint64_t> blocks;  ///< blocks with aio in flight
 
-  list<FS::aio_t> pending_aios;    ///< not yet submitted
+  list<FS::aio_t> pending_aios;    ///< not yet submitted (KernelDevice)
   list<FS::aio_t> running_aios;    ///< submitting or submitted
+  list<NVMETask*> pending_tasks;   ///< not yet submitted (NVMEDevice)
   atomic_t num_pending;
   atomic_t num_running;
   atomic_t num_reading;
@@ -35,6 +38,9 @@ struct IOContext {
     Mutex::Locker l(lock);
     return num_pending.read() + num_running.read();
   }
+  bool has_pending_aios() {
+    return num_pending.read();
+  }
 
   void aio_wait();
 };
@@ -43,45 +49,25 @@ class BlockDevice {
 public:
   typedef void (*aio_callback_t)(void *handle, void *aio);
 
-private:
-  int fd_direct, fd_buffered;
+protected:
   uint64_t size;
   uint64_t block_size;
-  string path;
-  FS *fs;
-  bool aio, dio;
-  bufferptr zeros;
-
-  Mutex debug_lock;
-  interval_set<uint64_t> debug_inflight;
 
-  FS::aio_queue_t aio_queue;
   aio_callback_t aio_callback;
   void *aio_callback_priv;
-  bool aio_stop;
-
-  struct AioCompletionThread : public Thread {
-    BlockDevice *bdev;
-    AioCompletionThread(BlockDevice *b) : bdev(b) {}
-    void *entry() {
-      bdev->_aio_thread();
-      return NULL;
-    }
-  } aio_thread;
-
-  void _aio_thread();
-  int _aio_start();
-  void _aio_stop();
-
-  void _aio_log_start(IOContext *ioc, uint64_t offset, uint64_t length);
-  void _aio_log_finish(IOContext *ioc, uint64_t offset, uint64_t length);
-
-  int _lock();
 
 public:
-  BlockDevice(aio_callback_t cb, void *cbpriv);
+  BlockDevice(aio_callback_t cb, void *cbpriv)
+    : size(0),
+      block_size(0),
+      aio_callback(cb),
+      aio_callback_priv(cbpriv) {}
+  virtual ~BlockDevice() {}
 
-  void aio_submit(IOContext *ioc);
+  /// create a device of type bdev_type; open() it to use it
+  static BlockDevice *create(aio_callback_t cb, void *cbpriv);
+
+  virtual void aio_submit(IOContext *ioc) = 0;
 
   uint64_t get_size() const {
     return size;
@@ -90,21 +76,25 @@ public:
     return block_size;
   }
 
-  int read(uint64_t off, uint64_t len, bufferlist *pbl,
-	   IOContext *ioc,
-	   bool buffered);
+  virtual int read(uint64_t off, uint64_t len, bufferlist *pbl,
+		   IOContext *ioc,
+		   bool buffered) = 0;
 
-  int aio_write(uint64_t off, bufferlist& bl,
-		IOContext *ioc,
-		bool buffered);
-  int aio_zero(uint64_t off, uint64_t len,
-	       IOContext *ioc);
-  int flush();
+  /// queue a write on ioc for aio_submit; if buffered, write it now
+  virtual int aio_write(uint64_t off, bufferlist& bl,
+			IOContext *ioc,
+			bool buffered) = 0;
+  virtual int aio_zero(uint64_t off, uint64_t len,
+		       IOContext *ioc) = 0;
+  virtual int flush() = 0;
 
   // for managing buffered readers/writers
-  int invalidate_cache(uint64_t off, uint64_t len);
-  int open(string path);
-  void close();
+  virtual int invalidate_cache(uint64_t off, uint64_t len) = 0;
+  virtual int open(string path) = 0;
+  virtual void close() = 0;
+
+  /// queue and latency statistics, if the backend keeps any
+  virtual void dump_stats(Formatter *f) {}
 };
 
 #endif
@@ -3,8 +3,12 @@
 
 #include "BlueFS.h"
 
+#include <algorithm>
+
 #include "common/debug.h"
 #include "common/errno.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
 #include "BlockDevice.h"
 #include "Allocator.h"
 #include "StupidAllocator.h"
@@ -14,11 +18,35 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "bluefs "
 
+class BlueFS::SocketHook : public AdminSocketHook {
+  BlueFS *fs;
+public:
+  SocketHook(BlueFS *f) : fs(f) {}
+  bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	    bufferlist& out) {
+    Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+    f->open_object_section("bluefs");
+    fs->dump_usage(f);
+    f->close_section();
+    f->flush(out);
+    delete f;
+    return true;
+  }
+};
+
 BlueFS::BlueFS()
   : lock("BlueFS::lock"),
+    asok_hook(NULL),
+    spill_back_thread(this),
+    spill_back_stop(false),
+    spill_back_running(false),
+    spill_back_passes(0),
+    spill_back_files(0),
+    spill_back_bytes(0),
     ino_last(0),
     log_seq(0),
-    log_writer(NULL)
+    log_writer(NULL),
+    tier_bdev(TIER_MAX, -1)
 {
 }
 
@@ -40,11 +68,15 @@ BlueFS::~BlueFS()
     fs->_aio_finish(priv2);
     }*/
 
-int BlueFS::add_block_device(unsigned id, string path)
+int BlueFS::add_block_device(unsigned id, string path, unsigned tier)
 {
-  dout(10) << __func__ << " bdev " << id << " path " << path << dendl;
+  dout(10) << __func__ << " bdev " << id << " path " << path
+	   << " tier " << tier << dendl;
   assert(id == bdev.size());
-  BlockDevice *b = new BlockDevice(NULL, NULL); //aio_cb, this);
+  assert(tier < TIER_MAX);
+  BlockDevice *b = BlockDevice::create(NULL, NULL); //aio_cb, this);
+  if (!b)
+    return -EINVAL;
   int r = b->open(path);
   if (r < 0) {
     delete b;
@@ -55,6 +87,8 @@ int BlueFS::add_block_device(unsigned id, string path)
   bdev.push_back(b);
   ioc.push_back(new IOContext(NULL));
   block_all.resize(bdev.size());
+  if (tier_bdev[tier] < 0)
+    tier_bdev[tier] = id;
   return 0;
 }
 
@@ -123,6 +157,63 @@ void BlueFS::get_usage(vector<pair<uint64_t,uint64_t>> *usage)
   }
 }
 
+void BlueFS::dump_usage(Formatter *f)
+{
+  Mutex::Locker l(lock);
+  vector<vector<uint64_t> > used(bdev.size(),
+				 vector<uint64_t>(BLUEFS_FILE_MAX, 0));
+  vector<uint64_t> spilled(bdev.size(), 0);  // extents not on prefer_bdev
+  uint64_t spilled_files = 0;
+  for (auto& p : file_map) {
+    bluefs_fnode_t& fnode = p.second->fnode;
+    unsigned type = fnode.type < BLUEFS_FILE_MAX ?
+      fnode.type : (unsigned)BLUEFS_FILE_OTHER;
+    bool is_spilled = false;
+    for (auto& e : fnode.extents) {
+      used[e.bdev][type] += e.length;
+      if (e.bdev != fnode.prefer_bdev) {
+	spilled[e.bdev] += e.length;
+	is_spilled = true;
+      }
+    }
+    if (is_spilled)
+      ++spilled_files;
+  }
+
+  static const char *tier_name[] = { "wal", "db", "slow" };
+  f->open_array_section("bdevs");
+  for (unsigned id = 0; id < bdev.size(); ++id) {
+    f->open_object_section("bdev");
+    f->dump_unsigned("id", id);
+    f->open_array_section("tiers");
+    for (unsigned t = 0; t < TIER_MAX; ++t) {
+      if (_get_tier_bdev(t) == id)
+	f->dump_string("tier", tier_name[t]);
+    }
+    f->close_section();
+    uint64_t total = 0;
+    for (interval_set<uint64_t>::iterator q = block_all[id].begin();
+	 q != block_all[id].end();
+	 ++q)
+      total += q.get_len();
+    f->dump_unsigned("total", total);
+    f->dump_unsigned("free", alloc.size() ? alloc[id]->get_free() : 0);
+    f->open_object_section("used");
+    for (unsigned t = 0; t < BLUEFS_FILE_MAX; ++t)
+      f->dump_unsigned(bluefs_file_type_name(t), used[id][t]);
+    f->close_section();
+    f->dump_unsigned("spilled", spilled[id]);
+    f->open_object_section("device");
+    bdev[id]->dump_stats(f);
+    f->close_section();
+    f->close_section();
+  }
+  f->close_section();
+  f->dump_unsigned("spilled_files", spilled_files);
+  f->dump_unsigned("spill_back_files", spill_back_files);
+  f->dump_unsigned("spill_back_bytes", spill_back_bytes);
+}
+
 int BlueFS::get_block_extents(unsigned id, interval_set<uint64_t> *extents)
 {
   Mutex::Locker l(lock);
@@ -149,6 +240,7 @@ int BlueFS::mkfs(uuid_d osd_uuid)
   // init log
   FileRef log_file = new File;
   log_file->fnode.ino = 1;
+  log_file->fnode.type = BLUEFS_FILE_LOG;
   log_file->fnode.prefer_bdev = bdev.size() - 1;
   _allocate(log_file->fnode.prefer_bdev,
 	    g_conf->bluefs_max_log_runway,
@@ -241,6 +333,26 @@ int BlueFS::mount()
   assert(log_writer->file->fnode.ino == 1);
   log_writer->pos = log_writer->file->fnode.size;
   dout(10) << __func__ << " log write pos set to " << log_writer->pos << dendl;
+
+  if (bdev.size() > 1 && g_conf->bluefs_spill_back_interval > 0) {
+    spill_back_stop = false;
+    spill_back_thread.create();
+  }
+
+  {
+    SocketHook *hook = new SocketHook(this);
+    AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+    r = admin_socket->register_command("bluefs stats", "bluefs stats", hook,
+				       "show bluefs space by device and file type");
+    if (r == 0) {
+      asok_hook = hook;
+    } else {
+      // only the first bluefs in a process gets the command
+      dout(10) << __func__ << " not registering admin socket command: "
+	       << cpp_strerror(r) << dendl;
+      delete hook;
+    }
+  }
   return 0;
 
  out:
@@ -252,6 +364,19 @@ void BlueFS::umount()
 {
   dout(1) << __func__ << dendl;
 
+  if (asok_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command("bluefs stats");
+    delete asok_hook;
+    asok_hook = NULL;
+  }
+  if (spill_back_thread.is_started()) {
+    lock.Lock();
+    spill_back_stop = true;
+    spill_back_cond.Signal();
+    lock.Unlock();
+    spill_back_thread.join();
+  }
+
   sync_metadata();
 
   _close_writer(log_writer);
@@ -985,7 +1110,7 @@ int BlueFS::_flush_range(FileWriter *h, uint64_t offset, uint64_t length)
     x_off = 0;
   }
   for (unsigned i = 0; i < bdev.size(); ++i) {
-    if (!h->iocv[i]->pending_aios.empty()) {
+    if (h->iocv[i]->has_pending_aios()) {
       bdev[i]->aio_submit(h->iocv[i]);
     }
   }
@@ -1079,20 +1204,60 @@ void BlueFS::_flush_bdev()
   }
 }
 
-int BlueFS::_allocate(unsigned id, uint64_t len, vector<bluefs_extent_t> *ev)
+unsigned BlueFS::_get_tier_bdev(unsigned tier)
+{
+  assert(tier < TIER_MAX);
+  if (tier_bdev[tier] >= 0)
+    return tier_bdev[tier];
+  // no dedicated wal or slow device: those fold into db.  no db device:
+  // the shared (slow) device is all we have.
+  if (tier != TIER_DB && tier_bdev[TIER_DB] >= 0)
+    return tier_bdev[TIER_DB];
+  if (tier_bdev[TIER_SLOW] >= 0)
+    return tier_bdev[TIER_SLOW];
+  return 0;
+}
+
+void BlueFS::_get_spill_order(unsigned id, vector<unsigned> *order)
+{
+  // slower tiers first, then anything else that still has room
+  unsigned t = 0;
+  while (t < TIER_MAX && _get_tier_bdev(t) != id)
+    ++t;
+  for (; t < TIER_MAX; ++t) {
+    unsigned b = _get_tier_bdev(t);
+    if (b != id && std::find(order->begin(), order->end(), b) == order->end())
+      order->push_back(b);
+  }
+  for (unsigned b = 0; b < bdev.size(); ++b) {
+    if (b != id && std::find(order->begin(), order->end(), b) == order->end())
+      order->push_back(b);
+  }
+}
+
+int BlueFS::_allocate(unsigned id, uint64_t len, vector<bluefs_extent_t> *ev,
+		      bool may_spill)
 {
   dout(10) << __func__ << " len " << len << " from " << id << dendl;
   assert(id < alloc.size());
 
   uint64_t left = ROUND_UP_TO(len, g_conf->bluefs_alloc_size);
   int r = alloc[id]->reserve(left);
-  if (r < 0) {
-    if (id) {
-      derr << __func__ << " failed to allocate " << left << " on bdev " << id
-	   << ", free " << alloc[id]->get_free()
-	   << "; fallback to bdev 0" << dendl;
-      return _allocate(0, len, ev);
+  if (r < 0 && may_spill) {
+    vector<unsigned> order;
+    _get_spill_order(id, &order);
+    for (auto alt : order) {
+      if (alloc[alt]->reserve(left) == 0) {
+	derr << __func__ << " failed to allocate " << left << " on bdev " << id
+	     << ", free " << alloc[id]->get_free()
+	     << "; spilling to bdev " << alt << dendl;
+	id = alt;
+	r = 0;
+	break;
+      }
     }
+  }
+  if (r < 0) {
     derr << __func__ << " failed to allocate " << left << " on bdev " << id
 	 << ", free " << alloc[id]->get_free() << dendl;
     return r;
@@ -1138,6 +1303,200 @@ int BlueFS::_preallocate(FileRef f, uint64_t off, uint64_t len)
   return 0;
 }
 
+void BlueFS::_spill_back_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  Mutex::Locker l(lock);
+  while (!spill_back_stop) {
+    _spill_back(g_conf->bluefs_spill_back_max_bytes);
+    utime_t interval;
+    interval.set_from_double(g_conf->bluefs_spill_back_interval);
+    spill_back_cond.WaitInterval(g_ceph_context, lock, interval);
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+void BlueFS::wait_for_spill_back()
+{
+  Mutex::Locker l(lock);
+  assert(spill_back_thread.is_started());
+  uint64_t want = spill_back_passes + (spill_back_running ? 2 : 1);
+  spill_back_cond.Signal();
+  while (spill_back_passes < want)
+    spill_back_done_cond.Wait(lock);
+}
+
+/*
+ * Move files that spilled onto a slower device back to their preferred
+ * device once it has room again.  We leave the preferred device
+ * bluefs_spill_back_min_free_ratio free, so that we do not just spill
+ * again.  Files being written are skipped; everything else is copied with
+ * the lock dropped, and switched over only if it did not change meanwhile.
+ */
+uint64_t BlueFS::_spill_back(uint64_t max_bytes)
+{
+  // _spill_back_file drops the lock; one pass at a time
+  while (spill_back_running)
+    spill_back_done_cond.Wait(lock);
+  spill_back_running = true;
+
+  vector<FileRef> spilled;
+  for (auto& p : file_map) {
+    File *f = p.second.get();
+    if (f->fnode.ino == 1 || f->num_writers.read())
+      continue;
+    for (auto& e : f->fnode.extents) {
+      if (e.bdev != f->fnode.prefer_bdev) {
+	spilled.push_back(f);
+	break;
+      }
+    }
+  }
+  dout(20) << __func__ << " " << spilled.size() << " spilled files" << dendl;
+
+  uint64_t moved = 0;
+  for (auto& f : spilled) {
+    if (moved >= max_bytes || spill_back_stop)
+      break;
+    if (f->deleted || f->num_writers.read())
+      continue;
+    unsigned id = f->fnode.prefer_bdev;
+    uint64_t need = 0;
+    for (auto& e : f->fnode.extents) {
+      if (e.bdev != id)
+	need += e.length;
+    }
+    uint64_t total = 0;
+    for (interval_set<uint64_t>::iterator q = block_all[id].begin();
+	 q != block_all[id].end();
+	 ++q)
+      total += q.get_len();
+    uint64_t free = alloc[id]->get_free();
+    if (free < need ||
+	free - need < total * g_conf->bluefs_spill_back_min_free_ratio) {
+      dout(20) << __func__ << " bdev " << id << " free " << free
+	       << " of " << total << ", not moving " << need << " of "
+	       << f->fnode << dendl;
+      continue;
+    }
+    int r = _spill_back_file(f, &moved);
+    if (r < 0) {
+      dout(10) << __func__ << " " << f->fnode << ": "
+	       << cpp_strerror(r) << dendl;
+    }
+  }
+  if (moved)
+    dout(10) << __func__ << " moved " << moved << " bytes" << dendl;
+  spill_back_running = false;
+  ++spill_back_passes;
+  spill_back_done_cond.Signal();
+  return moved;
+}
+
+int BlueFS::_spill_back_file(FileRef f, uint64_t *moved)
+{
+  dout(10) << __func__ << " " << f->fnode << dendl;
+  unsigned id = f->fnode.prefer_bdev;
+  vector<bluefs_extent_t> old = f->fnode.extents;
+  uint64_t need = 0;
+  for (auto& e : old) {
+    if (e.bdev != id)
+      need += e.length;
+  }
+  vector<bluefs_extent_t> to;
+  int r = _allocate(id, need, &to, false);
+  if (r < 0)
+    return r;
+
+  // lay the file out again: our extents stay, spilled ones map to 'to'
+  vector<bluefs_extent_t> extents;
+  vector<pair<bluefs_extent_t,bluefs_extent_t> > copies;  // from, to
+  vector<bluefs_extent_t>::iterator t = to.begin();
+  uint64_t t_off = 0;
+  for (auto& e : old) {
+    if (e.bdev == id) {
+      extents.push_back(e);
+      continue;
+    }
+    uint64_t e_off = 0;
+    while (e_off < e.length) {
+      assert(t != to.end());
+      uint32_t l = MIN(e.length - e_off, t->length - t_off);
+      l = MIN(l, g_conf->bluefs_max_prefetch);  // bound each copy
+      bluefs_extent_t dst(id, t->offset + t_off, l);
+      copies.push_back(make_pair(
+	  bluefs_extent_t(e.bdev, e.offset + e_off, l), dst));
+      if (!extents.empty() && extents.back().bdev == id &&
+	  extents.back().end() == dst.offset)
+	extents.back().length += l;
+      else
+	extents.push_back(dst);
+      e_off += l;
+      t_off += l;
+      if (t_off == t->length) {
+	++t;
+	t_off = 0;
+      }
+    }
+  }
+  // the allocation was rounded up; give back what we do not need
+  if (t != to.end() && t_off) {
+    alloc[id]->release(t->offset + t_off, t->length - t_off);
+    t->length = t_off;
+    ++t;
+  }
+  for (vector<bluefs_extent_t>::iterator u = t; u != to.end(); ++u)
+    alloc[id]->release(u->offset, u->length);
+  to.erase(t, to.end());
+
+  lock.Unlock();
+  IOContext ioc(NULL);
+  for (auto& c : copies) {
+    bufferlist bl;
+    r = bdev[c.first.bdev]->read(c.first.offset, c.first.length, &bl, &ioc,
+				 false);
+    if (r < 0)
+      break;
+    bdev[id]->aio_write(c.second.offset, bl, &ioc, false);
+    if (ioc.has_pending_aios()) {
+      bdev[id]->aio_submit(&ioc);
+      ioc.aio_wait();
+    }
+    bdev[id]->invalidate_cache(c.second.offset, c.second.length);
+  }
+  if (r == 0)
+    bdev[id]->flush();
+  lock.Lock();
+
+  if (r < 0 || f->deleted || f->num_writers.read() ||
+      f->fnode.extents.size() != old.size() ||
+      !std::equal(old.begin(), old.end(), f->fnode.extents.begin(),
+		  [](const bluefs_extent_t& a, const bluefs_extent_t& b) {
+		    return a.bdev == b.bdev && a.offset == b.offset &&
+		      a.length == b.length;
+		  })) {
+    dout(10) << __func__ << " " << f->fnode.ino
+	     << " changed (or failed) while copying, r = " << r << dendl;
+    for (auto& e : to)
+      alloc[id]->release(e.offset, e.length);
+    return r < 0 ? r : -EAGAIN;
+  }
+
+  f->fnode.extents.swap(extents);
+  log_t.op_file_update(f->fnode);
+  r = _flush_log();
+  assert(r == 0);
+  // the old space is not reused until the next commit, by which time the
+  // log entry pointing away from it is stable.
+  for (auto& c : copies)
+    alloc[c.first.bdev]->release(c.first.offset, c.first.length);
+  ++spill_back_files;
+  spill_back_bytes += need;
+  *moved += need;
+  dout(10) << __func__ << " now " << f->fnode << dendl;
+  return 0;
+}
+
 void BlueFS::sync_metadata()
 {
   Mutex::Locker l(lock);
@@ -1169,7 +1528,8 @@ int BlueFS::open_for_write(
   const string& dirname,
   const string& filename,
   FileWriter **h,
-  bool overwrite)
+  bool overwrite,
+  unsigned type)
 {
   Mutex::Locker l(lock);
   dout(10) << __func__ << " " << dirname << "/" << filename << dendl;
@@ -1184,6 +1544,23 @@ int BlueFS::open_for_write(
     dir = p->second;
   }
 
+  // the "db.slow" and "db.wal" directory names are hard-coded to match
+  // up with bluestore (which sets rocksdb's db_paths and wal_dir to
+  // them); the kv store decides which sst levels go to db.slow.
+  unsigned tier = TIER_DB;
+  if (type == BLUEFS_FILE_WAL ||
+      (dirname.length() > 4 &&
+       strcmp(dirname.c_str() + dirname.length() - 4, ".wal") == 0)) {
+    tier = TIER_WAL;
+  } else if (dirname.length() > 5 &&
+	     strcmp(dirname.c_str() + dirname.length() - 5, ".slow") == 0) {
+    tier = TIER_SLOW;
+  }
+  unsigned prefer_bdev = _get_tier_bdev(tier);
+  dout(20) << __func__ << " mapping " << dirname << "/" << filename
+	   << " (" << bluefs_file_type_name(type) << ") to tier " << tier
+	   << " bdev " << prefer_bdev << dendl;
+
   FileRef file;
   map<string,FileRef>::iterator q = dir->file_map.find(filename);
   if (q == dir->file_map.end()) {
@@ -1196,6 +1573,8 @@ int BlueFS::open_for_write(
     file = new File;
     file->fnode.ino = ++ino_last;
     file->fnode.mtime = ceph_clock_now(NULL);
+    file->fnode.prefer_bdev = prefer_bdev;
+    file->fnode.type = type;
     file_map[ino_last] = file;
     dir->file_map[filename] = file;
     ++file->refs;
@@ -1215,27 +1594,11 @@ int BlueFS::open_for_write(
       file->fnode.size = 0;
     }
     file->fnode.mtime = ceph_clock_now(NULL);
+    file->fnode.prefer_bdev = prefer_bdev;
+    file->fnode.type = type;
     log_t.op_file_update(file->fnode);
   }
 
-  if (dirname.length() > 5) {
-    // the "db.slow" and "db.wal" directory names are hard-coded at
-    // match up with bluestore.  the slow device is always the second
-    // one (when a dedicated block.db device is present and used at
-    // bdev 0).  the wal device is always last.
-    if (strcmp(dirname.c_str() + dirname.length() - 5, ".slow") == 0) {
-      assert(bdev.size() > 1);
-      dout(20) << __func__ << " mapping " << dirname << "/" << filename
-	       << " to bdev 1" << dendl;
-      file->fnode.prefer_bdev = 1;
-    } else if (strcmp(dirname.c_str() + dirname.length() - 4, ".wal") == 0) {
-      assert(bdev.size() > 1);
-      file->fnode.prefer_bdev = bdev.size() - 1;
-      dout(20) << __func__ << " mapping " << dirname << "/" << filename
-	       << " to bdev " << (int)file->fnode.prefer_bdev << dendl;
-    }
-  }
-
   *h = new FileWriter(file, bdev.size());
   dout(10) << __func__ << " h " << *h << " on " << file->fnode << dendl;
   return 0;
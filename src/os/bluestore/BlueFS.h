@@ -6,6 +6,7 @@
 #include "bluefs_types.h"
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
 #include "common/RefCountedObj.h"
 #include "BlockDevice.h"
 
@@ -16,6 +17,14 @@ class Allocator;
 
 class BlueFS {
 public:
+  /// device roles, fastest first; see add_block_device()
+  enum {
+    TIER_WAL = 0,  ///< kv write-ahead logs
+    TIER_DB,       ///< kv tables and metadata
+    TIER_SLOW,     ///< what does not fit on db; shared with bluestore
+    TIER_MAX
+  };
+
   struct File : public RefCountedObject {
     bluefs_fnode_t fnode;
     int refs;
@@ -149,6 +158,25 @@ private:
   Mutex lock;
   Cond cond;
 
+  class SocketHook;
+  SocketHook *asok_hook;      ///< "bluefs stats", if we registered it
+
+  struct SpillBackThread : public Thread {
+    BlueFS *fs;
+    SpillBackThread(BlueFS *f) : fs(f) {}
+    void *entry() {
+      fs->_spill_back_thread();
+      return NULL;
+    }
+  } spill_back_thread;
+  Cond spill_back_cond;
+  Cond spill_back_done_cond;  ///< a pass finished
+  bool spill_back_stop;
+  bool spill_back_running;    ///< a pass is in progress, maybe unlocked
+  uint64_t spill_back_passes; ///< passes completed
+  uint64_t spill_back_files;  ///< files moved back to their preferred bdev
+  uint64_t spill_back_bytes;
+
   // cache
   map<string, Dir*> dir_map;                      ///< dirname -> Dir
   ceph::unordered_map<uint64_t,FileRef> file_map; ///< ino -> File
@@ -174,8 +202,14 @@ private:
    *
    * - a wal device, if present, it always the last device.  it should be
    *   used for any files in the db.wal/ directory.
+   *
+   * which device plays which role is given by tier_bdev.  files are
+   * placed by role (see open_for_write), and when a device fills we
+   * spill to the next slower one.  spilled files move back when room
+   * frees up (see _spill_back).
    */
   vector<BlockDevice*> bdev;                  ///< block devices we can use
+  vector<int> tier_bdev;                      ///< TIER_* -> bdev, or -1
   vector<IOContext*> ioc;                     ///< IOContexts for bdevs
   vector<interval_set<uint64_t> > block_all;  ///< extents in bdev we own
   vector<Allocator*> alloc;                   ///< allocators for bdevs
@@ -190,7 +224,10 @@ private:
   FileRef _get_file(uint64_t ino);
   void _drop_link(FileRef f);
 
-  int _allocate(unsigned bdev, uint64_t len, vector<bluefs_extent_t> *ev);
+  unsigned _get_tier_bdev(unsigned tier);
+  void _get_spill_order(unsigned id, vector<unsigned> *order);
+  int _allocate(unsigned bdev, uint64_t len, vector<bluefs_extent_t> *ev,
+		bool may_spill = true);
   int _flush_range(FileWriter *h, uint64_t offset, uint64_t length);
   int _flush(FileWriter *h, bool force);
   void _flush_wait(FileWriter *h);
@@ -224,6 +261,10 @@ private:
 
   void _close_writer(FileWriter *h);
 
+  void _spill_back_thread();
+  uint64_t _spill_back(uint64_t max_bytes);
+  int _spill_back_file(FileRef f, uint64_t *moved);
+
   // always put the super in the second 4k block.  FIXME should this be
   // block size independent?
   unsigned get_super_offset() {
@@ -248,14 +289,28 @@ public:
   uint64_t get_free(unsigned id);
   void get_usage(vector<pair<uint64_t,uint64_t>> *usage); // [<free,total> ...]
 
+  /// bytes per device per file type, and how much has spilled
+  void dump_usage(Formatter *f);
+
+  /// move spilled files back to their preferred device; return bytes moved
+  uint64_t spill_back(uint64_t max_bytes) {
+    Mutex::Locker l(lock);
+    return _spill_back(max_bytes);
+  }
+
+  /// kick the spill-back thread, and wait for a pass that starts after now
+  void wait_for_spill_back();
+
   /// get current extents that we own for given block device
   int get_block_extents(unsigned id, interval_set<uint64_t> *extents);
 
+  /// type is a BLUEFS_FILE_* hint, used to place the file
   int open_for_write(
     const string& dir,
     const string& file,
     FileWriter **h,
-    bool overwrite);
+    bool overwrite,
+    unsigned type = BLUEFS_FILE_OTHER);
 
   int open_for_read(
     const string& dir,
@@ -292,7 +347,8 @@ public:
   /// compact metadata
   int compact();
 
-  int add_block_device(unsigned bdev, string path);
+  /// the first device added for a tier plays that role (see TIER_*)
+  int add_block_device(unsigned bdev, string path, unsigned tier = TIER_DB);
   uint64_t get_block_device_size(unsigned bdev);
 
   /// gift more block space
@@ -24,6 +24,22 @@ rocksdb::Status err_to_status(int r)
   }
 }
 
+// Tell BlueFS what a file is for, from rocksdb's naming: the write-ahead
+// log is NNNNNN.log and tables are NNNNNN.sst; everything else (MANIFEST,
+// CURRENT, OPTIONS, the LOG info log) is small metadata.
+static unsigned file_type(const std::string& file)
+{
+  size_t dot = file.rfind('.');
+  if (dot != std::string::npos) {
+    std::string ext = file.substr(dot + 1);
+    if (ext == "log")
+      return BLUEFS_FILE_WAL;
+    if (ext == "sst")
+      return BLUEFS_FILE_SST;
+  }
+  return BLUEFS_FILE_OTHER;
+}
+
 // A file abstraction for reading sequentially through a file
 class BlueRocksSequentialFile : public rocksdb::SequentialFile {
   BlueFS *fs;
@@ -361,7 +377,7 @@ rocksdb::Status BlueRocksEnv::NewWritableFile(
   std::string dir, file;
   split(fname, &dir, &file);
   BlueFS::FileWriter *h;
-  int r = fs->open_for_write(dir, file, &h, false);
+  int r = fs->open_for_write(dir, file, &h, false, file_type(file));
   if (r < 0)
     return err_to_status(r);
   result->reset(new BlueRocksWritableFile(fs, h));
@@ -384,7 +400,7 @@ rocksdb::Status BlueRocksEnv::ReuseWritableFile(
     return err_to_status(r);
 
   BlueFS::FileWriter *h;
-  r = fs->open_for_write(new_dir, new_file, &h, true);
+  r = fs->open_for_write(new_dir, new_file, &h, true, file_type(new_file));
   if (r < 0)
     return err_to_status(r);
   result->reset(new BlueRocksWritableFile(fs, h));
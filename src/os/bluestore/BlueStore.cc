@@ -25,6 +25,8 @@
 #include "include/stringify.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
 #include "Allocator.h"
 #include "FreelistManager.h"
 #include "BlueFS.h"
@@ -63,6 +65,7 @@ const string PREFIX_OVERLAY = "V"; // u64 + offset -> data
 const string PREFIX_OMAP = "M";    // u64 + keyname -> value
 const string PREFIX_WAL = "L";     // id -> wal_transaction_t
 const string PREFIX_ALLOC = "B";   // u64 offset -> u64 length (freelist)
+const string PREFIX_ALLOC_BITMAP = "b"; // (see BitmapFreelistManager)
 
 // write a label in the first block.  always use this size.  note that
 // bluefs makes a matching assumption about the location of its
@@ -448,6 +451,355 @@ static void get_wal_key(uint64_t seq, string *out)
   _key_encode_u64(seq, out);
 }
 
+// Cache
+
+BlueStore::Cache *BlueStore::Cache::create(string type)
+{
+  if (type == "lru")
+    return new LRUCache;
+  if (type == "2q")
+    return new TwoQCache;
+  assert(0 == "unrecognized cache type");
+  return NULL;
+}
+
+// LRUCache
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.LRUCache(" << this << ") "
+
+void BlueStore::LRUCache::_trim(uint64_t max_bytes)
+{
+  dout(20) << __func__ << " buffers " << buffer_bytes << " / " << max_bytes
+	   << dendl;
+  while (buffer_bytes > max_bytes) {
+    auto i = buffer_lru.rbegin();
+    if (i == buffer_lru.rend()) {
+      // stop if buffer_lru is now empty
+      break;
+    }
+    Buffer *b = &*i;
+    assert(b->is_clean());
+    dout(20) << __func__ << " rm " << b->offset << "~" << b->length << dendl;
+    b->space->_rm_buffer(b);
+  }
+}
+
+// TwoQCache
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.2QCache(" << this << ") "
+
+void BlueStore::TwoQCache::_add_buffer(Buffer *b, int level)
+{
+  dout(20) << __func__ << " level " << level << " "
+	   << b->offset << "~" << b->length
+	   << " cache_private " << b->cache_private << dendl;
+  if (b->cache_private == BUFFER_NEW) {
+    b->cache_private = BUFFER_WARM_IN;
+    if (level > 0) {
+      buffer_warm_in.push_front(*b);
+    } else {
+      // take caller hint to start at the back of the warm queue
+      buffer_warm_in.push_back(*b);
+    }
+  } else {
+    // we got a hint from discard
+    switch (b->cache_private) {
+    case BUFFER_WARM_IN:
+      // stay in warm_in.  move to front, even though 2Q doesn't actually
+      // do this.
+      dout(20) << __func__ << " move to front of warm " << b->offset << dendl;
+      buffer_warm_in.push_front(*b);
+      break;
+    case BUFFER_WARM_OUT:
+      b->cache_private = BUFFER_HOT;
+      // move to hot.  fall-thru
+    case BUFFER_HOT:
+      dout(20) << __func__ << " move to front of hot " << b->offset << dendl;
+      buffer_hot.push_front(*b);
+      break;
+    default:
+      assert(0 == "bad cache_private");
+    }
+  }
+  if (!b->is_empty()) {
+    buffer_bytes += b->length;
+    buffer_list_bytes[b->cache_private] += b->length;
+  }
+}
+
+void BlueStore::TwoQCache::_rm_buffer(Buffer *b)
+{
+  dout(20) << __func__ << " " << b->offset << "~" << b->length << dendl;
+  if (!b->is_empty()) {
+    assert(buffer_bytes >= b->length);
+    buffer_bytes -= b->length;
+    assert(buffer_list_bytes[b->cache_private] >= b->length);
+    buffer_list_bytes[b->cache_private] -= b->length;
+  }
+  switch (b->cache_private) {
+  case BUFFER_WARM_IN:
+    buffer_warm_in.erase(buffer_warm_in.iterator_to(*b));
+    break;
+  case BUFFER_WARM_OUT:
+    buffer_warm_out.erase(buffer_warm_out.iterator_to(*b));
+    break;
+  case BUFFER_HOT:
+    buffer_hot.erase(buffer_hot.iterator_to(*b));
+    break;
+  default:
+    assert(0 == "bad cache_private");
+  }
+}
+
+void BlueStore::TwoQCache::_adjust_buffer_size(Buffer *b, int64_t delta)
+{
+  dout(20) << __func__ << " delta " << delta << " " << b->offset << dendl;
+  if (!b->is_empty()) {
+    assert((int64_t)buffer_bytes + delta >= 0);
+    buffer_bytes += delta;
+    assert((int64_t)buffer_list_bytes[b->cache_private] + delta >= 0);
+    buffer_list_bytes[b->cache_private] += delta;
+  }
+}
+
+void BlueStore::TwoQCache::_touch_buffer(Buffer *b)
+{
+  switch (b->cache_private) {
+  case BUFFER_WARM_IN:
+    // do nothing (somewhat counter-intuitively!)
+    break;
+  case BUFFER_WARM_OUT:
+    // move from warm_out to hot LRU
+    assert(0 == "this happens via discard hint");
+    break;
+  case BUFFER_HOT:
+    // move to front of hot LRU
+    buffer_hot.erase(buffer_hot.iterator_to(*b));
+    buffer_hot.push_front(*b);
+    break;
+  }
+}
+
+void BlueStore::TwoQCache::_trim(uint64_t max_bytes)
+{
+  dout(20) << __func__ << " buffers " << buffer_bytes << " / " << max_bytes
+	   << dendl;
+
+  // split the budget between the two "real" queues
+  double kin_ratio = g_conf->bluestore_2q_cache_kin_ratio;
+  uint64_t kin = max_bytes * kin_ratio;
+  uint64_t khot = max_bytes - kin;
+
+  // the history (A1out) queue is sized in buffers, based on the
+  // average buffer size we are currently caching
+  uint64_t kout = 0;
+  uint64_t buffer_num = buffer_hot.size() + buffer_warm_in.size();
+  if (buffer_num && buffer_bytes) {
+    uint64_t buffer_avg_size = MAX(1, buffer_bytes / buffer_num);
+    kout = (max_bytes / buffer_avg_size) *
+      g_conf->bluestore_2q_cache_kout_ratio;
+  }
+
+  // let an under-used queue lend its share to the other
+  if (buffer_list_bytes[BUFFER_HOT] < khot) {
+    kin += khot - buffer_list_bytes[BUFFER_HOT];
+  } else if (buffer_list_bytes[BUFFER_WARM_IN] < kin) {
+    khot += kin - buffer_list_bytes[BUFFER_WARM_IN];
+  }
+
+  // demote warm_in -> warm_out, dropping the data
+  while (buffer_list_bytes[BUFFER_WARM_IN] > kin) {
+    auto p = buffer_warm_in.rbegin();
+    if (p == buffer_warm_in.rend())
+      break;
+    Buffer *b = &*p;
+    assert(b->is_clean());
+    dout(20) << __func__ << " buffer_warm_in -> out " << b->offset
+	     << "~" << b->length << dendl;
+    assert(buffer_bytes >= b->length);
+    buffer_bytes -= b->length;
+    buffer_list_bytes[BUFFER_WARM_IN] -= b->length;
+    b->state = Buffer::STATE_EMPTY;
+    b->data.clear();
+    buffer_warm_in.erase(buffer_warm_in.iterator_to(*b));
+    buffer_warm_out.push_front(*b);
+    b->cache_private = BUFFER_WARM_OUT;
+  }
+
+  // evict from the cold end of hot
+  while (buffer_list_bytes[BUFFER_HOT] > khot) {
+    auto p = buffer_hot.rbegin();
+    if (p == buffer_hot.rend())
+      break;
+    Buffer *b = &*p;
+    assert(b->is_clean());
+    dout(20) << __func__ << " buffer_hot rm " << b->offset
+	     << "~" << b->length << dendl;
+    b->space->_rm_buffer(b);
+  }
+
+  // bound the history
+  while (buffer_warm_out.size() > kout) {
+    Buffer *b = &*buffer_warm_out.rbegin();
+    assert(b->is_empty());
+    dout(20) << __func__ << " buffer_warm_out rm " << b->offset
+	     << "~" << b->length << dendl;
+    b->space->_rm_buffer(b);
+  }
+}
+
+// BufferSpace
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.BufferSpace(" << this << ") "
+
+void BlueStore::BufferSpace::_clear()
+{
+  // note: we already hold cache->lock
+  dout(10) << __func__ << dendl;
+  while (!buffer_map.empty()) {
+    _rm_buffer(buffer_map.begin());
+  }
+}
+
+int BlueStore::BufferSpace::_discard(uint64_t offset, uint64_t length)
+{
+  // note: we already hold cache->lock
+  dout(20) << __func__ << " " << offset << "~" << length << dendl;
+  int cache_private = 0;
+  uint64_t end = offset + length;
+  auto i = _data_lower_bound(offset);
+  while (i != buffer_map.end()) {
+    Buffer *b = i->second.get();
+    if (b->offset >= end) {
+      break;
+    }
+    if (b->cache_private > cache_private) {
+      cache_private = b->cache_private;
+    }
+    if (b->is_empty()) {
+      // history only; just forget it
+      _rm_buffer(i++);
+      continue;
+    }
+    if (b->offset < offset) {
+      int64_t front = offset - b->offset;
+      if (b->end() > end) {
+	// drop middle (split)
+	uint64_t tail = b->end() - end;
+	bufferlist bl;
+	bl.substr_of(b->data, b->length - tail, tail);
+	Buffer *nb = new Buffer(this, b->state, b->seq, end, bl);
+	nb->cache_private = b->cache_private;
+	if (b->is_writing()) {
+	  // keep the writing list ordered by seq
+	  buffer_map[end].reset(nb);
+	  writing.insert(writing.iterator_to(*b), *nb);
+	} else {
+	  cache->_adjust_buffer_size(b, front - (int64_t)b->length);
+	  _add_buffer(nb, 0);
+	}
+	b->truncate(front);
+	return cache_private;
+      } else {
+	// drop tail
+	if (!b->is_writing()) {
+	  cache->_adjust_buffer_size(b, front - (int64_t)b->length);
+	}
+	b->truncate(front);
+	++i;
+	continue;
+      }
+    }
+    if (b->end() <= end) {
+      // drop entire buffer
+      _rm_buffer(i++);
+      continue;
+    }
+    // drop front
+    uint64_t keep = b->end() - end;
+    bufferlist bl;
+    bl.substr_of(b->data, b->length - keep, keep);
+    Buffer *nb = new Buffer(this, b->state, b->seq, end, bl);
+    nb->cache_private = b->cache_private;
+    if (b->is_writing()) {
+      buffer_map[end].reset(nb);
+      writing.insert(writing.iterator_to(*b), *nb);
+    } else {
+      _add_buffer(nb, 0);
+    }
+    _rm_buffer(i);
+    break;
+  }
+  return cache_private;
+}
+
+void BlueStore::BufferSpace::read(
+  uint64_t offset, uint64_t length,
+  map<uint64_t,bufferlist>& res,
+  interval_set<uint64_t>& res_intervals)
+{
+  Mutex::Locker l(cache->lock);
+  res.clear();
+  res_intervals.clear();
+  uint64_t end = offset + length;
+  for (auto i = _data_lower_bound(offset);
+       i != buffer_map.end() && offset < end && i->first < end;
+       ++i) {
+    Buffer *b = i->second.get();
+    assert(b->end() > offset);
+    if (b->is_empty()) {
+      continue;
+    }
+    if (b->offset < offset) {
+      uint64_t skip = offset - b->offset;
+      uint64_t l = MIN(length, b->length - skip);
+      res[offset].substr_of(b->data, skip, l);
+      res_intervals.insert(offset, l);
+      offset += l;
+      length -= l;
+    } else {
+      uint64_t l = MIN(end - b->offset, b->length);
+      if (l == b->length) {
+	res[b->offset] = b->data;
+      } else {
+	res[b->offset].substr_of(b->data, 0, l);
+      }
+      res_intervals.insert(b->offset, l);
+      offset = b->offset + l;
+      length = end - offset;
+    }
+    if (b->is_clean()) {
+      cache->_touch_buffer(b);
+    }
+  }
+}
+
+void BlueStore::BufferSpace::finish_write(uint64_t seq)
+{
+  Mutex::Locker l(cache->lock);
+  auto i = writing.begin();
+  while (i != writing.end()) {
+    if (i->seq > seq) {
+      break;
+    }
+    Buffer *b = &*i;
+    writing.erase(i++);
+    if (b->flags & Buffer::FLAG_NOCACHE) {
+      dout(20) << __func__ << " " << b->offset << "~" << b->length
+	       << " seq " << b->seq << " drop" << dendl;
+      buffer_map.erase(b->offset);
+      continue;
+    }
+    dout(20) << __func__ << " " << b->offset << "~" << b->length
+	     << " seq " << b->seq << " clean" << dendl;
+    b->state = Buffer::STATE_CLEAN;
+    cache->_add_buffer(b, 1);
+  }
+}
+
 // Enode
 
 #undef dout_prefix
@@ -468,13 +820,14 @@ void BlueStore::Enode::put()
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.onode(" << this << ") "
 
-BlueStore::Onode::Onode(const ghobject_t& o, const string& k)
+BlueStore::Onode::Onode(const ghobject_t& o, const string& k, CacheRef c)
   : nref(0),
     oid(o),
     key(k),
     dirty(false),
     exists(true),
-    flush_lock("BlueStore::Onode::flush_lock") {
+    flush_lock("BlueStore::Onode::flush_lock"),
+    bc(c) {
 }
 
 void BlueStore::Onode::flush()
@@ -549,7 +902,7 @@ void BlueStore::OnodeHashLRU::rename(const ghobject_t& old_oid,
   OnodeRef o = po->second;
 
   // install a non-existent onode at old location
-  po->second.reset(new Onode(old_oid, o->key));
+  po->second.reset(new Onode(old_oid, o->key, o->bc.cache));
   po->second->exists = false;
   lru.push_back(*po->second);
 
@@ -636,6 +989,7 @@ BlueStore::Collection::Collection(BlueStore *ns, coll_t c)
     cid(c),
     lock("BlueStore::Collection::lock"),
     onode_map(),
+    cache(Cache::create(g_conf->bluestore_cache_type)),
     enode_set(g_conf->bluestore_onode_map_size)
 {
 }
@@ -713,14 +1067,14 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
       return OnodeRef();
 
     // new
-    on = new Onode(oid, key);
+    on = new Onode(oid, key, cache);
     on->dirty = true;
     if (g_conf->bluestore_debug_misc && !create)
       on->exists = on->dirty = false;
   } else {
     // loaded
     assert(r >=0);
-    on = new Onode(oid, key);
+    on = new Onode(oid, key, cache);
     bufferlist::iterator p = v.begin();
     ::decode(on->onode, p);
   }
@@ -743,6 +1097,22 @@ static void aio_cb(void *priv, void *priv2)
   store->_txc_aio_finish(priv2);
 }
 
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore *store;
+public:
+  SocketHook(BlueStore *s) : store(s) {}
+  bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	    bufferlist& out) {
+    Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+    f->open_object_section("bdev");
+    store->bdev->dump_stats(f);
+    f->close_section();
+    f->flush(out);
+    delete f;
+    return true;
+  }
+};
+
 BlueStore::BlueStore(CephContext *cct, const string& path)
   : ObjectStore(path),
     cct(cct),
@@ -756,6 +1126,7 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
     path_fd(-1),
     fsid_fd(-1),
     mounted(false),
+    asok_hook(NULL),
     coll_lock("BlueStore::coll_lock"),
     nid_lock("BlueStore::nid_lock"),
     nid_max(0),
@@ -777,19 +1148,50 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 	     cct->_conf->bluestore_wal_thread_timeout,
 	     cct->_conf->bluestore_wal_thread_suicide_timeout,
 	     &wal_tp),
-    finisher(cct),
+    wal_batch_thread(this),
+    wal_batch_lock("BlueStore::wal_batch_lock"),
+    wal_batch_stop(false),
+    wal_batch(new WALBatch),
     kv_sync_thread(this),
     kv_lock("BlueStore::kv_lock"),
     kv_stop(false),
+    kv_finalize_thread(this),
+    kv_finalize_lock("BlueStore::kv_finalize_lock"),
+    kv_finalize_stop(false),
+    csum_type(BLUESTORE_CSUM_NONE),
+    csum_chunk_order(0),
+    comp_mode(COMP_NONE),
+    comp_type(BLUESTORE_COMPRESSION_NONE),
     logger(NULL),
     reap_lock("BlueStore::reap_lock")
 {
   _init_logger();
+  int num_finishers = MAX(1, cct->_conf->bluestore_shard_finishers);
+  for (int i = 0; i < num_finishers; ++i) {
+    ostringstream oss;
+    oss << "bluestore-" << i;
+    finishers.push_back(new Finisher(cct, oss.str()));
+  }
+  compressors[BLUESTORE_COMPRESSION_NONE] = NULL;
+  for (int t = 1; t < BLUESTORE_COMPRESSION_MAX; ++t) {
+    compressors[t] = Compressor::create(bluestore_compression_type_name(t));
+    assert(compressors[t]);
+  }
 }
 
 BlueStore::~BlueStore()
 {
   _shutdown_logger();
+  for (int t = 0; t < BLUESTORE_COMPRESSION_MAX; ++t) {
+    delete compressors[t];
+  }
+  for (vector<Finisher*>::iterator p = finishers.begin();
+       p != finishers.end();
+       ++p) {
+    delete *p;
+  }
+  assert(wal_batch->empty());
+  delete wal_batch;
   assert(!mounted);
   assert(db == NULL);
   assert(bluefs == NULL);
@@ -798,12 +1200,80 @@ BlueStore::~BlueStore()
 
 void BlueStore::_init_logger()
 {
-  // XXX
+  PerfCountersBuilder b(g_ceph_context, "BlueStore",
+                        l_bluestore_first, l_bluestore_last);
+  b.add_u64_counter(l_bluestore_buffer_hit_bytes, "buffer_hit_bytes",
+		    "Sum for bytes of read hit in the cache");
+  b.add_u64_counter(l_bluestore_buffer_miss_bytes, "buffer_miss_bytes",
+		    "Sum for bytes of read missed in the cache");
+  b.add_time_avg(l_bluestore_compute_csum_lat, "compute_csum_lat",
+		 "Average time spent computing data checksums");
+  b.add_time_avg(l_bluestore_verify_csum_lat, "verify_csum_lat",
+		 "Average time spent verifying data checksums");
+  b.add_u64_counter(l_bluestore_csum_errors, "csum_errors",
+		    "Data checksum mismatches detected on read");
+  b.add_time_avg(l_bluestore_compress_lat, "compress_lat",
+		 "Average compress latency");
+  b.add_time_avg(l_bluestore_decompress_lat, "decompress_lat",
+		 "Average decompress latency");
+  b.add_u64_counter(l_bluestore_compress_success_count,
+		    "compress_success_count",
+		    "Sum for beneficial compress ops");
+  b.add_u64_counter(l_bluestore_compress_rejected_count,
+		    "compress_rejected_count",
+		    "Sum for compress ops rejected due to low net gain of space");
+  b.add_u64_counter(l_bluestore_compressed_bytes, "compressed_bytes",
+		    "Sum for logical bytes stored compressed");
+  b.add_u64_counter(l_bluestore_compressed_allocated, "compressed_allocated",
+		    "Sum for bytes allocated for compressed data");
+  b.add_time_avg(l_bluestore_state_prepare_lat, "state_prepare_lat",
+		 "Average prepare state latency");
+  b.add_time_avg(l_bluestore_state_aio_wait_lat, "state_aio_wait_lat",
+		 "Average aio_wait state latency");
+  b.add_time_avg(l_bluestore_state_io_done_lat, "state_io_done_lat",
+		 "Average io_done state latency");
+  b.add_time_avg(l_bluestore_state_kv_queued_lat, "state_kv_queued_lat",
+		 "Average kv_queued state latency");
+  b.add_time_avg(l_bluestore_state_kv_committing_lat,
+		 "state_kv_committing_lat",
+		 "Average kv_committing state latency");
+  b.add_time_avg(l_bluestore_state_kv_done_lat, "state_kv_done_lat",
+		 "Average kv_done state latency");
+  b.add_time_avg(l_bluestore_state_wal_queued_lat, "state_wal_queued_lat",
+		 "Average wal_queued state latency");
+  b.add_time_avg(l_bluestore_state_wal_applying_lat,
+		 "state_wal_applying_lat",
+		 "Average wal_applying state latency");
+  b.add_time_avg(l_bluestore_state_wal_cleanup_lat, "state_wal_cleanup_lat",
+		 "Average wal_cleanup state latency");
+  b.add_time_avg(l_bluestore_state_finishing_lat, "state_finishing_lat",
+		 "Average finishing state latency");
+  b.add_time_avg(l_bluestore_state_done_lat, "state_done_lat",
+		 "Average done state latency");
+  b.add_time_avg(l_bluestore_commit_lat, "commit_lat",
+		 "Average submit to commit latency");
+  b.add_time_avg(l_bluestore_kv_sync_lat, "kv_sync_lat",
+		 "Average kv sync thread batch commit latency");
+  b.add_u64_counter(l_bluestore_kv_sync_batch, "kv_sync_batch",
+		    "Sum for txcs committed by the kv sync thread");
+  b.add_u64_avg(l_bluestore_wal_batch_txc, "wal_batch_txc",
+		"Average txcs per wal batch");
+  b.add_u64_avg(l_bluestore_wal_batch_bytes, "wal_batch_bytes",
+		"Average bytes written per wal batch");
+  b.add_u64_counter(l_bluestore_wal_write_ops, "wal_write_ops",
+		    "Sum for wal write ios submitted");
+  b.add_u64_counter(l_bluestore_wal_merged_ops, "wal_merged_ops",
+		    "Sum for wal extents merged into an adjacent write io");
+  b.add_u64_counter(l_bluestore_wal_coalesced_bytes, "wal_coalesced_bytes",
+		    "Sum for wal bytes overwritten before reaching disk");
+  logger = b.create_perf_counters();
+  g_ceph_context->get_perfcounters_collection()->add(logger);
 }
 
 void BlueStore::_shutdown_logger()
 {
-  // XXX
+  g_ceph_context->get_perfcounters_collection()->remove(logger);
+  delete logger;
 }
 
 int BlueStore::get_block_device_fsid(const string& path, uuid_d *fsid)
@@ -938,7 +1408,9 @@ int BlueStore::_open_bdev(bool create)
 {
   bluestore_bdev_label_t label;
   assert(bdev == NULL);
-  bdev = new BlockDevice(aio_cb, static_cast<void*>(this));
+  bdev = BlockDevice::create(aio_cb, static_cast<void*>(this));
+  if (!bdev)
+    return -EINVAL;
   string p = path + "/block";
   int r = bdev->open(p);
   if (r < 0)
@@ -965,42 +1437,146 @@ void BlueStore::_close_bdev()
   bdev = NULL;
 }
 
-int BlueStore::_open_alloc()
+int BlueStore::_open_fm(bool create)
 {
   assert(fm == NULL);
-  assert(alloc == NULL);
-  fm = new FreelistManager();
-  int r = fm->init(db, PREFIX_ALLOC);
+  fm = FreelistManager::create(freelist_type, db, PREFIX_ALLOC,
+			       PREFIX_ALLOC_BITMAP);
+  if (!fm) {
+    derr << __func__ << " unknown freelist type " << freelist_type << dendl;
+    return -EINVAL;
+  }
+
+  if (create) {
+    // initialize freespace
+    dout(20) << __func__ << " initializing freespace" << dendl;
+    KeyValueDB::Transaction t = db->get_transaction();
+    fm->create(bdev->get_size(), bdev->get_block_size(), t);
+
+    uint64_t reserved = 0;
+    if (g_conf->bluestore_bluefs) {
+      reserved = BLUEFS_START + g_conf->bluestore_bluefs_initial_length;
+      dout(20) << __func__ << " reserved first " << reserved
+	       << " bytes for bluefs" << dendl;
+      bluefs_extents.insert(BLUEFS_START,
+			    g_conf->bluestore_bluefs_initial_length);
+      bufferlist bl;
+      ::encode(bluefs_extents, bl);
+      t->set(PREFIX_SUPER, "bluefs_extents", bl);
+      dout(20) << __func__ << " bluefs_extents " << bluefs_extents << dendl;
+    }
+    if (reserved)
+      fm->allocate(0, reserved, t);
+    db->submit_transaction_sync(t);
+  }
+
+  int r = fm->init();
   if (r < 0) {
+    derr << __func__ << " freelist init failed: " << cpp_strerror(r) << dendl;
     delete fm;
     fm = NULL;
     return r;
   }
+  return 0;
+}
+
+void BlueStore::_close_fm()
+{
+  dout(10) << __func__ << dendl;
+  assert(fm);
+  fm->shutdown();
+  delete fm;
+  fm = NULL;
+}
+
+int BlueStore::_open_alloc()
+{
+  assert(alloc == NULL);
+  assert(fm);
+  alloc = Allocator::create(g_conf->bluestore_allocator, bdev->get_size(),
+			    bdev->get_block_size());
+  if (!alloc) {
+    derr << __func__ << " unknown bluestore_allocator "
+	 << g_conf->bluestore_allocator << dendl;
+    return -EINVAL;
+  }
 
-  alloc = Allocator::create("stupid");
+  // stream the freelist straight into the allocator
   uint64_t num = 0, bytes = 0;
-  const map<uint64_t,uint64_t>& fl = fm->get_freelist();
-  for (auto& p : fl) {
-    alloc->init_add_free(p.first, p.second);
+  uint64_t offset, length;
+  fm->enumerate_reset();
+  while (fm->enumerate_next(&offset, &length)) {
+    alloc->init_add_free(offset, length);
     ++num;
-    bytes += p.second;
+    bytes += length;
   }
   dout(10) << __func__ << " loaded " << pretty_si_t(bytes)
 	   << " in " << num << " extents"
 	   << dendl;
-  return r;
+  return 0;
 }
 
 void BlueStore::_close_alloc()
 {
-  assert(fm);
   assert(alloc);
   alloc->shutdown();
   delete alloc;
   alloc = NULL;
-  fm->shutdown();
-  delete fm;
-  fm = NULL;
+}
+
+int BlueStore::_set_csum()
+{
+  int t = bluestore_csum_type_from_name(g_conf->bluestore_csum_type);
+  if (t < 0) {
+    derr << __func__ << " unrecognized bluestore_csum_type '"
+	 << g_conf->bluestore_csum_type << "'" << dendl;
+    return -EINVAL;
+  }
+  uint64_t chunk = g_conf->bluestore_csum_block_size;
+  uint64_t min_alloc_size = g_conf->bluestore_min_alloc_size;
+  if (t != BLUESTORE_CSUM_NONE &&
+      (chunk < 4096 || chunk > 65536 || (chunk & (chunk - 1)) ||
+       chunk < bdev->get_block_size() || min_alloc_size % chunk)) {
+    derr << __func__ << " bluestore_csum_block_size " << chunk
+	 << " must be a power of 2 between 4096 and 65536, no smaller than"
+	 << " the device block size " << bdev->get_block_size()
+	 << ", and divide bluestore_min_alloc_size " << min_alloc_size << dendl;
+    return -EINVAL;
+  }
+  csum_type = t;
+  csum_chunk_order = __builtin_ctzll(chunk);
+  dout(10) << __func__ << " " << bluestore_csum_type_name(csum_type)
+	   << " chunk " << chunk << dendl;
+  return 0;
+}
+
+int BlueStore::_set_compression()
+{
+  const string& mode = g_conf->bluestore_compression;
+  if (mode == "none") {
+    comp_mode = COMP_NONE;
+  } else if (mode == "passive") {
+    comp_mode = COMP_PASSIVE;
+  } else if (mode == "aggressive") {
+    comp_mode = COMP_AGGRESSIVE;
+  } else if (mode == "force") {
+    comp_mode = COMP_FORCE;
+  } else {
+    derr << __func__ << " unrecognized bluestore_compression '" << mode
+	 << "'" << dendl;
+    return -EINVAL;
+  }
+  int t = bluestore_compression_type_from_name(
+    g_conf->bluestore_compression_algorithm);
+  if (comp_mode != COMP_NONE && t <= BLUESTORE_COMPRESSION_NONE) {
+    derr << __func__ << " unrecognized bluestore_compression_algorithm '"
+	 << g_conf->bluestore_compression_algorithm << "'" << dendl;
+    return -EINVAL;
+  }
+  comp_type = t;
+  dout(10) << __func__ << " " << mode << " "
+	   << g_conf->bluestore_compression_algorithm << dendl;
+  return 0;
 }
 
 int BlueStore::_open_fsid(bool create)
@@ -1124,6 +1700,30 @@ int BlueStore::_open_db(bool create)
   }
   dout(10) << __func__ << " kv_backend = " << kv_backend << dendl;
 
+  if (create) {
+    freelist_type = g_conf->bluestore_freelist_type;
+  } else {
+    r = read_meta("freelist_type", &freelist_type);
+    if (r < 0) {
+      // stores created before the freelist type was recorded
+      freelist_type = "extent";
+    }
+  }
+  dout(10) << __func__ << " freelist_type = " << freelist_type << dendl;
+
+  // the column family layout is fixed at mkfs
+  string cf_spec;
+  if (create) {
+    cf_spec = g_conf->bluestore_rocksdb_column_families;
+  } else {
+    r = read_meta("kv_column_families", &cf_spec);
+    if (r < 0) {
+      // stores created before column families were recorded
+      cf_spec.clear();
+    }
+  }
+  dout(10) << __func__ << " kv_column_families = " << cf_spec << dendl;
+
   bool do_bluefs;
   if (create) {
     do_bluefs = g_conf->bluestore_bluefs;
@@ -1160,7 +1760,7 @@ int BlueStore::_open_db(bool create)
 
     snprintf(bfn, sizeof(bfn), "%s/block.db", path.c_str());
     if (::stat(bfn, &st) == 0) {
-      bluefs->add_block_device(id, bfn);
+      bluefs->add_block_device(id, bfn, BlueFS::TIER_DB);
       int r = _check_or_set_bdev_label(bfn, bluefs->get_block_device_size(id),
 				       "bluefs db", create);
       if (r < 0)
@@ -1174,7 +1774,7 @@ int BlueStore::_open_db(bool create)
     }
 
     snprintf(bfn, sizeof(bfn), "%s/block", path.c_str());
-    bluefs->add_block_device(id, bfn);
+    bluefs->add_block_device(id, bfn, BlueFS::TIER_SLOW);
     if (create) {
       // note: we might waste a 4k block here if block.db is used, but it's
       // simpler.
@@ -1200,7 +1800,7 @@ int BlueStore::_open_db(bool create)
 
     snprintf(bfn, sizeof(bfn), "%s/block.wal", path.c_str());
     if (::stat(bfn, &st) == 0) {
-      bluefs->add_block_device(id, bfn);
+      bluefs->add_block_device(id, bfn, BlueFS::TIER_WAL);
       int r = _check_or_set_bdev_label(bfn, bluefs->get_block_device_size(id),
 				       "bluefs wal", create);
       if (r < 0)
@@ -1286,6 +1886,51 @@ int BlueStore::_open_db(bool create)
     db = NULL;
     return -EIO;
   }
+  r = FreelistManager::setup_merge_operators(db, freelist_type,
+					     PREFIX_ALLOC_BITMAP);
+  if (r < 0) {
+    derr << __func__ << " freelist type " << freelist_type
+	 << " not supported by kv backend " << kv_backend << ": "
+	 << cpp_strerror(r) << dendl;
+    if (bluefs) {
+      bluefs->umount();
+      delete bluefs;
+      bluefs = NULL;
+    }
+    delete db;
+    db = NULL;
+    return -EINVAL;
+  }
+  if (cf_spec.length()) {
+    vector<KeyValueDB::ColumnFamily> cfs, conf_cfs;
+    r = KeyValueDB::parse_column_families(cf_spec, &cfs);
+    if (r == 0 && !create &&
+	KeyValueDB::parse_column_families(
+	  g_conf->bluestore_rocksdb_column_families, &conf_cfs) == 0) {
+      // options of a family may be retuned, as long as it keeps its prefixes
+      for (auto& cf : cfs) {
+	for (auto& c : conf_cfs) {
+	  if (c.name == cf.name && c.prefixes == cf.prefixes)
+	    cf.options = c.options;
+	}
+      }
+    }
+    if (r == 0)
+      r = db->set_column_families(cfs);
+    if (r < 0) {
+      derr << __func__ << " column families '" << cf_spec
+	   << "' not supported by kv backend " << kv_backend << ": "
+	   << cpp_strerror(r) << dendl;
+      if (bluefs) {
+	bluefs->umount();
+	delete bluefs;
+	bluefs = NULL;
+      }
+      delete db;
+      db = NULL;
+      return -EINVAL;
+    }
+  }
   string options;
   if (kv_backend == "rocksdb")
     options = g_conf->bluestore_rocksdb_options;
@@ -1579,39 +2224,26 @@ int BlueStore::mkfs()
   if (r < 0)
     goto out_close_bdev;
 
-  r = _open_alloc();
+  r = _open_fm(true);
   if (r < 0)
     goto out_close_db;
 
-  // initialize freespace
-  {
-    dout(20) << __func__ << " initializing freespace" << dendl;
-    KeyValueDB::Transaction t = db->get_transaction();
-    uint64_t reserved = 0;
-    if (g_conf->bluestore_bluefs) {
-      reserved = BLUEFS_START + g_conf->bluestore_bluefs_initial_length;
-      dout(20) << __func__ << " reserved first " << reserved
-	       << " bytes for bluefs" << dendl;
-      bluefs_extents.insert(BLUEFS_START,
-			    g_conf->bluestore_bluefs_initial_length);
-      bufferlist bl;
-      ::encode(bluefs_extents, bl);
-      t->set(PREFIX_SUPER, "bluefs_extents", bl);
-      dout(20) << __func__ << " bluefs_extents " << bluefs_extents << dendl;
-    }
-    fm->release(reserved, bdev->get_size() - reserved, t);
-    db->submit_transaction_sync(t);
-  }
-
   r = write_meta("kv_backend", g_conf->bluestore_backend);
   if (r < 0)
-    goto out_close_alloc;
+    goto out_close_fm;
   r = write_meta("bluefs", stringify((int)g_conf->bluestore_bluefs));
   if (r < 0)
-    goto out_close_alloc;
+    goto out_close_fm;
+  r = write_meta("freelist_type", freelist_type);
+  if (r < 0)
+    goto out_close_fm;
+  r = write_meta("kv_column_families",
+		 g_conf->bluestore_rocksdb_column_families);
+  if (r < 0)
+    goto out_close_fm;
   r = write_meta("type", "bluestore");
   if (r < 0)
-    goto out_close_alloc;
+    goto out_close_fm;
 
   // indicate mkfs completion/success by writing the fsid file
   r = _write_fsid();
@@ -1620,8 +2252,8 @@ int BlueStore::mkfs()
   else
     derr << __func__ << " error writing fsid: " << cpp_strerror(r) << dendl;
 
- out_close_alloc:
-  _close_alloc();
+ out_close_fm:
+  _close_fm();
  out_close_db:
   _close_db();
  out_close_bdev:
@@ -1666,14 +2298,26 @@ int BlueStore::mount()
   if (r < 0)
     goto out_fsid;
 
+  r = _set_csum();
+  if (r < 0)
+    goto out_bdev;
+
+  r = _set_compression();
+  if (r < 0)
+    goto out_bdev;
+
   r = _open_db(false);
   if (r < 0)
     goto out_bdev;
 
-  r = _open_alloc();
+  r = _open_fm(false);
   if (r < 0)
     goto out_db;
 
+  r = _open_alloc();
+  if (r < 0)
+    goto out_fm;
+
   r = _open_super_meta();
   if (r < 0)
     goto out_alloc;
@@ -1688,24 +2332,46 @@ int BlueStore::mount()
       goto out_alloc;
   }
 
-  finisher.start();
+  for (auto f : finishers) {
+    f->start();
+  }
   wal_tp.start();
-  kv_sync_thread.create();
+  _kv_start();
 
   r = _wal_replay();
   if (r < 0)
     goto out_stop;
 
+  {
+    SocketHook *hook = new SocketHook(this);
+    AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+    r = admin_socket->register_command("bluestore bdev stats",
+				       "bluestore bdev stats", hook,
+				       "show aio queue stats for the main device");
+    if (r == 0) {
+      asok_hook = hook;
+    } else {
+      // only the first bluestore in a process gets the command
+      dout(10) << __func__ << " not registering admin socket command: "
+	       << cpp_strerror(r) << dendl;
+      delete hook;
+    }
+  }
+
   mounted = true;
   return 0;
 
  out_stop:
   _kv_stop();
   wal_tp.stop();
-  finisher.wait_for_empty();
-  finisher.stop();
+  for (auto f : finishers) {
+    f->wait_for_empty();
+    f->stop();
+  }
  out_alloc:
   _close_alloc();
+ out_fm:
+  _close_fm();
  out_db:
   _close_db();
  out_bdev:
@@ -1722,6 +2388,13 @@ int BlueStore::umount()
   assert(mounted);
   dout(1) << __func__ << dendl;
 
+  if (asok_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command(
+      "bluestore bdev stats");
+    delete asok_hook;
+    asok_hook = NULL;
+  }
+
   _sync();
   _reap_collections();
   coll_map.clear();
@@ -1732,14 +2405,17 @@ int BlueStore::umount()
   wal_wq.drain();
   dout(20) << __func__ << " stopping wal_tp" << dendl;
   wal_tp.stop();
-  dout(20) << __func__ << " draining finisher" << dendl;
-  finisher.wait_for_empty();
-  dout(20) << __func__ << " stopping finisher" << dendl;
-  finisher.stop();
+  for (auto f : finishers) {
+    dout(20) << __func__ << " draining finisher" << dendl;
+    f->wait_for_empty();
+    dout(20) << __func__ << " stopping finisher" << dendl;
+    f->stop();
+  }
   dout(20) << __func__ << " closing" << dendl;
 
   mounted = false;
   _close_alloc();
+  _close_fm();
   _close_db();
   _close_bdev();
   _close_fsid();
@@ -1822,10 +2498,14 @@ int BlueStore::fsck()
   if (r < 0)
     goto out_bdev;
 
-  r = _open_alloc();
+  r = _open_fm(false);
   if (r < 0)
     goto out_db;
 
+  r = _open_alloc();
+  if (r < 0)
+    goto out_fm;
+
   r = _open_super_meta();
   if (r < 0)
     goto out_alloc;
@@ -1902,6 +2582,30 @@ int BlueStore::fsck()
 	    ++errors;
 	  }
 	}
+	// compressed blobs
+	for (auto& cb : o->onode.compressed_map) {
+	  if (cb.first + cb.second.raw_length > o->onode.size) {
+	    derr << " " << oid << " compressed " << cb.first << ": "
+		 << cb.second << " extends past end of object" << dendl;
+	    ++errors;
+	  }
+	  for (auto& e : cb.second.extents) {
+	    if (e.has_flag(bluestore_extent_t::FLAG_SHARED))
+	      hash_shared.push_back(e);
+	    if (used_blocks.intersects(e.offset, e.length)) {
+	      derr << " " << oid << " compressed " << cb.first << ": "
+		   << cb.second << " already allocated" << dendl;
+	      ++errors;
+	      continue;
+	    }
+	    used_blocks.insert(e.offset, e.length);
+	    if (e.end() > bdev->get_size()) {
+	      derr << " " << oid << " compressed " << cb.first << ": "
+		   << cb.second << " past end of block device" << dendl;
+	      ++errors;
+	    }
+	  }
+	}
 	// overlays
 	set<string> overlay_keys;
 	map<uint64_t,int> refs;
@@ -2011,7 +2715,8 @@ int BlueStore::fsck()
   }
 
   dout(1) << __func__ << " checking for stray objects" << dendl;
-  it = db->get_iterator(PREFIX_OBJ);
+  it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE |
+			KeyValueDB::ITERATOR_PREFETCH);
   if (it) {
     CollectionRef c;
     for (it->lower_bound(string()); it->valid(); it->next()) {
@@ -2045,7 +2750,8 @@ int BlueStore::fsck()
   }
 
   dout(1) << __func__ << " checking for stray overlay data" << dendl;
-  it = db->get_iterator(PREFIX_OVERLAY);
+  it = db->get_iterator(PREFIX_OVERLAY, KeyValueDB::ITERATOR_NOCACHE |
+			KeyValueDB::ITERATOR_PREFETCH);
   if (it) {
     for (it->lower_bound(string()); it->valid(); it->next()) {
       string key = it->key();
@@ -2060,7 +2766,8 @@ int BlueStore::fsck()
   }
 
   dout(1) << __func__ << " checking for stray omap data" << dendl;
-  it = db->get_iterator(PREFIX_OMAP);
+  it = db->get_iterator(PREFIX_OMAP, KeyValueDB::ITERATOR_NOCACHE |
+			KeyValueDB::ITERATOR_PREFETCH);
   if (it) {
     for (it->lower_bound(string()); it->valid(); it->next()) {
       string key = it->key();
@@ -2098,20 +2805,20 @@ int BlueStore::fsck()
 
   dout(1) << __func__ << " checking freelist vs allocated" << dendl;
   {
-    const map<uint64_t,uint64_t>& free = fm->get_freelist();
-    for (map<uint64_t,uint64_t>::const_iterator p = free.begin();
-	 p != free.end(); ++p) {
-      if (used_blocks.intersects(p->first, p->second)) {
-	derr << __func__ << " free extent " << p->first << "~" << p->second
+    uint64_t offset, length;
+    fm->enumerate_reset();
+    while (fm->enumerate_next(&offset, &length)) {
+      if (used_blocks.intersects(offset, length)) {
+	derr << __func__ << " free extent " << offset << "~" << length
 	     << " intersects allocated blocks" << dendl;
 	interval_set<uint64_t> free, overlap;
-	free.insert(p->first, p->second);
+	free.insert(offset, length);
 	overlap.intersection_of(free, used_blocks);
 	derr << __func__ << " overlap: " << overlap << dendl;
 	++errors;
 	continue;
       }
-      used_blocks.insert(p->first, p->second);
+      used_blocks.insert(offset, length);
     }
     if (!used_blocks.contains(0, bdev->get_size())) {
       derr << __func__ << " leaked some space; free+used = "
@@ -2125,6 +2832,8 @@ int BlueStore::fsck()
   coll_map.clear();
  out_alloc:
   _close_alloc();
+ out_fm:
+  _close_fm();
  out_db:
   it.reset();  // before db is closed
   _close_db();
@@ -2146,13 +2855,34 @@ void BlueStore::_sync()
   // flush aios in flght
   bdev->flush();
 
-  kv_lock.Lock();
-  while (!kv_committing.empty() ||
-	 !kv_queue.empty()) {
-    dout(20) << " waiting for kv to commit" << dendl;
-    kv_sync_cond.Wait(kv_lock);
+  // committing may apply wal, which needs another commit to clean up
+  while (true) {
+    _wal_batch_flush();
+
+    kv_lock.Lock();
+    while (!kv_committing.empty() ||
+	   !kv_queue.empty() ||
+	   !wal_cleaning.empty() ||
+	   !wal_cleanup_queue.empty()) {
+      dout(20) << " waiting for kv to commit" << dendl;
+      kv_sync_cond.Wait(kv_lock);
+    }
+    kv_lock.Unlock();
+
+    kv_finalize_lock.Lock();
+    while (!kv_finalizing.empty() ||
+	   !kv_committed_queue.empty() ||
+	   !wal_finalizing.empty() ||
+	   !wal_cleaned_queue.empty()) {
+      dout(20) << " waiting for kv to finalize" << dendl;
+      kv_finalize_sync_cond.Wait(kv_finalize_lock);
+    }
+    kv_finalize_lock.Unlock();
+
+    Mutex::Locker l(wal_batch_lock);
+    if (wal_batch->empty())
+      break;
   }
-  kv_lock.Unlock();
 
   dout(10) << __func__ << " done" << dendl;
 }
@@ -2162,7 +2892,7 @@ int BlueStore::statfs(struct statfs *buf)
   memset(buf, 0, sizeof(*buf));
   buf->f_blocks = bdev->get_size() / bdev->get_block_size();
   buf->f_bsize = bdev->get_block_size();
-  buf->f_bfree = fm->get_total_free() / bdev->get_block_size();
+  buf->f_bfree = alloc->get_free() / bdev->get_block_size();
   buf->f_bavail = buf->f_bfree;
   dout(20) << __func__ << " free " << pretty_si_t(buf->f_bfree * buf->f_bsize)
 	   << " / " << pretty_si_t(buf->f_blocks * buf->f_bsize) << dendl;
@@ -2304,9 +3034,13 @@ int BlueStore::_do_read(
 {
   map<uint64_t,bluestore_extent_t>::iterator bp, bend;
   map<uint64_t,bluestore_overlay_t>::iterator op, oend;
+  map<uint64_t,bluestore_compressed_t>::iterator cp, cend;
   uint64_t block_size = bdev->get_block_size();
   int r;
   IOContext ioc(NULL);   // FIXME?
+  map<uint64_t,bufferlist> ready;
+  interval_set<uint64_t> ready_intervals;
+  bool cached = false;
 
   // generally, don't buffer anything, unless the client explicitly requests
   // it.
@@ -2315,6 +3049,9 @@ int BlueStore::_do_read(
     dout(20) << __func__ << " will do buffered read" << dendl;
     buffered = true;
   }
+  bool cache_read =
+    (buffered || g_conf->bluestore_default_buffered_read) &&
+    !(op_flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
 
   dout(20) << __func__ << " " << offset << "~" << length << " size "
 	   << o->onode.size << dendl;
@@ -2330,6 +3067,21 @@ int BlueStore::_do_read(
     length = o->onode.size - offset;
   }
 
+  // check the buffer cache first.  it holds recently written data, so
+  // a complete hit does not need to wait for the txc(s) to commit.
+  o->bc.read(offset, length, ready, ready_intervals);
+  if ((uint64_t)ready_intervals.size() == length) {
+    dout(20) << __func__ << " cache hit " << offset << "~" << length << dendl;
+    for (auto& p : ready) {
+      bl.claim_append(p.second);
+    }
+    logger->inc(l_bluestore_buffer_hit_bytes, length);
+    r = bl.length();
+    goto out;
+  }
+  logger->inc(l_bluestore_buffer_hit_bytes, ready_intervals.size());
+  logger->inc(l_bluestore_buffer_miss_bytes, length - ready_intervals.size());
+
   o->flush();
 
   r = 0;
@@ -2345,6 +3097,8 @@ int BlueStore::_do_read(
   if (op != o->onode.overlay_map.begin()) {
     --op;
   }
+  cend = o->onode.compressed_map.end();
+  cp = o->onode.seek_compressed(offset);
   while (length > 0) {
     if (op != oend && op->first + op->second.length < offset) {
       dout(20) << __func__ << " skip overlay " << op->first << " " << op->second
@@ -2358,6 +3112,10 @@ int BlueStore::_do_read(
       ++bp;
       continue;
     }
+    if (cp != cend && cp->first + cp->second.raw_length <= offset) {
+      ++cp;
+      continue;
+    }
 
     // overlay?
     if (op != oend && op->first <= offset) {
@@ -2384,11 +3142,55 @@ int BlueStore::_do_read(
       x_len = op->first - offset;
     }
 
+    // compressed?
+    if (cp != cend && cp->first <= offset) {
+      uint64_t x_off = offset - cp->first;
+      x_len = MIN(x_len, cp->second.raw_length - x_off);
+      if (ready_intervals.contains(offset, x_len)) {
+	dout(30) << __func__ << " compressed " << cp->first << ": "
+		 << cp->second << " use " << x_off << "~" << x_len
+		 << " from cache" << dendl;
+	_append_cached(ready, offset, x_len, &bl);
+      } else {
+	dout(30) << __func__ << " compressed " << cp->first << ": "
+		 << cp->second << " use " << x_off << "~" << x_len << dendl;
+	bufferlist raw;
+	r = _do_read_compressed(o, cp->first, cp->second, &raw, &ioc,
+				buffered);
+	if (r < 0) {
+	  goto out;
+	}
+	bufferlist u;
+	u.substr_of(raw, x_off, x_len);
+	if (cache_read) {
+	  // keep the whole blob so we don't decompress it again
+	  o->bc.did_read(cp->first, raw);
+	  cached = true;
+	}
+	bl.claim_append(u);
+      }
+      offset += x_len;
+      length -= x_len;
+      if (x_off + x_len == cp->second.raw_length) {
+	++cp;
+      }
+      continue;
+    }
+    if (cp != cend &&
+	cp->first > offset &&
+	cp->first - offset < x_len) {
+      x_len = cp->first - offset;
+    }
+
     // extent?
     if (bp != bend && bp->first <= offset) {
       uint64_t x_off = offset - bp->first;
       x_len = MIN(x_len, bp->second.length - x_off);
-      if (!bp->second.has_flag(bluestore_extent_t::FLAG_UNWRITTEN)) {
+      if (ready_intervals.contains(offset, x_len)) {
+	dout(30) << __func__ << " data " << bp->first << ": " << bp->second
+		 << " use " << x_off << "~" << x_len << " from cache" << dendl;
+	_append_cached(ready, offset, x_len, &bl);
+      } else if (!bp->second.has_flag(bluestore_extent_t::FLAG_UNWRITTEN)) {
 	dout(30) << __func__ << " data " << bp->first << ": " << bp->second
 		 << " use " << x_off << "~" << x_len
 		 << " final offset " << x_off + bp->second.offset
@@ -2396,15 +3198,35 @@ int BlueStore::_do_read(
 	uint64_t front_extra = x_off % block_size;
 	uint64_t r_off = x_off - front_extra;
 	uint64_t r_len = ROUND_UP_TO(x_len + front_extra, block_size);
+	if (o->onode.has_csum()) {
+	  // widen to whole csum chunks (within this extent) so we can verify
+	  uint64_t chunk = o->onode.get_csum_chunk_size();
+	  uint64_t c_off = MAX(offset & ~(chunk - 1), bp->first);
+	  uint64_t c_end = MIN(ROUND_UP_TO(offset + x_len, chunk),
+			       bp->first + bp->second.length);
+	  r_off = c_off - bp->first;
+	  r_len = ROUND_UP_TO(c_end - c_off, block_size);
+	  front_extra = offset - c_off;
+	}
 	dout(30) << __func__ << "  reading " << r_off << "~" << r_len << dendl;
 	bufferlist t;
 	r = bdev->read(r_off + bp->second.offset, r_len, &t, &ioc, buffered);
 	if (r < 0) {
 	  goto out;
 	}
+	if (o->onode.has_csum()) {
+	  r = _verify_csum(o, bp->first + r_off, t);
+	  if (r < 0) {
+	    goto out;
+	  }
+	}
 	r = r_len;
 	bufferlist u;
 	u.substr_of(t, front_extra, x_len);
+	if (cache_read) {
+	  o->bc.did_read(offset, u);
+	  cached = true;
+	}
 	bl.claim_append(u);
       } else {
 	// unwritten (zero) extent
@@ -2439,9 +3261,117 @@ int BlueStore::_do_read(
   r = bl.length();
 
  out:
+  if (cached) {
+    o->bc.cache->trim(g_conf->bluestore_buffer_cache_size);
+  }
   return r;
 }
 
+void BlueStore::_append_cached(
+  map<uint64_t,bufferlist>& ready,
+  uint64_t offset,
+  uint64_t length,
+  bufferlist *out)
+{
+  map<uint64_t,bufferlist>::iterator p = ready.upper_bound(offset);
+  assert(p != ready.begin());
+  --p;
+  while (length > 0) {
+    assert(p != ready.end());
+    assert(p->first <= offset);
+    uint64_t x_off = offset - p->first;
+    assert(x_off < p->second.length());
+    uint64_t x_len = MIN(length, p->second.length() - x_off);
+    bufferlist t;
+    t.substr_of(p->second, x_off, x_len);
+    out->claim_append(t);
+    offset += x_len;
+    length -= x_len;
+    ++p;
+  }
+}
+
+int BlueStore::_verify_csum(
+  OnodeRef o,
+  uint64_t offset,
+  bufferlist& bl)
+{
+  uint64_t chunk = o->onode.get_csum_chunk_size();
+  uint64_t start = ROUND_UP_TO(offset, chunk);
+  uint64_t end = (offset + bl.length()) & ~(chunk - 1);
+  utime_t begin = ceph_clock_now(g_ceph_context);
+  int r = 0;
+  for (uint64_t pos = start; pos < end; pos += chunk) {
+    uint64_t expected = o->onode.get_csum_item(pos >> o->onode.csum_chunk_order);
+    if (!expected)
+      continue;
+    map<uint64_t,bluestore_overlay_t>::iterator op =
+      o->onode.overlay_map.lower_bound(pos + chunk);
+    if (op != o->onode.overlay_map.begin() &&
+	(--op)->first + op->second.length > pos) {
+      // overlay data is newer than what is on disk
+      continue;
+    }
+    bufferlist t;
+    t.substr_of(bl, pos - offset, chunk);
+    uint64_t actual = bluestore_csum_calc(o->onode.csum_type, t);
+    if (actual != expected) {
+      derr << __func__ << " " << o->oid << " bad "
+	   << bluestore_csum_type_name(o->onode.csum_type)
+	   << " csum on chunk " << pos << "~" << chunk
+	   << ", expected 0x" << std::hex << expected
+	   << " != actual 0x" << actual << std::dec << dendl;
+      logger->inc(l_bluestore_csum_errors);
+      r = -EIO;
+      break;
+    }
+  }
+  logger->tinc(l_bluestore_verify_csum_lat,
+	       ceph_clock_now(g_ceph_context) - begin);
+  return r;
+}
+
+int BlueStore::_do_read_compressed(
+  OnodeRef o,
+  uint64_t offset,
+  const bluestore_compressed_t& cb,
+  bufferlist *raw,
+  IOContext *ioc,
+  bool buffered)
+{
+  bufferlist cbl;
+  for (auto& e : cb.extents) {
+    bufferlist t;
+    int r = bdev->read(e.offset, e.length, &t, ioc, buffered);
+    if (r < 0)
+      return r;
+    cbl.claim_append(t);
+  }
+  if (cb.type >= BLUESTORE_COMPRESSION_MAX || !compressors[cb.type] ||
+      cbl.length() < cb.length) {
+    derr << __func__ << " " << o->oid << " bad compressed blob " << offset
+	 << ": " << cb << dendl;
+    return -EIO;
+  }
+  bufferlist t;
+  t.substr_of(cbl, 0, cb.length);
+  utime_t start = ceph_clock_now(g_ceph_context);
+  int r = compressors[cb.type]->decompress(t, *raw);
+  logger->tinc(l_bluestore_decompress_lat,
+	       ceph_clock_now(g_ceph_context) - start);
+  if (r < 0 || raw->length() != cb.raw_length) {
+    derr << __func__ << " " << o->oid << " failed to decompress " << offset
+	 << ": " << cb << dendl;
+    return -EIO;
+  }
+  if (o->onode.has_csum()) {
+    r = _verify_csum(o, offset, *raw);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
 int BlueStore::fiemap(
   coll_t cid,
   const ghobject_t& oid,
@@ -2475,6 +3405,7 @@ int BlueStore::fiemap(
 
   map<uint64_t,bluestore_extent_t>::iterator bp, bend;
   map<uint64_t,bluestore_overlay_t>::iterator op, oend;
+  map<uint64_t,bluestore_compressed_t>::iterator cp, cend;
 
   // loop over overlays and data fragments.  overlays take precedence.
   bend = o->onode.block_map.end();
@@ -2487,6 +3418,8 @@ int BlueStore::fiemap(
   if (op != o->onode.overlay_map.begin()) {
     --op;
   }
+  cend = o->onode.compressed_map.end();
+  cp = o->onode.seek_compressed(offset);
   uint64_t start = offset;
   while (len > 0) {
     if (op != oend && op->first + op->second.length < offset) {
@@ -2497,6 +3430,10 @@ int BlueStore::fiemap(
       ++bp;
       continue;
     }
+    if (cp != cend && cp->first + cp->second.raw_length <= offset) {
+      ++cp;
+      continue;
+    }
 
     // overlay?
     if (op != oend && op->first <= offset) {
@@ -2527,6 +3464,21 @@ int BlueStore::fiemap(
 	++bp;
       continue;
     }
+    // compressed?
+    if (cp != cend && cp->first <= offset) {
+      uint64_t x_off = offset - cp->first;
+      x_len = MIN(x_len, cp->second.raw_length - x_off);
+      dout(30) << __func__ << " compressed " << offset << "~" << x_len << dendl;
+      len -= x_len;
+      offset += x_len;
+      if (x_off + x_len == cp->second.raw_length)
+	++cp;
+      continue;
+    }
+    if (bp != bend && bp->first > offset && bp->first - offset < x_len)
+      x_len = bp->first - offset;
+    if (cp != cend && cp->first > offset && cp->first - offset < x_len)
+      x_len = cp->first - offset;
     // we are seeing a hole, time to add an entry to fiemap.
     m[start] = offset - start;
     dout(20) << __func__ << " out " << start << "~" << m[start] << dendl;
@@ -2671,7 +3623,7 @@ int BlueStore::collection_list(
 	   << " and " << pretty_binary_string(start_key)
 	   << " to " << pretty_binary_string(end_key)
 	   << " start " << start << dendl;
-  it = db->get_iterator(PREFIX_OBJ);
+  it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_PREFETCH);
   if (start == ghobject_t() ||
       start.hobj == hobject_t() ||
       start == cid.get_min_hobj()) {
@@ -2867,7 +3819,8 @@ int BlueStore::omap_get(
     goto out;
   o->flush();
   {
-    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP,
+					       KeyValueDB::ITERATOR_PREFETCH);
     string head, tail;
     get_omap_header(o->onode.omap_head, &head);
     get_omap_tail(o->onode.omap_head, &tail);
@@ -2951,7 +3904,8 @@ int BlueStore::omap_get_keys(
     goto out;
   o->flush();
   {
-    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
+    KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP,
+					       KeyValueDB::ITERATOR_PREFETCH);
     string head, tail;
     get_omap_key(o->onode.omap_head, string(), &head);
     get_omap_tail(o->onode.omap_head, &tail);
@@ -2996,14 +3950,26 @@ int BlueStore::omap_get_values(
   if (!o->onode.omap_head)
     goto out;
   o->flush();
-  for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-    string key;
-    get_omap_key(o->onode.omap_head, *p, &key);
-    bufferlist val;
-    if (db->get(PREFIX_OMAP, key, &val) >= 0) {
-      dout(30) << __func__ << "  got " << pretty_binary_string(key)
-	       << " -> " << *p << dendl;
-      out->insert(make_pair(*p, val));
+  {
+    vector<string> db_keys;
+    vector<bufferlist> vals;
+    vector<int> rs;
+    db_keys.reserve(keys.size());
+    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
+      db_keys.push_back(string());
+      get_omap_key(o->onode.omap_head, *p, &db_keys.back());
+    }
+    r = db->get_many(PREFIX_OMAP, db_keys, &vals, &rs);
+    if (r < 0)
+      goto out;
+    unsigned i = 0;
+    for (set<string>::const_iterator p = keys.begin(); p != keys.end();
+	 ++p, ++i) {
+      if (rs[i] == 0) {
+	dout(30) << __func__ << "  got " << pretty_binary_string(db_keys[i])
+		 << " -> " << *p << dendl;
+	out->insert(make_pair(*p, vals[i]));
+      }
     }
   }
  out:
@@ -3032,17 +3998,29 @@ int BlueStore::omap_check_keys(
   if (!o->onode.omap_head)
     goto out;
   o->flush();
-  for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-    string key;
-    get_omap_key(o->onode.omap_head, *p, &key);
-    bufferlist val;
-    if (db->get(PREFIX_OMAP, key, &val) >= 0) {
-      dout(30) << __func__ << "  have " << pretty_binary_string(key)
-	       << " -> " << *p << dendl;
-      out->insert(*p);
-    } else {
-      dout(30) << __func__ << "  miss " << pretty_binary_string(key)
-	       << " -> " << *p << dendl;
+  {
+    vector<string> db_keys;
+    vector<bufferlist> vals;
+    vector<int> rs;
+    db_keys.reserve(keys.size());
+    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
+      db_keys.push_back(string());
+      get_omap_key(o->onode.omap_head, *p, &db_keys.back());
+    }
+    r = db->get_many(PREFIX_OMAP, db_keys, &vals, &rs);
+    if (r < 0)
+      goto out;
+    unsigned i = 0;
+    for (set<string>::const_iterator p = keys.begin(); p != keys.end();
+	 ++p, ++i) {
+      if (rs[i] == 0) {
+	dout(30) << __func__ << "  have " << pretty_binary_string(db_keys[i])
+		 << " -> " << *p << dendl;
+	out->insert(*p);
+      } else {
+	dout(30) << __func__ << "  miss " << pretty_binary_string(db_keys[i])
+		 << " -> " << *p << dendl;
+      }
     }
   }
  out:
@@ -3070,7 +4048,8 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
   }
   o->flush();
   dout(10) << __func__ << " header = " << o->onode.omap_head <<dendl;
-  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP);
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OMAP,
+					     KeyValueDB::ITERATOR_PREFETCH);
   return ObjectMap::ObjectMapIterator(new OmapIteratorImpl(c, o, it));
 }
 
@@ -3164,6 +4143,7 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	     << " " << txc->get_state_name() << dendl;
     switch (txc->state) {
     case TransContext::STATE_PREPARE:
+      txc->log_state_latency(logger, l_bluestore_state_prepare_lat);
       if (txc->ioc.has_aios()) {
 	txc->state = TransContext::STATE_AIO_WAIT;
 	_txc_aio_submit(txc);
@@ -3172,14 +4152,19 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       // ** fall-thru **
 
     case TransContext::STATE_AIO_WAIT:
+      txc->log_state_latency(logger, l_bluestore_state_aio_wait_lat);
       _txc_finish_io(txc);  // may trigger blocked txc's too
       return;
 
     case TransContext::STATE_IO_DONE:
       assert(txc->osr->qlock.is_locked());  // see _txc_finish_io
+      txc->log_state_latency(logger, l_bluestore_state_io_done_lat);
       txc->state = TransContext::STATE_KV_QUEUED;
       if (!g_conf->bluestore_sync_transaction) {
 	Mutex::Locker l(kv_lock);
+	// freelist updates are folded in here, in the submitting thread,
+	// so that the kv sync thread only has to sync the batch
+	_txc_finalize_kv(txc, txc->t);
 	if (g_conf->bluestore_sync_submit_transaction) {
 	  db->submit_transaction(txc->t);
 	}
@@ -3187,15 +4172,29 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	kv_cond.SignalOne();
 	return;
       }
+      {
+	Mutex::Locker l(kv_lock);
+	_txc_finalize_kv(txc, txc->t);
+      }
       db->submit_transaction_sync(txc->t);
+      if (!txc->released.empty()) {
+	// hand the space to the allocator the way the kv sync thread
+	// does for queued txcs
+	Mutex::Locker l(kv_lock);
+	kv_sync_released.insert(txc->released);
+	kv_cond.SignalOne();
+      }
       break;
 
     case TransContext::STATE_KV_QUEUED:
+    case TransContext::STATE_KV_COMMITTING:
+      txc->log_state_latency(logger, l_bluestore_state_kv_committing_lat);
       txc->state = TransContext::STATE_KV_DONE;
       _txc_finish_kv(txc);
       // ** fall-thru **
 
     case TransContext::STATE_KV_DONE:
+      txc->log_state_latency(logger, l_bluestore_state_kv_done_lat);
       if (txc->wal_txn) {
 	txc->state = TransContext::STATE_WAL_QUEUED;
 	if (g_conf->bluestore_sync_wal_apply) {
@@ -3208,23 +4207,13 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       txc->state = TransContext::STATE_FINISHING;
       break;
 
-    case TransContext::STATE_WAL_APPLYING:
-      if (txc->ioc.has_aios()) {
-	txc->state = TransContext::STATE_WAL_AIO_WAIT;
-	_txc_aio_submit(txc);
-	return;
-      }
-      // ** fall-thru **
-
-    case TransContext::STATE_WAL_AIO_WAIT:
-      _wal_finish(txc);
-      return;
-
     case TransContext::STATE_WAL_CLEANUP:
+      txc->log_state_latency(logger, l_bluestore_state_wal_cleanup_lat);
       txc->state = TransContext::STATE_FINISHING;
       // ** fall-thru **
 
     case TransContext::TransContext::STATE_FINISHING:
+      txc->log_state_latency(logger, l_bluestore_state_finishing_lat);
       _txc_finish(txc);
       return;
 
@@ -3326,18 +4315,22 @@ void BlueStore::_txc_finish_kv(TransContext *txc)
     txc->onreadable_sync->complete(0);
     txc->onreadable_sync = NULL;
   }
+  // completions for one sequencer always go to the same finisher so
+  // that they are delivered in order
+  Finisher *finisher = finishers[txc->osr->shard];
   if (txc->onreadable) {
-    finisher.queue(txc->onreadable);
+    finisher->queue(txc->onreadable);
     txc->onreadable = NULL;
   }
   if (txc->oncommit) {
-    finisher.queue(txc->oncommit);
+    finisher->queue(txc->oncommit);
     txc->oncommit = NULL;
   }
   while (!txc->oncommits.empty()) {
-    finisher.queue(txc->oncommits.front());
+    finisher->queue(txc->oncommits.front());
     txc->oncommits.pop_front();
   }
+  logger->tinc(l_bluestore_commit_lat, ceph_clock_now(NULL) - txc->start);
 
   throttle_ops.put(txc->ops);
   throttle_bytes.put(txc->bytes);
@@ -3351,6 +4344,7 @@ void BlueStore::_txc_finish(TransContext *txc)
   for (set<OnodeRef>::iterator p = txc->onodes.begin();
        p != txc->onodes.end();
        ++p) {
+    (*p)->bc.finish_write(txc->seq);
     Mutex::Locker l((*p)->flush_lock);
     dout(20) << __func__ << " onode " << *p << " had " << (*p)->flush_txns
 	     << dendl;
@@ -3371,6 +4365,8 @@ void BlueStore::_txc_finish(TransContext *txc)
   throttle_wal_ops.put(txc->ops);
   throttle_wal_bytes.put(txc->bytes);
 
+  txc->log_state_latency(logger, l_bluestore_state_done_lat);
+
   OpSequencerRef osr = txc->osr;
   osr->qlock.Lock();
   txc->state = TransContext::STATE_DONE;
@@ -3393,6 +4389,7 @@ void BlueStore::_osr_reap_done(OpSequencer *osr)
 
     if (txc->first_collection) {
       txc->first_collection->onode_map.trim(g_conf->bluestore_onode_map_size);
+      txc->first_collection->cache->trim(g_conf->bluestore_buffer_cache_size);
     }
 
     osr->q.pop_front();
@@ -3403,6 +4400,69 @@ void BlueStore::_osr_reap_done(OpSequencer *osr)
   }
 }
 
+void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
+{
+  assert(kv_lock.is_locked());
+  dout(20) << __func__ << " txc " << txc << std::hex
+	   << " allocated 0x" << txc->allocated
+	   << " released 0x" << txc->released
+	   << std::dec << dendl;
+
+  // freelist updates must reach the kv store in the same order they are
+  // applied to the FreelistManager, so they are made under kv_lock in
+  // kv_queue order.
+  for (interval_set<uint64_t>::iterator p = txc->allocated.begin();
+       p != txc->allocated.end();
+       ++p) {
+    fm->allocate(p.get_start(), p.get_len(), t);
+  }
+  if (txc->wal_txn) {
+    // released only once the wal is applied; see _kv_sync_thread
+    txc->wal_txn->released.swap(txc->released);
+    assert(txc->released.empty());
+  } else {
+    for (interval_set<uint64_t>::iterator p = txc->released.begin();
+	 p != txc->released.end();
+	 ++p) {
+      fm->release(p.get_start(), p.get_len(), t);
+    }
+  }
+}
+
+void BlueStore::_kv_start()
+{
+  dout(10) << __func__ << dendl;
+  kv_sync_thread.create();
+  kv_finalize_thread.create();
+  wal_batch_thread.create();
+}
+
+void BlueStore::_kv_stop()
+{
+  dout(10) << __func__ << dendl;
+  {
+    Mutex::Locker l(wal_batch_lock);
+    wal_batch_stop = true;
+    wal_batch_cond.Signal();
+  }
+  wal_batch_thread.join();
+  wal_batch_stop = false;
+  {
+    Mutex::Locker l(kv_lock);
+    kv_stop = true;
+    kv_cond.Signal();
+  }
+  kv_sync_thread.join();
+  {
+    Mutex::Locker l(kv_finalize_lock);
+    kv_finalize_stop = true;
+    kv_finalize_cond.Signal();
+  }
+  kv_finalize_thread.join();
+  kv_stop = false;
+  kv_finalize_stop = false;
+}
+
 void BlueStore::_kv_sync_thread()
 {
   dout(10) << __func__ << " start" << dendl;
@@ -3410,7 +4470,8 @@ void BlueStore::_kv_sync_thread()
   while (true) {
     assert(kv_committing.empty());
     assert(wal_cleaning.empty());
-    if (kv_queue.empty() && wal_cleanup_queue.empty()) {
+    if (kv_queue.empty() && wal_cleanup_queue.empty() &&
+	kv_sync_released.empty()) {
       if (kv_stop)
 	break;
       dout(20) << __func__ << " sleep" << dendl;
@@ -3423,49 +4484,21 @@ void BlueStore::_kv_sync_thread()
       kv_committing.swap(kv_queue);
       wal_cleaning.swap(wal_cleanup_queue);
       utime_t start = ceph_clock_now(NULL);
-      kv_lock.Unlock();
-
-      dout(30) << __func__ << " committing txc " << kv_committing << dendl;
-      dout(30) << __func__ << " wal_cleaning txc " << wal_cleaning << dendl;
 
       // one transaction to force a sync
       KeyValueDB::Transaction t = db->get_transaction();
 
-      // allocations and deallocations
-      interval_set<uint64_t> released;
-      for (std::deque<TransContext *>::iterator it = kv_committing.begin();
-	   it != kv_committing.end();
-	   ++it) {
-	TransContext *txc = *it;
-	if (txc->wal_txn)
-	  dout(20) << __func__ << " txc " << txc
-		   << " allocated " << txc->allocated
-		   << " (will release " << txc->released << " after wal)"
-		   << dendl;
-	else
-	  dout(20) << __func__ << " txc " << *it
-		   << " allocated " << txc->allocated
-		   << " released " << txc->released
-		   << dendl;
-	for (interval_set<uint64_t>::iterator p = txc->allocated.begin();
-	     p != txc->allocated.end();
-	     ++p) {
-	  fm->allocate(p.get_start(), p.get_len(), txc->t);
-	}
-	if (txc->wal_txn) {
-	  txc->wal_txn->released.swap(txc->released);
-	  assert(txc->released.empty());
-	} else {
-	  released.insert(txc->released);
-	  for (interval_set<uint64_t>::iterator p = txc->released.begin();
-	       p != txc->released.end();
-	       ++p) {
-	    dout(20) << __func__ << " release " << p.get_start()
-		     << "~" << p.get_len() << dendl;
-	    fm->release(p.get_start(), p.get_len(), txc->t);
-	  }
-	}
-      }
+      // Our own freelist updates are made before dropping kv_lock so that
+      // they are ordered after this batch and before the next one.  If
+      // txcs are submitted as they are queued, the next batch may reach
+      // the kv store before t does, so submit these right away instead;
+      // the space is not reusable until the sync below completes.
+      KeyValueDB::Transaction tfl = t;
+      if (g_conf->bluestore_sync_submit_transaction)
+	tfl = db->get_transaction();
+
+      interval_set<uint64_t> released;
+      released.swap(kv_sync_released);  // their txcs are already durable
       for (std::deque<TransContext *>::iterator it = wal_cleaning.begin();
 	   it != wal_cleaning.end();
 	   ++it) {
@@ -3481,18 +4514,10 @@ void BlueStore::_kv_sync_thread()
 	       ++p) {
 	    dout(20) << __func__ << " release " << p.get_start()
 		     << "~" << p.get_len() << dendl;
-	    fm->release(p.get_start(), p.get_len(), t);
+	    fm->release(p.get_start(), p.get_len(), tfl);
 	  }
 	}
       }
-      for (interval_set<uint64_t>::iterator p = released.begin();
-	   p != released.end();
-	   ++p) {
-	dout(20) << __func__ << " release " << p.get_start()
-		 << "~" << p.get_len() << dendl;
-	if (!g_conf->bluestore_debug_no_reuse_blocks)
-	  alloc->release(p.get_start(), p.get_len());
-      }
 
       vector<bluestore_extent_t> bluefs_gift_extents;
       if (bluefs) {
@@ -3500,16 +4525,41 @@ void BlueStore::_kv_sync_thread()
 	assert(r >= 0);
 	if (r > 0) {
 	  for (auto& p : bluefs_gift_extents) {
-	    fm->allocate(p.offset, p.length, t);
+	    fm->allocate(p.offset, p.length, tfl);
 	    bluefs_extents.insert(p.offset, p.length);
 	  }
 	  bufferlist bl;
 	  ::encode(bluefs_extents, bl);
 	  dout(10) << __func__ << " bluefs_extents now " << bluefs_extents
 		   << dendl;
-	  t->set(PREFIX_SUPER, "bluefs_extents", bl);
+	  tfl->set(PREFIX_SUPER, "bluefs_extents", bl);
 	}
       }
+      if (tfl != t)
+	db->submit_transaction(tfl);
+      kv_lock.Unlock();
+
+      dout(30) << __func__ << " committing txc " << kv_committing << dendl;
+      dout(30) << __func__ << " wal_cleaning txc " << wal_cleaning << dendl;
+
+      // the freelist is already updated (see _txc_finalize_kv); we only
+      // need to tell the allocator what becomes free after this commit
+      for (std::deque<TransContext *>::iterator it = kv_committing.begin();
+	   it != kv_committing.end();
+	   ++it) {
+	TransContext *txc = *it;
+	txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
+	txc->state = TransContext::STATE_KV_COMMITTING;
+	released.insert(txc->released);
+      }
+      for (interval_set<uint64_t>::iterator p = released.begin();
+	   p != released.end();
+	   ++p) {
+	dout(20) << __func__ << " release " << p.get_start()
+		 << "~" << p.get_len() << dendl;
+	if (!g_conf->bluestore_debug_no_reuse_blocks)
+	  alloc->release(p.get_start(), p.get_len());
+      }
 
       alloc->commit_start();
 
@@ -3550,19 +4600,22 @@ void BlueStore::_kv_sync_thread()
       dout(20) << __func__ << " committed " << kv_committing.size()
 	       << " cleaned " << wal_cleaning.size()
 	       << " in " << dur << dendl;
-      while (!kv_committing.empty()) {
-	TransContext *txc = kv_committing.front();
-	_txc_state_proc(txc);
-	kv_committing.pop_front();
-      }
-      while (!wal_cleaning.empty()) {
-	TransContext *txc = wal_cleaning.front();
-	_txc_state_proc(txc);
-	wal_cleaning.pop_front();
-      }
+      logger->tinc(l_bluestore_kv_sync_lat, dur);
+      logger->inc(l_bluestore_kv_sync_batch, kv_committing.size());
 
       alloc->commit_finish();
 
+      // hand the batch off for completion so that we can start syncing
+      // the next one
+      {
+	Mutex::Locker l(kv_finalize_lock);
+	kv_committed_queue.insert(kv_committed_queue.end(),
+				  kv_committing.begin(), kv_committing.end());
+	wal_cleaned_queue.insert(wal_cleaned_queue.end(),
+				 wal_cleaning.begin(), wal_cleaning.end());
+	kv_finalize_cond.Signal();
+      }
+
       // this is as good a place as any ...
       _reap_collections();
 
@@ -3573,12 +4626,57 @@ void BlueStore::_kv_sync_thread()
       }
 
       kv_lock.Lock();
+      // clear these only now so that _sync() does not see an empty
+      // pipeline before the batch is visible to the finalize thread
+      kv_committing.clear();
+      wal_cleaning.clear();
     }
   }
   kv_lock.Unlock();
   dout(10) << __func__ << " finish" << dendl;
 }
 
+void BlueStore::_kv_finalize_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  kv_finalize_lock.Lock();
+  while (true) {
+    assert(kv_finalizing.empty());
+    assert(wal_finalizing.empty());
+    if (kv_committed_queue.empty() && wal_cleaned_queue.empty()) {
+      if (kv_finalize_stop)
+	break;
+      dout(20) << __func__ << " sleep" << dendl;
+      kv_finalize_sync_cond.Signal();
+      kv_finalize_cond.Wait(kv_finalize_lock);
+      dout(20) << __func__ << " wake" << dendl;
+    } else {
+      dout(20) << __func__ << " finalizing " << kv_committed_queue.size()
+	       << " cleaned " << wal_cleaned_queue.size() << dendl;
+      kv_finalizing.swap(kv_committed_queue);
+      wal_finalizing.swap(wal_cleaned_queue);
+      kv_finalize_lock.Unlock();
+
+      for (std::deque<TransContext *>::iterator it = kv_finalizing.begin();
+	   it != kv_finalizing.end();
+	   ++it) {
+	_txc_state_proc(*it);
+      }
+      for (std::deque<TransContext *>::iterator it = wal_finalizing.begin();
+	   it != wal_finalizing.end();
+	   ++it) {
+	_txc_state_proc(*it);
+      }
+
+      kv_finalize_lock.Lock();
+      kv_finalizing.clear();
+      wal_finalizing.clear();
+    }
+  }
+  kv_finalize_lock.Unlock();
+  dout(10) << __func__ << " finish" << dendl;
+}
+
 bluestore_wal_op_t *BlueStore::_get_wal_op(TransContext *txc, OnodeRef o)
 {
   if (!txc->wal_txn) {
@@ -3589,13 +4687,67 @@ bluestore_wal_op_t *BlueStore::_get_wal_op(TransContext *txc, OnodeRef o)
   return &txc->wal_txn->ops.back();
 }
 
+void BlueStore::WALBatch::write(uint64_t offset, bufferlist& bl)
+{
+  uint64_t end = offset + bl.length();
+  map<uint64_t,bufferlist>::iterator p = extents.lower_bound(offset);
+  if (p != extents.begin()) {
+    --p;
+    if (p->first + p->second.length() <= offset)
+      ++p;
+  }
+  while (p != extents.end() && p->first < end) {
+    uint64_t pstart = p->first;
+    uint64_t pend = pstart + p->second.length();
+    coalesced_bytes += MIN(pend, end) - MAX(pstart, offset);
+    bytes -= p->second.length();
+    bufferlist head, tail;
+    if (pstart < offset)
+      head.substr_of(p->second, 0, offset - pstart);
+    if (pend > end)
+      tail.substr_of(p->second, end - pstart, pend - end);
+    extents.erase(p++);
+    if (head.length()) {
+      bytes += head.length();
+      extents[pstart].swap(head);
+    }
+    if (tail.length()) {
+      bytes += tail.length();
+      extents[end].swap(tail);
+    }
+  }
+  bytes += bl.length();
+  extents[offset].claim(bl);
+}
+
+void BlueStore::WALBatch::read(uint64_t offset, bufferlist& bl)
+{
+  uint64_t end = offset + bl.length();
+  map<uint64_t,bufferlist>::iterator p = extents.lower_bound(offset);
+  if (p != extents.begin()) {
+    --p;
+    if (p->first + p->second.length() <= offset)
+      ++p;
+  }
+  for (; p != extents.end() && p->first < end; ++p) {
+    uint64_t s = MAX(p->first, offset);
+    uint64_t e = MIN(p->first + p->second.length(), end);
+    p->second.copy(s - p->first, e - s, bl.c_str() + s - offset);
+  }
+}
+
 int BlueStore::_wal_apply(TransContext *txc)
 {
   bluestore_wal_transaction_t& wt = *txc->wal_txn;
   dout(20) << __func__ << " txc " << txc << " seq " << wt.seq << dendl;
+
+  // ops are resolved into wal_batch under wal_batch_lock, so any
+  // read-modify-write sees batched data from earlier txcs
+  Mutex::Locker l(wal_batch_lock);
+  txc->log_state_latency(logger, l_bluestore_state_wal_queued_lat);
   txc->state = TransContext::STATE_WAL_APPLYING;
 
-  assert(txc->ioc.pending_aios.empty());
+  assert(!txc->ioc.has_pending_aios());
   vector<OnodeRef>::iterator q = txc->wal_op_onodes.begin();
   for (list<bluestore_wal_op_t>::iterator p = wt.ops.begin();
        p != wt.ops.end();
@@ -3604,18 +4756,113 @@ int BlueStore::_wal_apply(TransContext *txc)
     assert(r == 0);
   }
 
-  _txc_state_proc(txc);
+  if (wal_batch->empty()) {
+    wal_batch->start = ceph_clock_now(NULL);
+    wal_batch_cond.Signal();
+  }
+  wal_batch->txcs.push_back(txc);
+  if (wal_batch->bytes >= g_conf->bluestore_wal_batch_max_bytes ||
+      wal_batch->txcs.size() >= (unsigned)g_conf->bluestore_wal_batch_max_txc ||
+      g_conf->bluestore_wal_batch_max_age <= 0) {
+    _wal_batch_submit();
+  }
   return 0;
 }
 
-int BlueStore::_wal_finish(TransContext *txc)
+void BlueStore::_wal_batch_submit()
 {
-  bluestore_wal_transaction_t& wt = *txc->wal_txn;
-  dout(20) << __func__ << " txc " << " seq " << wt.seq << txc << dendl;
+  assert(wal_batch_lock.is_locked());
+  WALBatch *b = wal_batch;
+  wal_batch = new WALBatch;
+  dout(10) << __func__ << " " << b->txcs.size() << " txcs "
+	   << b->extents.size() << " extents " << b->bytes << " bytes"
+	   << dendl;
+
+  // extents are sorted by offset; merge adjacent ones into one write.
+  // we still hold wal_batch_lock so that a racing read-modify-write
+  // finds this data on disk.
+  uint64_t ios = 0, merged = 0;
+  map<uint64_t,bufferlist>::iterator p = b->extents.begin();
+  while (p != b->extents.end()) {
+    uint64_t offset = p->first;
+    bufferlist bl;
+    bl.claim(p->second);
+    ++p;
+    while (p != b->extents.end() &&
+	   p->first == offset + bl.length()) {
+      bl.claim_append(p->second);
+      ++p;
+      ++merged;
+    }
+    dout(20) << __func__ << "  write " << offset << "~" << bl.length()
+	     << dendl;
+    int r = bdev->aio_write(offset, bl, &b->ioc, true);
+    assert(r == 0);
+    ++ios;
+  }
+  assert(!b->ioc.has_aios());
+
+  logger->inc(l_bluestore_wal_batch_txc, b->txcs.size());
+  logger->inc(l_bluestore_wal_batch_bytes, b->bytes);
+  logger->inc(l_bluestore_wal_write_ops, ios);
+  logger->inc(l_bluestore_wal_merged_ops, merged);
+  logger->inc(l_bluestore_wal_coalesced_bytes, b->coalesced_bytes);
+
+  _wal_finish(b);
+  delete b;
+}
+
+void BlueStore::_wal_batch_flush()
+{
+  Mutex::Locker l(wal_batch_lock);
+  if (!wal_batch->empty())
+    _wal_batch_submit();
+}
+
+void BlueStore::_wal_batch_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  wal_batch_lock.Lock();
+  while (true) {
+    if (wal_batch->empty()) {
+      if (wal_batch_stop)
+	break;
+      dout(20) << __func__ << " sleep" << dendl;
+      wal_batch_cond.Wait(wal_batch_lock);
+      dout(20) << __func__ << " wake" << dendl;
+      continue;
+    }
+    utime_t max_age;
+    max_age.set_from_double(g_conf->bluestore_wal_batch_max_age);
+    utime_t age = ceph_clock_now(NULL) - wal_batch->start;
+    if (wal_batch_stop || age >= max_age) {
+      _wal_batch_submit();
+    } else {
+      wal_batch_cond.WaitInterval(g_ceph_context, wal_batch_lock,
+				  max_age - age);
+    }
+  }
+  wal_batch_lock.Unlock();
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+int BlueStore::_wal_finish(WALBatch *b)
+{
+  dout(20) << __func__ << " " << b->txcs.size() << " txcs" << dendl;
+  for (deque<TransContext*>::iterator p = b->txcs.begin();
+       p != b->txcs.end();
+       ++p) {
+    dout(20) << __func__ << " txc " << *p << " seq " << (*p)->wal_txn->seq
+	     << dendl;
+    (*p)->log_state_latency(logger, l_bluestore_state_wal_applying_lat);
+    (*p)->state = TransContext::STATE_WAL_CLEANUP;
+  }
 
+  // the kv sync thread removes the wal keys for the whole batch in its
+  // next commit
   Mutex::Locker l(kv_lock);
-  txc->state = TransContext::STATE_WAL_CLEANUP;
-  wal_cleanup_queue.push_back(txc);
+  wal_cleanup_queue.insert(wal_cleanup_queue.end(),
+			   b->txcs.begin(), b->txcs.end());
   kv_cond.SignalOne();
   return 0;
 }
@@ -3628,8 +4875,8 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
   // read all the overlay data first for apply
   _do_read_all_overlays(wo);
 
-  // NOTE: we are doing all reads and writes buffered so that we can
-  // avoid worrying about multiple RMW cycles over the same blocks.
+  // NOTE: writes are collected in wal_batch and reads see them, so that
+  // we can avoid worrying about multiple RMW cycles over the same blocks.
 
   switch (wo.op) {
   case bluestore_wal_op_t::OP_WRITE:
@@ -3650,7 +4897,7 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       offset = offset & block_mask;
       dout(20) << __func__ << "  reading initial partial block "
 	       << src_offset << "~" << block_size << dendl;
-      bdev->read(src_offset, block_size, &first, ioc, true);
+      _wal_read(src_offset, block_size, &first, ioc);
       bufferlist t;
       t.substr_of(first, 0, first_len);
       t.claim_append(bl);
@@ -3668,7 +4915,7 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       } else {
 	dout(20) << __func__ << "  reading trailing partial block "
 		 << last_offset << "~" << block_size << dendl;
-	bdev->read(last_offset, block_size, &last, ioc, true);
+	_wal_read(last_offset, block_size, &last, ioc);
       }
       bufferlist t;
       uint64_t endoff = wo.extent.end() & ~block_mask;
@@ -3676,7 +4923,7 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       bl.claim_append(t);
     }
     assert((bl.length() & ~block_mask) == 0);
-    bdev->aio_write(offset, bl, ioc, true);
+    wal_batch->write(offset, bl);
   }
   break;
 
@@ -3689,11 +4936,10 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
     assert(wo.extent.length == wo.src_extent.length);
     assert((wo.src_extent.offset & ~block_mask) == 0);
     bufferlist bl;
-    int r = bdev->read(wo.src_extent.offset, wo.src_extent.length, &bl, ioc,
-		       true);
+    int r = _wal_read(wo.src_extent.offset, wo.src_extent.length, &bl, ioc);
     assert(r >= 0);
     assert(bl.length() == wo.extent.length);
-    bdev->aio_write(wo.extent.offset, bl, ioc, true);
+    wal_batch->write(wo.extent.offset, bl);
   }
   break;
 
@@ -3708,10 +4954,10 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       uint64_t first_offset = offset & block_mask;
       dout(20) << __func__ << "  reading initial partial block "
 	       << first_offset << "~" << block_size << dendl;
-      bdev->read(first_offset, block_size, &first, ioc, true);
+      _wal_read(first_offset, block_size, &first, ioc);
       size_t z_len = MIN(block_size - first_len, length);
       memset(first.c_str() + first_len, 0, z_len);
-      bdev->aio_write(first_offset, first, ioc, true);
+      wal_batch->write(first_offset, first);
       offset += block_size - first_len;
       length -= z_len;
     }
@@ -3719,7 +4965,11 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
     if (length >= block_size) {
       uint64_t middle_len = length & block_mask;
       dout(20) << __func__ << "  zero " << offset << "~" << length << dendl;
-      bdev->aio_zero(offset, middle_len, ioc);
+      bufferptr z = buffer::create_page_aligned(middle_len);
+      z.zero();
+      bufferlist zbl;
+      zbl.append(z);
+      wal_batch->write(offset, zbl);
       offset += middle_len;
       length -= middle_len;
     }
@@ -3729,9 +4979,9 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
       bufferlist last;
       dout(20) << __func__ << "  reading trailing partial block "
 	       << offset << "~" << block_size << dendl;
-      bdev->read(offset, block_size, &last, ioc, true);
+      _wal_read(offset, block_size, &last, ioc);
       memset(last.c_str(), 0, length);
-      bdev->aio_write(offset, last, ioc, true);
+      wal_batch->write(offset, last);
     }
   }
   break;
@@ -3743,6 +4993,17 @@ int BlueStore::_do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc)
   return 0;
 }
 
+int BlueStore::_wal_read(uint64_t offset, uint64_t length, bufferlist *bl,
+			 IOContext *ioc)
+{
+  assert(wal_batch_lock.is_locked());
+  int r = bdev->read(offset, length, bl, ioc, true);
+  if (r < 0)
+    return r;
+  wal_batch->read(offset, *bl);
+  return 0;
+}
+
 int BlueStore::_wal_replay()
 {
   dout(10) << __func__ << " start" << dendl;
@@ -3795,7 +5056,7 @@ int BlueStore::queue_transactions(
     osr = static_cast<OpSequencer *>(posr->p.get());
     dout(10) << __func__ << " existing " << osr << " " << *osr << dendl;
   } else {
-    osr = new OpSequencer;
+    osr = new OpSequencer(finisher_shard_last.inc() % finishers.size());
     osr->parent = posr;
     posr->p = osr;
     dout(10) << __func__ << " new " << osr << " " << *osr << dendl;
@@ -4421,6 +5682,10 @@ void BlueStore::_dump_onode(OnodeRef o)
   if (!o->onode.overlay_refs.empty()) {
     dout(30) << __func__ << "  overlay_refs " << o->onode.overlay_refs << dendl;
   }
+  for (auto& p : o->onode.compressed_map) {
+    dout(30) << __func__ << "  compressed " << p.first << " " << p.second
+	     << dendl;
+  }
 }
 
 void BlueStore::_pad_zeros(
@@ -4865,6 +6130,228 @@ bool BlueStore::_can_overlay_write(OnodeRef o, uint64_t length)
 }
 
 int BlueStore::_do_write(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length,
+  bufferlist& bl,
+  uint32_t fadvise_flags)
+{
+  // compressed blobs are immutable; rewrite any we touch as raw data
+  int r = _do_decompress_range(txc, c, o, offset, length);
+  if (r < 0)
+    return r;
+  if (length >= g_conf->bluestore_min_alloc_size &&
+      _want_compress(o, fadvise_flags))
+    return _do_write_compressed(txc, c, o, offset, length, bl, fadvise_flags);
+  return _do_write_raw(txc, c, o, offset, length, bl, fadvise_flags);
+}
+
+bool BlueStore::_want_compress(OnodeRef o, uint32_t fadvise_flags)
+{
+  switch (comp_mode) {
+  case COMP_FORCE:
+    return true;
+  case COMP_AGGRESSIVE:
+    return !(fadvise_flags & (CEPH_OSD_OP_FLAG_FADVISE_WILLNEED |
+			      CEPH_OSD_OP_FLAG_FADVISE_RANDOM));
+  case COMP_PASSIVE:
+    return fadvise_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+			    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+  default:
+    return false;
+  }
+}
+
+bool BlueStore::_compress(bufferlist& raw, bufferlist *out)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  int r = compressors[comp_type]->compress(raw, *out);
+  logger->tinc(l_bluestore_compress_lat,
+	       ceph_clock_now(g_ceph_context) - start);
+  uint64_t need = ROUND_UP_TO(out->length(), bdev->get_block_size());
+  if (r < 0 ||
+      need > raw.length() * g_conf->bluestore_compression_required_ratio) {
+    dout(20) << __func__ << " " << raw.length() << " -> " << out->length()
+	     << ", not worth it" << dendl;
+    logger->inc(l_bluestore_compress_rejected_count);
+    return false;
+  }
+  dout(20) << __func__ << " " << raw.length() << " -> " << out->length()
+	   << dendl;
+  logger->inc(l_bluestore_compress_success_count);
+  return true;
+}
+
+int BlueStore::_do_write_compressed(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length,
+  bufferlist& bl,
+  uint32_t fadvise_flags)
+{
+  uint64_t min_alloc_size = g_conf->bluestore_min_alloc_size;
+  uint64_t end = offset + length;
+  uint64_t pos = offset;  // everything before this is written
+  int r;
+
+  // compress each whole allocation unit that does not have any space
+  // allocated yet; everything else goes down the normal path.
+  for (uint64_t u = ROUND_UP_TO(offset, min_alloc_size);
+       u + min_alloc_size <= end;
+       u += min_alloc_size) {
+    map<uint64_t,bluestore_extent_t>::iterator bp = o->onode.seek_extent(u);
+    if (bp != o->onode.block_map.end() && bp->first < u + min_alloc_size)
+      continue;
+    bufferlist raw, cbl;
+    raw.substr_of(bl, u - offset, min_alloc_size);
+    if (!_compress(raw, &cbl))
+      continue;
+    if (u > pos) {
+      bufferlist t;
+      t.substr_of(bl, pos - offset, u - pos);
+      r = _do_write_raw(txc, c, o, pos, u - pos, t, fadvise_flags);
+      if (r < 0)
+	return r;
+    }
+    r = _do_write_compressed_blob(txc, o, u, raw, cbl, fadvise_flags);
+    if (r < 0)
+      return r;
+    pos = u + min_alloc_size;
+  }
+  if (pos < end) {
+    bufferlist t;
+    t.substr_of(bl, pos - offset, end - pos);
+    return _do_write_raw(txc, c, o, pos, end - pos, t, fadvise_flags);
+  }
+  return 0;
+}
+
+int BlueStore::_do_write_compressed_blob(
+  TransContext *txc,
+  OnodeRef o,
+  uint64_t offset,
+  bufferlist& raw,
+  bufferlist& cbl,
+  uint32_t fadvise_flags)
+{
+  uint64_t block_size = bdev->get_block_size();
+  uint64_t need = ROUND_UP_TO(cbl.length(), block_size);
+  bool buffered = fadvise_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED;
+
+  int r = alloc->reserve(need);
+  if (r < 0) {
+    derr << __func__ << " failed to reserve " << need << dendl;
+    return r;
+  }
+
+  if (offset > o->onode.size) {
+    _do_zero_tail_extent(txc, o, offset);
+  }
+  o->clear_tail();
+
+  bluestore_compressed_t& cb = o->onode.compressed_map[offset];
+  cb = bluestore_compressed_t(comp_type, raw.length(), cbl.length());
+  if (need > cbl.length()) {
+    bufferptr z(need - cbl.length());
+    z.zero();
+    cbl.append(z);
+  }
+  uint64_t pos = 0;
+  uint64_t hint = 0;
+  while (pos < need) {
+    bluestore_extent_t e;
+    r = alloc->allocate(need - pos, block_size, hint, &e.offset, &e.length);
+    assert(r == 0);
+    assert(e.length <= need - pos);
+    txc->allocated.insert(e.offset, e.length);
+    bufferlist t;
+    t.substr_of(cbl, pos, e.length);
+    bdev->aio_write(e.offset, t, &txc->ioc, buffered);
+    cb.extents.push_back(e);
+    pos += e.length;
+    hint = e.end();
+  }
+  dout(20) << __func__ << " " << offset << ": " << cb << dendl;
+  logger->inc(l_bluestore_compressed_bytes, raw.length());
+  logger->inc(l_bluestore_compressed_allocated, need);
+
+  if (offset + raw.length() > o->onode.size) {
+    o->onode.size = offset + raw.length();
+  }
+  _do_write_csum(o, offset, raw.length(), raw);
+  // keep the raw data around (even with dontneed) until the aio is done:
+  // a later op in this txc that decompresses the blob can't read it back
+  // from disk yet.
+  o->bc.write(txc->seq, offset, raw, fadvise_flags);
+  return 0;
+}
+
+int BlueStore::_do_decompress_range(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length)
+{
+  EnodeRef enode;
+  map<uint64_t,bluestore_compressed_t>::iterator cp =
+    o->onode.seek_compressed(offset);
+  while (cp != o->onode.compressed_map.end() &&
+	 cp->first < offset + length) {
+    uint64_t c_off = cp->first;
+    bufferlist raw;
+    bool whole = offset <= c_off &&
+      c_off + cp->second.raw_length <= offset + length;
+    if (!whole) {
+      int r = _do_read(o, c_off, cp->second.raw_length, raw);
+      if (r < 0)
+	return r;
+    }
+    dout(20) << __func__ << " " << (whole ? "drop " : "decompress ")
+	     << c_off << ": " << cp->second << dendl;
+    for (auto& e : cp->second.extents) {
+      _txc_release(txc, c, enode, o->oid.hobj.get_hash(),
+		   e.offset, e.length,
+		   e.has_flag(bluestore_extent_t::FLAG_SHARED));
+    }
+    o->onode.compressed_map.erase(cp++);
+    if (!whole) {
+      int r = _do_write_raw(txc, c, o, c_off, raw.length(), raw, 0);
+      if (r < 0)
+	return r;
+    }
+  }
+  return 0;
+}
+
+void BlueStore::_do_zero_tail_extent(
+  TransContext *txc,
+  OnodeRef o,
+  uint64_t offset)
+{
+  // zero tail of previous existing extent?
+  // (this happens if the old eof was partway through a previous extent,
+  // and we implicitly zero the rest of it by writing to a larger offset.)
+  uint64_t block_size = bdev->get_block_size();
+  uint64_t end = ROUND_UP_TO(o->onode.size, block_size);
+  map<uint64_t, bluestore_extent_t>::iterator pp = o->onode.find_extent(end);
+  if (offset > end &&
+      pp != o->onode.block_map.end() &&
+      pp->first + pp->second.length <= offset) {
+    uint64_t x_off = end - pp->first;
+    uint64_t x_len = pp->second.length - x_off;
+    dout(10) << __func__ << " zero tail " << x_off << "~" << x_len
+	     << " of prior extent " << pp->first << ": " << pp->second
+	     << dendl;
+    bdev->aio_zero(pp->second.offset + x_off, x_len, &txc->ioc);
+  }
+}
+
+int BlueStore::_do_write_raw(
   TransContext *txc,
   CollectionRef& c,
   OnodeRef o,
@@ -4910,23 +6397,8 @@ int BlueStore::_do_write(
 
   bp = o->onode.seek_extent(orig_offset);
 
-  // zero tail of previous existing extent?
-  // (this happens if the old eof was partway through a previous extent,
-  // and we implicitly zero the rest of it by writing to a larger offset.)
   if (orig_offset > o->onode.size) {
-    uint64_t end = ROUND_UP_TO(o->onode.size, block_size);
-    map<uint64_t, bluestore_extent_t>::iterator pp = o->onode.find_extent(end);
-    if (orig_offset > end &&
-	pp != o->onode.block_map.end() &&
-	pp != bp) {
-      assert(pp->first < bp->first);
-      uint64_t x_off = end - pp->first;
-      uint64_t x_len = pp->second.length - x_off;
-      dout(10) << __func__ << " zero tail " << x_off << "~" << x_len
-	       << " of prior extent " << pp->first << ": " << pp->second
-	       << dendl;
-      bdev->aio_zero(pp->second.offset + x_off, x_len, &txc->ioc);
-    }
+    _do_zero_tail_extent(txc, o, orig_offset);
   }
 
   for (uint64_t offset = orig_offset;
@@ -5141,6 +6613,15 @@ int BlueStore::_do_write(
     o->onode.size = orig_offset + orig_length;
   }
 
+  _do_write_csum(o, orig_offset, orig_length, orig_bl);
+
+  // keep the new data in the buffer cache (pinned until txc is done)
+  if (fadvise_flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED) {
+    o->bc.discard(orig_offset, orig_length);
+  } else {
+    o->bc.write(txc->seq, orig_offset, orig_bl, fadvise_flags);
+  }
+
   // make sure we didn't leave unwritten extents behind
   for (map<uint64_t,bluestore_extent_t>::iterator p = o->onode.block_map.begin();
        p != o->onode.block_map.end();
@@ -5164,6 +6645,47 @@ int BlueStore::_do_write(
   return r;
 }
 
+void BlueStore::_do_write_csum(
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length,
+  bufferlist& bl)
+{
+  if (!o->onode.get_csum_count() && csum_type != BLUESTORE_CSUM_NONE) {
+    o->onode.csum_type = csum_type;
+    o->onode.csum_chunk_order = csum_chunk_order;
+  }
+  if (!o->onode.has_csum())
+    return;
+
+  // only chunks we completely overwrote get a new csum; the existing
+  // ones for partially overwritten chunks are no longer valid.
+  uint64_t chunk = o->onode.get_csum_chunk_size();
+  uint64_t start = ROUND_UP_TO(offset, chunk);
+  uint64_t end = (offset + length) & ~(chunk - 1);
+  if (csum_type == BLUESTORE_CSUM_NONE || start >= end) {
+    o->onode.csum_clear(offset, length);
+    return;
+  }
+  if (start > offset)
+    o->onode.csum_clear(offset, start - offset);
+  if (offset + length > end)
+    o->onode.csum_clear(end, offset + length - end);
+
+  utime_t begin = ceph_clock_now(g_ceph_context);
+  o->onode.csum_prepare(end >> o->onode.csum_chunk_order);
+  for (uint64_t pos = start; pos < end; pos += chunk) {
+    bufferlist t;
+    t.substr_of(bl, pos - offset, chunk);
+    o->onode.set_csum_item(pos >> o->onode.csum_chunk_order,
+			   bluestore_csum_calc(o->onode.csum_type, t));
+  }
+  logger->tinc(l_bluestore_compute_csum_lat,
+	       ceph_clock_now(g_ceph_context) - begin);
+  dout(20) << __func__ << " " << start << "~" << (end - start) << " "
+	   << bluestore_csum_type_name(o->onode.csum_type) << dendl;
+}
+
 int BlueStore::_write(TransContext *txc,
 		     CollectionRef& c,
 		     const ghobject_t& oid,
@@ -5216,9 +6738,16 @@ int BlueStore::_zero(TransContext *txc,
   _dump_onode(o);
   _assign_nid(txc, o);
 
+  r = _do_decompress_range(txc, c, o, offset, length);
+  if (r < 0)
+    return r;
+
   // overlay
   _do_overlay_trim(txc, o, offset, length);
 
+  o->bc.discard(offset, length);
+  o->onode.csum_clear(offset, length);
+
   uint64_t block_size = bdev->get_block_size();
   map<uint64_t,bluestore_extent_t>::iterator bp = o->onode.seek_extent(offset);
 
@@ -5308,6 +6837,18 @@ int BlueStore::_do_truncate(
   // they may touch.
   o->flush();
 
+  // drop compressed blobs past the new eof, and rewrite the one that
+  // straddles it (if any) raw so that we can trim it below.
+  int r = _do_decompress_range(txc, c, o, offset, (uint64_t)-1 - offset);
+  if (r < 0)
+    return r;
+
+  // trim down buffer cache
+  o->bc.discard(offset, (uint64_t)-1 - offset);
+
+  // forget csums for chunks we are cutting into
+  o->onode.csum_truncate(offset);
+
   // trim down cached tail
   if (o->tail_bl.length()) {
     // we could adjust this if we truncate down within the same
@@ -5876,10 +7417,27 @@ int BlueStore::_clone(TransContext *txc,
 	marked = true;
       }
     }
+    for (auto& p : oldo->onode.compressed_map) {
+      for (auto& x : p.second.extents) {
+	if (x.has_flag(bluestore_extent_t::FLAG_SHARED)) {
+	  e->ref_map.get(x.offset, x.length);
+	} else {
+	  x.set_flag(bluestore_extent_t::FLAG_SHARED);
+	  e->ref_map.add(x.offset, x.length, 2);
+	  marked = true;
+	}
+      }
+    }
     dout(20) << __func__ << " hash " << e->hash << " ref_map now "
 	     << e->ref_map << dendl;
     newo->onode.block_map = oldo->onode.block_map;
+    newo->onode.compressed_map = oldo->onode.compressed_map;
     newo->onode.size = oldo->onode.size;
+    newo->onode.csum_type = oldo->onode.csum_type;
+    newo->onode.csum_chunk_order = oldo->onode.csum_chunk_order;
+    if (oldo->onode.csum_data.length())
+      newo->onode.csum_data = buffer::copy(oldo->onode.csum_data.c_str(),
+					   oldo->onode.csum_data.length());
     dout(20) << __func__ << " block_map " << newo->onode.block_map << dendl;
     txc->write_enode(e);
     if (marked)
@@ -27,6 +27,8 @@
 #include "include/unordered_map.h"
 #include "include/memory.h"
 #include "common/Finisher.h"
+#include "common/perf_counters.h"
+#include "compressor/Compressor.h"
 #include "common/RWLock.h"
 #include "common/WorkQueue.h"
 #include "os/ObjectStore.h"
@@ -40,6 +42,41 @@ class Allocator;
 class FreelistManager;
 class BlueFS;
 
+enum {
+  l_bluestore_first = 732430,
+  l_bluestore_buffer_hit_bytes,
+  l_bluestore_buffer_miss_bytes,
+  l_bluestore_compute_csum_lat,
+  l_bluestore_verify_csum_lat,
+  l_bluestore_csum_errors,
+  l_bluestore_compress_lat,
+  l_bluestore_decompress_lat,
+  l_bluestore_compress_success_count,
+  l_bluestore_compress_rejected_count,
+  l_bluestore_compressed_bytes,
+  l_bluestore_compressed_allocated,
+  l_bluestore_state_prepare_lat,
+  l_bluestore_state_aio_wait_lat,
+  l_bluestore_state_io_done_lat,
+  l_bluestore_state_kv_queued_lat,
+  l_bluestore_state_kv_committing_lat,
+  l_bluestore_state_kv_done_lat,
+  l_bluestore_state_wal_queued_lat,
+  l_bluestore_state_wal_applying_lat,
+  l_bluestore_state_wal_cleanup_lat,
+  l_bluestore_state_finishing_lat,
+  l_bluestore_state_done_lat,
+  l_bluestore_commit_lat,
+  l_bluestore_kv_sync_lat,
+  l_bluestore_kv_sync_batch,
+  l_bluestore_wal_batch_txc,
+  l_bluestore_wal_batch_bytes,
+  l_bluestore_wal_write_ops,
+  l_bluestore_wal_merged_ops,
+  l_bluestore_wal_coalesced_bytes,
+  l_bluestore_last
+};
+
 class BlueStore : public ObjectStore {
   // -----------------------------------------------------
   // types
@@ -104,6 +141,296 @@ public:
     }
   };
 
+  struct BufferSpace;
+
+  /// cached buffer
+  struct Buffer {
+    enum {
+      STATE_EMPTY,     ///< empty buffer -- used for cache history
+      STATE_CLEAN,     ///< clean data that is up to date
+      STATE_WRITING,   ///< data that is being written (io not yet complete)
+    };
+    static const char *get_state_name(int s) {
+      switch (s) {
+      case STATE_EMPTY: return "empty";
+      case STATE_CLEAN: return "clean";
+      case STATE_WRITING: return "writing";
+      default: return "???";
+      }
+    }
+
+    enum {
+      FLAG_NOCACHE = 1,  ///< drop once the write completes (fadvise dontneed)
+    };
+
+    BufferSpace *space;
+    uint16_t state;             ///< STATE_*
+    uint16_t cache_private;     ///< opaque (to us) value used by Cache impl
+    uint32_t flags;             ///< FLAG_*
+    uint64_t seq;               ///< txc seq (for STATE_WRITING)
+    uint64_t offset, length;    ///< logical extent in the object
+    bufferlist data;
+
+    boost::intrusive::list_member_hook<> lru_item;
+    boost::intrusive::list_member_hook<> state_item;
+
+    Buffer(BufferSpace *space, unsigned s, uint64_t q, uint64_t o, uint64_t l)
+      : space(space), state(s), cache_private(0), flags(0), seq(q), offset(o),
+	length(l) {}
+    Buffer(BufferSpace *space, unsigned s, uint64_t q, uint64_t o,
+	   bufferlist& b)
+      : space(space), state(s), cache_private(0), flags(0), seq(q), offset(o),
+	length(b.length()), data(b) {}
+
+    bool is_empty() const {
+      return state == STATE_EMPTY;
+    }
+    bool is_clean() const {
+      return state == STATE_CLEAN;
+    }
+    bool is_writing() const {
+      return state == STATE_WRITING;
+    }
+
+    uint64_t end() const {
+      return offset + length;
+    }
+
+    void truncate(uint64_t newlen) {
+      assert(newlen < length);
+      if (data.length()) {
+	bufferlist t;
+	t.substr_of(data, 0, newlen);
+	data.claim(t);
+      }
+      length = newlen;
+    }
+
+    void dump(Formatter *f) const {
+      f->dump_string("state", get_state_name(state));
+      f->dump_unsigned("seq", seq);
+      f->dump_unsigned("offset", offset);
+      f->dump_unsigned("length", length);
+      f->dump_unsigned("data_length", data.length());
+    }
+  };
+
+  /// a cache (shared by a collection) of clean data Buffers
+  struct Cache {
+    Mutex lock;                ///< protect lru and BufferSpaces
+
+    static Cache *create(string type);
+
+    Cache() : lock("BlueStore::Cache::lock") {}
+    virtual ~Cache() {}
+
+    /// add a buffer; a level > 0 means "hot", 0 means "evict me first"
+    virtual void _add_buffer(Buffer *b, int level) = 0;
+    virtual void _rm_buffer(Buffer *b) = 0;
+    virtual void _adjust_buffer_size(Buffer *b, int64_t delta) = 0;
+    virtual void _touch_buffer(Buffer *b) = 0;
+
+    virtual uint64_t _get_num_buffers() = 0;
+    virtual uint64_t _get_buffer_bytes() = 0;
+
+    void trim(uint64_t max_bytes) {
+      Mutex::Locker l(lock);
+      _trim(max_bytes);
+    }
+    virtual void _trim(uint64_t max_bytes) = 0;
+  };
+  typedef ceph::shared_ptr<Cache> CacheRef;
+
+  /// simple LRU cache for buffers
+  struct LRUCache : public Cache {
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+	Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::lru_item> > buffer_list_t;
+    buffer_list_t buffer_lru;
+    uint64_t buffer_bytes;
+
+    LRUCache() : buffer_bytes(0) {}
+
+    void _add_buffer(Buffer *b, int level) {
+      if (level > 0)
+	buffer_lru.push_front(*b);
+      else
+	buffer_lru.push_back(*b);
+      buffer_bytes += b->length;
+    }
+    void _rm_buffer(Buffer *b) {
+      assert(buffer_bytes >= b->length);
+      buffer_bytes -= b->length;
+      buffer_lru.erase(buffer_lru.iterator_to(*b));
+    }
+    void _adjust_buffer_size(Buffer *b, int64_t delta) {
+      assert((int64_t)buffer_bytes + delta >= 0);
+      buffer_bytes += delta;
+    }
+    void _touch_buffer(Buffer *b) {
+      buffer_lru.erase(buffer_lru.iterator_to(*b));
+      buffer_lru.push_front(*b);
+    }
+
+    uint64_t _get_num_buffers() {
+      return buffer_lru.size();
+    }
+    uint64_t _get_buffer_bytes() {
+      return buffer_bytes;
+    }
+
+    void _trim(uint64_t max_bytes);
+  };
+
+  /// 2Q cache for buffers (see Johnson & Shasha, VLDB '94)
+  struct TwoQCache : public Cache {
+    enum {
+      BUFFER_NEW = 0,
+      BUFFER_WARM_IN,   ///< in buffer_warm_in
+      BUFFER_WARM_OUT,  ///< in buffer_warm_out (empty; history only)
+      BUFFER_HOT,       ///< in buffer_hot
+      BUFFER_TYPE_MAX
+    };
+
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+	Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::lru_item> > buffer_list_t;
+    buffer_list_t buffer_hot;      ///< "Am" hot buffers
+    buffer_list_t buffer_warm_in;  ///< "A1in" newly warm buffers
+    buffer_list_t buffer_warm_out; ///< "A1out" empty buffers we've evicted
+    uint64_t buffer_bytes;                         ///< bytes
+    uint64_t buffer_list_bytes[BUFFER_TYPE_MAX];   ///< bytes per list
+
+    TwoQCache() : buffer_bytes(0) {
+      memset(buffer_list_bytes, 0, sizeof(buffer_list_bytes));
+    }
+
+    void _add_buffer(Buffer *b, int level);
+    void _rm_buffer(Buffer *b);
+    void _adjust_buffer_size(Buffer *b, int64_t delta);
+    void _touch_buffer(Buffer *b);
+
+    uint64_t _get_num_buffers() {
+      return buffer_hot.size() + buffer_warm_in.size();
+    }
+    uint64_t _get_buffer_bytes() {
+      return buffer_bytes;
+    }
+
+    void _trim(uint64_t max_bytes);
+  };
+
+  /// map logical extent range (object) onto buffers
+  struct BufferSpace {
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+        Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::state_item> > state_list_t;
+
+    CacheRef cache;
+    map<uint64_t,std::unique_ptr<Buffer>> buffer_map;
+    state_list_t writing;    ///< writing buffers, sorted by seq, ascending
+
+    BufferSpace(CacheRef c) : cache(c) {}
+    ~BufferSpace() {
+      Mutex::Locker l(cache->lock);
+      _clear();
+      assert(buffer_map.empty());
+      assert(writing.empty());
+    }
+
+    void _add_buffer(Buffer *b, int level) {
+      buffer_map[b->offset].reset(b);
+      if (b->is_writing()) {
+	writing.push_back(*b);
+      } else {
+	cache->_add_buffer(b, level);
+      }
+    }
+    void _rm_buffer(Buffer *b) {
+      _rm_buffer(buffer_map.find(b->offset));
+    }
+    void _rm_buffer(map<uint64_t,std::unique_ptr<Buffer>>::iterator p) {
+      assert(p != buffer_map.end());
+      if (p->second->is_writing()) {
+	writing.erase(writing.iterator_to(*p->second));
+      } else {
+	cache->_rm_buffer(p->second.get());
+      }
+      buffer_map.erase(p);
+    }
+
+    map<uint64_t,std::unique_ptr<Buffer>>::iterator _data_lower_bound(
+      uint64_t offset) {
+      auto i = buffer_map.lower_bound(offset);
+      if (i != buffer_map.begin()) {
+	--i;
+	if (i->first + i->second->length <= offset)
+	  ++i;
+      }
+      return i;
+    }
+
+    bool empty() const {
+      return buffer_map.empty();
+    }
+
+    void _clear();
+
+    /// drop cached content for a range; return cache_private of any
+    /// empty (history) buffer we remove at exactly offset
+    int _discard(uint64_t offset, uint64_t length);
+    void discard(uint64_t offset, uint64_t length) {
+      Mutex::Locker l(cache->lock);
+      _discard(offset, length);
+    }
+
+    /// cache data being written by txc seq.  with fadvise dontneed it is
+    /// only kept until the write completes.
+    void write(uint64_t seq, uint64_t offset, bufferlist& bl, unsigned flags) {
+      Mutex::Locker l(cache->lock);
+      Buffer *b = new Buffer(this, Buffer::STATE_WRITING, seq, offset, bl);
+      if (flags & CEPH_OSD_OP_FLAG_FADVISE_DONTNEED)
+	b->flags |= Buffer::FLAG_NOCACHE;
+      b->cache_private = _discard(offset, bl.length());
+      _add_buffer(b, (flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) ? 1 : 0);
+    }
+    /// txc seq (and anything before it) is stable; mark its buffers clean
+    void finish_write(uint64_t seq);
+    /// cache clean data we just read from disk
+    void did_read(uint64_t offset, bufferlist& bl) {
+      Mutex::Locker l(cache->lock);
+      Buffer *b = new Buffer(this, Buffer::STATE_CLEAN, 0, offset, bl);
+      b->cache_private = _discard(offset, bl.length());
+      _add_buffer(b, 1);
+    }
+
+    /// fill in whatever cached data we have for offset~length
+    void read(uint64_t offset, uint64_t length,
+	      map<uint64_t,bufferlist>& res,
+	      interval_set<uint64_t>& res_intervals);
+
+    void dump(Formatter *f) const {
+      Mutex::Locker l(cache->lock);
+      f->open_array_section("buffers");
+      for (auto& i : buffer_map) {
+	f->open_object_section("buffer");
+	assert(i.first == i.second->offset);
+	i.second->dump(f);
+	f->close_section();
+      }
+      f->close_section();
+    }
+  };
+
   /// an in-memory object
   struct Onode {
     atomic_t nref;  ///< reference count
@@ -125,7 +452,9 @@ public:
     uint64_t tail_offset;
     bufferlist tail_bl;
 
-    Onode(const ghobject_t& o, const string& k);
+    BufferSpace bc;  ///< cached data buffers
+
+    Onode(const ghobject_t& o, const string& k, CacheRef c);
 
     void flush();
     void get() {
@@ -172,9 +501,10 @@ public:
     bluestore_cnode_t cnode;
     RWLock lock;
 
-    // cache onodes on a per-collection basis to avoid lock
-    // contention.
+    // cache onodes and data buffers on a per-collection basis to
+    // avoid lock contention.
     OnodeHashLRU onode_map;
+    CacheRef cache;
 
     EnodeSet enode_set;      ///< open Enodes
 
@@ -228,7 +558,6 @@ public:
       STATE_KV_DONE,
       STATE_WAL_QUEUED,
       STATE_WAL_APPLYING,
-      STATE_WAL_AIO_WAIT,
       STATE_WAL_CLEANUP,   // remove wal kv record
       STATE_WAL_DONE,
       STATE_FINISHING,
@@ -247,7 +576,6 @@ public:
       case STATE_KV_DONE: return "kv_done";
       case STATE_WAL_QUEUED: return "wal_queued";
       case STATE_WAL_APPLYING: return "wal_applying";
-      case STATE_WAL_AIO_WAIT: return "wal_aio_wait";
       case STATE_WAL_CLEANUP: return "wal_cleanup";
       case STATE_WAL_DONE: return "wal_done";
       case STATE_FINISHING: return "finishing";
@@ -260,6 +588,7 @@ public:
     boost::intrusive::list_member_hook<> sequencer_item;
 
     uint64_t ops, bytes;
+    uint64_t seq;             ///< per-sequencer seq (for buffer cache)
 
     set<OnodeRef> onodes;     ///< these onodes need to be updated/written
     set<EnodeRef> enodes;     ///< these enodes need to be updated/written
@@ -283,17 +612,23 @@ public:
 
     CollectionRef first_collection;  ///< first referenced collection
 
+    utime_t start;       ///< when the txc was created
+    utime_t last_stamp;  ///< when the txc entered its current state
+
     TransContext(OpSequencer *o)
       : state(STATE_PREPARE),
 	osr(o),
 	ops(0),
 	bytes(0),
+	seq(0),
 	oncommit(NULL),
 	onreadable(NULL),
 	onreadable_sync(NULL),
 	wal_txn(NULL),
 	ioc(this),
-	lock("BlueStore::TransContext::lock") {
+	lock("BlueStore::TransContext::lock"),
+	start(ceph_clock_now(NULL)),
+	last_stamp(start) {
       //cout << "txc new " << this << std::endl;
     }
     ~TransContext() {
@@ -307,6 +642,13 @@ public:
     void write_enode(EnodeRef &e) {
       enodes.insert(e);
     }
+
+    /// account the time spent in the state we are leaving to idx
+    void log_state_latency(PerfCounters *logger, int idx) {
+      utime_t now = ceph_clock_now(NULL);
+      logger->tinc(idx, now - last_stamp);
+      last_stamp = now;
+    }
   };
 
   class OpSequencer : public Sequencer_impl {
@@ -335,11 +677,17 @@ public:
 
     Mutex wal_apply_lock;
 
-    OpSequencer()
+    uint64_t last_seq;   ///< last txc seq assigned (under qlock)
+
+    unsigned shard;      ///< finisher shard for our completions
+
+    OpSequencer(unsigned s = 0)
 	//set the qlock to to PTHREAD_MUTEX_RECURSIVE mode
       : qlock("BlueStore::OpSequencer::qlock", true, false),
 	parent(NULL),
-	wal_apply_lock("BlueStore::OpSequencer::wal_apply_lock") {
+	wal_apply_lock("BlueStore::OpSequencer::wal_apply_lock"),
+	last_seq(0),
+	shard(s) {
     }
     ~OpSequencer() {
       assert(q.empty());
@@ -347,6 +695,7 @@ public:
 
     void queue_new(TransContext *txc) {
       Mutex::Locker l(qlock);
+      txc->seq = ++last_seq;
       q.push_back(*txc);
     }
 
@@ -444,6 +793,35 @@ public:
     }
   };
 
+  /// wal ops from many txcs, resolved to block aligned writes
+  struct WALBatch {
+    map<uint64_t,bufferlist> extents; ///< disk offset -> data; disjoint
+    deque<TransContext*> txcs;        ///< txcs with wal ops in this batch
+    uint64_t bytes;                   ///< bytes in extents
+    uint64_t coalesced_bytes;         ///< bytes overwritten in the batch
+    utime_t start;                    ///< when the first txc was added
+    IOContext ioc;
+
+    WALBatch() : bytes(0), coalesced_bytes(0), ioc(NULL) {}
+
+    bool empty() const {
+      return txcs.empty();
+    }
+
+    /// add block aligned data, replacing anything it overlaps
+    void write(uint64_t offset, bufferlist& bl);
+    /// overlay any batched data onto bl, read from disk at offset
+    void read(uint64_t offset, bufferlist& bl);
+  };
+
+  struct WALBatchThread : public Thread {
+    BlueStore *store;
+    WALBatchThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_wal_batch_thread();
+      return NULL;
+    }
+  };
   struct KVSyncThread : public Thread {
     BlueStore *store;
     KVSyncThread(BlueStore *s) : store(s) {}
@@ -452,6 +830,14 @@ public:
       return NULL;
     }
   };
+  struct KVFinalizeThread : public Thread {
+    BlueStore *store;
+    KVFinalizeThread(BlueStore *s) : store(s) {}
+    void *entry() {
+      store->_kv_finalize_thread();
+      return NULL;
+    }
+  };
 
   // --------------------------------------------------------
   // members
@@ -463,12 +849,16 @@ private:
   FS *fs;
   BlockDevice *bdev;
   FreelistManager *fm;
+  string freelist_type;
   Allocator *alloc;
   uuid_d fsid;
   int path_fd;  ///< open handle to $path
   int fsid_fd;  ///< open handle (locked) to $path/fsid
   bool mounted;
 
+  class SocketHook;
+  SocketHook *asok_hook;  ///< "bluestore bdev stats", if we registered it
+
   RWLock coll_lock;    ///< rwlock to protect coll_map
   ceph::unordered_map<coll_t, CollectionRef> coll_map;
 
@@ -486,7 +876,14 @@ private:
   ThreadPool wal_tp;
   WALWQ wal_wq;
 
-  Finisher finisher;
+  WALBatchThread wal_batch_thread;
+  Mutex wal_batch_lock;    ///< protects wal_batch; held while applying it
+  Cond wal_batch_cond;
+  bool wal_batch_stop;
+  WALBatch *wal_batch;     ///< wal ops not yet written to disk
+
+  vector<Finisher*> finishers;  ///< completions, sharded by OpSequencer
+  atomic_t finisher_shard_last;   ///< round-robin shard for new osrs
 
   KVSyncThread kv_sync_thread;
   Mutex kv_lock;
@@ -494,8 +891,31 @@ private:
   bool kv_stop;
   deque<TransContext*> kv_queue, kv_committing;
   deque<TransContext*> wal_cleanup_queue, wal_cleaning;
+  interval_set<uint64_t> kv_sync_released;  ///< from bluestore_sync_transaction txcs
+
+  // txcs whose kv transaction is durable, handed from the sync thread so
+  // it can start the next batch while these complete
+  KVFinalizeThread kv_finalize_thread;
+  Mutex kv_finalize_lock;
+  Cond kv_finalize_cond, kv_finalize_sync_cond;
+  bool kv_finalize_stop;
+  deque<TransContext*> kv_committed_queue, kv_finalizing;
+  deque<TransContext*> wal_cleaned_queue, wal_finalizing;
+
+  int csum_type;             ///< BLUESTORE_CSUM_* for newly written data
+  uint8_t csum_chunk_order;  ///< log2(bluestore_csum_block_size)
+
+  enum {
+    COMP_NONE = 0,        ///< never compress
+    COMP_PASSIVE = 1,     ///< compress if the client hints the data is cold
+    COMP_AGGRESSIVE = 2,  ///< compress unless the client hints it is hot
+    COMP_FORCE = 3,       ///< always compress
+  };
+  int comp_mode;          ///< COMP_*
+  int comp_type;          ///< BLUESTORE_COMPRESSION_* for newly written data
+  Compressor *compressors[BLUESTORE_COMPRESSION_MAX];  ///< indexed by type
 
-  Logger *logger;
+  PerfCounters *logger;
 
   Mutex reap_lock;
   Cond reap_cond;
@@ -519,8 +939,12 @@ private:
   void _close_bdev();
   int _open_db(bool create);
   void _close_db();
+  int _open_fm(bool create);
+  void _close_fm();
   int _open_alloc();
   void _close_alloc();
+  int _set_csum();
+  int _set_compression();
   int _open_collections(int *errors=0);
   void _close_collections();
 
@@ -565,21 +989,22 @@ private:
 
   void _osr_reap_done(OpSequencer *osr);
 
+  void _txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t);
+
   void _kv_sync_thread();
-  void _kv_stop() {
-    {
-      Mutex::Locker l(kv_lock);
-      kv_stop = true;
-      kv_cond.Signal();
-    }
-    kv_sync_thread.join();
-    kv_stop = false;
-  }
+  void _kv_finalize_thread();
+  void _kv_start();
+  void _kv_stop();
 
   bluestore_wal_op_t *_get_wal_op(TransContext *txc, OnodeRef o);
   int _wal_apply(TransContext *txc);
-  int _wal_finish(TransContext *txc);
+  int _wal_finish(WALBatch *b);
   int _do_wal_op(bluestore_wal_op_t& wo, IOContext *ioc);
+  int _wal_read(uint64_t offset, uint64_t length, bufferlist *bl,
+		IOContext *ioc);
+  void _wal_batch_submit();
+  void _wal_batch_flush();
+  void _wal_batch_thread();
   int _wal_replay();
 
   // for fsck
@@ -638,6 +1063,22 @@ public:
     size_t len,
     bufferlist& bl,
     uint32_t op_flags = 0);
+  void _append_cached(
+    map<uint64_t,bufferlist>& ready,
+    uint64_t offset,
+    uint64_t length,
+    bufferlist *out);
+  int _verify_csum(
+    OnodeRef o,
+    uint64_t offset,
+    bufferlist& bl);
+  int _do_read_compressed(
+    OnodeRef o,
+    uint64_t offset,
+    const bluestore_compressed_t& cb,
+    bufferlist *raw,
+    IOContext *ioc,
+    bool buffered);
 
   int fiemap(coll_t cid, const ghobject_t& oid, uint64_t offset, size_t len, bufferlist& bl);
   int getattr(coll_t cid, const ghobject_t& oid, const char *name, bufferptr& value);
@@ -760,6 +1201,36 @@ private:
 		uint64_t offset, uint64_t length,
 		bufferlist& bl,
 		uint32_t fadvise_flags);
+  int _do_write_raw(TransContext *txc,
+		    CollectionRef &c,
+		    OnodeRef o,
+		    uint64_t offset, uint64_t length,
+		    bufferlist& bl,
+		    uint32_t fadvise_flags);
+  void _do_zero_tail_extent(TransContext *txc,
+			    OnodeRef o,
+			    uint64_t offset);
+  bool _want_compress(OnodeRef o, uint32_t fadvise_flags);
+  bool _compress(bufferlist& raw, bufferlist *out);
+  int _do_write_compressed(TransContext *txc,
+			   CollectionRef &c,
+			   OnodeRef o,
+			   uint64_t offset, uint64_t length,
+			   bufferlist& bl,
+			   uint32_t fadvise_flags);
+  int _do_write_compressed_blob(TransContext *txc,
+				OnodeRef o,
+				uint64_t offset,
+				bufferlist& raw,
+				bufferlist& cbl,
+				uint32_t fadvise_flags);
+  int _do_decompress_range(TransContext *txc,
+			   CollectionRef &c,
+			   OnodeRef o,
+			   uint64_t offset, uint64_t length);
+  void _do_write_csum(OnodeRef o,
+		      uint64_t offset, uint64_t length,
+		      bufferlist& bl);
   int _touch(TransContext *txc,
 	     CollectionRef& c,
 	     const ghobject_t& oid);
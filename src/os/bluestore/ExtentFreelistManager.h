@@ -0,0 +1,54 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_EXTENTFREELISTMANAGER_H
+#define CEPH_OS_BLUESTORE_EXTENTFREELISTMANAGER_H
+
+#include <string>
+#include <map>
+#include <ostream>
+#include "common/Mutex.h"
+#include "FreelistManager.h"
+
+/// one kv key per free extent, mirrored in memory
+class ExtentFreelistManager : public FreelistManager {
+  KeyValueDB *kvdb;
+  std::string prefix;
+  Mutex lock;
+  uint64_t total_free;
+
+  std::map<uint64_t, uint64_t> kv_free;    ///< mirrors our kv values in the db
+
+  std::map<uint64_t, uint64_t>::const_iterator enumerate_p;
+
+  void _audit();
+
+public:
+  ExtentFreelistManager(KeyValueDB *db, std::string prefix) :
+    kvdb(db),
+    prefix(prefix),
+    lock("ExtentFreelistManager::lock"),
+    total_free(0) {
+  }
+
+  int create(uint64_t size, uint64_t block_size,
+	     KeyValueDB::Transaction txn);
+
+  int init();
+  void shutdown();
+
+  void dump();
+
+  void enumerate_reset();
+  bool enumerate_next(uint64_t *offset, uint64_t *length);
+
+  int allocate(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn);
+  int release(
+    uint64_t offset, uint64_t length,
+    KeyValueDB::Transaction txn);
+};
+
+
+#endif
@@ -5,46 +5,44 @@
 #define CEPH_OS_BLUESTORE_FREELISTMANAGER_H
 
 #include <string>
-#include <map>
-#include <ostream>
-#include "common/Mutex.h"
 #include "kv/KeyValueDB.h"
 
 class FreelistManager {
-  std::string prefix;
-  Mutex lock;
-  uint64_t total_free;
-
-  std::map<uint64_t, uint64_t> kv_free;    ///< mirrors our kv values in the db
+public:
+  FreelistManager() {}
+  virtual ~FreelistManager() {}
 
-  void _audit();
+  static FreelistManager *create(
+    std::string type,
+    KeyValueDB *db,
+    std::string prefix,
+    std::string bitmap_prefix);
 
-public:
-  FreelistManager() :
-    lock("FreelistManager::lock"),
-    total_free(0) {
-  }
+  /// register any merge operators type needs; call before opening db
+  static int setup_merge_operators(
+    KeyValueDB *db,
+    std::string type,
+    std::string bitmap_prefix);
 
-  int init(KeyValueDB *kvdb, std::string prefix);
-  void shutdown();
+  /// initialize a new freelist (mkfs) with the whole device free
+  virtual int create(uint64_t size, uint64_t block_size,
+		     KeyValueDB::Transaction txn) = 0;
 
-  void dump();
+  virtual int init() = 0;
+  virtual void shutdown() = 0;
 
-  uint64_t get_total_free() {
-    Mutex::Locker l(lock);
-    return total_free;
-  }
+  virtual void dump() = 0;
 
-  const std::map<uint64_t,uint64_t>& get_freelist() {
-    return kv_free;
-  }
+  /// walk free extents in offset order, without copying the freelist
+  virtual void enumerate_reset() = 0;
+  virtual bool enumerate_next(uint64_t *offset, uint64_t *length) = 0;
 
-  int allocate(
+  virtual int allocate(
     uint64_t offset, uint64_t length,
-    KeyValueDB::Transaction txn);
-  int release(
+    KeyValueDB::Transaction txn) = 0;
+  virtual int release(
     uint64_t offset, uint64_t length,
-    KeyValueDB::Transaction txn);
+    KeyValueDB::Transaction txn) = 0;
 };
 
 
@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_KERNELDEVICE_H
+#define CEPH_OS_BLUESTORE_KERNELDEVICE_H
+
+#include "BlockDevice.h"
+#include "common/histogram.h"
+
+/// a file or kernel block device, driven with libaio
+class KernelDevice : public BlockDevice {
+  int fd_direct, fd_buffered;
+  string path;
+  FS *fs;
+  bool aio, dio;
+  bufferptr zeros;
+
+  Mutex debug_lock;
+  interval_set<uint64_t> debug_inflight;
+
+  struct AioQueue;
+
+  struct AioCompletionThread : public Thread {
+    KernelDevice *bdev;
+    AioQueue *q;
+    AioCompletionThread(KernelDevice *b, AioQueue *q) : bdev(b), q(q) {}
+    void *entry() {
+      bdev->_aio_thread(q);
+      return NULL;
+    }
+  };
+
+  /**
+   * An aio context and the thread that reaps it.  Submitters append to
+   * batch; whichever finds no one else submitting drains it, so aios from
+   * concurrent IOContexts go to the kernel in one io_submit.
+   */
+  struct AioQueue {
+    unsigned id;
+    FS::aio_queue_t aio_queue;
+    AioCompletionThread aio_thread;
+
+    Mutex lock;                 ///< protects everything below
+    Cond cond;                  ///< signaled as inflight drops
+    deque<FS::aio_t*> batch;    ///< queued, not yet submitted
+    bool submitting;            ///< someone is draining batch
+    unsigned inflight;          ///< submitted, not yet reaped
+    unsigned max_inflight;
+    unsigned peak_inflight;     ///< most ever in flight
+    unsigned peak_batch;        ///< most aios in one io_submit
+
+    pow2_hist_t batch_hist;     ///< aios per io_submit
+    pow2_hist_t depth_hist;     ///< inflight after each io_submit
+    pow2_hist_t lat_hist;       ///< submit to reap, usec
+
+    AioQueue(KernelDevice *b, unsigned i, unsigned depth)
+      : id(i),
+	aio_queue(depth),
+	aio_thread(b, this),
+	lock("KernelDevice::AioQueue::lock"),
+	submitting(false),
+	inflight(0),
+	max_inflight(depth),
+	peak_inflight(0),
+	peak_batch(0) {}
+  };
+
+  vector<AioQueue*> aio_queues;
+  bool aio_stop;
+
+  AioQueue *_get_aio_queue();
+  bool _is_aio_thread();
+  void _aio_drain(AioQueue *q, bool may_block);
+  void _aio_thread(AioQueue *q);
+  int _aio_start();
+  void _aio_stop();
+
+  void _aio_log_start(IOContext *ioc, uint64_t offset, uint64_t length);
+  void _aio_log_finish(IOContext *ioc, uint64_t offset, uint64_t length);
+
+  int _lock();
+
+public:
+  KernelDevice(aio_callback_t cb, void *cbpriv);
+  ~KernelDevice();
+
+  void aio_submit(IOContext *ioc);
+
+  int read(uint64_t off, uint64_t len, bufferlist *pbl,
+	   IOContext *ioc,
+	   bool buffered);
+
+  int aio_write(uint64_t off, bufferlist& bl,
+		IOContext *ioc,
+		bool buffered);
+  int aio_zero(uint64_t off, uint64_t len,
+	       IOContext *ioc);
+  int flush();
+
+  int invalidate_cache(uint64_t off, uint64_t len);
+  int open(string path);
+  void close();
+
+  void dump_stats(Formatter *f);
+};
+
+#endif
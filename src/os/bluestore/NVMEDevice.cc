@@ -0,0 +1,473 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "NVMEDevice.h"
+#include "include/types.h"
+#include "include/compat.h"
+#include "common/errno.h"
+#include "common/debug.h"
+#include "common/blkdev.h"
+#include "common/strtol.h"
+
+#define dout_subsys ceph_subsys_bdev
+#undef dout_prefix
+#define dout_prefix *_dout << "bdev-nvme "
+
+// ----------------
+// namespaces
+
+class MemNamespace : public NVMENamespace {
+  bufferptr data;
+
+public:
+  MemNamespace(uint64_t s) {
+    size = s;
+  }
+
+  int open() {
+    data = buffer::create_page_aligned(size);
+    data.zero();
+    return 0;
+  }
+  void close() {
+    data = bufferptr();
+  }
+
+  int read(uint64_t off, uint64_t len, char *buf) {
+    memcpy(buf, data.c_str() + off, len);
+    return 0;
+  }
+  int write(uint64_t off, bufferlist& bl) {
+    bl.copy(0, bl.length(), data.c_str() + off);
+    return 0;
+  }
+  int flush() {
+    return 0;
+  }
+};
+
+class FileNamespace : public NVMENamespace {
+  string path;
+  int fd;
+
+public:
+  FileNamespace(const string& p) : path(p), fd(-1) {}
+
+  int open() {
+    fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+      int r = -errno;
+      derr << __func__ << " failed to open " << path << ": "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    struct flock l;
+    memset(&l, 0, sizeof(l));
+    l.l_type = F_WRLCK;
+    l.l_whence = SEEK_SET;
+    int r = ::fcntl(fd, F_SETLK, &l);
+    if (r < 0) {
+      r = -errno;
+      derr << __func__ << " failed to lock " << path << ": "
+	   << cpp_strerror(r) << dendl;
+      goto out_fail;
+    }
+    struct stat st;
+    r = ::fstat(fd, &st);
+    if (r < 0) {
+      r = -errno;
+      goto out_fail;
+    }
+    if (S_ISBLK(st.st_mode)) {
+      int64_t s;
+      r = get_block_device_size(fd, &s);
+      if (r < 0)
+	goto out_fail;
+      size = s;
+    } else {
+      size = st.st_size;
+    }
+    return 0;
+
+  out_fail:
+    VOID_TEMP_FAILURE_RETRY(::close(fd));
+    fd = -1;
+    return r;
+  }
+  void close() {
+    assert(fd >= 0);
+    VOID_TEMP_FAILURE_RETRY(::close(fd));
+    fd = -1;
+  }
+
+  int read(uint64_t off, uint64_t len, char *buf) {
+    while (len > 0) {
+      ssize_t r = ::pread(fd, buf, len, off);
+      if (r < 0)
+	return -errno;
+      if (r == 0)
+	return -EIO;
+      buf += r;
+      off += r;
+      len -= r;
+    }
+    return 0;
+  }
+  int write(uint64_t off, bufferlist& bl) {
+    vector<iovec> iov;
+    bl.prepare_iov(&iov);
+    ssize_t r = ::pwritev(fd, &iov[0], iov.size(), off);
+    if (r < 0)
+      return -errno;
+    if ((uint64_t)r != bl.length())
+      return -EIO;
+    return 0;
+  }
+  int flush() {
+    if (::fdatasync(fd) < 0)
+      return -errno;
+    return 0;
+  }
+};
+
+NVMENamespace *NVMENamespace::create(const string& path)
+{
+  if (path.compare(0, 4, "mem:") == 0) {
+    string err;
+    uint64_t size = strict_sistrtoll(path.c_str() + 4, &err);
+    if (!err.empty()) {
+      derr << __func__ << " bad size in " << path << ": " << err << dendl;
+      return NULL;
+    }
+    return new MemNamespace(size);
+  }
+  return new FileNamespace(path);
+}
+
+// ----------------
+// device
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bdev-nvme(" << path << ") "
+
+NVMEDevice::NVMEDevice(aio_callback_t cb, void *cbpriv)
+  : BlockDevice(cb, cbpriv),
+    ns(NULL)
+{
+  zeros = buffer::create_page_aligned(1048576);
+  zeros.zero();
+}
+
+NVMEDevice::~NVMEDevice()
+{
+  assert(ns == NULL);
+  assert(queue_pairs.empty());
+}
+
+int NVMEDevice::open(string p)
+{
+  path = p;
+  dout(1) << __func__ << " path " << path << dendl;
+
+  ns = NVMENamespace::create(path);
+  if (!ns)
+    return -EINVAL;
+  int r = ns->open();
+  if (r < 0) {
+    delete ns;
+    ns = NULL;
+    return r;
+  }
+  size = ns->get_size();
+  block_size = ns->get_block_size();
+
+  int n = MAX(1, g_conf->bdev_nvme_queue_pairs);
+  for (int i = 0; i < n; ++i) {
+    QueuePair *qp = new QueuePair(this, i);
+    queue_pairs.push_back(qp);
+    qp->poller.create();
+  }
+
+  dout(1) << __func__
+	  << " size " << size
+	  << " (" << pretty_si_t(size) << "B)"
+	  << " block_size " << block_size
+	  << " (" << pretty_si_t(block_size) << "B)"
+	  << " queue_pairs " << n
+	  << dendl;
+  return 0;
+}
+
+void NVMEDevice::close()
+{
+  dout(1) << __func__ << dendl;
+  for (vector<QueuePair*>::iterator p = queue_pairs.begin();
+       p != queue_pairs.end();
+       ++p) {
+    QueuePair *qp = *p;
+    {
+      Mutex::Locker l(qp->sq_lock);
+      qp->stop = true;
+      qp->doorbell.Signal();
+    }
+    qp->poller.join();
+    assert(qp->sq.empty());
+    assert(qp->cq.empty());
+    delete qp;
+  }
+  queue_pairs.clear();
+
+  ns->close();
+  delete ns;
+  ns = NULL;
+  path.clear();
+}
+
+NVMEDevice::QueuePair *NVMEDevice::_get_queue_pair()
+{
+  int cpu = sched_getcpu();
+  if (cpu < 0)
+    cpu = 0;
+  return queue_pairs[cpu % queue_pairs.size()];
+}
+
+void NVMEDevice::_submit(QueuePair *qp, deque<NVMETask*>& tasks)
+{
+  Mutex::Locker l(qp->sq_lock);
+  qp->sq.insert(qp->sq.end(), tasks.begin(), tasks.end());
+  if (qp->sleeping)
+    qp->doorbell.Signal();
+}
+
+int NVMEDevice::_sync_io(NVMETask *t)
+{
+  // completion callbacks run on a poller and may do io of their own;
+  // like any thread owning a queue pair, it just executes it inline
+  for (vector<QueuePair*>::iterator p = queue_pairs.begin();
+       p != queue_pairs.end();
+       ++p) {
+    if ((*p)->poller.am_self()) {
+      _execute(t);
+      return t->ret;
+    }
+  }
+  deque<NVMETask*> tasks;
+  tasks.push_back(t);
+  _submit(_get_queue_pair(), tasks);
+  t->wait();
+  return t->ret;
+}
+
+void NVMEDevice::_poll_thread(QueuePair *qp)
+{
+  dout(10) << __func__ << " qp " << qp->id << " start" << dendl;
+  int idle = 0;
+  deque<NVMETask*> sq;
+  qp->sq_lock.Lock();
+  while (true) {
+    if (qp->sq.empty()) {
+      if (qp->stop)
+	break;
+      if (idle < g_conf->bdev_nvme_poll_spins) {
+	// keep polling
+	++idle;
+	qp->sq_lock.Unlock();
+	sched_yield();
+	qp->sq_lock.Lock();
+	continue;
+      }
+      dout(30) << __func__ << " qp " << qp->id << " sleep" << dendl;
+      qp->sleeping = true;
+      qp->doorbell.Wait(qp->sq_lock);
+      qp->sleeping = false;
+      dout(30) << __func__ << " qp " << qp->id << " wake" << dendl;
+      continue;
+    }
+    idle = 0;
+    sq.swap(qp->sq);
+    qp->sq_lock.Unlock();
+
+    // the (fake) controller executes commands in submission order and
+    // posts them to our completion queue, which we then reap
+    for (deque<NVMETask*>::iterator p = sq.begin(); p != sq.end(); ++p) {
+      _execute(*p);
+      qp->cq.push_back(*p);
+    }
+    sq.clear();
+    while (!qp->cq.empty()) {
+      NVMETask *t = qp->cq.front();
+      qp->cq.pop_front();
+      _complete(t);
+    }
+
+    qp->sq_lock.Lock();
+  }
+  qp->sq_lock.Unlock();
+  dout(10) << __func__ << " qp " << qp->id << " finish" << dendl;
+}
+
+void NVMEDevice::_execute(NVMETask *t)
+{
+  switch (t->op) {
+  case NVMETask::OP_READ:
+    t->ret = ns->read(t->offset, t->length, t->bl.c_str());
+    break;
+  case NVMETask::OP_WRITE:
+    t->ret = ns->write(t->offset, t->bl);
+    break;
+  case NVMETask::OP_FLUSH:
+    t->ret = ns->flush();
+    break;
+  }
+  dout(20) << __func__ << " op " << (int)t->op << " " << t->offset << "~"
+	   << t->length << " = " << t->ret << dendl;
+}
+
+void NVMEDevice::_complete(NVMETask *t)
+{
+  IOContext *ioc = t->ioc;
+  if (!ioc) {
+    Mutex::Locker l(t->lock);
+    t->done = true;
+    t->cond.Signal();
+    return;
+  }
+
+  int r = t->ret;
+  delete t;
+  assert(r >= 0);
+  int left = ioc->num_running.dec();
+  dout(10) << __func__ << " ioc " << ioc << " with " << left
+	   << " aios left" << dendl;
+  if (left == 0) {
+    // check waiting count before doing callback (which may
+    // destroy this ioc), and take priv before waking the waiter
+    // (which may destroy it, too).
+    void *priv = ioc->priv;
+    if (ioc->num_waiting.read()) {
+      Mutex::Locker l(ioc->lock);
+      ioc->cond.Signal();
+    }
+    if (priv) {
+      aio_callback(aio_callback_priv, priv);
+    }
+  }
+}
+
+void NVMEDevice::aio_submit(IOContext *ioc)
+{
+  dout(20) << __func__ << " ioc " << ioc
+	   << " pending " << ioc->num_pending.read()
+	   << " running " << ioc->num_running.read()
+	   << dendl;
+  // take the tasks first: they may complete (and the ioc go away) as
+  // soon as they are queued
+  deque<NVMETask*> tasks(ioc->pending_tasks.begin(), ioc->pending_tasks.end());
+  ioc->pending_tasks.clear();
+  int pending = ioc->num_pending.read();
+  ioc->num_running.add(pending);
+  ioc->num_pending.sub(pending);
+  assert(ioc->num_pending.read() == 0);  // we should be only thread doing this
+  if (!tasks.empty())
+    _submit(_get_queue_pair(), tasks);
+}
+
+int NVMEDevice::read(uint64_t off, uint64_t len, bufferlist *pbl,
+		     IOContext *ioc,
+		     bool buffered)
+{
+  dout(5) << __func__ << " " << off << "~" << len << dendl;
+  assert(off % block_size == 0);
+  assert(len % block_size == 0);
+  assert(len > 0);
+  assert(off < size);
+  assert(off + len <= size);
+
+  ioc->num_reading.inc();
+  NVMETask t(NVMETask::OP_READ, off, len, NULL);
+  t.bl.push_back(buffer::create_page_aligned(len));
+  int r = _sync_io(&t);
+  if (r >= 0) {
+    pbl->clear();
+    pbl->claim_append(t.bl);
+  }
+  ioc->num_reading.dec();
+  if (ioc->num_waiting.read()) {
+    Mutex::Locker l(ioc->lock);
+    ioc->cond.Signal();
+  }
+  return r < 0 ? r : 0;
+}
+
+int NVMEDevice::aio_write(uint64_t off, bufferlist& bl,
+			  IOContext *ioc,
+			  bool buffered)
+{
+  uint64_t len = bl.length();
+  dout(20) << __func__ << " " << off << "~" << len << dendl;
+  assert(off % block_size == 0);
+  assert(len % block_size == 0);
+  assert(len > 0);
+  assert(off < size);
+  assert(off + len <= size);
+
+  if (buffered) {
+    // there is no page cache; write it through now, as a buffered
+    // KernelDevice write would be visible to readers right away
+    NVMETask t(NVMETask::OP_WRITE, off, len, NULL);
+    t.bl.claim(bl);
+    return _sync_io(&t);
+  }
+  NVMETask *t = new NVMETask(NVMETask::OP_WRITE, off, len, ioc);
+  t->bl.claim(bl);
+  ioc->pending_tasks.push_back(t);
+  ioc->num_pending.inc();
+  return 0;
+}
+
+int NVMEDevice::aio_zero(uint64_t off, uint64_t len,
+			 IOContext *ioc)
+{
+  dout(5) << __func__ << " " << off << "~" << len << dendl;
+  assert(off % block_size == 0);
+  assert(len % block_size == 0);
+  assert(len > 0);
+  assert(off < size);
+  assert(off + len <= size);
+
+  bufferlist bl;
+  while (len > 0) {
+    bufferlist t;
+    t.append(zeros, 0, MIN(zeros.length(), len));
+    len -= t.length();
+    bl.claim_append(t);
+  }
+  return aio_write(off, bl, ioc, false);
+}
+
+int NVMEDevice::flush()
+{
+  dout(10) << __func__ << " start" << dendl;
+  utime_t start = ceph_clock_now(NULL);
+  NVMETask t(NVMETask::OP_FLUSH, 0, 0, NULL);
+  int r = _sync_io(&t);
+  if (r < 0) {
+    derr << __func__ << " flush got: " << cpp_strerror(r) << dendl;
+  }
+  dout(5) << __func__ << " in " << (ceph_clock_now(NULL) - start) << dendl;
+  return r;
+}
+
+int NVMEDevice::invalidate_cache(uint64_t off, uint64_t len)
+{
+  // nothing is cached
+  return 0;
+}
@@ -0,0 +1,144 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_NVMEDEVICE_H
+#define CEPH_OS_BLUESTORE_NVMEDEVICE_H
+
+#include "BlockDevice.h"
+
+/// one io command, queued on an NVMEDevice queue pair
+struct NVMETask {
+  typedef enum {
+    OP_READ,
+    OP_WRITE,
+    OP_FLUSH,
+  } op_t;
+
+  op_t op;
+  uint64_t offset, length;
+  bufferlist bl;      ///< data to write, or buffer to read into
+  IOContext *ioc;     ///< aio owner; NULL if the submitter waits on done
+  int ret;
+
+  Mutex lock;
+  Cond cond;
+  bool done;
+
+  NVMETask(op_t o, uint64_t off, uint64_t len, IOContext *i)
+    : op(o), offset(off), length(len), ioc(i), ret(0),
+      lock("NVMETask::lock"), done(false) {}
+
+  void wait() {
+    Mutex::Locker l(lock);
+    while (!done)
+      cond.Wait(lock);
+  }
+};
+
+/**
+ * The storage behind an NVMEDevice: executes commands as the controller
+ * would.  "mem:<bytes>" is held in memory; anything else is a file or
+ * block device used as the namespace, which lets the driver run (and be
+ * tested) on machines without NVMe.
+ */
+class NVMENamespace {
+protected:
+  uint64_t size;
+  uint64_t block_size;
+
+public:
+  NVMENamespace() : size(0), block_size(4096) {}
+  virtual ~NVMENamespace() {}
+
+  static NVMENamespace *create(const string& path);
+
+  uint64_t get_size() const {
+    return size;
+  }
+  uint64_t get_block_size() const {
+    return block_size;
+  }
+
+  virtual int open() = 0;
+  virtual void close() = 0;
+
+  virtual int read(uint64_t off, uint64_t len, char *buf) = 0;
+  virtual int write(uint64_t off, bufferlist& bl) = 0;
+  virtual int flush() = 0;
+};
+
+/**
+ * A userspace, polled-mode driver.  There is one queue pair per
+ * bdev_nvme_queue_pairs, each served by its own poller thread;
+ * submitters use the queue pair for the cpu they run on, so cores do not
+ * share a submission queue.  Pollers do not wait for interrupts: they
+ * spin on their queues, and only sleep after bdev_nvme_poll_spins idle
+ * passes, until the next submission rings the doorbell.
+ */
+class NVMEDevice : public BlockDevice {
+  struct QueuePair;
+
+  struct PollerThread : public Thread {
+    NVMEDevice *bdev;
+    QueuePair *qp;
+    PollerThread(NVMEDevice *b, QueuePair *q) : bdev(b), qp(q) {}
+    void *entry() {
+      bdev->_poll_thread(qp);
+      return NULL;
+    }
+  };
+
+  struct QueuePair {
+    unsigned id;
+    Mutex sq_lock;              ///< protects sq, sleeping, stop
+    Cond doorbell;
+    deque<NVMETask*> sq;        ///< submission queue
+    deque<NVMETask*> cq;        ///< completion queue (poller only)
+    bool sleeping;              ///< poller is waiting on doorbell
+    bool stop;
+    PollerThread poller;
+
+    QueuePair(NVMEDevice *b, unsigned i)
+      : id(i),
+	sq_lock("NVMEDevice::QueuePair::sq_lock"),
+	sleeping(false),
+	stop(false),
+	poller(b, this) {}
+  };
+
+  string path;
+  NVMENamespace *ns;
+  vector<QueuePair*> queue_pairs;
+  bufferptr zeros;
+
+  QueuePair *_get_queue_pair();
+  void _submit(QueuePair *qp, deque<NVMETask*>& tasks);
+  int _sync_io(NVMETask *t);
+
+  void _poll_thread(QueuePair *qp);
+  void _execute(NVMETask *t);
+  void _complete(NVMETask *t);
+
+public:
+  NVMEDevice(aio_callback_t cb, void *cbpriv);
+  ~NVMEDevice();
+
+  void aio_submit(IOContext *ioc);
+
+  int read(uint64_t off, uint64_t len, bufferlist *pbl,
+	   IOContext *ioc,
+	   bool buffered);
+
+  int aio_write(uint64_t off, bufferlist& bl,
+		IOContext *ioc,
+		bool buffered);
+  int aio_zero(uint64_t off, uint64_t len,
+	       IOContext *ioc);
+  int flush();
+
+  int invalidate_cache(uint64_t off, uint64_t len);
+  int open(string path);
+  void close();
+};
+
+#endif
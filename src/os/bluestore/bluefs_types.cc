@@ -100,6 +100,17 @@ ostream& operator<<(ostream& out, const bluefs_super_t& s)
 
 // bluefs_fnode_t
 
+const char *bluefs_file_type_name(unsigned t)
+{
+  switch (t) {
+  case BLUEFS_FILE_OTHER: return "other";
+  case BLUEFS_FILE_WAL: return "wal";
+  case BLUEFS_FILE_SST: return "sst";
+  case BLUEFS_FILE_LOG: return "log";
+  default: return "???";
+  }
+}
+
 vector<bluefs_extent_t>::iterator bluefs_fnode_t::seek(
   uint64_t offset, uint64_t *x_off)
 {
@@ -118,23 +129,28 @@ vector<bluefs_extent_t>::iterator bluefs_fnode_t::seek(
 
 void bluefs_fnode_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(2, 1, bl);
   ::encode(ino, bl);
   ::encode(size, bl);
   ::encode(mtime, bl);
   ::encode(prefer_bdev, bl);
   ::encode(extents, bl);
+  ::encode(type, bl);
   ENCODE_FINISH(bl);
 }
 
 void bluefs_fnode_t::decode(bufferlist::iterator& p)
 {
-  DECODE_START(1, p);
+  DECODE_START(2, p);
   ::decode(ino, p);
   ::decode(size, p);
   ::decode(mtime, p);
   ::decode(prefer_bdev, p);
   ::decode(extents, p);
+  if (struct_v >= 2)
+    ::decode(type, p);
+  else
+    type = ino == 1 ? BLUEFS_FILE_LOG : BLUEFS_FILE_OTHER;
   DECODE_FINISH(p);
 }
 
@@ -144,6 +160,7 @@ void bluefs_fnode_t::dump(Formatter *f) const
   f->dump_unsigned("size", size);
   f->dump_stream("mtime") << mtime;
   f->dump_unsigned("prefer_bdev", prefer_bdev);
+  f->dump_string("type", bluefs_file_type_name(type));
   f->open_array_section("extents");
   for (auto& p : extents)
     f->dump_object("extent", p);
@@ -159,6 +176,7 @@ void bluefs_fnode_t::generate_test_instances(list<bluefs_fnode_t*>& ls)
   ls.back()->mtime = utime_t(123,45);
   ls.back()->extents.push_back(bluefs_extent_t(0, 1048576, 4096));
   ls.back()->prefer_bdev = 1;
+  ls.back()->type = BLUEFS_FILE_SST;
 }
 
 ostream& operator<<(ostream& out, const bluefs_fnode_t& file)
@@ -167,6 +185,7 @@ ostream& operator<<(ostream& out, const bluefs_fnode_t& file)
 	     << " size " << file.size
 	     << " mtime " << file.mtime
 	     << " bdev " << (int)file.prefer_bdev
+	     << " " << bluefs_file_type_name(file.type)
 	     << " extents " << file.extents
 	     << ")";
 }
@@ -29,14 +29,27 @@ WRITE_CLASS_ENCODER(bluefs_extent_t)
 ostream& operator<<(ostream& out, bluefs_extent_t e);
 
 
+/// what a file holds, as hinted by its writer
+enum {
+  BLUEFS_FILE_OTHER = 0,  ///< kv metadata (manifest, CURRENT, ...), info logs
+  BLUEFS_FILE_WAL,        ///< kv write-ahead log
+  BLUEFS_FILE_SST,        ///< kv sorted table
+  BLUEFS_FILE_LOG,        ///< our own metadata log
+  BLUEFS_FILE_MAX
+};
+
+const char *bluefs_file_type_name(unsigned t);
+
 struct bluefs_fnode_t {
   uint64_t ino;
   uint64_t size;
   utime_t mtime;
   uint8_t prefer_bdev;
+  uint8_t type;           ///< BLUEFS_FILE_*
   vector<bluefs_extent_t> extents;
 
-  bluefs_fnode_t() : ino(0), size(0), prefer_bdev(0) {}
+  bluefs_fnode_t()
+    : ino(0), size(0), prefer_bdev(0), type(BLUEFS_FILE_OTHER) {}
 
   uint64_t get_allocated() const {
     uint64_t r = 0;
@@ -15,6 +15,8 @@
 #include "bluestore_types.h"
 #include "common/Formatter.h"
 #include "include/stringify.h"
+#include "include/crc32c.h"
+#include "include/xxhash.h"
 
 // bluestore_bdev_label_t
 
@@ -394,11 +396,195 @@ ostream& operator<<(ostream& out, const bluestore_overlay_t& o)
   return out;
 }
 
+// bluestore_compressed_t
+
+const char *bluestore_compression_type_name(int t)
+{
+  switch (t) {
+  case BLUESTORE_COMPRESSION_NONE: return "none";
+  case BLUESTORE_COMPRESSION_SNAPPY: return "snappy";
+  case BLUESTORE_COMPRESSION_ZLIB: return "zlib";
+  default: return "???";
+  }
+}
+
+int bluestore_compression_type_from_name(const string& s)
+{
+  for (int t = 0; t < BLUESTORE_COMPRESSION_MAX; ++t) {
+    if (s == bluestore_compression_type_name(t))
+      return t;
+  }
+  return -EINVAL;
+}
+
+void bluestore_compressed_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(type, bl);
+  ::encode(raw_length, bl);
+  ::encode(length, bl);
+  ::encode(extents, bl);
+  ENCODE_FINISH(bl);
+}
+
+void bluestore_compressed_t::decode(bufferlist::iterator& p)
+{
+  DECODE_START(1, p);
+  ::decode(type, p);
+  ::decode(raw_length, p);
+  ::decode(length, p);
+  ::decode(extents, p);
+  DECODE_FINISH(p);
+}
+
+void bluestore_compressed_t::dump(Formatter *f) const
+{
+  f->dump_string("type", bluestore_compression_type_name(type));
+  f->dump_unsigned("raw_length", raw_length);
+  f->dump_unsigned("length", length);
+  f->open_array_section("extents");
+  for (auto& e : extents) {
+    f->open_object_section("extent");
+    e.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void bluestore_compressed_t::generate_test_instances(
+  list<bluestore_compressed_t*>& o)
+{
+  o.push_back(new bluestore_compressed_t());
+  o.push_back(new bluestore_compressed_t(BLUESTORE_COMPRESSION_SNAPPY,
+					 65536, 5000));
+  o.back()->extents.push_back(bluestore_extent_t(1024*1024, 4096, 0));
+  o.back()->extents.push_back(bluestore_extent_t(8192, 4096, 0));
+}
+
+ostream& operator<<(ostream& out, const bluestore_compressed_t& c)
+{
+  return out << "compressed(" << bluestore_compression_type_name(c.type)
+	     << " " << c.raw_length << " -> " << c.length
+	     << " in " << c.extents << ")";
+}
+
+// csum
+
+const char *bluestore_csum_type_name(int t)
+{
+  switch (t) {
+  case BLUESTORE_CSUM_NONE: return "none";
+  case BLUESTORE_CSUM_CRC32C: return "crc32c";
+  case BLUESTORE_CSUM_XXHASH32: return "xxhash32";
+  case BLUESTORE_CSUM_XXHASH64: return "xxhash64";
+  default: return "???";
+  }
+}
+
+int bluestore_csum_type_from_name(const string& s)
+{
+  for (int t = 0; t < BLUESTORE_CSUM_MAX; ++t) {
+    if (s == bluestore_csum_type_name(t))
+      return t;
+  }
+  return -EINVAL;
+}
+
+unsigned bluestore_csum_value_size(int t)
+{
+  switch (t) {
+  case BLUESTORE_CSUM_CRC32C: return 4;
+  case BLUESTORE_CSUM_XXHASH32: return 4;
+  case BLUESTORE_CSUM_XXHASH64: return 8;
+  default: return 0;
+  }
+}
+
+uint64_t bluestore_csum_calc(int t, bufferlist& bl)
+{
+  switch (t) {
+  case BLUESTORE_CSUM_CRC32C:
+    return bl.crc32c(-1);
+  case BLUESTORE_CSUM_XXHASH32:
+    return ceph_xxhash32(-1, bl.c_str(), bl.length());
+  case BLUESTORE_CSUM_XXHASH64:
+    return ceph_xxhash64(-1, bl.c_str(), bl.length());
+  default:
+    return 0;
+  }
+}
+
 // bluestore_onode_t
 
+uint64_t bluestore_onode_t::get_csum_item(unsigned i) const
+{
+  unsigned vs = bluestore_csum_value_size(csum_type);
+  if ((i + 1) * vs > csum_data.length())
+    return 0;
+  const unsigned char *p = (const unsigned char *)csum_data.c_str() + i * vs;
+  uint64_t v = 0;
+  for (unsigned b = 0; b < vs; ++b)
+    v |= (uint64_t)p[b] << (8 * b);
+  return v;
+}
+
+void bluestore_onode_t::set_csum_item(unsigned i, uint64_t v)
+{
+  unsigned vs = bluestore_csum_value_size(csum_type);
+  assert((i + 1) * vs <= csum_data.length());
+  unsigned char *p = (unsigned char *)csum_data.c_str() + i * vs;
+  for (unsigned b = 0; b < vs; ++b)
+    p[b] = v >> (8 * b);
+}
+
+void bluestore_onode_t::csum_prepare(unsigned count)
+{
+  assert(has_csum());
+  unsigned vs = bluestore_csum_value_size(csum_type);
+  unsigned len = MAX(count * vs, csum_data.length());
+  bufferptr n(len);
+  if (csum_data.length())
+    n.copy_in(0, csum_data.length(), csum_data.c_str());
+  if (len > csum_data.length())
+    n.zero(csum_data.length(), len - csum_data.length());
+  csum_data = n;
+}
+
+void bluestore_onode_t::csum_clear(uint64_t offset, uint64_t length)
+{
+  unsigned count = get_csum_count();
+  if (!count || !length)
+    return;
+  uint64_t first = offset >> csum_chunk_order;
+  uint64_t last = (offset + length - 1) >> csum_chunk_order;
+  if (first >= count)
+    return;
+  if (last >= count)
+    last = count - 1;
+  unsigned vs = bluestore_csum_value_size(csum_type);
+  csum_prepare(0);
+  csum_data.zero(first * vs, (last - first + 1) * vs);
+}
+
+void bluestore_onode_t::csum_truncate(uint64_t offset)
+{
+  unsigned count = get_csum_count();
+  uint64_t keep = offset >> csum_chunk_order;
+  if (keep >= count)
+    return;
+  if (keep == 0) {
+    csum_data = bufferptr();
+    csum_type = BLUESTORE_CSUM_NONE;
+    csum_chunk_order = 0;
+    return;
+  }
+  unsigned vs = bluestore_csum_value_size(csum_type);
+  csum_data = buffer::copy(csum_data.c_str(), keep * vs);
+}
+
 void bluestore_onode_t::encode(bufferlist& bl) const
 {
-  ENCODE_START(1, 1, bl);
+  ENCODE_START(3, 1, bl);
   ::encode(nid, bl);
   ::encode(size, bl);
   ::encode(attrs, bl);
@@ -409,12 +595,18 @@ void bluestore_onode_t::encode(bufferlist& bl) const
   ::encode(omap_head, bl);
   ::encode(expected_object_size, bl);
   ::encode(expected_write_size, bl);
+  ::encode(csum_type, bl);
+  if (csum_type != BLUESTORE_CSUM_NONE) {
+    ::encode(csum_chunk_order, bl);
+    ::encode(csum_data, bl);
+  }
+  ::encode(compressed_map, bl);
   ENCODE_FINISH(bl);
 }
 
 void bluestore_onode_t::decode(bufferlist::iterator& p)
 {
-  DECODE_START(1, p);
+  DECODE_START(3, p);
   ::decode(nid, p);
   ::decode(size, p);
   ::decode(attrs, p);
@@ -425,6 +617,22 @@ void bluestore_onode_t::decode(bufferlist::iterator& p)
   ::decode(omap_head, p);
   ::decode(expected_object_size, p);
   ::decode(expected_write_size, p);
+  if (struct_v >= 2) {
+    ::decode(csum_type, p);
+    if (csum_type != BLUESTORE_CSUM_NONE) {
+      ::decode(csum_chunk_order, p);
+      ::decode(csum_data, p);
+    }
+  } else {
+    csum_type = BLUESTORE_CSUM_NONE;
+    csum_chunk_order = 0;
+    csum_data = bufferptr();
+  }
+  if (struct_v >= 3) {
+    ::decode(compressed_map, p);
+  } else {
+    compressed_map.clear();
+  }
   DECODE_FINISH(p);
 }
 
@@ -468,15 +676,38 @@ void bluestore_onode_t::dump(Formatter *f) const
     f->close_section();
   }
   f->close_section();
+  f->open_array_section("compressed_map");
+  for (auto& p : compressed_map) {
+    f->open_object_section("compressed");
+    f->dump_unsigned("offset", p.first);
+    p.second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
   f->dump_unsigned("last_overlay_key", last_overlay_key);
   f->dump_unsigned("omap_head", omap_head);
   f->dump_unsigned("expected_object_size", expected_object_size);
   f->dump_unsigned("expected_write_size", expected_write_size);
+  f->dump_string("csum_type", bluestore_csum_type_name(csum_type));
+  if (has_csum()) {
+    f->dump_unsigned("csum_chunk_size", get_csum_chunk_size());
+    f->open_array_section("csum");
+    for (unsigned i = 0; i < get_csum_count(); ++i)
+      f->dump_unsigned("value", get_csum_item(i));
+    f->close_section();
+  }
 }
 
 void bluestore_onode_t::generate_test_instances(list<bluestore_onode_t*>& o)
 {
   o.push_back(new bluestore_onode_t());
+  o.push_back(new bluestore_onode_t());
+  o.back()->size = 8192;
+  o.back()->csum_type = BLUESTORE_CSUM_CRC32C;
+  o.back()->csum_chunk_order = 12;
+  o.back()->csum_prepare(2);
+  o.back()->set_csum_item(0, 0x12345678);
+  o.back()->set_csum_item(1, 0x9abcdef0);
   // FIXME
 }
 
@@ -179,6 +179,56 @@ WRITE_CLASS_ENCODER(bluestore_overlay_t)
 
 ostream& operator<<(ostream& out, const bluestore_overlay_t& o);
 
+/// compression algorithms
+enum {
+  BLUESTORE_COMPRESSION_NONE = 0,
+  BLUESTORE_COMPRESSION_SNAPPY = 1,
+  BLUESTORE_COMPRESSION_ZLIB = 2,
+  BLUESTORE_COMPRESSION_MAX = 3,
+};
+const char *bluestore_compression_type_name(int t);
+int bluestore_compression_type_from_name(const string& s);  ///< or -EINVAL
+
+/// compressed blob: a logical range whose data is stored compressed
+struct bluestore_compressed_t {
+  uint8_t type;                        ///< BLUESTORE_COMPRESSION_*
+  uint32_t raw_length;                 ///< logical (uncompressed) length
+  uint32_t length;                     ///< compressed length
+  vector<bluestore_extent_t> extents;  ///< where the compressed bytes live
+
+  bluestore_compressed_t(int t=BLUESTORE_COMPRESSION_NONE,
+			 uint32_t rl=0, uint32_t l=0)
+    : type(t), raw_length(rl), length(l) {}
+
+  uint64_t get_allocated() const {
+    uint64_t r = 0;
+    for (auto& e : extents)
+      r += e.length;
+    return r;
+  }
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& p);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<bluestore_compressed_t*>& o);
+};
+WRITE_CLASS_ENCODER(bluestore_compressed_t)
+
+ostream& operator<<(ostream& out, const bluestore_compressed_t& c);
+
+/// data checksum algorithms
+enum {
+  BLUESTORE_CSUM_NONE = 0,
+  BLUESTORE_CSUM_CRC32C = 1,
+  BLUESTORE_CSUM_XXHASH32 = 2,
+  BLUESTORE_CSUM_XXHASH64 = 3,
+  BLUESTORE_CSUM_MAX = 4,
+};
+const char *bluestore_csum_type_name(int t);
+int bluestore_csum_type_from_name(const string& s);  ///< or -EINVAL
+unsigned bluestore_csum_value_size(int t);           ///< bytes per value
+uint64_t bluestore_csum_calc(int t, bufferlist& bl);
+
 /// onode: per-object metadata
 struct bluestore_onode_t {
   uint64_t nid;                        ///< numeric id (locally unique)
@@ -187,19 +237,26 @@ struct bluestore_onode_t {
   map<uint64_t, bluestore_extent_t> block_map;   ///< block data
   map<uint64_t,bluestore_overlay_t> overlay_map; ///< overlay data (stored in db)
   map<uint64_t,uint16_t> overlay_refs; ///< overlay keys ref counts (if >1)
+  map<uint64_t,bluestore_compressed_t> compressed_map; ///< compressed data (not in block_map)
   uint32_t last_overlay_key;           ///< key for next overlay
   uint64_t omap_head;                  ///< id for omap root node
 
   uint32_t expected_object_size;
   uint32_t expected_write_size;
 
+  uint8_t csum_type;                   ///< BLUESTORE_CSUM_*
+  uint8_t csum_chunk_order;            ///< csum chunk size is 1<<order
+  bufferptr csum_data;                 ///< one value per logical chunk; 0 = none
+
   bluestore_onode_t()
     : nid(0),
       size(0),
       last_overlay_key(0),
       omap_head(0),
       expected_object_size(0),
-      expected_write_size(0) {}
+      expected_write_size(0),
+      csum_type(BLUESTORE_CSUM_NONE),
+      csum_chunk_order(0) {}
 
   map<uint64_t,bluestore_extent_t>::iterator find_extent(uint64_t offset) {
     map<uint64_t,bluestore_extent_t>::iterator fp = block_map.lower_bound(offset);
@@ -225,6 +282,19 @@ struct bluestore_onode_t {
     return fp;
   }
 
+  /// first compressed blob ending after offset
+  map<uint64_t,bluestore_compressed_t>::iterator seek_compressed(
+    uint64_t offset) {
+    map<uint64_t,bluestore_compressed_t>::iterator cp =
+      compressed_map.lower_bound(offset);
+    if (cp != compressed_map.begin()) {
+      --cp;
+      if (cp->first + cp->second.raw_length <= offset)
+	++cp;
+    }
+    return cp;
+  }
+
   bool put_overlay_ref(uint64_t key) {
     map<uint64_t,uint16_t>::iterator q = overlay_refs.find(key);
     if (q == overlay_refs.end())
@@ -243,6 +313,28 @@ struct bluestore_onode_t {
       ++q->second;
   }
 
+  bool has_csum() const {
+    return csum_type != BLUESTORE_CSUM_NONE;
+  }
+  uint64_t get_csum_chunk_size() const {
+    return 1ull << csum_chunk_order;
+  }
+  unsigned get_csum_count() const {
+    if (!has_csum())
+      return 0;
+    return csum_data.length() / bluestore_csum_value_size(csum_type);
+  }
+  uint64_t get_csum_item(unsigned i) const;
+  void set_csum_item(unsigned i, uint64_t v);  ///< after csum_prepare()
+
+  /// make csum_data private (it may be shared with an encoded onode) and
+  /// big enough for count values
+  void csum_prepare(unsigned count);
+  /// forget checksums for any chunk overlapping offset~length
+  void csum_clear(uint64_t offset, uint64_t length);
+  /// forget checksums for any chunk not entirely below offset
+  void csum_truncate(uint64_t offset);
+
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& p);
   void dump(Formatter *f) const;
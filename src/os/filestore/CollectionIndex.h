@@ -192,6 +192,17 @@ protected:
       uint64_t expected_num_objs  ///< [in] expected number of objects this collection has
       ) { assert(0); return 0; }
 
+  /*
+   * Create the directories of an empty pg collection down to depth, so
+   * that no splits happen until each leaf fills up.
+   *
+   * @Return 0 on success, an error code otherwise.
+   */
+  virtual int presplit(
+      uint32_t pg_num, ///< [in] pg number of the pool this collection belongs to
+      unsigned depth   ///< [in] depth of the leaf directories
+      ) { return -EOPNOTSUPP; }
+
   /// Virtual destructor
   virtual ~CollectionIndex() {}
 };
@@ -470,6 +470,47 @@ int DBObjectMap::set_header(const ghobject_t &oid,
   return db->submit_transaction(t);
 }
 
+int DBObjectMap::apply_updates(const ghobject_t &oid,
+			       const list<Update> &updates)
+{
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    MapHeaderLock hl(this, oid);
+    Header header = lookup_map_header(hl, oid);
+    if (!header || !header->parent) {
+      // one header lookup and one kv transaction for the whole run
+      for (list<Update>::const_iterator p = updates.begin();
+	   p != updates.end();
+	   ++p) {
+	if (!header) {
+	  if (p->type == Update::RM_KEYS)
+	    continue;  // nothing to remove yet
+	  header = generate_new_header(oid, Header());
+	  set_map_header(hl, oid, *header, t);
+	}
+	if (check_spos(oid, header, &p->spos))
+	  continue;
+	switch (p->type) {
+	case Update::SET_KEYS:
+	  t->set(user_prefix(header), p->to_set);
+	  break;
+	case Update::RM_KEYS:
+	  t->rmkeys(user_prefix(header), p->to_rm);
+	  break;
+	case Update::SET_HEADER:
+	  _set_header(header, p->header, t);
+	  break;
+	}
+      }
+      return db->submit_transaction(t);
+    }
+  }
+
+  // rm_keys on a clone may copy keys up from the parent, which means
+  // reading back what the updates before it wrote; go one at a time
+  return ObjectMap::apply_updates(oid, updates);
+}
+
 void DBObjectMap::_set_header(Header header, const bufferlist &bl,
 			      KeyValueDB::Transaction t)
 {
@@ -1073,41 +1114,30 @@ int DBObjectMap::write_state(KeyValueDB::Transaction _t) {
 }
 
 
-DBObjectMap::Header DBObjectMap::_lookup_map_header(
+DBObjectMap::Header DBObjectMap::lookup_map_header(
   const MapHeaderLock &l,
   const ghobject_t &oid)
 {
   assert(l.get_locked() == oid);
 
   _Header *header = new _Header();
-  {
-    Mutex::Locker l(cache_lock);
-    if (caches.lookup(oid, header)) {
-      assert(!in_use.count(header->seq));
-      in_use.insert(header->seq);
-      return Header(header, RemoveOnDelete(this));
+  if (!get_cache(oid).lookup(oid, header)) {
+    bufferlist out;
+    int r = db->get(HOBJECT_TO_SEQ, map_header_key(oid), &out);
+    if (r < 0 || out.length()==0) {
+      delete header;
+      return Header();
     }
-  }
-
-  bufferlist out;
-  int r = db->get(HOBJECT_TO_SEQ, map_header_key(oid), &out);
-  if (r < 0 || out.length()==0) {
-    delete header;
-    return Header();
-  }
-
-  Header ret(header, RemoveOnDelete(this));
-  bufferlist::iterator iter = out.begin();
 
-  ret->decode(iter);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.add(oid, *ret);
+    bufferlist::iterator iter = out.begin();
+    header->decode(iter);
+    get_cache(oid).add(oid, *header);
   }
 
+  Mutex::Locker l2(header_lock);
   assert(!in_use.count(header->seq));
   in_use.insert(header->seq);
-  return ret;
+  return Header(header, RemoveOnDelete(this));
 }
 
 DBObjectMap::Header DBObjectMap::_generate_new_header(const ghobject_t &oid,
@@ -1164,10 +1194,9 @@ DBObjectMap::Header DBObjectMap::lookup_create_map_header(
   const ghobject_t &oid,
   KeyValueDB::Transaction t)
 {
-  Mutex::Locker l(header_lock);
-  Header header = _lookup_map_header(hl, oid);
+  Header header = lookup_map_header(hl, oid);
   if (!header) {
-    header = _generate_new_header(oid, Header());
+    header = generate_new_header(oid, Header());
     set_map_header(hl, oid, *header, t);
   }
   return header;
@@ -1205,10 +1234,7 @@ void DBObjectMap::remove_map_header(
   set<string> to_remove;
   to_remove.insert(map_header_key(oid));
   t->rmkeys(HOBJECT_TO_SEQ, to_remove);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.clear(oid);
-  }
+  get_cache(oid).clear(oid);
 }
 
 void DBObjectMap::set_map_header(
@@ -1223,10 +1249,7 @@ void DBObjectMap::set_map_header(
   map<string, bufferlist> to_set;
   header.encode(to_set[map_header_key(oid)]);
   t->set(HOBJECT_TO_SEQ, to_set);
-  {
-    Mutex::Locker l(cache_lock);
-    caches.add(oid, header);
-  }
+  get_cache(oid).add(oid, header);
 }
 
 bool DBObjectMap::check_spos(const ghobject_t &oid,
@@ -115,10 +115,18 @@ public:
     }
   };
 
-  DBObjectMap(KeyValueDB *db) : db(db), header_lock("DBOBjectMap"),
-                                cache_lock("DBObjectMap::CacheLock"),
-                                caches(g_conf->filestore_omap_header_cache_size)
-    {}
+  DBObjectMap(KeyValueDB *db) : db(db), header_lock("DBOBjectMap") {
+    int shards = MAX(1, g_conf->filestore_omap_header_cache_shards);
+    int per_shard = MAX(1, g_conf->filestore_omap_header_cache_size / shards);
+    for (int i = 0; i < shards; ++i)
+      caches.push_back(new HeaderCache(per_shard));
+  }
+  ~DBObjectMap() {
+    for (vector<HeaderCache*>::iterator p = caches.begin();
+	 p != caches.end();
+	 ++p)
+      delete *p;
+  }
 
   int set_keys(
     const ghobject_t &oid,
@@ -137,6 +145,11 @@ public:
     bufferlist *bl
     );
 
+  int apply_updates(
+    const ghobject_t &oid,
+    const list<Update> &updates
+    );
+
   int clear(
     const ghobject_t &oid,
     const SequencerPosition *spos=0
@@ -328,8 +341,17 @@ public:
 private:
   /// Implicit lock on Header->seq
   typedef ceph::shared_ptr<_Header> Header;
-  Mutex cache_lock;
-  SimpleLRU<ghobject_t, _Header, ghobject_t::BitwiseComparator> caches;
+
+  /**
+   * Leaf headers by object, sharded by object hash so that lookups of
+   * different objects don't all serialize on one lock.  Kept current by
+   * set_map_header and remove_map_header.
+   */
+  typedef SimpleLRU<ghobject_t, _Header, ghobject_t::BitwiseComparator> HeaderCache;
+  vector<HeaderCache*> caches;
+  HeaderCache &get_cache(const ghobject_t &oid) {
+    return *caches[oid.hobj.get_hash() % caches.size()];
+  }
 
   string map_header_key(const ghobject_t &oid);
   string header_key(uint64_t seq);
@@ -459,16 +481,15 @@ private:
     return _generate_new_header(oid, parent);
   }
 
-  /// Lookup leaf header for c oid
-  Header _lookup_map_header(
+  /**
+   * Lookup leaf header for c oid
+   *
+   * The MapHeaderLock keeps the mapping for oid stable, so this only
+   * takes header_lock to mark the header in use, not while it reads it.
+   */
+  Header lookup_map_header(
     const MapHeaderLock &l,
     const ghobject_t &oid);
-  Header lookup_map_header(
-    const MapHeaderLock &l2,
-    const ghobject_t &oid) {
-    Mutex::Locker l(header_lock);
-    return _lookup_map_header(l2, oid);
-  }
 
   /// Lookup header node for input
   Header lookup_parent(Header input);
@@ -101,7 +101,7 @@ int FileJournal::_open(bool forwrite, bool create)
 #ifdef HAVE_LIBAIO
   if (aio) {
     aio_ctx = 0;
-    ret = io_setup(128, &aio_ctx);
+    ret = io_setup(g_conf->journal_aio_queue_depth, &aio_ctx);
     if (ret < 0) {
       ret = errno;
       derr << "FileJournal::_open: unable to setup io_context " << cpp_strerror(ret) << dendl;
@@ -1268,18 +1268,27 @@ void FileJournal::write_thread_entry()
       // but should be fine given that we will have plenty of aios in
       // flight if we hit this limit to ensure we keep the device
       // saturated.
+      //
+      // never go past journal_aio_queue_depth, though: the aio context
+      // has no room for more.
       while (aio_num > 0) {
-	int exp = MIN(aio_num * 2, 24);
-	long unsigned min_new = 1ull << exp;
-	long unsigned cur = throttle_bytes.get_current();
-	dout(20) << "write_thread_entry aio throttle: aio num " << aio_num << " bytes " << aio_bytes
-		 << " ... exp " << exp << " min_new " << min_new
-		 << " ... pending " << cur << dendl;
-	if (cur >= min_new)
-	  break;
-	dout(20) << "write_thread_entry deferring until more aios complete: "
-		 << aio_num << " aios with " << aio_bytes << " bytes needs " << min_new
-		 << " bytes to start a new aio (currently " << cur << " pending)" << dendl;
+	if (aio_num >= g_conf->journal_aio_queue_depth) {
+	  dout(20) << "write_thread_entry deferring until more aios complete: "
+		   << aio_num << " aios in flight, queue depth "
+		   << g_conf->journal_aio_queue_depth << dendl;
+	} else {
+	  int exp = MIN(aio_num * 2, 24);
+	  long unsigned min_new = 1ull << exp;
+	  long unsigned cur = throttle_bytes.get_current();
+	  dout(20) << "write_thread_entry aio throttle: aio num " << aio_num << " bytes " << aio_bytes
+		   << " ... exp " << exp << " min_new " << min_new
+		   << " ... pending " << cur << dendl;
+	  if (cur >= min_new)
+	    break;
+	  dout(20) << "write_thread_entry deferring until more aios complete: "
+		   << aio_num << " aios with " << aio_bytes << " bytes needs " << min_new
+		   << " bytes to start a new aio (currently " << cur << " pending)" << dendl;
+	}
 	aio_cond.Wait(aio_lock);
 	dout(20) << "write_thread_entry woke up" << dendl;
       }
@@ -1358,6 +1367,9 @@ void FileJournal::do_aio_write(bufferlist& bl)
 	   << (hbp.length() ? " + header":"")
 	   << dendl;
 
+  // queue every aio of this write first, then submit them together
+  vector<iocb*> iocbs;
+
   // split?
   off64_t split = 0;
   if (pos + bl.length() > header.max_size) {
@@ -1368,7 +1380,7 @@ void FileJournal::do_aio_write(bufferlist& bl)
     assert(first.length() + second.length() == bl.length());
     dout(10) << "do_aio_write wrapping, first bit at " << pos << "~" << first.length() << dendl;
 
-    if (write_aio_bl(pos, first, 0)) {
+    if (write_aio_bl(pos, first, 0, &iocbs)) {
       derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
 	   << ") failed" << dendl;
       ceph_abort();
@@ -1380,7 +1392,7 @@ void FileJournal::do_aio_write(bufferlist& bl)
       pos = 0;          // we included the header
     } else
       pos = get_top();  // no header, start after that
-    if (write_aio_bl(pos, second, writing_seq)) {
+    if (write_aio_bl(pos, second, writing_seq, &iocbs)) {
       derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
 	   << ") failed" << dendl;
       ceph_abort();
@@ -1391,19 +1403,21 @@ void FileJournal::do_aio_write(bufferlist& bl)
       bufferlist hbl;
       hbl.push_back(hbp);
       loff_t pos = 0;
-      if (write_aio_bl(pos, hbl, 0)) {
+      if (write_aio_bl(pos, hbl, 0, &iocbs)) {
 	derr << "FileJournal::do_aio_write: write_aio_bl(header) failed" << dendl;
 	ceph_abort();
       }
     }
 
-    if (write_aio_bl(pos, bl, writing_seq)) {
+    if (write_aio_bl(pos, bl, writing_seq, &iocbs)) {
       derr << "FileJournal::do_aio_write: write_aio_bl(pos=" << pos
 	   << ") failed" << dendl;
       ceph_abort();
     }
   }
 
+  submit_aio(iocbs);
+
   write_pos = pos;
   if (write_pos == header.max_size)
     write_pos = get_top();
@@ -1411,12 +1425,17 @@ void FileJournal::do_aio_write(bufferlist& bl)
 }
 
 /**
- * write a buffer using aio
+ * queue aios to write a buffer, without submitting them
+ *
+ * The iovecs point straight into bl, which the aio keeps a reference to
+ * until it completes; bl must already be aligned (see prepare_entry).
  *
  * @param seq seq to trigger when this aio completes.  if 0, do not update any state
  * on completion.
+ * @param iocbs the iocbs to pass to submit_aio
  */
-int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
+int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq,
+			      vector<iocb*> *iocbs)
 {
   align_bl(pos, bl);
 
@@ -1441,7 +1460,7 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 
     // lock only aio_queue, current aio, aio_num, aio_bytes, which may be
     // modified in check_aio_completion
-    aio_lock.Lock();
+    Mutex::Locker locker(aio_lock);
     aio_queue.push_back(aio_info(tbl, pos, bl.length() > 0 ? 0 : seq));
     aio_info& aio = aio_queue.back();
     aio.iov = iov;
@@ -1453,36 +1472,50 @@ int FileJournal::write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq)
 
     aio_num++;
     aio_bytes += aio.len;
+    iocbs->push_back(&aio.iocb);
+    pos += aio.len;
+  }
+  return 0;
+}
 
-    // need to save current aio len to update write_pos later because current
-    // aio could be ereased from aio_queue once it is done
-    uint64_t cur_len = aio.len;
-    // unlock aio_lock because following io_submit might take time to return
-    aio_lock.Unlock();
-
-    iocb *piocb = &aio.iocb;
-    int attempts = 10;
-    do {
-      int r = io_submit(aio_ctx, 1, &piocb);
-      dout(20) << "write_aio_bl io_submit return value: " << r << dendl;
-      if (r < 0) {
-	derr << "io_submit to " << aio.off << "~" << cur_len
-	     << " got " << cpp_strerror(r) << dendl;
-	if (r == -EAGAIN && attempts-- > 0) {
-	  usleep(500);
-	  continue;
-	}
-	assert(0 == "io_submit got unexpected error");
-      } else {
-	break;
+/**
+ * submit the aios queued by write_aio_bl, as many per io_submit as the
+ * kernel takes
+ *
+ * If the aio context is full we wait for earlier aios to complete
+ * rather than spinning.
+ */
+void FileJournal::submit_aio(vector<iocb*>& iocbs)
+{
+  unsigned done = 0;
+  int attempts = 10;
+  while (done < iocbs.size()) {
+    unsigned left = iocbs.size() - done;
+    int r = io_submit(aio_ctx, left, &iocbs[done]);
+    dout(20) << "submit_aio io_submit " << left << " return value: " << r << dendl;
+    if (r == -EAGAIN) {
+      Mutex::Locker locker(aio_lock);
+      if (aio_num > (int)left) {
+	dout(10) << "submit_aio aio context full, waiting for "
+		 << (aio_num - left) << " aios in flight" << dendl;
+	aio_cond.Wait(aio_lock);
+	continue;
       }
-    } while (true);
-    pos += cur_len;
+    }
+    if (r < 0) {
+      derr << "io_submit of " << left << " aios got " << cpp_strerror(r) << dendl;
+      if (r == -EAGAIN && attempts-- > 0) {
+	usleep(500);
+	continue;
+      }
+      assert(0 == "io_submit got unexpected error");
+    }
+    done += r;
   }
-  aio_lock.Lock();
+  // the iocbs may be completed and freed by now; don't touch them
+
+  Mutex::Locker locker(aio_lock);
   write_finish_cond.Signal();
-  aio_lock.Unlock();
-  return 0;
 }
 #endif
 
@@ -328,7 +328,9 @@ private:
   void write_finish_thread_entry();
   void check_aio_completion();
   void do_aio_write(bufferlist& bl);
-  int write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq);
+  int write_aio_bl(off64_t& pos, bufferlist& bl, uint64_t seq,
+		   vector<iocb*> *iocbs);
+  void submit_aio(vector<iocb*>& iocbs);
 
 
   void align_bl(off64_t pos, bufferlist& bl);
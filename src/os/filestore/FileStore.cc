@@ -66,6 +66,8 @@
 #include "common/safe_io.h"
 #include "common/perf_counters.h"
 #include "common/sync_filesystem.h"
+#include "common/admin_socket.h"
+#include "common/Formatter.h"
 #include "common/fd.h"
 #include "HashIndex.h"
 #include "DBObjectMap.h"
@@ -172,6 +174,51 @@ int FileStore::init_index(coll_t cid)
   return r;
 }
 
+int FileStore::presplit_collection(coll_t cid, uint32_t pg_num, unsigned depth)
+{
+  dout(10) << __func__ << " " << cid << " pg_num " << pg_num
+	   << " depth " << depth << dendl;
+  if (!collection_exists(cid))
+    return -ENOENT;
+  Index index;
+  int r = get_index(cid, &index);
+  if (r < 0)
+    return r;
+  assert(NULL != index.index);
+  RWLock::WLocker l((index.index)->access_lock);
+  r = index->presplit(pg_num, depth);
+  assert(!m_filestore_fail_eio || r != -EIO);
+  return r;
+}
+
+class FileStore::SocketHook : public AdminSocketHook {
+  FileStore *store;
+public:
+  SocketHook(FileStore *s) : store(s) {}
+  bool call(std::string command, cmdmap_t& cmdmap, std::string format,
+	    bufferlist& out) {
+    string cidstr;
+    int64_t pg_num = 0, depth = 0;
+    cmd_getval(g_ceph_context, cmdmap, "collection", cidstr);
+    cmd_getval(g_ceph_context, cmdmap, "pg_num", pg_num);
+    cmd_getval(g_ceph_context, cmdmap, "depth", depth);
+    coll_t cid;
+    int r = -EINVAL;
+    if (cid.parse(cidstr))
+      r = store->presplit_collection(cid, pg_num, depth);
+    Formatter *f = Formatter::create(format, "json-pretty", "json-pretty");
+    f->open_object_section("presplit");
+    f->dump_string("collection", cidstr);
+    f->dump_int("result", r);
+    if (r < 0)
+      f->dump_string("error", cpp_strerror(r));
+    f->close_section();
+    f->flush(out);
+    delete f;
+    return true;
+  }
+};
+
 int FileStore::lfn_find(const ghobject_t& oid, const Index& index, IndexedPath *path)
 {
   IndexedPath path2;
@@ -510,6 +557,7 @@ FileStore::FileStore(const std::string &base, const std::string &jdev, osflagbit
   basedir_fd(-1), current_fd(-1),
   backend(NULL),
   index_manager(do_update),
+  asok_hook(NULL),
   lock("FileStore::lock"),
   force_sync(false),
   sync_entry_timeo_lock("sync_entry_timeo_lock"),
@@ -1637,6 +1685,34 @@ int FileStore::mount()
     (*it)->start();
   }
 
+  if (g_conf->filestore_split_in_background)
+    index_manager.start_split_thread();
+
+  {
+    SocketHook *hook = new SocketHook(this);
+    AdminSocket *admin_socket = g_ceph_context->get_admin_socket();
+    int r = admin_socket->register_command(
+      "filestore presplit",
+      "filestore presplit " \
+      "name=collection,type=CephString " \
+      "name=pg_num,type=CephInt,range=2 " \
+      "name=depth,type=CephInt,range=1|8",
+      hook,
+      // depth counts directory levels below the collection, leaves
+      // included.  The top levels of a pg only ever have one
+      // subdirectory, so depths that do not reach past them fail with
+      // ERANGE: with pg_num 4096, depth must be at least 4.
+      "create the directories of an empty pg collection, leaves at depth");
+    if (r == 0) {
+      asok_hook = hook;
+    } else {
+      // only the first filestore in a process gets the command
+      dout(10) << __func__ << " not registering admin socket command: "
+	       << cpp_strerror(r) << dendl;
+      delete hook;
+    }
+  }
+
   timer.init();
 
   // upgrade?
@@ -1720,6 +1796,13 @@ int FileStore::umount()
   sync_thread.join();
   wbthrottle.stop();
   op_tp.stop();
+  index_manager.stop_split_thread();
+
+  if (asok_hook) {
+    g_ceph_context->get_admin_socket()->unregister_command("filestore presplit");
+    delete asok_hook;
+    asok_hook = NULL;
+  }
 
   journal_stop();
   if (!(generic_flags & SKIP_JOURNAL_REPLAY))
@@ -1791,9 +1874,66 @@ FileStore::Op *FileStore::build_op(list<Transaction*>& tls,
   o->ops = ops;
   o->bytes = bytes;
   o->osd_op = osd_op;
+  if (g_conf->filestore_parallel_apply)
+    _get_op_footprint(o);
   return o;
 }
 
+void FileStore::_get_op_footprint(Op *o)
+{
+  // object ops may run alongside ops on other objects; anything that
+  // works on a whole collection needs the sequencer to itself
+  o->barrier = false;
+  for (list<Transaction*>::iterator p = o->tls.begin();
+       p != o->tls.end();
+       ++p) {
+    Transaction::iterator i = (*p)->begin();
+    while (i.have_op()) {
+      Transaction::Op *op = i.decode_op();
+      switch (op->op) {
+      case Transaction::OP_NOP:
+      case Transaction::OP_STARTSYNC:
+	break;
+
+      case Transaction::OP_TOUCH:
+      case Transaction::OP_WRITE:
+      case Transaction::OP_ZERO:
+      case Transaction::OP_TRIMCACHE:
+      case Transaction::OP_TRUNCATE:
+      case Transaction::OP_REMOVE:
+      case Transaction::OP_SETATTR:
+      case Transaction::OP_SETATTRS:
+      case Transaction::OP_RMATTR:
+      case Transaction::OP_RMATTRS:
+      case Transaction::OP_COLL_ADD:
+      case Transaction::OP_COLL_REMOVE:
+      case Transaction::OP_COLL_MOVE:
+      case Transaction::OP_OMAP_CLEAR:
+      case Transaction::OP_OMAP_SETKEYS:
+      case Transaction::OP_OMAP_RMKEYS:
+      case Transaction::OP_OMAP_RMKEYRANGE:
+      case Transaction::OP_OMAP_SETHEADER:
+      case Transaction::OP_SETALLOCHINT:
+	o->objects.insert(i.get_oid(op->oid));
+	break;
+
+      case Transaction::OP_CLONE:
+      case Transaction::OP_CLONERANGE:
+      case Transaction::OP_CLONERANGE2:
+      case Transaction::OP_COLL_MOVE_RENAME:
+	o->objects.insert(i.get_oid(op->oid));
+	o->objects.insert(i.get_oid(op->dest_oid));
+	break;
+
+      default:
+	o->barrier = true;
+	o->objects.clear();
+	return;
+      }
+    }
+  }
+}
+
 
 
 void FileStore::queue_op(OpSequencer *osr, Op *o)
@@ -1867,42 +2007,47 @@ void FileStore::_do_op(OpSequencer *osr, ThreadPool::TPHandle &handle)
     dout(5) << "_do_op done stalling" << dendl;
   }
 
-  osr->apply_lock.Lock();
-  Op *o = osr->peek_queue();
+  Op *o = osr->claim(handle);
   apply_manager.op_apply_start(o->op);
   dout(5) << "_do_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << " start" << dendl;
   int r = _do_transactions(o->tls, o->op, &handle);
   apply_manager.op_apply_finish(o->op);
   dout(10) << "_do_op " << o << " seq " << o->op << " r = " << r
 	   << ", finisher " << o->onreadable << " " << o->onreadable_sync << dendl;
+  osr->applied(o);
 }
 
 void FileStore::_finish_op(OpSequencer *osr)
 {
+  // our op may be held back by an earlier one still applying; whoever
+  // finishes that one completes ours too, in order
+  list<Op*> done;
   list<Context*> to_queue;
-  Op *o = osr->dequeue(&to_queue);
+  osr->dequeue(&done, &to_queue);
 
-  utime_t lat = ceph_clock_now(g_ceph_context);
-  lat -= o->start;
+  for (list<Op*>::iterator p = done.begin(); p != done.end(); ++p) {
+    Op *o = *p;
+    utime_t lat = ceph_clock_now(g_ceph_context);
+    lat -= o->start;
 
-  dout(10) << "_finish_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << " lat " << lat << dendl;
-  osr->apply_lock.Unlock();  // locked in _do_op
+    dout(10) << "_finish_op " << o << " seq " << o->op << " " << *osr << "/" << osr->parent << " lat " << lat << dendl;
 
-  // called with tp lock held
-  op_queue_release_throttle(o);
+    // called with tp lock held
+    op_queue_release_throttle(o);
 
-  logger->tinc(l_os_apply_lat, lat);
+    logger->tinc(l_os_apply_lat, lat);
 
-  if (o->onreadable_sync) {
-    o->onreadable_sync->complete(0);
-  }
-  if (o->onreadable) {
-    apply_finishers[osr->id % m_apply_finisher_num]->queue(o->onreadable);
+    if (o->onreadable_sync) {
+      o->onreadable_sync->complete(0);
+    }
+    if (o->onreadable) {
+      apply_finishers[osr->id % m_apply_finisher_num]->queue(o->onreadable);
+    }
+    delete o;
   }
   if (!to_queue.empty()) {
     apply_finishers[osr->id % m_apply_finisher_num]->queue(to_queue);
   }
-  delete o;
 }
 
 
@@ -2703,27 +2848,63 @@ unsigned FileStore::_do_transaction(
       }
       break;
     case Transaction::OP_OMAP_SETKEYS:
-      {
-        coll_t cid = i.get_cid(op->cid);
-        ghobject_t oid = i.get_oid(op->oid);
-	_kludge_temp_object_collection(cid, oid);
-        map<string, bufferlist> aset;
-        i.decode_attrset(aset);
-        tracepoint(objectstore, omap_setkeys_enter, osr_name);
-        r = _omap_setkeys(cid, oid, aset, spos);
-        tracepoint(objectstore, omap_setkeys_exit, r);
-      }
-      break;
     case Transaction::OP_OMAP_RMKEYS:
+    case Transaction::OP_OMAP_SETHEADER:
       {
         coll_t cid = i.get_cid(op->cid);
         ghobject_t oid = i.get_oid(op->oid);
 	_kludge_temp_object_collection(cid, oid);
-        set<string> keys;
-        i.decode_keyset(keys);
-        tracepoint(objectstore, omap_rmkeys_enter, osr_name);
-        r = _omap_rmkeys(cid, oid, keys, spos);
-        tracepoint(objectstore, omap_rmkeys_exit, r);
+	// fold this and any following updates to the same object's omap
+	// into one ObjectMap update
+	list<ObjectMap::Update> updates;
+	list<int> types;
+	while (true) {
+	  updates.push_back(ObjectMap::Update(spos));
+	  ObjectMap::Update &u = updates.back();
+	  types.push_back(op->op);
+	  switch (op->op) {
+	  case Transaction::OP_OMAP_SETKEYS:
+	    u.type = ObjectMap::Update::SET_KEYS;
+	    i.decode_attrset(u.to_set);
+	    tracepoint(objectstore, omap_setkeys_enter, osr_name);
+	    break;
+	  case Transaction::OP_OMAP_RMKEYS:
+	    u.type = ObjectMap::Update::RM_KEYS;
+	    i.decode_keyset(u.to_rm);
+	    tracepoint(objectstore, omap_rmkeys_enter, osr_name);
+	    break;
+	  case Transaction::OP_OMAP_SETHEADER:
+	    u.type = ObjectMap::Update::SET_HEADER;
+	    i.decode_bl(u.header);
+	    tracepoint(objectstore, omap_setheader_enter, osr_name);
+	    break;
+	  }
+	  if (!i.have_op())
+	    break;
+	  const Transaction::Op *next = i.peek_op();
+	  if ((next->op != Transaction::OP_OMAP_SETKEYS &&
+	       next->op != Transaction::OP_OMAP_RMKEYS &&
+	       next->op != Transaction::OP_OMAP_SETHEADER) ||
+	      next->cid != op->cid ||
+	      next->oid != op->oid)
+	    break;
+	  op = i.decode_op();
+	  spos.op++;
+	}
+        r = _omap_update(cid, oid, updates);
+	for (list<int>::iterator p = types.begin(); p != types.end(); ++p) {
+	  switch (*p) {
+	  case Transaction::OP_OMAP_SETKEYS:
+	    tracepoint(objectstore, omap_setkeys_exit, r);
+	    break;
+	  case Transaction::OP_OMAP_RMKEYS:
+	    tracepoint(objectstore, omap_rmkeys_exit, r);
+	    break;
+	  case Transaction::OP_OMAP_SETHEADER:
+	    tracepoint(objectstore, omap_setheader_exit, r);
+	    break;
+	  }
+	}
       }
       break;
     case Transaction::OP_OMAP_RMKEYRANGE:
@@ -2739,18 +2920,6 @@ unsigned FileStore::_do_transaction(
         tracepoint(objectstore, omap_rmkeyrange_exit, r);
       }
       break;
-    case Transaction::OP_OMAP_SETHEADER:
-      {
-        coll_t cid = i.get_cid(op->cid);
-        ghobject_t oid = i.get_oid(op->oid);
-	_kludge_temp_object_collection(cid, oid);
-        bufferlist bl;
-        i.decode_bl(bl);
-        tracepoint(objectstore, omap_setheader_enter, osr_name);
-        r = _omap_setheader(cid, oid, bl, spos);
-        tracepoint(objectstore, omap_setheader_exit, r);
-      }
-      break;
     case Transaction::OP_SPLIT_COLLECTION:
       {
 	assert(0 == "not legacy journal; upgrade to firefly first");
@@ -5197,36 +5366,6 @@ int FileStore::_omap_clear(coll_t cid, const ghobject_t &hoid,
   return 0;
 }
 
-int FileStore::_omap_setkeys(coll_t cid, const ghobject_t &hoid,
-			     const map<string, bufferlist> &aset,
-			     const SequencerPosition &spos) {
-  dout(15) << __func__ << " " << cid << "/" << hoid << dendl;
-  Index index;
-  int r;
-  //treat pgmeta as a logical object, skip to check exist
-  if (hoid.is_pgmeta())
-    goto skip;
-
-  r = get_index(cid, &index);
-  if (r < 0) {
-    dout(20) << __func__ << " get_index got " << cpp_strerror(r) << dendl;
-    return r;
-  }
-  {
-    assert(NULL != index.index);
-    RWLock::RLocker l((index.index)->access_lock);
-    r = lfn_find(hoid, index);
-    if (r < 0) {
-      dout(20) << __func__ << " lfn_find got " << cpp_strerror(r) << dendl;
-      return r;
-    }
-  }
-skip:
-  r = object_map->set_keys(hoid, aset, &spos);
-  dout(20) << __func__ << " " << cid << "/" << hoid << " = " << r << dendl;
-  return r;
-}
-
 int FileStore::_omap_rmkeys(coll_t cid, const ghobject_t &hoid,
 			    const set<string> &keys,
 			    const SequencerPosition &spos) {
@@ -5254,6 +5393,32 @@ skip:
   return 0;
 }
 
+int FileStore::_omap_update(coll_t cid, const ghobject_t &hoid,
+			    const list<ObjectMap::Update> &updates)
+{
+  dout(15) << __func__ << " " << cid << "/" << hoid
+	   << " " << updates.size() << " updates" << dendl;
+  //treat pgmeta as a logical object, skip to check exist
+  if (!hoid.is_pgmeta()) {
+    Index index;
+    int r = get_index(cid, &index);
+    if (r < 0) {
+      dout(20) << __func__ << " get_index got " << cpp_strerror(r) << dendl;
+      return r;
+    }
+    assert(NULL != index.index);
+    RWLock::RLocker l((index.index)->access_lock);
+    r = lfn_find(hoid, index);
+    if (r < 0) {
+      dout(20) << __func__ << " lfn_find got " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  int r = object_map->apply_updates(hoid, updates);
+  dout(20) << __func__ << " " << cid << "/" << hoid << " = " << r << dendl;
+  return r;
+}
+
 int FileStore::_omap_rmkeyrange(coll_t cid, const ghobject_t &hoid,
 				const string& first, const string& last,
 				const SequencerPosition &spos) {
@@ -5271,25 +5436,6 @@ int FileStore::_omap_rmkeyrange(coll_t cid, const ghobject_t &hoid,
   return _omap_rmkeys(cid, hoid, keys, spos);
 }
 
-int FileStore::_omap_setheader(coll_t cid, const ghobject_t &hoid,
-			       const bufferlist &bl,
-			       const SequencerPosition &spos)
-{
-  dout(15) << __func__ << " " << cid << "/" << hoid << dendl;
-  Index index;
-  int r = get_index(cid, &index);
-  if (r < 0)
-    return r;
-  {
-    assert(NULL != index.index);
-    RWLock::RLocker l((index.index)->access_lock);
-    r = lfn_find(hoid, index);
-    if (r < 0)
-      return r;
-  }
-  return object_map->set_header(hoid, bl, &spos);
-}
-
 int FileStore::_split_collection(coll_t cid,
 				 uint32_t bits,
 				 uint32_t rem,
@@ -140,6 +140,9 @@ private:
   int get_index(coll_t c, Index *index);
   int init_index(coll_t c);
 
+  class SocketHook;
+  SocketHook *asok_hook;      ///< "filestore presplit", if we registered it
+
   void _kludge_temp_object_collection(coll_t& cid, const ghobject_t& oid) {
     // - normal temp case: cid is pg, object is temp (pool < -1)
     // - hammer temp case: cid is pg (or already temp), object pool is -1
@@ -189,16 +192,44 @@ private:
     Context *onreadable, *onreadable_sync;
     uint64_t ops, bytes;
     TrackedOpRef osd_op;
+
+    /// objects the transactions touch (see _get_op_footprint)
+    set<ghobject_t, ghobject_t::BitwiseComparator> objects;
+    bool barrier;   ///< must not overlap any other op of its sequencer
+    bool claimed;   ///< an op thread has picked it up
+    bool applied;
+
+    Op() : barrier(true), claimed(false), applied(false) {}
+
+    /// true if the two ops may not be applied at the same time
+    bool conflicts(const Op *o) const {
+      if (barrier || o->barrier)
+	return true;
+      const Op *small = this, *big = o;
+      if (small->objects.size() > big->objects.size())
+	swap(small, big);
+      for (auto& h : small->objects) {
+	if (big->objects.count(h))
+	  return true;
+      }
+      return false;
+    }
   };
+  /**
+   * Ops of a sequencer are claimed by the op threads in queue order, but
+   * an op only waits for the earlier ops it conflicts with, so ops on
+   * disjoint objects apply in parallel.  They are dequeued, and their
+   * onreadable callbacks fired, strictly in queue order.
+   */
   class OpSequencer : public Sequencer_impl {
-    Mutex qlock; // to protect q, for benefit of flush (peek/dequeue also protected by lock)
+    Mutex qlock; // to protect q, for benefit of flush (claim/dequeue also protected by lock)
     list<Op*> q;
     list<uint64_t> jq;
     list<pair<uint64_t, Context*> > flush_commit_waiters;
     Cond cond;
+    Cond apply_cond;  ///< signaled when an op is applied
   public:
     Sequencer *parent;
-    Mutex apply_lock;  // for apply mutual exclusion
     int id;
 
     /// get_max_uncompleted
@@ -264,22 +295,53 @@ private:
       Mutex::Locker l(qlock);
       q.push_back(o);
     }
-    Op *peek_queue() {
+    /// true if an earlier op that o conflicts with is still applying
+    bool _must_wait(Op *o) {
+      assert(qlock.is_locked());
+      for (list<Op*>::iterator p = q.begin(); *p != o; ++p) {
+	if (!(*p)->applied && o->conflicts(*p))
+	  return true;
+      }
+      return false;
+    }
+
+    /// claim the next op to apply, and wait until it may be applied
+    Op *claim(ThreadPool::TPHandle &handle) {
+      Mutex::Locker l(qlock);
+      list<Op*>::iterator p = q.begin();
+      while (p != q.end() && (*p)->claimed)
+	++p;
+      assert(p != q.end());
+      Op *o = *p;
+      o->claimed = true;
+      if (_must_wait(o)) {
+	handle.suspend_tp_timeout();
+	while (_must_wait(o))
+	  apply_cond.Wait(qlock);
+	handle.reset_tp_timeout();
+      }
+      return o;
+    }
+    void applied(Op *o) {
       Mutex::Locker l(qlock);
-      assert(apply_lock.is_locked());
-      return q.front();
+      o->applied = true;
+      apply_cond.SignalAll();
     }
 
-    Op *dequeue(list<Context*> *to_queue) {
+    /// dequeue the applied ops at the front of the queue, in order
+    void dequeue(list<Op*> *done, list<Context*> *to_queue) {
+      assert(done);
       assert(to_queue);
-      assert(apply_lock.is_locked());
       Mutex::Locker l(qlock);
-      Op *o = q.front();
-      q.pop_front();
+      while (!q.empty() && q.front()->applied) {
+	done->push_back(q.front());
+	q.pop_front();
+      }
+      if (done->empty())
+	return;
       cond.Signal();
 
       _wake_flush_waiters(to_queue);
-      return o;
     }
 
     void flush() {
@@ -317,7 +379,6 @@ private:
     OpSequencer(int i)
       : qlock("FileStore::OpSequencer::qlock", false, false),
 	parent(0),
-	apply_lock("FileStore::OpSequencer::apply_lock", false, false),
         id(i) {}
     ~OpSequencer() {
       assert(q.empty());
@@ -381,6 +442,7 @@ private:
   Op *build_op(list<Transaction*>& tls,
 	       Context *onreadable, Context *onreadable_sync,
 	       TrackedOpRef osd_op);
+  void _get_op_footprint(Op *o);
   void queue_op(OpSequencer *osr, Op *o);
   void op_queue_reserve_throttle(Op *o, ThreadPool::TPHandle *handle = NULL);
   void op_queue_release_throttle(Op *o);
@@ -618,6 +680,8 @@ public:
   int collection_stat(coll_t c, struct stat *st);
   bool collection_exists(coll_t c);
   bool collection_empty(coll_t c);
+  /// create the directories of empty pg collection c, leaves at depth
+  int presplit_collection(coll_t c, uint32_t pg_num, unsigned depth);
 
   // omap (see ObjectStore.h for documentation)
   int omap_get(coll_t c, const ghobject_t &oid, bufferlist *header,
@@ -669,16 +733,13 @@ private:
   // omap
   int _omap_clear(coll_t cid, const ghobject_t &oid,
 		  const SequencerPosition &spos);
-  int _omap_setkeys(coll_t cid, const ghobject_t &oid,
-		    const map<string, bufferlist> &aset,
-		    const SequencerPosition &spos);
+  int _omap_update(coll_t cid, const ghobject_t &oid,
+		   const list<ObjectMap::Update> &updates);
   int _omap_rmkeys(coll_t cid, const ghobject_t &oid, const set<string> &keys,
 		   const SequencerPosition &spos);
   int _omap_rmkeyrange(coll_t cid, const ghobject_t &oid,
 		       const string& first, const string& last,
 		       const SequencerPosition &spos);
-  int _omap_setheader(coll_t cid, const ghobject_t &oid, const bufferlist &bl,
-		      const SequencerPosition &spos);
   int _split_collection(coll_t cid, uint32_t bits, uint32_t rem, coll_t dest,
                         const SequencerPosition &spos);
   int _split_collection_create(coll_t cid, uint32_t bits, uint32_t rem,
@@ -19,6 +19,7 @@
 
 #include "HashIndex.h"
 
+#include "common/config.h"
 #include "common/debug.h"
 #define dout_subsys ceph_subsys_filestore
 
@@ -89,6 +90,8 @@ bool cmp_hexdigit_string_bitwise(const string& l, const string& r)
 }
 
 int HashIndex::cleanup() {
+  // any split split_step() had started is completed below
+  splitting = false;
   bufferlist bl;
   int r = get_attr_path(vector<string>(), IN_PROGRESS_OP_TAG, bl);
   if (r < 0) {
@@ -293,6 +296,12 @@ int HashIndex::_split(
   uint32_t bits,
   CollectionIndex* dest) {
   assert(collection_version() == dest->collection_version());
+  int r = finish_background_split();
+  if (r < 0)
+    return r;
+  r = static_cast<HashIndex*>(dest)->finish_background_split();
+  if (r < 0)
+    return r;
   unsigned mkdirred = 0;
   return col_split_level(
     *this,
@@ -324,6 +333,24 @@ int HashIndex::_created(const vector<string> &path,
     return r;
 
   if (must_split(info)) {
+    // the index may predate filestore_split_in_background being turned off
+    if (split_queue && g_conf->filestore_split_in_background &&
+	(split_inline_multiple <= 0 ||
+	 info.objs <= (uint64_t)abs(merge_threshold) * 16 * split_multiplier *
+	   split_inline_multiple)) {
+      split_queue->queue_split(coll(), path);
+      return 0;
+    }
+    if (splitting) {
+      r = finish_background_split();
+      if (r < 0)
+	return r;
+      r = get_info(path, &info);
+      if (r < 0)
+	return r;
+      if (!must_split(info))
+	return 0;
+    }
     int r = initiate_split(path, info);
     if (r < 0)
       return r;
@@ -349,6 +376,16 @@ int HashIndex::_remove(const vector<string> &path,
   if (r < 0)
     return r;
   if (must_merge(info)) {
+    if (splitting) {
+      r = finish_background_split();
+      if (r < 0)
+	return r;
+      r = get_info(path, &info);
+      if (r < 0)
+	return r;
+      if (!must_merge(info))
+	return 0;
+    }
     r = initiate_merge(path, info);
     if (r < 0)
       return r;
@@ -399,7 +436,11 @@ int HashIndex::_collection_list_partial(const ghobject_t &start,
 }
 
 int HashIndex::prep_delete() {
-  return recursive_remove(vector<string>());
+  int r = recursive_remove(vector<string>());
+  if (r < 0)
+    return r;
+  splitting = false;
+  return 0;
 }
 
 int HashIndex::_pre_hash_collection(uint32_t pg_num, uint64_t expected_num_objs) {
@@ -420,13 +461,34 @@ int HashIndex::_pre_hash_collection(uint32_t pg_num, uint64_t expected_num_objs)
   return init_split_folder(path, 0);
 }
 
+int HashIndex::_presplit(uint32_t pg_num, unsigned depth)
+{
+  // with merging enabled the folders would be merged straight back
+  if (merge_threshold > 0)
+    return -EINVAL;
+  if (depth == 0 || depth > (unsigned)MAX_HASH_LEVEL || pg_num < 2)
+    return -EINVAL;
+  if (depth <= (unsigned)pg_fixed_levels(pg_num))
+    return -ERANGE;
+  vector<string> path;
+  subdir_info_s root_info;
+  int ret = get_info(path, &root_info);
+  if (ret < 0)
+    return ret;
+  if (root_info.objs || root_info.subdirs)
+    return -ENOTEMPTY;
+  ret = create_pg_folders(pg_num, 0, depth);
+  if (ret < 0)
+    return ret;
+  return init_split_folder(path, 0);
+}
+
 int HashIndex::pre_split_folder(uint32_t pg_num, uint64_t expected_num_objs)
 {
   // If folder merging is enabled (by setting the threshold positive),
   // no need to split
   if (merge_threshold > 0)
     return 0;
-  const coll_t c = coll();
   // Do not split if the expected number of objects in this collection is zero (by default)
   if (expected_num_objs == 0)
     return 0;
@@ -439,6 +501,25 @@ int HashIndex::pre_split_folder(uint32_t pg_num, uint64_t expected_num_objs)
   if (leavies == 0 || expected_num_objs == objs_per_folder)
     return 0;
 
+  return create_pg_folders(pg_num, leavies, 0);
+}
+
+int HashIndex::pg_fixed_levels(uint32_t pg_num)
+{
+  const int pg_num_bits = calc_num_bits(pg_num - 1);
+  int num = pg_num_bits / 4;
+  // pg num's hex value is like 1xxx,xxxx,xxxx but not 1111,1111,1111,
+  // so that splitting starts at level 3
+  if (pg_num_bits % 4 == 0 && pg_num < ((uint32_t)1 << pg_num_bits)) {
+    --num;
+  }
+  return num;
+}
+
+int HashIndex::create_pg_folders(uint32_t pg_num, uint64_t leavies,
+				 unsigned depth)
+{
+  const coll_t c = coll();
   spg_t spgid;
   if (!c.is_pg_prefix(&spgid))
     return -EINVAL;
@@ -448,12 +529,7 @@ int HashIndex::pre_split_folder(uint32_t pg_num, uint64_t expected_num_objs)
   const int pg_num_bits = calc_num_bits(pg_num - 1);
   ps_t tmp_id = ps;
   // calculate the number of levels we only create one sub folder
-  int num = pg_num_bits / 4;
-  // pg num's hex value is like 1xxx,xxxx,xxxx but not 1111,1111,1111,
-  // so that splitting starts at level 3
-  if (pg_num_bits % 4 == 0 && pg_num < ((uint32_t)1 << pg_num_bits)) {
-    --num;
-  }
+  int num = pg_fixed_levels(pg_num);
 
   int ret;
   // Start with creation that only has one subfolder
@@ -483,10 +559,16 @@ int HashIndex::pre_split_folder(uint32_t pg_num, uint64_t expected_num_objs)
   const uint32_t subs = (1 << split_bits);
   // Calculate how many levels we create starting from here
   int level  = 0;
-  leavies /= subs;
-  while (leavies > 1) {
-    ++level;
-    leavies = leavies >> 4;
+  if (depth) {
+    // the folders created above and the subs level below count too
+    level = (int)depth - dump_num - 1;
+    assert(level >= 0);  // see _presplit
+  } else {
+    leavies /= subs;
+    while (leavies > 1) {
+      ++level;
+      leavies = leavies >> 4;
+    }
   }
   for (uint32_t i = 0; i < subs; ++i) {
     assert(split_bits <= 4); // otherwise BAD_SHIFT
@@ -786,6 +868,155 @@ int HashIndex::complete_split(const vector<string> &path, subdir_info_s info) {
   return end_split_or_merge(path);
 }
 
+int HashIndex::split_step(const vector<string> &path,
+			  unsigned max_objs,
+			  unsigned *moved,
+			  bool *done)
+{
+  WRAP_RETRY(
+  r = _split_step(path, max_objs, moved, done);
+  if (r < 0)
+    goto out;
+  );
+}
+
+int HashIndex::_split_step(const vector<string> &path,
+			   unsigned max_objs,
+			   unsigned *moved,
+			   bool *done)
+{
+  *moved = 0;
+  *done = false;
+  // the in progress tag has room for one split at a time
+  if (splitting && splitting_path != path)
+    return 0;
+  int exists;
+  int r = path_exists(path, &exists);
+  if (r < 0)
+    return r;
+  if (!exists) {
+    // merged away or removed since it was queued
+    *done = true;
+    return 0;
+  }
+  subdir_info_s info;
+  r = get_info(path, &info);
+  if (r < 0)
+    return r;
+  if (!splitting) {
+    if (!must_split(info)) {
+      *done = true;
+      return 0;
+    }
+    r = initiate_split(path, info);
+    if (r < 0)
+      return r;
+    splitting = true;
+    splitting_path = path;
+  }
+
+  int level = info.hash_level;
+  map<string, ghobject_t> objects;
+  r = list_objects(path, 0, 0, &objects);
+  if (r < 0)
+    return r;
+  vector<string> subdirs_vec;
+  r = list_subdirs(path, &subdirs_vec);
+  if (r < 0)
+    return r;
+  set<string> subdirs;
+  subdirs.insert(subdirs_vec.begin(), subdirs_vec.end());
+  map<string, map<string, ghobject_t> > mapped;
+  for (map<string, ghobject_t>::iterator i = objects.begin();
+       i != objects.end();
+       ++i) {
+    vector<string> new_path;
+    get_path_components(i->second, &new_path);
+    mapped[new_path[level]][i->first] = i->second;
+  }
+
+  // Move whole buckets only, so that lookups never find a subdir
+  // holding part of its objects.
+  vector<string> dst = path;
+  dst.push_back("");
+  map<string, ghobject_t> moved_objs;
+  map<string, map<string, ghobject_t> >::iterator i = mapped.begin();
+  for (; i != mapped.end() && *moved < max_objs; ++i) {
+    dst[level] = i->first;
+    subdir_info_s info_new;
+    info_new.objs = i->second.size();
+    info_new.subdirs = 0;
+    info_new.hash_level = level + 1;
+    if (!subdirs.count(i->first)) {
+      // left in place, as complete_split would
+      if (must_merge(info_new))
+	continue;
+      r = create_path(dst);
+      if (r < 0)
+	return r;
+    }
+    for (map<string, ghobject_t>::iterator j = i->second.begin();
+	 j != i->second.end();
+	 ++j) {
+      r = link_object(path, dst, j->second, j->first);
+      if (r < 0 && r != -EEXIST)
+	return r;
+      moved_objs[j->first] = j->second;
+      objects.erase(j->first);
+    }
+    r = fsync_dir(dst);
+    if (r < 0)
+      return r;
+
+    // Presence of info must imply that all objects have been copied
+    if (subdirs.count(i->first))
+      r = reset_attr(dst);
+    else
+      r = set_info(dst, info_new);
+    if (r < 0)
+      return r;
+    r = fsync_dir(dst);
+    if (r < 0)
+      return r;
+    *moved += i->second.size();
+  }
+  r = remove_objects(path, moved_objs, &objects);
+  if (r < 0)
+    return r;
+  r = reset_attr(path);
+  if (r < 0)
+    return r;
+  r = fsync_dir(path);
+  if (r < 0)
+    return r;
+  dout(20) << __func__ << " " << path << " moved " << *moved
+	   << ", " << objects.size() << " left" << dendl;
+  if (i != mapped.end())
+    return 0;
+
+  r = end_split_or_merge(path);
+  if (r < 0)
+    return r;
+  splitting = false;
+  *done = true;
+  return 0;
+}
+
+int HashIndex::finish_background_split()
+{
+  if (!splitting)
+    return 0;
+  subdir_info_s info;
+  int r = get_info(splitting_path, &info);
+  if (r < 0)
+    return r;
+  r = complete_split(splitting_path, info);
+  if (r < 0)
+    return r;
+  splitting = false;
+  return 0;
+}
+
 void HashIndex::get_path_components(const ghobject_t &oid,
 				    vector<string> *path) {
   char buf[MAX_HASH_LEVEL + 1];
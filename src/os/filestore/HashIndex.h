@@ -46,6 +46,15 @@ extern string reverse_hexdigit_bits_string(string l);
  * Subdirectories are created when the number of objects in a directory
  * exceed (abs(merge_threshhold)) * 16 * split_multiplier.  The number of objects in a directory
  * is encoded as subdir_info_s in an xattr on the directory.
+ *
+ * With a SplitQueue set, a directory that crosses the threshold is
+ * handed to the queue and split a few buckets at a time by
+ * split_step().  A bucket (the objects bound for one new subdirectory)
+ * is always moved whole, so between steps every object is either in
+ * its new subdirectory or still in the parent with no subdirectory for
+ * it yet, and lookups and listings work unchanged.  The root carries
+ * the usual in progress tag until the last step, so cleanup() finishes
+ * an interrupted split on mount.
  */
 class HashIndex : public LFNIndex {
 private:
@@ -67,6 +76,24 @@ private:
   int merge_threshold;
   int split_multiplier;
 
+public:
+  /// Takes directories that need splitting off the write path
+  class SplitQueue {
+  public:
+    virtual void queue_split(
+      const coll_t &c,           ///< [in] collection
+      const vector<string> &path ///< [in] directory to split
+      ) = 0;
+    virtual ~SplitQueue() {}
+  };
+
+private:
+  SplitQueue *split_queue;   ///< NULL to split inline
+  int split_inline_multiple; ///< split inline past this times the threshold
+  /// split_step() has started on splitting_path and not yet finished it
+  bool splitting;
+  vector<string> splitting_path;
+
   /// Encodes current subdir state for determining when to split/merge.
   struct subdir_info_s {
     uint64_t objs;       ///< Objects in subdir.
@@ -142,7 +169,10 @@ public:
     double retry_probability=0) ///< [in] retry probability
     : LFNIndex(collection, base_path, index_version, retry_probability),
       merge_threshold(merge_at),
-      split_multiplier(split_multiple) {}
+      split_multiplier(split_multiple),
+      split_queue(NULL),
+      split_inline_multiple(0),
+      splitting(false) {}
 
   /// @see CollectionIndex
   uint32_t collection_version() { return index_version; }
@@ -160,6 +190,30 @@ public:
     CollectionIndex* dest
     );
 
+  /// Queue directories to split on q rather than splitting them inline
+  void set_split_queue(
+    SplitQueue *q,      ///< [in] queue, or NULL to split inline
+    int inline_multiple ///< [in] split inline past this times the threshold
+    ) {
+    split_queue = q;
+    split_inline_multiple = inline_multiple;
+  }
+
+  /**
+   * Moves whole buckets of a queued directory into new subdirectories
+   * until at least max_objs objects have moved or the split is done.
+   * Only one directory per collection is split at a time; a step on any
+   * other returns with nothing moved until that one is done.
+   *
+   * Caller must hold access_lock for write.
+   */
+  int split_step(
+    const vector<string> &path, ///< [in] directory to split
+    unsigned max_objs,          ///< [in] objects to move in this step
+    unsigned *moved,            ///< [out] objects moved
+    bool *done                  ///< [out] path no longer needs splitting
+    ); ///< @return Error Code, 0 on success
+
 protected:
   int _init();
 
@@ -189,6 +243,16 @@ protected:
       uint64_t expected_num_objs
       );
 
+  /**
+   * Create every folder of an empty pg collection, with the leaves depth
+   * levels below the root.  That has to be deeper than the levels that
+   * only have the one subdirectory for the pg (see pg_fixed_levels).
+   */
+  int _presplit(
+    uint32_t pg_num,
+    unsigned depth
+    );
+
   int _collection_list_partial(
     const ghobject_t &start,
     const ghobject_t &end,
@@ -269,6 +333,18 @@ private:
     subdir_info_s info	       ///< [in] Info attached to path
     ); /// @return Error Code, 0 on success
 
+  /// @see split_step
+  int _split_step(
+    const vector<string> &path,
+    unsigned max_objs,
+    unsigned *moved,
+    bool *done
+    );
+
+  /// Completes the split split_step() is part way through, if any,
+  /// before another op takes the in progress tag
+  int finish_background_split(); ///< @return Error Code, 0 on success
+
   /// Determine path components from hoid hash
   void get_path_components(
     const ghobject_t &oid, ///< [in] Object for which to get path components
@@ -279,6 +355,11 @@ private:
   /// according to the given expected object number.
   int pre_split_folder(uint32_t pg_num, uint64_t expected_num_objs);
 
+  /// Create the folders of a pg collection: one per level while the
+  /// pg fixes the hash digit, then every folder below that down to
+  /// depth, or deep enough for leaves leaf folders if depth is 0.
+  int create_pg_folders(uint32_t pg_num, uint64_t leaves, unsigned depth);
+
   /// Initialize the folder (dir info) with the given hash
   /// level and number of its subdirs.
   int init_split_folder(vector<string> &path, uint32_t hash_level);
@@ -333,6 +414,9 @@ private:
   }
 
   /// Calculate the number of bits.
+  /// levels from the root with a single subdirectory, fixed by the pg
+  static int pg_fixed_levels(uint32_t pg_num);
+
   static int calc_num_bits(uint64_t n) {
     int ret = 0;
     while (n > 0) {
@@ -23,8 +23,10 @@
 
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Clock.h"
 #include "common/config.h"
 #include "common/debug.h"
+#include "common/errno.h"
 #include "include/buffer.h"
 
 #include "IndexManager.h"
@@ -60,8 +62,13 @@ static int get_version(const char *path, uint32_t *version) {
   return 0;
 }
 
+#define dout_subsys ceph_subsys_filestore
+#undef dout_prefix
+#define dout_prefix *_dout << "index_manager "
+
 IndexManager::~IndexManager() {
 
+  stop_split_thread();
   for (ceph::unordered_map<coll_t, CollectionIndex* > ::iterator it = col_indices.begin();
        it != col_indices.end(); ++it) {
 
@@ -99,8 +106,13 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
     case CollectionIndex::HASH_INDEX_TAG_2: // fall through
     case CollectionIndex::HOBJECT_WITH_POOL: {
       // Must be a HashIndex
-      *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				   g_conf->filestore_split_multiple, version);
+      HashIndex *hindex = new HashIndex(c, path,
+					g_conf->filestore_merge_threshold,
+					g_conf->filestore_split_multiple,
+					version);
+      if (g_conf->filestore_split_in_background)
+	hindex->set_split_queue(this, g_conf->filestore_split_inline_multiple);
+      *index = hindex;
       return 0;
     }
     default: assert(0);
@@ -108,10 +120,14 @@ int IndexManager::build_index(coll_t c, const char *path, CollectionIndex **inde
 
   } else {
     // No need to check
-    *index = new HashIndex(c, path, g_conf->filestore_merge_threshold,
-				 g_conf->filestore_split_multiple,
-				 CollectionIndex::HOBJECT_WITH_POOL,
-				 g_conf->filestore_index_retry_probability);
+    HashIndex *hindex = new HashIndex(c, path,
+				      g_conf->filestore_merge_threshold,
+				      g_conf->filestore_split_multiple,
+				      CollectionIndex::HOBJECT_WITH_POOL,
+				      g_conf->filestore_index_retry_probability);
+    if (g_conf->filestore_split_in_background)
+      hindex->set_split_queue(this, g_conf->filestore_split_inline_multiple);
+    *index = hindex;
     return 0;
   }
 }
@@ -134,3 +150,105 @@ int IndexManager::get_index(coll_t c, const string& baseDir, Index *index) {
   }
   return 0;
 }
+
+void IndexManager::start_split_thread()
+{
+  if (split_thread.is_started())
+    return;
+  split_stop = false;
+  split_thread.create();
+}
+
+void IndexManager::stop_split_thread()
+{
+  if (!split_thread.is_started())
+    return;
+  split_lock.Lock();
+  split_stop = true;
+  split_cond.Signal();
+  split_lock.Unlock();
+  split_thread.join();
+  // whatever is left is either finished by cleanup() or queued again
+  // by the next write to the directory
+  split_queue.clear();
+  split_queued.clear();
+}
+
+void IndexManager::queue_split(const coll_t &c, const vector<string> &path)
+{
+  Mutex::Locker l(split_lock);
+  split_item_t item(c, path);
+  if (split_queued.count(item))
+    return;
+  dout(10) << __func__ << " " << c << " " << path << dendl;
+  split_queued.insert(item);
+  split_queue.push_back(item);
+  split_cond.Signal();
+}
+
+void IndexManager::split_thread_entry()
+{
+  unsigned idle = 0;  // steps in a row that moved nothing
+  split_lock.Lock();
+  while (!split_stop) {
+    if (split_queue.empty()) {
+      split_cond.Wait(split_lock);
+      continue;
+    }
+    split_item_t item = split_queue.front();
+    split_queue.pop_front();
+    split_lock.Unlock();
+
+    CollectionIndex *index = NULL;
+    lock.Lock();
+    ceph::unordered_map<coll_t, CollectionIndex* >::iterator p =
+      col_indices.find(item.first);
+    if (p != col_indices.end())
+      index = p->second;
+    lock.Unlock();
+
+    unsigned moved = 0;
+    bool done = true;
+    int r = 0;
+    if (index) {
+      RWLock::WLocker l(index->access_lock);
+      r = static_cast<HashIndex*>(index)->split_step(
+	item.second, g_conf->filestore_split_batch_objects, &moved, &done);
+    }
+    if (r < 0) {
+      derr << __func__ << " splitting " << item.first << " " << item.second
+	   << ": " << cpp_strerror(r) << dendl;
+      done = false;
+    } else {
+      dout(15) << __func__ << " " << item.first << " " << item.second
+	       << " moved " << moved << (done ? ", done" : "") << dendl;
+    }
+
+    split_lock.Lock();
+    if (done) {
+      split_queued.erase(item);
+    } else {
+      split_queue.push_back(item);
+    }
+    utime_t wait;
+    if (moved) {
+      idle = 0;
+      if (g_conf->filestore_split_objects_per_sec > 0)
+	wait.set_from_double((double)moved /
+			     (double)g_conf->filestore_split_objects_per_sec);
+    } else if (!done && ++idle >= split_queue.size()) {
+      // a whole round without progress: failing, or only directories
+      // waiting for a split that is not queued
+      idle = 0;
+      wait = utime_t(1, 0);
+    }
+    if (wait > utime_t()) {
+      // queue_split() signals too; keep waiting until the time is up
+      utime_t until = ceph_clock_now(g_ceph_context);
+      until += wait;
+      while (!split_stop && ceph_clock_now(g_ceph_context) < until)
+	split_cond.WaitUntil(split_lock, until);
+    }
+  }
+  split_lock.Unlock();
+}
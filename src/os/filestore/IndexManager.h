@@ -19,6 +19,7 @@
 
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
 #include "common/config.h"
 #include "common/debug.h"
 
@@ -48,11 +49,37 @@ struct Index {
  * by it, no other concurrent accesses may be allowed.
  * This is enforced by using CollectionIndex::access_lock
  */
-class IndexManager {
+class IndexManager : public HashIndex::SplitQueue {
   Mutex lock; ///< Lock for Index Manager
   bool upgrade;
   ceph::unordered_map<coll_t, CollectionIndex* > col_indices;
 
+  /**
+   * Background directory splits, with filestore_split_in_background.
+   *
+   * Directories are split a filestore_split_batch_objects step at a
+   * time, round robin, pausing after each step for as long as moving
+   * that many objects takes at filestore_split_objects_per_sec.
+   */
+  typedef pair<coll_t, vector<string> > split_item_t;
+  Mutex split_lock;
+  Cond split_cond;
+  bool split_stop;
+  list<split_item_t> split_queue;    ///< next to step first
+  set<split_item_t> split_queued;    ///< everything in split_queue
+
+  class SplitThread : public Thread {
+    IndexManager *im;
+  public:
+    SplitThread(IndexManager *im) : im(im) {}
+    void *entry() {
+      im->split_thread_entry();
+      return NULL;
+    }
+  } split_thread;
+
+  void split_thread_entry();
+
   /**
    * Index factory
    *
@@ -68,10 +95,21 @@ class IndexManager {
 public:
   /// Constructor
   IndexManager(bool upgrade) : lock("IndexManager lock"),
-			       upgrade(upgrade) {}
+			       upgrade(upgrade),
+			       split_lock("IndexManager::split_lock"),
+			       split_stop(false),
+			       split_thread(this) {}
 
   ~IndexManager();
 
+  /// Start stepping through queued splits
+  void start_split_thread();
+  /// Stop splitting; a split left part way is finished by cleanup()
+  void stop_split_thread();
+
+  /// @see HashIndex::SplitQueue
+  void queue_split(const coll_t &c, const vector<string> &path);
+
   /**
    * Reserve and return index for c
    *
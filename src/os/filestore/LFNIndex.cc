@@ -134,6 +134,11 @@ int LFNIndex::pre_hash_collection(uint32_t pg_num, uint64_t expected_num_objs)
   return _pre_hash_collection(pg_num, expected_num_objs);
 }
 
+int LFNIndex::presplit(uint32_t pg_num, unsigned depth)
+{
+  return _presplit(pg_num, depth);
+}
+
 
 int LFNIndex::collection_list_partial(const ghobject_t &start,
 				      const ghobject_t &end,
@@ -184,6 +184,12 @@ public:
       uint64_t expected_num_objs
       );
 
+  /// @see CollectionIndex;
+  int presplit(
+      uint32_t pg_num,
+      unsigned depth
+      );
+
   /// @see CollectionIndex
   int collection_list_partial(
     const ghobject_t &start,
@@ -245,6 +251,12 @@ protected:
       uint64_t expected_num_objs
       ) = 0;
 
+  /// @see CollectionIndex
+  virtual int _presplit(
+      uint32_t pg_num,
+      unsigned depth
+      ) = 0;
+
   /// @see CollectionIndex
   virtual int _collection_list_partial(
     const ghobject_t &start,
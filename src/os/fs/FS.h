@@ -60,6 +60,7 @@ public:
     uint64_t offset, length;
     int rval;
     bufferlist bl;  ///< write payload (so that it remains stable for duration)
+    utime_t start;  ///< when queued for submission, for latency accounting
 
     aio_t(void *p, int f) : priv(p), fd(f), rval(-1000) {
       memset(&iocb, 0, sizeof(iocb));
@@ -128,13 +129,36 @@ public:
       return 0;
     }
 
+    /// submit n aios with as few io_submit calls as the kernel allows
+    int submit_batch(aio_t **aios, int n, int *retries) {
+      int attempts = 10;
+      iocb *piocb[n];
+      for (int i = 0; i < n; ++i)
+	piocb[i] = &aios[i]->iocb;
+      int done = 0;
+      while (done < n) {
+	int r = io_submit(ctx, n - done, piocb + done);
+	if (r < 0) {
+	  if (r == -EAGAIN && attempts-- > 0) {
+	    usleep(500);
+	    (*retries)++;
+	    continue;
+	  }
+	  return r;
+	}
+	assert(r > 0);
+	done += r;
+      }
+      return 0;
+    }
+
     int get_next_completed(int timeout_ms, aio_t **paio, int max) {
       io_event event[max];
       struct timespec t = {
 	timeout_ms / 1000,
 	(timeout_ms % 1000) * 1000 * 1000
       };
-      int r = io_getevents(ctx, 1, 1, event, &t);
+      int r = io_getevents(ctx, 1, max, event, &t);
       if (r <= 0) {
 	return r;
       }
@@ -1512,10 +1512,45 @@ int MemStore::PageSetObject::write(uint64_t offset, const bufferlist &src)
 
 int MemStore::PageSetObject::clone(Object *src, uint64_t srcoff,
                                    uint64_t len, uint64_t dstoff)
+{
+  auto &src_data = static_cast<PageSetObject*>(src)->data;
+  const uint64_t page_size = data.get_page_size();
+  const uint64_t end = dstoff + len;
+
+  // when the pages line up, share the whole ones and leave them to be
+  // copied on write; only the partial pages at either end are copied
+  if (src_data.get_page_size() == page_size &&
+      srcoff % page_size == dstoff % page_size) {
+    const uint64_t head = std::min(len,
+                                   (page_size - dstoff % page_size) % page_size);
+    if (head) {
+      copy_range(src_data, srcoff, head, dstoff);
+      srcoff += head;
+      dstoff += head;
+      len -= head;
+    }
+    const uint64_t middle = len & ~(page_size-1);
+    if (middle) {
+      data.share_range(src_data, srcoff, middle, dstoff);
+      srcoff += middle;
+      dstoff += middle;
+      len -= middle;
+    }
+  }
+  if (len)
+    copy_range(src_data, srcoff, len, dstoff);
+
+  // update object size
+  if (data_len < end)
+    data_len = end;
+  return 0;
+}
+
+void MemStore::PageSetObject::copy_range(PageSet &src_data, uint64_t srcoff,
+                                         uint64_t len, uint64_t dstoff)
 {
   const int64_t delta = dstoff - srcoff;
 
-  auto &src_data = static_cast<PageSetObject*>(src)->data;
   const uint64_t src_page_size = src_data.get_page_size();
 
   auto &dst_data = data;
@@ -1549,11 +1584,6 @@ int MemStore::PageSetObject::clone(Object *src, uint64_t srcoff,
     len -= count;
     tls_pages.clear(); // drop page refs
   }
-
-  // update object size
-  if (data_len < dstoff + len)
-    data_len = dstoff + len;
-  return 0;
 }
 
 int MemStore::PageSetObject::truncate(uint64_t size)
@@ -1571,6 +1601,11 @@ int MemStore::PageSetObject::truncate(uint64_t size)
   data.get_range(page_offset, page_size, tls_pages);
   if (tls_pages.empty())
     return 0;
+  if (tls_pages.front()->is_shared()) {
+    // copy it first; a clone still needs the old contents
+    tls_pages.clear();
+    data.alloc_range(size, page_offset + page_size - size, tls_pages);
+  }
 
   auto page = tls_pages.begin();
   auto data = (*page)->data;
@@ -130,7 +130,8 @@ public:
     static thread_local PageSet::page_vector tls_pages;
 #endif
 
-    PageSetObject(size_t page_size) : data(page_size), data_len(0) {}
+    PageSetObject(size_t page_size, PagePool *pool)
+      : data(page_size, pool), data_len(0) {}
 
     size_t get_size() const override { return data_len; }
 
@@ -154,6 +155,11 @@ public:
       decode_base(p);
       DECODE_FINISH(p);
     }
+
+  private:
+    // copy [srcoff,srcoff+len) of src_data to dstoff, byte by byte
+    void copy_range(PageSet &src_data, uint64_t srcoff, uint64_t len,
+                    uint64_t dstoff);
   };
 
   struct Collection : public RefCountedObject {
@@ -169,8 +175,13 @@ public:
     friend void intrusive_ptr_release(Collection *c) { c->put(); }
 
     ObjectRef create_object() const {
-      if (use_page_set)
-        return new PageSetObject(cct->_conf->memstore_page_size);
+      if (use_page_set) {
+        const size_t page_size = cct->_conf->memstore_page_size;
+        PagePool *pool = NULL;
+        if (cct->_conf->memstore_page_pool)
+          pool = PagePool::get(page_size + sizeof(PageBuffer));
+        return new PageSetObject(page_size, pool);
+      }
       return new BufferlistObject();
     }
 
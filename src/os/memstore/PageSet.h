@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <map>
 #include <mutex>
 #include <vector>
 #include <boost/intrusive/avl_set.hpp>
@@ -27,7 +28,165 @@
 #include "include/Spinlock.h"
 
 
+/**
+ * Hands out the fixed-size buffers that hold page data, carved from
+ * large slabs.  Each thread keeps a few free buffers of its own, so
+ * most allocations and frees take no lock; the rest are kept on the
+ * pool's free list for reuse.  Slab memory is not touched until a page
+ * is written, so on a NUMA machine the kernel places it on the node of
+ * the thread that first writes it.
+ *
+ * Pools live as long as the process: get() returns the one for a given
+ * buffer size, and slabs are never handed back to the system.
+ */
+class PagePool {
+  const size_t buffer_size;
+  const size_t buffers_per_slab;
+
+  Spinlock lock;
+  std::vector<char*> slabs;
+  std::vector<char*> free_buffers;
+
+  static const size_t SLAB_BYTES = 4 << 20;
+  static const size_t CACHE_MAX = 64;    ///< free buffers a thread keeps
+  static const size_t CACHE_BATCH = 16;  ///< moved to/from the pool at once
+
+  struct ThreadCache {
+    PagePool *pool;
+    std::vector<char*> free;
+    ThreadCache() : pool(nullptr) {}
+    ~ThreadCache() {
+      if (pool)
+	pool->put_batch(free, free.size());
+    }
+  };
+
+  /// this thread's cache for this pool, if it has a slot for one
+  ThreadCache *get_cache() {
+#if defined(__GLIBCXX__)
+    static thread_local ThreadCache caches[4];
+    for (auto &c : caches) {
+      if (c.pool == this)
+	return &c;
+      if (!c.pool) {
+	c.pool = this;
+	return &c;
+      }
+    }
+#endif
+    return nullptr;
+  }
+
+  void get_batch(std::vector<char*> &out, size_t n) {
+    std::lock_guard<Spinlock> l(lock);
+    while (free_buffers.size() < n) {
+      char *slab = new char[buffer_size * buffers_per_slab];
+      slabs.push_back(slab);
+      for (size_t i = 0; i < buffers_per_slab; ++i)
+	free_buffers.push_back(slab + i * buffer_size);
+    }
+    out.insert(out.end(), free_buffers.end() - n, free_buffers.end());
+    free_buffers.resize(free_buffers.size() - n);
+  }
+
+  void put_batch(std::vector<char*> &in, size_t n) {
+    std::lock_guard<Spinlock> l(lock);
+    free_buffers.insert(free_buffers.end(), in.end() - n, in.end());
+    in.resize(in.size() - n);
+  }
+
+  explicit PagePool(size_t size)
+    : buffer_size(size),
+      buffers_per_slab(std::max<size_t>(SLAB_BYTES / size, 1)) {}
+
+public:
+  /// the pool for buffers of the given size
+  static PagePool *get(size_t size) {
+    static std::mutex pools_lock;
+    static std::map<size_t, PagePool*> pools;
+    std::lock_guard<std::mutex> l(pools_lock);
+    PagePool *&pool = pools[size];
+    if (!pool)
+      pool = new PagePool(size);
+    return pool;
+  }
+
+  size_t get_buffer_size() const { return buffer_size; }
+
+  /// bytes in slabs, in use or free
+  uint64_t get_bytes() {
+    std::lock_guard<Spinlock> l(lock);
+    return (uint64_t)slabs.size() * buffers_per_slab * buffer_size;
+  }
+
+  char *alloc() {
+    ThreadCache *c = get_cache();
+    if (!c) {
+      std::vector<char*> one;
+      get_batch(one, 1);
+      return one.back();
+    }
+    if (c->free.empty())
+      get_batch(c->free, CACHE_BATCH);
+    char *buf = c->free.back();
+    c->free.pop_back();
+    return buf;
+  }
+
+  void free(char *buf) {
+    ThreadCache *c = get_cache();
+    if (!c) {
+      std::lock_guard<Spinlock> l(lock);
+      free_buffers.push_back(buf);
+      return;
+    }
+    c->free.push_back(buf);
+    if (c->free.size() > CACHE_MAX)
+      put_batch(c->free, CACHE_BATCH);
+  }
+
+  // copy disabled
+  PagePool(const PagePool&) = delete;
+  const PagePool& operator=(const PagePool&) = delete;
+};
+
+/// The data of a page, shared by the Pages of clones until one writes.
+struct PageBuffer {
+  std::atomic<uint32_t> nrefs;
+  PagePool *const pool;  ///< or NULL if allocated with new
+
+  char *data() { return reinterpret_cast<char*>(this + 1); }
+
+  static PageBuffer *create(size_t page_size, PagePool *pool) {
+    char *buf;
+    if (pool) {
+      assert(pool->get_buffer_size() == page_size + sizeof(PageBuffer));
+      buf = pool->alloc();
+    } else {
+      buf = new char[page_size + sizeof(PageBuffer)];
+    }
+    return new (buf) PageBuffer(pool);
+  }
+
+  void get() { ++nrefs; }
+  void put() {
+    if (--nrefs)
+      return;
+    PagePool *p = pool;
+    char *buf = reinterpret_cast<char*>(this);
+    this->~PageBuffer();
+    if (p)
+      p->free(buf);
+    else
+      delete[] buf;
+  }
+
+ private:
+  explicit PageBuffer(PagePool *pool) : nrefs(1), pool(pool) {}
+};
+
 struct Page {
+  PageBuffer *const buffer;
   char *const data;
   boost::intrusive::avl_set_member_hook<> hook;
   uint64_t offset;
@@ -41,6 +200,9 @@ struct Page {
   friend void intrusive_ptr_add_ref(Page *p) { p->get(); }
   friend void intrusive_ptr_release(Page *p) { p->put(); }
 
+  /// another page's data is the same buffer; write to a copy instead
+  bool is_shared() const { return buffer->nrefs > 1; }
+
   // key-value comparison functor for avl
   struct Less {
     bool operator()(uint64_t offset, const Page &page) const {
@@ -62,11 +224,14 @@ struct Page {
     ::decode(offset, p);
   }
 
-  static Ref create(size_t page_size, uint64_t offset = 0) {
-    // allocate the Page and its data in a single buffer
-    auto buffer = new char[page_size + sizeof(Page)];
-    // place the Page structure at the end of the buffer
-    return new (buffer + page_size) Page(buffer, offset);
+  static Ref create(size_t page_size, uint64_t offset = 0,
+		    PagePool *pool = nullptr) {
+    return new Page(PageBuffer::create(page_size, pool), offset);
+  }
+  /// a page at offset sharing src's data
+  static Ref create_shared(const Page &src, uint64_t offset) {
+    src.buffer->get();
+    return new Page(src.buffer, offset);
   }
 
   // copy disabled
@@ -74,11 +239,9 @@ struct Page {
   const Page& operator=(const Page&) = delete;
 
  private: // private constructor, use create() instead
-  Page(char *data, uint64_t offset) : data(data), offset(offset), nrefs(1) {}
-
-  static void operator delete(void *p) {
-    delete[] reinterpret_cast<Page*>(p)->data;
-  }
+  Page(PageBuffer *buffer, uint64_t offset)
+    : buffer(buffer), data(buffer->data()), offset(offset), nrefs(1) {}
+  ~Page() { buffer->put(); }
 };
 
 class PageSet {
@@ -99,6 +262,7 @@ class PageSet {
 
   page_set pages;
   uint64_t page_size;
+  PagePool *pool;  ///< where new pages come from, or NULL for new
 
   typedef Spinlock lock_type;
   lock_type mutex;
@@ -125,10 +289,21 @@ class PageSet {
     return count;
   }
 
+  // replace a page shared with a clone by a private copy
+  iterator copy_on_write(iterator cur) {
+    Page *old = &*cur;
+    auto page = Page::create(page_size, old->offset, pool);
+    std::copy(old->data, old->data + page_size, page->data);
+    cur = pages.insert_before(pages.erase(cur), *page);
+    old->put();
+    return cur;
+  }
+
  public:
-  PageSet(size_t page_size) : page_size(page_size) {}
+  PageSet(size_t page_size, PagePool *pool = nullptr)
+    : page_size(page_size), pool(pool) {}
   PageSet(PageSet &&rhs)
-    : pages(std::move(rhs.pages)), page_size(rhs.page_size) {}
+    : pages(std::move(rhs.pages)), page_size(rhs.page_size), pool(rhs.pool) {}
   ~PageSet() {
     free_pages(pages.begin(), pages.end());
   }
@@ -141,7 +316,8 @@ class PageSet {
   size_t size() const { return pages.size(); }
   size_t get_page_size() const { return page_size; }
 
-  // allocate all pages that intersect the range [offset,length)
+  // allocate all pages that intersect the range [offset,length), and
+  //  copy any that are shared so the caller can write to them
   void alloc_range(uint64_t offset, uint64_t length, page_vector &range) {
     // loop in reverse so we can provide hints to avl_set::insert_check()
     //	and get O(1) insertions after the first
@@ -158,7 +334,7 @@ class PageSet {
       typename page_set::insert_commit_data commit;
       auto insert = pages.insert_check(cur, page_offset, page_cmp(), commit);
       if (insert.second) {
-        auto page = Page::create(page_size, page_offset);
+        auto page = Page::create(page_size, page_offset, pool);
         cur = pages.insert_commit(*page, commit);
 
         // assume that the caller will write to the range [offset,length),
@@ -171,6 +347,8 @@ class PageSet {
         // zero front of page between page_offset and offset
         if (offset > page->offset)
           std::fill(page->data, page->data + offset - page->offset, 0);
+      } else if (insert.first->is_shared()) {
+        cur = copy_on_write(insert.first);
       } else { // exists
         cur = insert.first;
       }
@@ -193,6 +371,34 @@ class PageSet {
       range.push_back(&*cur++);
   }
 
+  // make [dstoff,dstoff+length) refer to the pages of src at
+  //  [srcoff,srcoff+length), holes included; all must be page aligned
+  void share_range(PageSet &src, uint64_t srcoff, uint64_t length,
+                   uint64_t dstoff) {
+    assert(src.page_size == page_size);
+    assert((srcoff | dstoff | length) % page_size == 0);
+    page_vector range;
+    if (&src == this) {
+      get_range(srcoff, length, range);
+    } else {
+      std::lock_guard<lock_type> lock(src.mutex);
+      src.get_range(srcoff, length, range);
+    }
+
+    std::lock_guard<lock_type> lock(mutex);
+    auto cur = pages.lower_bound(dstoff, page_cmp());
+    auto end = cur;
+    while (end != pages.end() && end->offset < dstoff + length)
+      ++end;
+    // drop our pages before sharing theirs, in case they are the same
+    free_pages(cur, end);
+    for (auto &src_page : range) {
+      auto page = Page::create_shared(*src_page,
+                                      src_page->offset - srcoff + dstoff);
+      pages.insert_before(end, *page);
+    }
+  }
+
   void free_pages_after(uint64_t offset) {
     std::lock_guard<lock_type> lock(mutex);
     auto cur = pages.lower_bound(offset & ~(page_size-1), page_cmp());
@@ -213,11 +419,14 @@ class PageSet {
   void decode(bufferlist::iterator &p) {
     assert(empty());
     ::decode(page_size, p);
+    // the dump may have been taken with a different page size
+    if (pool && pool->get_buffer_size() != page_size + sizeof(PageBuffer))
+      pool = PagePool::get(page_size + sizeof(PageBuffer));
     unsigned count;
     ::decode(count, p);
     auto cur = pages.end();
     for (unsigned i = 0; i < count; i++) {
-      auto page = Page::create(page_size);
+      auto page = Page::create(page_size, 0, pool);
       page->decode(p, page_size);
       cur = pages.insert_before(cur, *page);
     }
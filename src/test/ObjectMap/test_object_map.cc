@@ -612,6 +612,91 @@ TEST_F(ObjectMapTest, CreateOneObject) {
   ASSERT_EQ(attrs_got.size(), 0U);
 }
 
+TEST_F(ObjectMapTest, ApplyUpdates) {
+  ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)), 300, shard_id_t(0));
+  ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)), 301, shard_id_t(0));
+  bufferlist val;
+  val.append("val");
+
+  // a run creating the map, on an object without a parent
+  {
+    list<ObjectMap::Update> updates;
+    updates.push_back(ObjectMap::Update(SequencerPosition(1, 0, 0)));
+    updates.back().type = ObjectMap::Update::RM_KEYS;
+    updates.back().to_rm.insert("x");
+    updates.push_back(ObjectMap::Update(SequencerPosition(1, 0, 1)));
+    updates.back().type = ObjectMap::Update::SET_KEYS;
+    updates.back().to_set["a"] = val;
+    updates.back().to_set["b"] = val;
+    updates.push_back(ObjectMap::Update(SequencerPosition(1, 0, 2)));
+    updates.back().type = ObjectMap::Update::RM_KEYS;
+    updates.back().to_rm.insert("a");
+    updates.push_back(ObjectMap::Update(SequencerPosition(1, 0, 3)));
+    updates.back().type = ObjectMap::Update::SET_HEADER;
+    updates.back().header = val;
+    updates.push_back(ObjectMap::Update(SequencerPosition(1, 0, 4)));
+    updates.back().type = ObjectMap::Update::SET_KEYS;
+    updates.back().to_set["c"] = val;
+    ASSERT_EQ(0, db->apply_updates(hoid, updates));
+  }
+  map<string, bufferlist> got;
+  bufferlist header;
+  db->get(hoid, &header, &got);
+  ASSERT_EQ(2U, got.size());
+  ASSERT_TRUE(got.count("b"));
+  ASSERT_TRUE(got.count("c"));
+  ASSERT_TRUE(header.contents_equal(val));
+
+  // updates at or before the synced position are replays and skipped
+  SequencerPosition synced(2, 0, 1);
+  db->sync(&hoid, &synced);
+  {
+    list<ObjectMap::Update> updates;
+    updates.push_back(ObjectMap::Update(SequencerPosition(2, 0, 1)));
+    updates.back().type = ObjectMap::Update::SET_KEYS;
+    updates.back().to_set["skipped"] = val;
+    updates.push_back(ObjectMap::Update(SequencerPosition(2, 0, 2)));
+    updates.back().type = ObjectMap::Update::SET_KEYS;
+    updates.back().to_set["d"] = val;
+    ASSERT_EQ(0, db->apply_updates(hoid, updates));
+  }
+  got.clear();
+  db->get(hoid, &header, &got);
+  ASSERT_EQ(3U, got.size());
+  ASSERT_FALSE(got.count("skipped"));
+  ASSERT_TRUE(got.count("d"));
+
+  // once cloned, removals go through the parent
+  db->clone(hoid, hoid2);
+  {
+    list<ObjectMap::Update> updates;
+    updates.push_back(ObjectMap::Update(SequencerPosition(3, 0, 0)));
+    updates.back().type = ObjectMap::Update::RM_KEYS;
+    updates.back().to_rm.insert("b");
+    updates.push_back(ObjectMap::Update(SequencerPosition(3, 0, 1)));
+    updates.back().type = ObjectMap::Update::RM_KEYS;
+    updates.back().to_rm.insert("c");
+    updates.push_back(ObjectMap::Update(SequencerPosition(3, 0, 2)));
+    updates.back().type = ObjectMap::Update::SET_KEYS;
+    updates.back().to_set["e"] = val;
+    ASSERT_EQ(0, db->apply_updates(hoid, updates));
+  }
+  got.clear();
+  db->get(hoid, &header, &got);
+  ASSERT_EQ(2U, got.size());
+  ASSERT_TRUE(got.count("d"));
+  ASSERT_TRUE(got.count("e"));
+  got.clear();
+  db->get(hoid2, &header, &got);
+  ASSERT_EQ(3U, got.size());
+  ASSERT_TRUE(got.count("b"));
+  ASSERT_TRUE(got.count("c"));
+  ASSERT_TRUE(got.count("d"));
+
+  db->clear(hoid);
+  db->clear(hoid2);
+}
+
 TEST_F(ObjectMapTest, CloneOneObject) {
   ghobject_t hoid(hobject_t(sobject_t("foo", CEPH_NOSNAP)), 200, shard_id_t(0));
   ghobject_t hoid2(hobject_t(sobject_t("foo2", CEPH_NOSNAP)), 201, shard_id_t(1));
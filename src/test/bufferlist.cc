@@ -27,6 +27,7 @@
 #include "include/buffer.h"
 #include "include/utime.h"
 #include "include/encoding.h"
+#include "include/crc32c.h"
 #include "common/environment.h"
 #include "common/Clock.h"
 #include "common/safe_io.h"
@@ -2311,6 +2312,100 @@ TEST(BufferList, crc32c_append_perf) {
   cout << "crc cache hits (adjusted) = " << buffer::get_cached_crc_adjusted() << std::endl;
 }
 
+TEST(BufferList, crc32c_pieces) {
+  unsigned piece = 4096;
+  bufferptr a(piece * 4);
+  for (unsigned i = 0; i < a.length(); i++)
+    a[i] = rand();
+  // as if it was received in four reads, then handled as one ptr
+  bufferlist pieces;
+  for (unsigned i = 0; i < 4; i++)
+    pieces.push_back(bufferptr(a, i * piece, piece));
+  uint32_t crc = pieces.crc32c(0);
+  ASSERT_EQ(ceph_crc32c(0, (unsigned char*)a.c_str(), a.length()), crc);
+
+  buffer::track_cached_crc(true);
+  int base_cached = buffer::get_cached_crc();
+  int base_cached_adjusted = buffer::get_cached_crc_adjusted();
+  bufferlist whole;
+  whole.push_back(a);
+  // each piece starts where it did before, so their crcs are used as is
+  ASSERT_EQ(crc, whole.crc32c(0));
+  ASSERT_EQ(4 + base_cached, buffer::get_cached_crc());
+  ASSERT_EQ(0 + base_cached_adjusted, buffer::get_cached_crc_adjusted());
+  ASSERT_EQ(crc, whole.crc32c(0));
+  ASSERT_EQ(5 + base_cached, buffer::get_cached_crc());
+
+  // only the middle pieces are cached for this one, and for another
+  // initial value
+  bufferlist partial;
+  partial.push_back(bufferptr(a, 100, piece * 3));
+  ASSERT_EQ(ceph_crc32c(5, (unsigned char*)a.c_str() + 100, piece * 3),
+	    partial.crc32c(5));
+  ASSERT_EQ(5 + base_cached, buffer::get_cached_crc());
+  ASSERT_EQ(2 + base_cached_adjusted, buffer::get_cached_crc_adjusted());
+
+  // small pieces are scanned rather than adjusted
+  bufferlist small;
+  small.push_back(bufferptr(a, 0, 1000));
+  small.crc32c(0);
+  bufferlist small2;
+  small2.push_back(bufferptr(a, 0, 2000));
+  ASSERT_EQ(ceph_crc32c(7, (unsigned char*)a.c_str(), 2000), small2.crc32c(7));
+  ASSERT_EQ(2 + base_cached_adjusted, buffer::get_cached_crc_adjusted());
+}
+
+TEST(BufferList, crc32c_resend_perf) {
+  // a 4MB data segment received in 64KB reads
+  unsigned len = 4 * 1024 * 1024;
+  unsigned piece = 64 * 1024;
+  bufferptr a(len);
+  char *pa = a.c_str();
+  for (unsigned i = 0; i < len; i++)
+    pa[i] = (i & 0xff) ^ 73;
+  bufferlist received;
+  for (unsigned off = 0; off < len; off += piece)
+    received.push_back(bufferptr(a, off, piece));
+
+  uint32_t crc;
+  {
+    utime_t start = ceph_clock_now(NULL);
+    crc = received.crc32c(0);
+    utime_t end = ceph_clock_now(NULL);
+    float rate = (float)len / (float)(1024*1024) / (float)(end - start);
+    std::cout << "received.crc32c(0) = " << crc << " at " << rate << " MB/sec" << std::endl;
+  }
+  {
+    // resent or forwarded as is
+    utime_t start = ceph_clock_now(NULL);
+    uint32_t r = received.crc32c(0);
+    utime_t end = ceph_clock_now(NULL);
+    float rate = (float)len / (float)(1024*1024) / (float)(end - start);
+    std::cout << "received.crc32c(0) (again) = " << r << " at " << rate << " MB/sec" << std::endl;
+    ASSERT_EQ(crc, r);
+  }
+  {
+    // behind something else, so every piece starts from another crc
+    utime_t start = ceph_clock_now(NULL);
+    uint32_t r = received.crc32c(5);
+    utime_t end = ceph_clock_now(NULL);
+    float rate = (float)len / (float)(1024*1024) / (float)(end - start);
+    std::cout << "received.crc32c(5) = " << r << " at " << rate << " MB/sec" << std::endl;
+    ASSERT_EQ(ceph_crc32c(5, (unsigned char*)pa, len), r);
+  }
+  {
+    // the same data as a single ptr
+    bufferlist whole;
+    whole.push_back(a);
+    utime_t start = ceph_clock_now(NULL);
+    uint32_t r = whole.crc32c(0);
+    utime_t end = ceph_clock_now(NULL);
+    float rate = (float)len / (float)(1024*1024) / (float)(end - start);
+    std::cout << "whole.crc32c(0) = " << r << " at " << rate << " MB/sec" << std::endl;
+    ASSERT_EQ(crc, r);
+  }
+}
+
 TEST(BufferList, compare) {
   bufferlist a;
   a.append("A");
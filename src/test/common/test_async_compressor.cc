@@ -94,6 +94,64 @@ TEST_F(AsyncCompressorTest, DecompressInjectTest) {
   ASSERT_EQ(-EIO, async_compressor->get_decompress_data(id, decompress_data, true, &finished));
 }
 
+class C_Wait : public AsyncCompressor::Completion {
+ public:
+  Mutex lock;
+  Cond cond;
+  bool done;
+  int r;
+  C_Wait(): lock("C_Wait::lock"), done(false), r(0) {}
+  // the caller keeps it around to look at the result
+  void complete(int r) {
+    finish(r);
+  }
+  void finish(int _r) {
+    Mutex::Locker l(lock);
+    r = _r;
+    done = true;
+    cond.Signal();
+  }
+  int wait() {
+    Mutex::Locker l(lock);
+    while (!done)
+      cond.Wait(lock);
+    return r;
+  }
+};
+
+TEST_F(AsyncCompressorTest, CompletionTest) {
+  bufferlist rawdata;
+  generate_random_data(rawdata, 1<<22);
+  C_Wait compressed, decompressed;
+  async_compressor->async_compress(rawdata, &compressed);
+  ASSERT_EQ(0, compressed.wait());
+  ASSERT_LT(compressed.data.length(), rawdata.length());
+  async_compressor->async_decompress(compressed.data, &decompressed);
+  ASSERT_EQ(0, decompressed.wait());
+  ASSERT_TRUE(rawdata.contents_equal(decompressed.data));
+
+  // garbage doesn't decompress
+  C_Wait failed;
+  char error[] = "asjdfkwejrljqwaelrj";
+  memcpy(compressed.data.c_str()+1024, error, sizeof(error)-1);
+  async_compressor->async_decompress(compressed.data, &failed);
+  ASSERT_EQ(-EIO, failed.wait());
+}
+
+TEST_F(AsyncCompressorTest, MaxLenTest) {
+  bufferlist rawdata;
+  generate_random_data(rawdata, 1<<20);
+  C_Wait compressed, fits, too_big;
+  async_compressor->async_compress(rawdata, &compressed);
+  ASSERT_EQ(0, compressed.wait());
+  async_compressor->async_decompress(compressed.data, &fits, 1<<20);
+  ASSERT_EQ(0, fits.wait());
+  ASSERT_TRUE(rawdata.contents_equal(fits.data));
+  async_compressor->async_decompress(compressed.data, &too_big, (1<<20) - 1);
+  ASSERT_EQ(-EIO, too_big.wait());
+  ASSERT_EQ(0u, too_big.data.length());
+}
+
 class SyntheticWorkload {
   set<pair<uint64_t, uint64_t> > compress_jobs, decompress_jobs;
   AsyncCompressor *async_compressor;
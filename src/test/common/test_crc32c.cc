@@ -6,6 +6,7 @@
 
 #include "include/types.h"
 #include "include/crc32c.h"
+#include "include/xxhash.h"
 #include "include/utime.h"
 #include "common/Clock.h"
 
@@ -24,6 +25,17 @@ TEST(Crc32c, Small) {
   ASSERT_EQ(3743019208u, ceph_crc32c(5678, (unsigned char *)b, strlen(b)));
 }
 
+TEST(XXHash, Small) {
+  const char *a = "abc";
+  const char *b = "Nobody inspects the spammish repetition";
+  ASSERT_EQ(0x02cc5d05u, ceph_xxhash32(0, "", 0));
+  ASSERT_EQ(0x32d153ffu, ceph_xxhash32(0, a, strlen(a)));
+  ASSERT_EQ(0xe2293b2fu, ceph_xxhash32(0, b, strlen(b)));
+  ASSERT_EQ(0xef46db3751d8e999ull, ceph_xxhash64(0, "", 0));
+  ASSERT_EQ(0x44bc2cf5ad770999ull, ceph_xxhash64(0, a, strlen(a)));
+  ASSERT_EQ(0xfbcea83c8a378bf1ull, ceph_xxhash64(0, b, strlen(b)));
+}
+
 TEST(Crc32c, PartialWord) {
   const char *a = (const char *)malloc(5);
   const char *b = (const char *)malloc(35);
@@ -41,6 +53,31 @@ TEST(Crc32c, Big) {
   ASSERT_EQ(1400919119u, ceph_crc32c(1234, (unsigned char *)a, len));
 }
 
+TEST(Crc32c, Zeros) {
+  unsigned lens[] = { 1, 7, 64, 65, 4096, 4096000 };
+  for (unsigned i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+    ASSERT_EQ(ceph_crc32c_sctp(1234, NULL, lens[i]), ceph_crc32c_zeros(1234, lens[i]));
+    ASSERT_EQ(0u, ceph_crc32c_zeros(0, lens[i]));
+  }
+  // too slow to feed zeros for; from ceph_crc32c_sctp in 256MB steps
+  ASSERT_EQ(2197174860u, ceph_crc32c_zeros(1234, 1u << 29));
+  ASSERT_EQ(3157331422u, ceph_crc32c_zeros(1234, (1u << 29) + 4095));
+  ASSERT_EQ(854102360u, ceph_crc32c_zeros(1234, 1u << 31));
+  ASSERT_EQ(854102360u, ceph_crc32c_zeros(1234, 0xffffffff));
+}
+
+TEST(Crc32c, Combine) {
+  int len = 4096000;
+  char *a = (char *)malloc(len);
+  memset(a, 1, len);
+  for (int split = 0; split <= len; split += len / 4) {
+    uint32_t crc_a = ceph_crc32c(1234, (unsigned char *)a, split);
+    uint32_t crc_b = ceph_crc32c(0, (unsigned char *)a + split, len - split);
+    ASSERT_EQ(1400919119u, ceph_crc32c_combine(crc_a, crc_b, len - split));
+  }
+  free(a);
+}
+
 TEST(Crc32c, Performance) {
   int len = 1000 * 1024 * 1024;
   char *a = (char *)malloc(len);
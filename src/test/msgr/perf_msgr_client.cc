@@ -28,8 +28,24 @@ using namespace std;
 #include "common/Cycles.h"
 #include "global/global_init.h"
 #include "msg/Messenger.h"
+#include "msg/async/AsyncMessenger.h"
 #include "messages/MOSDOp.h"
 
+/// an AsyncMessenger perf counter summed over all workers; zero for
+/// other messengers
+static uint64_t get_worker_counter(int idx)
+{
+  if (g_ceph_context->_conf->ms_type != "async")
+    return 0;
+  WorkerPool *pool;
+  g_ceph_context->lookup_or_create_singleton_object<WorkerPool>(pool, WorkerPool::name);
+  const vector<Worker*>& workers = pool->get_workers();
+  uint64_t v = 0;
+  for (vector<Worker*>::const_iterator it = workers.begin(); it != workers.end(); ++it)
+    v += (*it)->get_perf_counter()->get(idx);
+  return v;
+}
+
 class MessengerClient {
   class ClientThread;
   class ClientDispatcher : public Dispatcher {
@@ -199,7 +215,19 @@ int main(int argc, char **argv)
   uint64_t start = Cycles::rdtsc();
   client.start();
   uint64_t stop = Cycles::rdtsc();
-  cerr << " Total op " << ios << " run time " << Cycles::to_microseconds(stop - start) << "us." << std::endl;
+  uint64_t us = Cycles::to_microseconds(stop - start);
+  uint64_t ops = (uint64_t)ios * numjobs;
+  cerr << " Total op " << ios << " run time " << us << "us." << std::endl;
+  cerr << " ops/s " << ops * 1000000 / us
+       << " MB/s " << (double)ops * len * 1000000 / us / (1 << 20) << std::endl;
+  uint64_t recv = get_worker_counter(l_msgr_recv_messages);
+  uint64_t sent = get_worker_counter(l_msgr_send_messages);
+  if (recv)
+    cerr << " copies per received message "
+         << (double)get_worker_counter(l_msgr_recv_copies) / recv << std::endl;
+  if (sent)
+    cerr << " send syscalls per message "
+         << (double)get_worker_counter(l_msgr_send_syscalls) / sent << std::endl;
 
   return 0;
 }
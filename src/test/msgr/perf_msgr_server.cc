@@ -28,9 +28,25 @@ using namespace std;
 #include "common/Cycles.h"
 #include "global/global_init.h"
 #include "msg/Messenger.h"
+#include "msg/async/AsyncMessenger.h"
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
 
+/// an AsyncMessenger perf counter summed over all workers; zero for
+/// other messengers
+static uint64_t get_worker_counter(int idx)
+{
+  if (g_ceph_context->_conf->ms_type != "async")
+    return 0;
+  WorkerPool *pool;
+  g_ceph_context->lookup_or_create_singleton_object<WorkerPool>(pool, WorkerPool::name);
+  const vector<Worker*>& workers = pool->get_workers();
+  uint64_t v = 0;
+  for (vector<Worker*>::const_iterator it = workers.begin(); it != workers.end(); ++it)
+    v += (*it)->get_perf_counter()->get(idx);
+  return v;
+}
+
 class ServerDispatcher : public Dispatcher {
   uint64_t think_time;
   ThreadPool op_tp;
@@ -71,9 +87,11 @@ class ServerDispatcher : public Dispatcher {
   } op_wq;
 
  public:
+  atomic64_t ops, bytes;
+
   ServerDispatcher(int threads, uint64_t delay): Dispatcher(g_ceph_context), think_time(delay),
     op_tp(g_ceph_context, "ServerDispatcher::op_tp", threads, "serverdispatcher_op_threads"),
-    op_wq(30, 30, &op_tp) {
+    op_wq(30, 30, &op_tp), ops(0), bytes(0) {
     op_tp.start();
   }
   ~ServerDispatcher() {
@@ -95,6 +113,8 @@ class ServerDispatcher : public Dispatcher {
   bool ms_handle_reset(Connection *con) { return true; }
   void ms_handle_remote_reset(Connection *con) {}
   void ms_fast_dispatch(Message *m) {
+    ops.inc();
+    bytes.add(m->get_data().length());
     usleep(think_time);
     //cerr << __func__ << " reply message=" << m << std::endl;
     op_wq.queue(m);
@@ -129,7 +149,33 @@ class MessengerServer {
     msgr->bind(addr);
     msgr->add_dispatcher_head(&dispatcher);
     msgr->start();
-    msgr->wait();
+
+    // runs until it is killed
+    uint64_t last_ops = 0, last_bytes = 0;
+    uint64_t last_copies = 0, last_recv = 0, last_syscalls = 0, last_sent = 0;
+    while (true) {
+      sleep(5);
+      uint64_t ops = dispatcher.ops.read(), bytes = dispatcher.bytes.read();
+      uint64_t copies = get_worker_counter(l_msgr_recv_copies);
+      uint64_t recv = get_worker_counter(l_msgr_recv_messages);
+      uint64_t syscalls = get_worker_counter(l_msgr_send_syscalls);
+      uint64_t sent = get_worker_counter(l_msgr_send_messages);
+      if (ops == last_ops)
+        continue;
+      cerr << " ops/s " << (ops - last_ops) / 5
+           << " MB/s " << (bytes - last_bytes) / 5 / (1 << 20);
+      if (recv > last_recv)
+        cerr << " copies per message " << (double)(copies - last_copies) / (recv - last_recv);
+      if (sent > last_sent)
+        cerr << " send syscalls per message " << (double)(syscalls - last_syscalls) / (sent - last_sent);
+      cerr << std::endl;
+      last_ops = ops;
+      last_bytes = bytes;
+      last_copies = copies;
+      last_recv = recv;
+      last_syscalls = syscalls;
+      last_sent = sent;
+    }
   }
 };
 
@@ -28,6 +28,7 @@
 #include "global/global_init.h"
 #include "common/ceph_argparse.h"
 #include "msg/async/Event.h"
+#include "msg/async/RxBufferPool.h"
 
 // We use epoll, kqueue, evport, select in descending order by performance.
 #if defined(__linux__)
@@ -322,6 +323,31 @@ TEST(EventCenterTest, DispatchTest) {
   worker2.stop();
 }
 
+TEST(RxBufferPoolTest, Layout) {
+  RxBufferPool *pool = new RxBufferPool(g_ceph_context, 1 << 20, 1 << 20);
+
+  // data for object offset 100 starts 100 bytes into a page
+  bufferptr bp = pool->get(3 * CEPH_PAGE_SIZE, 100);
+  ASSERT_EQ(3 * CEPH_PAGE_SIZE, bp.length());
+  ASSERT_EQ(100u, (unsigned long)bp.c_str() & ~CEPH_PAGE_MASK);
+  char *first = bp.c_str();
+  bp = bufferptr();
+  bufferptr again = pool->get(3 * CEPH_PAGE_SIZE, 100);
+  ASSERT_EQ(first, again.c_str());
+
+  // too big to pool, but laid out the same
+  bufferptr big = pool->get(2 << 20, CEPH_PAGE_SIZE + 8);
+  ASSERT_EQ(2u << 20, big.length());
+  ASSERT_EQ(8u, (unsigned long)big.c_str() & ~CEPH_PAGE_MASK);
+
+  bufferptr small = pool->get(100, 0);
+  ASSERT_EQ(100u, small.length());
+
+  // buffers that are still out keep the pool around
+  pool->release();
+  memset(again.c_str(), 0xff, again.length());
+}
+
 INSTANTIATE_TEST_CASE_P(
   AsyncMessenger,
   EventDriverTest,
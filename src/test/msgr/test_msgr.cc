@@ -20,6 +20,8 @@
 #include <time.h>
 #include "common/Mutex.h"
 #include "common/Cond.h"
+#include "common/Throttle.h"
+#include "include/stringify.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include "msg/Dispatcher.h"
@@ -27,6 +29,8 @@
 #include "msg/Message.h"
 #include "msg/Messenger.h"
 #include "msg/Connection.h"
+#include "msg/async/AsyncMessenger.h"
+#include "compressor/AsyncCompressor.h"
 #include "messages/MPing.h"
 #include "messages/MCommand.h"
 
@@ -1305,6 +1309,288 @@ class MarkdownDispatcher : public Dispatcher {
 };
 
 
+TEST_P(MessengerTest, MigrateTest) {
+  if (string(GetParam()) != "async")
+    return;
+  FakeDispatcher cli_dispatcher(false), srv_dispatcher(true);
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  WorkerPool *pool;
+  g_ceph_context->lookup_or_create_singleton_object<WorkerPool>(pool, WorkerPool::name);
+  const vector<Worker*>& workers = pool->get_workers();
+  ASSERT_LT(1u, workers.size());
+
+  ConnectionRef conn = client_msgr->get_connection(server_msgr->get_myinst());
+  AsyncConnection *c = static_cast<AsyncConnection*>(conn.get());
+  for (int i = 0; i < 10; ++i) {
+    MPing *m = new MPing();
+    ASSERT_EQ(conn->send_message(m), 0);
+    {
+      Mutex::Locker l(cli_dispatcher.lock);
+      while (!cli_dispatcher.got_new)
+        cli_dispatcher.cond.Wait(cli_dispatcher.lock);
+      cli_dispatcher.got_new = false;
+    }
+
+    // the connection is open now, so it has to follow
+    Worker *from = c->get_worker();
+    Worker *to = workers[0] == from ? workers[1] : workers[0];
+    c->migrate(to);
+    CHECK_AND_WAIT_TRUE(c->get_worker() == to);
+    ASSERT_EQ(to, c->get_worker());
+  }
+  // and still works where it ended up
+  MPing *m = new MPing();
+  ASSERT_EQ(conn->send_message(m), 0);
+  {
+    Mutex::Locker l(cli_dispatcher.lock);
+    while (!cli_dispatcher.got_new)
+      cli_dispatcher.cond.Wait(cli_dispatcher.lock);
+    cli_dispatcher.got_new = false;
+  }
+  ASSERT_EQ(11u, static_cast<Session*>(conn->get_priv())->get_count());
+  server_msgr->shutdown();
+  client_msgr->shutdown();
+  server_msgr->wait();
+  client_msgr->wait();
+}
+
+class CompressDispatcher : public FakeDispatcher {
+ public:
+  bufferlist last_data;
+  vector<string> last_cmd;
+
+  CompressDispatcher(bool s): FakeDispatcher(s) {}
+  bool ms_dispatch(Message *m) {
+    {
+      Mutex::Locker l(lock);
+      if (m->get_type() == MSG_COMMAND)
+        last_cmd = static_cast<MCommand*>(m)->cmd;
+    }
+    return FakeDispatcher::ms_dispatch(m);
+  }
+  void ms_fast_dispatch(Message *m) {
+    {
+      Mutex::Locker l(lock);
+      if (m->get_data_len())
+        last_data = m->get_data();
+    }
+    FakeDispatcher::ms_fast_dispatch(m);
+  }
+};
+
+static uint64_t get_worker_counter(int idx)
+{
+  WorkerPool *pool;
+  g_ceph_context->lookup_or_create_singleton_object<WorkerPool>(pool, WorkerPool::name);
+  const vector<Worker*>& workers = pool->get_workers();
+  uint64_t v = 0;
+  for (vector<Worker*>::const_iterator it = workers.begin(); it != workers.end(); ++it)
+    v += (*it)->get_perf_counter()->get(idx);
+  return v;
+}
+
+TEST_P(MessengerTest, CompressTest) {
+  if (string(GetParam()) != "async")
+    return;
+  AsyncCompressor compressor(g_ceph_context);
+  compressor.init();
+  server_msgr->set_compressor(&compressor);
+  client_msgr->set_compressor(&compressor);
+
+  CompressDispatcher cli_dispatcher(false), srv_dispatcher(true);
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  Messenger::Policy p = Messenger::Policy::stateful_server(0, 0);
+  server_msgr->set_policy(entity_name_t::TYPE_CLIENT, p);
+  p = Messenger::Policy::lossless_peer(0, 0);
+  p.compress = true;
+  client_msgr->set_policy(entity_name_t::TYPE_OSD, p);
+
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  uint64_t raw = get_worker_counter(l_msgr_compress_raw_bytes);
+  uint64_t compressed = get_worker_counter(l_msgr_compress_bytes);
+  uint64_t decompressed = get_worker_counter(l_msgr_decompress_bytes);
+  ConnectionRef conn = client_msgr->get_connection(server_msgr->get_myinst());
+  string s("abcdefghijklmnopqrstuvwxyz");
+  // a large front
+  {
+    vector<string> cmds;
+    for (int i = 0; i < 1024*30; i++)
+      cmds.push_back(s);
+    uuid_d uuid;
+    uuid.generate_random();
+    MCommand *m = new MCommand(uuid);
+    m->cmd = cmds;
+    ASSERT_EQ(conn->send_message(m), 0);
+    Mutex::Locker l(srv_dispatcher.lock);
+    while (!srv_dispatcher.got_new)
+      srv_dispatcher.cond.Wait(srv_dispatcher.lock);
+    srv_dispatcher.got_new = false;
+    ASSERT_EQ(cmds, srv_dispatcher.last_cmd);
+  }
+  // large data, with small messages around it
+  bufferlist bl;
+  for (int i = 0; i < 1024*30; i++)
+    bl.append(s);
+  for (int i = 0; i < 3; ++i) {
+    MPing *m = new MPing();
+    if (i == 1)
+      m->set_data(bl);
+    ASSERT_EQ(conn->send_message(m), 0);
+  }
+  {
+    // one reply to the command and one to each ping
+    Mutex::Locker l(cli_dispatcher.lock);
+    while (static_cast<Session*>(conn->get_priv())->get_count() < 4)
+      cli_dispatcher.cond.WaitInterval(g_ceph_context, cli_dispatcher.lock, utime_t(0, 10000000));
+  }
+  ASSERT_EQ(4u, static_cast<Session*>(conn->get_priv())->get_count());
+  {
+    Mutex::Locker l(srv_dispatcher.lock);
+    ASSERT_TRUE(bl.contents_equal(srv_dispatcher.last_data));
+  }
+  ASSERT_LT(raw, get_worker_counter(l_msgr_compress_raw_bytes));
+  ASSERT_LT(get_worker_counter(l_msgr_compress_bytes) - compressed,
+            get_worker_counter(l_msgr_compress_raw_bytes) - raw);
+  ASSERT_LT(decompressed, get_worker_counter(l_msgr_decompress_bytes));
+
+  server_msgr->shutdown();
+  client_msgr->shutdown();
+  server_msgr->wait();
+  client_msgr->wait();
+  compressor.terminate();
+}
+
+TEST_P(MessengerTest, CompressThrottleTest) {
+  if (string(GetParam()) != "async")
+    return;
+  AsyncCompressor compressor(g_ceph_context);
+  compressor.init();
+  server_msgr->set_compressor(&compressor);
+  client_msgr->set_compressor(&compressor);
+  // less than two of the messages below, decompressed
+  Throttle bytes(g_ceph_context, "compress_test_bytes", 1 << 20);
+  Throttle msgs(g_ceph_context, "compress_test_msgs", 100);
+
+  CompressDispatcher cli_dispatcher(false), srv_dispatcher(true);
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  Messenger::Policy p = Messenger::Policy::stateful_server(0, 0);
+  server_msgr->set_policy(entity_name_t::TYPE_CLIENT, p);
+  server_msgr->set_policy_throttlers(entity_name_t::TYPE_CLIENT, &bytes, &msgs);
+  p = Messenger::Policy::lossless_peer(0, 0);
+  p.compress = true;
+  client_msgr->set_policy(entity_name_t::TYPE_OSD, p);
+
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  ConnectionRef conn = client_msgr->get_connection(server_msgr->get_myinst());
+  bufferlist bl;
+  string s("abcdefghijklmnopqrstuvwxyz");
+  for (int i = 0; i < 1024*30; i++)
+    bl.append(s);
+  for (int i = 0; i < 10; ++i) {
+    MPing *m = new MPing();
+    m->set_data(bl);
+    ASSERT_EQ(conn->send_message(m), 0);
+  }
+  {
+    Mutex::Locker l(cli_dispatcher.lock);
+    while (static_cast<Session*>(conn->get_priv())->get_count() < 10)
+      cli_dispatcher.cond.WaitInterval(g_ceph_context, cli_dispatcher.lock, utime_t(0, 10000000));
+  }
+  {
+    Mutex::Locker l(srv_dispatcher.lock);
+    ASSERT_TRUE(bl.contents_equal(srv_dispatcher.last_data));
+  }
+  // every message gave back exactly what it took
+  for (int i = 0; i < 100 && (bytes.get_current() || msgs.get_current()); ++i)
+    usleep(10000);
+  ASSERT_EQ(0, bytes.get_current());
+  ASSERT_EQ(0, msgs.get_current());
+
+  server_msgr->shutdown();
+  client_msgr->shutdown();
+  server_msgr->wait();
+  client_msgr->wait();
+  compressor.terminate();
+}
+
+TEST_P(MessengerTest, CompressLimitTest) {
+  if (string(GetParam()) != "async")
+    return;
+  const uint64_t max_size = g_conf->ms_async_decompress_max_size;
+  g_ceph_context->_conf->set_val("ms_async_decompress_max_size", "65536");
+  g_ceph_context->_conf->apply_changes(NULL);
+  AsyncCompressor compressor(g_ceph_context);
+  compressor.init();
+  server_msgr->set_compressor(&compressor);
+  client_msgr->set_compressor(&compressor);
+
+  CompressDispatcher cli_dispatcher(false), srv_dispatcher(true);
+  entity_addr_t bind_addr;
+  bind_addr.parse("127.0.0.1");
+  Messenger::Policy p = Messenger::Policy::lossy_client(0, 0);
+  p.compress = true;
+  client_msgr->set_policy(entity_name_t::TYPE_OSD, p);
+
+  server_msgr->bind(bind_addr);
+  server_msgr->add_dispatcher_head(&srv_dispatcher);
+  server_msgr->start();
+  client_msgr->add_dispatcher_head(&cli_dispatcher);
+  client_msgr->start();
+
+  ConnectionRef conn = client_msgr->get_connection(server_msgr->get_myinst());
+  {
+    MPing *m = new MPing();
+    ASSERT_EQ(conn->send_message(m), 0);
+    Mutex::Locker l(cli_dispatcher.lock);
+    while (!cli_dispatcher.got_new)
+      cli_dispatcher.cond.Wait(cli_dispatcher.lock);
+    cli_dispatcher.got_new = false;
+  }
+  ASSERT_TRUE(conn->is_connected());
+
+  // a few KB on the wire, but more than we take decompressed
+  bufferlist bl;
+  bl.append_zero(1 << 20);
+  MPing *m = new MPing();
+  m->set_data(bl);
+  ASSERT_EQ(conn->send_message(m), 0);
+  CHECK_AND_WAIT_TRUE(!conn->is_connected());
+  ASSERT_FALSE(conn->is_connected());
+  {
+    Mutex::Locker l(srv_dispatcher.lock);
+    ASSERT_EQ(0u, srv_dispatcher.last_data.length());
+  }
+
+  server_msgr->shutdown();
+  client_msgr->shutdown();
+  server_msgr->wait();
+  client_msgr->wait();
+  compressor.terminate();
+  g_ceph_context->_conf->set_val("ms_async_decompress_max_size",
+                                 stringify(max_size));
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 // Markdown with external lock
 TEST_P(MessengerTest, MarkdownTest) {
   Messenger *server_msgr2 = Messenger::create(g_ceph_context, string(GetParam()), entity_name_t::OSD(0), "server", getpid());
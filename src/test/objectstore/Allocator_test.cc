@@ -0,0 +1,146 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "include/interval_set.h"
+#include <gtest/gtest.h>
+
+#include "os/bluestore/Allocator.h"
+
+#if GTEST_HAS_PARAM_TEST
+
+class AllocTest : public ::testing::TestWithParam<const char*> {
+public:
+  Allocator *alloc;
+  AllocTest() : alloc(NULL) {}
+  void init_alloc(uint64_t size, uint64_t block_size) {
+    alloc = Allocator::create(GetParam(), size, block_size);
+    ASSERT_TRUE(alloc);
+  }
+  void TearDown() {
+    if (alloc) {
+      alloc->shutdown();
+      delete alloc;
+    }
+  }
+};
+
+TEST_P(AllocTest, simple)
+{
+  uint64_t block_size = 4096;
+  uint64_t size = block_size * 4096;
+  init_alloc(size, block_size);
+  alloc->init_add_free(0, size);
+  ASSERT_EQ(size, alloc->get_free());
+
+  uint64_t offset;
+  uint32_t length;
+  ASSERT_EQ(0, alloc->reserve(block_size * 16));
+  ASSERT_EQ(0, alloc->allocate(block_size * 16, block_size * 16, 0,
+			       &offset, &length));
+  ASSERT_EQ(block_size * 16, length);
+  ASSERT_EQ(0u, offset % (block_size * 16));
+  ASSERT_EQ(size - length, alloc->get_free());
+
+  // released space is not reusable until the commit completes
+  alloc->release(offset, length);
+  ASSERT_EQ(size - length, alloc->get_free());
+  alloc->commit_start();
+  alloc->commit_finish();
+  ASSERT_EQ(size, alloc->get_free());
+
+  ASSERT_EQ(-ENOSPC, alloc->reserve(size + block_size));
+  ASSERT_EQ(0, alloc->reserve(size));
+  alloc->unreserve(size);
+}
+
+TEST_P(AllocTest, init_rm_free)
+{
+  uint64_t block_size = 4096;
+  uint64_t size = block_size * 4096;
+  init_alloc(size, block_size);
+  alloc->init_add_free(0, size);
+  alloc->init_rm_free(0, size / 2);
+  ASSERT_EQ(size / 2, alloc->get_free());
+
+  uint64_t offset;
+  uint32_t length;
+  ASSERT_EQ(0, alloc->reserve(block_size));
+  ASSERT_EQ(0, alloc->allocate(block_size, block_size, 0, &offset, &length));
+  ASSERT_GE(offset, size / 2);
+  ASSERT_EQ(block_size, length);
+}
+
+TEST_P(AllocTest, fragmented)
+{
+  uint64_t block_size = 4096;
+  uint64_t unit = block_size * 4;
+  uint64_t size = block_size * 16384;
+  init_alloc(size, block_size);
+  alloc->init_add_free(0, size);
+
+  // fill the device one unit at a time, then free every other unit
+  vector<pair<uint64_t,uint32_t> > allocated;
+  ASSERT_EQ(0, alloc->reserve(size));
+  for (uint64_t i = 0; i < size / unit; ++i) {
+    uint64_t offset;
+    uint32_t length;
+    ASSERT_EQ(0, alloc->allocate(unit, unit, 0, &offset, &length));
+    ASSERT_EQ(unit, length);
+    allocated.push_back(make_pair(offset, length));
+  }
+  ASSERT_EQ(0u, alloc->get_free());
+  for (unsigned i = 0; i < allocated.size(); i += 2)
+    alloc->release(allocated[i].first, allocated[i].second);
+  alloc->commit_start();
+  alloc->commit_finish();
+  ASSERT_EQ(size / 2, alloc->get_free());
+
+  // a large request is satisfied with unit-sized pieces and never
+  // hands out the same space twice
+  interval_set<uint64_t> got;
+  uint64_t need = size / 4;
+  ASSERT_EQ(0, alloc->reserve(need));
+  while (need) {
+    uint64_t offset;
+    uint32_t length;
+    ASSERT_EQ(0, alloc->allocate(need, unit, 0, &offset, &length));
+    ASSERT_EQ(unit, length);
+    ASSERT_EQ(0u, offset % unit);
+    ASSERT_FALSE(got.intersects(offset, length));
+    got.insert(offset, length);
+    need -= length;
+  }
+  ASSERT_EQ(size / 4, alloc->get_free());
+}
+
+INSTANTIATE_TEST_CASE_P(
+  Allocator,
+  AllocTest,
+  ::testing::Values("stupid", "bitmap"));
+
+#else
+
+TEST(DummyTest, ValueParameterizedTestsAreNotSupportedOnThisPlatform) {}
+
+#endif
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->set_val("bluestore_min_alloc_size", "16384");
+  g_ceph_context->_conf->set_val("bluestore_bitmapallocator_blocks_per_zone",
+				 "1024");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,250 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <thread>
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "common/config.h"
+#include "common/ceph_argparse.h"
+#include "common/Formatter.h"
+#include "include/atomic.h"
+#include <gtest/gtest.h>
+
+#include "os/bluestore/BlockDevice.h"
+
+#if GTEST_HAS_PARAM_TEST
+
+static void aio_cb(void *priv, void *priv2)
+{
+  atomic_t *n = static_cast<atomic_t*>(priv);
+  n->inc();
+}
+
+/// parameters are "<bdev_type>:<path>"
+class BlockDeviceTest : public ::testing::TestWithParam<const char*> {
+public:
+  BlockDevice *bdev;
+  atomic_t completions;
+  string path;
+
+  BlockDeviceTest() : bdev(NULL) {}
+
+  void SetUp() {
+    string param = GetParam();
+    size_t colon = param.find(':');
+    ASSERT_NE(string::npos, colon);
+    g_ceph_context->_conf->set_val("bdev_type", param.substr(0, colon));
+    g_ceph_context->_conf->apply_changes(NULL);
+    path = param.substr(colon + 1);
+    if (path.find("mem:") != 0) {
+      int fd = ::open(path.c_str(), O_CREAT|O_TRUNC|O_RDWR, 0644);
+      ASSERT_GE(fd, 0);
+      ASSERT_EQ(0, ::ftruncate(fd, 16 << 20));
+      ::close(fd);
+    }
+    bdev = BlockDevice::create(aio_cb, &completions);
+    ASSERT_TRUE(bdev);
+    ASSERT_EQ(0, bdev->open(path));
+  }
+  void TearDown() {
+    if (bdev) {
+      bdev->close();
+      delete bdev;
+    }
+    if (path.find("mem:") != 0)
+      ::unlink(path.c_str());
+  }
+};
+
+TEST_P(BlockDeviceTest, aio)
+{
+  uint64_t bs = bdev->get_block_size();
+  ASSERT_EQ(16ull << 20, bdev->get_size());
+
+  // the device only calls back for an ioc with a priv
+  IOContext ioc(this);
+  for (unsigned i = 0; i < 64; ++i) {
+    bufferlist bl;
+    bl.append(string(bs * (1 + i % 3), 'a' + i % 26));
+    ASSERT_EQ(0, bdev->aio_write(i * 4 * bs, bl, &ioc, false));
+  }
+  ASSERT_TRUE(ioc.has_pending_aios());
+  bdev->aio_submit(&ioc);
+  ioc.aio_wait();
+  ASSERT_FALSE(ioc.has_aios());
+  while (completions.read() == 0)
+    usleep(1000);
+  ASSERT_EQ(1u, completions.read());
+
+  for (unsigned i = 0; i < 64; ++i) {
+    bufferlist bl;
+    ASSERT_EQ(0, bdev->read(i * 4 * bs, bs * (1 + i % 3), &bl, &ioc, false));
+    ASSERT_EQ(bs * (1 + i % 3), bl.length());
+    bufferlist expected;
+    expected.append(string(bl.length(), 'a' + i % 26));
+    ASSERT_TRUE(bl.contents_equal(expected));
+  }
+}
+
+TEST_P(BlockDeviceTest, zero_and_buffered)
+{
+  uint64_t bs = bdev->get_block_size();
+  IOContext ioc(NULL);
+  bufferlist bl;
+  bl.append(string(bs * 4, 'x'));
+  ASSERT_EQ(0, bdev->aio_write(0, bl, &ioc, false));
+  bdev->aio_submit(&ioc);
+  ioc.aio_wait();
+
+  ASSERT_EQ(0, bdev->aio_zero(bs, bs * 2, &ioc));
+  bdev->aio_submit(&ioc);
+  ioc.aio_wait();
+
+  // buffered writes complete before aio_write returns
+  bufferlist b;
+  b.append(string(bs, 'y'));
+  ASSERT_EQ(0, bdev->aio_write(bs * 3, b, &ioc, true));
+  ASSERT_FALSE(ioc.has_aios());
+  ASSERT_EQ(0, bdev->flush());
+
+  bufferlist r, expected;
+  expected.append(string(bs, 'x'));
+  expected.append_zero(bs * 2);
+  expected.append(string(bs, 'y'));
+  ASSERT_EQ(0, bdev->read(0, bs * 4, &r, &ioc, true));
+  ASSERT_TRUE(r.contents_equal(expected));
+}
+
+TEST_P(BlockDeviceTest, concurrent_submitters)
+{
+  uint64_t bs = bdev->get_block_size();
+  const unsigned nthreads = 8;
+  vector<std::thread> threads;
+  atomic_t errors;
+  for (unsigned t = 0; t < nthreads; ++t) {
+    threads.push_back(std::thread([&, t] {
+      for (unsigned j = 0; j < 200; ++j) {
+	IOContext ioc(NULL);
+	uint64_t off = (t * 8 + j % 8) * bs;
+	bufferlist bl;
+	bl.append(string(bs, 'A' + t));
+	bdev->aio_write(off, bl, &ioc, false);
+	bdev->aio_submit(&ioc);
+	ioc.aio_wait();
+	bufferlist r;
+	if (bdev->read(off, bs, &r, &ioc, false) < 0 || r[0] != (char)('A' + t))
+	  errors.inc();
+      }
+    }));
+  }
+  for (auto& t : threads)
+    t.join();
+  ASSERT_EQ(0u, errors.read());
+}
+
+TEST_P(BlockDeviceTest, aio_batching)
+{
+  if (string(g_conf->bdev_type) != "kernel")
+    return;
+
+  // reopen with one shallow queue, and hold each submitter back long
+  // enough for the others to join its io_submit
+  bdev->close();
+  delete bdev;
+  bdev = NULL;
+  g_ceph_context->_conf->set_val("bdev_aio_queues", "1");
+  g_ceph_context->_conf->set_val("bdev_aio_max_queue_depth", "4");
+  g_ceph_context->_conf->set_val("bdev_aio_submit_batch_us", "100000");
+  g_ceph_context->_conf->apply_changes(NULL);
+  bdev = BlockDevice::create(aio_cb, &completions);
+  ASSERT_TRUE(bdev);
+  ASSERT_EQ(0, bdev->open(path));
+  uint64_t bs = bdev->get_block_size();
+
+  auto get_stat = [&](const string& name) {
+    JSONFormatter f(true);
+    f.open_object_section("bdev");
+    bdev->dump_stats(&f);
+    f.close_section();
+    stringstream ss;
+    f.flush(ss);
+    string key = "\"" + name + "\": ";
+    size_t pos = ss.str().find(key);
+    return pos == string::npos ? -1 : atoi(ss.str().c_str() + pos + key.size());
+  };
+
+  vector<std::thread> threads;
+  for (unsigned t = 0; t < 4; ++t) {
+    threads.push_back(std::thread([&, t] {
+      IOContext ioc(NULL);
+      bufferlist bl;
+      bl.append(string(bs, 'A' + t));
+      bdev->aio_write(t * bs, bl, &ioc, false);
+      bdev->aio_submit(&ioc);
+      ioc.aio_wait();
+    }));
+  }
+  for (auto& t : threads)
+    t.join();
+  int peak_batch = get_stat("peak_batch");
+
+  // more aios than the queue takes at once
+  {
+    IOContext ioc(NULL);
+    for (unsigned i = 0; i < 32; ++i) {
+      bufferlist bl;
+      bl.append(string(bs, 'a' + i % 26));
+      ASSERT_EQ(0, bdev->aio_write((8 + i) * bs, bl, &ioc, false));
+    }
+    bdev->aio_submit(&ioc);
+    ioc.aio_wait();
+  }
+  int max_inflight = get_stat("max_inflight");
+  int peak_inflight = get_stat("peak_inflight");
+
+  g_ceph_context->_conf->set_val("bdev_aio_queues", "2");
+  g_ceph_context->_conf->set_val("bdev_aio_max_queue_depth", "4096");
+  g_ceph_context->_conf->set_val("bdev_aio_submit_batch_us", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ASSERT_GE(peak_batch, 2);
+  ASSERT_EQ(4, max_inflight);
+  ASSERT_EQ(4, peak_inflight);
+  for (unsigned i = 0; i < 32; ++i) {
+    bufferlist bl;
+    IOContext ioc(NULL);
+    ASSERT_EQ(0, bdev->read((8 + i) * bs, bs, &bl, &ioc, false));
+    ASSERT_EQ('a' + i % 26, bl[0]);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+  BlockDevice,
+  BlockDeviceTest,
+  ::testing::Values(
+    "kernel:unittest_bluestore_bdev.img",
+    "nvme:mem:16M",
+    "nvme:unittest_bluestore_bdev.ns"));
+
+#else
+
+TEST(DummyTest, ValueParameterizedTestsAreNotSupportedOnThisPlatform) {}
+
+#endif
+
+int main(int argc, char **argv) {
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+  g_ceph_context->_conf->set_val("bdev_nvme_queue_pairs", "2");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
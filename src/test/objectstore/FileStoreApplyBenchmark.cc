@@ -0,0 +1,219 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Measures how the write throughput of a single sequencer (one PG)
+ * scales with filestore_op_threads, with filestore_parallel_apply off
+ * and on.  Every run gets a fresh FileStore under --osd-data.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <iostream>
+#include <sys/stat.h>
+
+using namespace std;
+
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/Clock.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "global/global_init.h"
+#include "include/stringify.h"
+#include "include/str_list.h"
+#include "os/ObjectStore.h"
+
+#define dout_subsys ceph_subsys_filestore
+
+struct Config {
+  int ops;
+  int objects;
+  int block_size;
+  vector<int> threads;
+  Config() : ops(10000), objects(64), block_size(4096) {
+    threads.push_back(1);
+    threads.push_back(2);
+    threads.push_back(4);
+    threads.push_back(8);
+  }
+};
+
+static void usage()
+{
+  derr << "usage: ceph_perf_filestore_apply [flags]\n"
+       << "	 --ops\n"
+       << "	       number of write transactions per run\n"
+       << "	 --objects\n"
+       << "	       number of objects the writes are spread over\n"
+       << "	 --block-size\n"
+       << "	       bytes per write\n"
+       << "	 --threads\n"
+       << "	       comma separated filestore_op_threads values to try\n"
+       << dendl;
+  generic_server_usage();
+}
+
+class C_CountOnreadable : public Context {
+  Mutex *lock;
+  Cond *cond;
+  int *left;
+  ObjectStore::Transaction *t;
+public:
+  C_CountOnreadable(Mutex *l, Cond *c, int *left, ObjectStore::Transaction *t)
+    : lock(l), cond(c), left(left), t(t) {}
+  void finish(int r) {
+    delete t;
+    Mutex::Locker l(*lock);
+    if (--(*left) == 0)
+      cond->Signal();
+  }
+};
+
+/// ops/s for one store configuration, or negative error code
+static double run(const Config& cfg, int threads, bool parallel)
+{
+  g_conf->set_val("filestore_op_threads", stringify(threads));
+  g_conf->set_val("filestore_parallel_apply", parallel ? "true" : "false");
+  g_conf->apply_changes(NULL);
+
+  string dir = g_conf->osd_data + "/apply-" + stringify(threads) +
+    (parallel ? "-parallel" : "-serial");
+  int r = ::mkdir(dir.c_str(), 0755);
+  if (r < 0 && errno != EEXIST) {
+    r = -errno;
+    derr << "mkdir " << dir << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ObjectStore *os = ObjectStore::create(g_ceph_context, "filestore",
+					dir, dir + "/journal");
+  if (!os) {
+    derr << "failed to create filestore" << dendl;
+    return -EINVAL;
+  }
+  r = os->mkfs();
+  if (r < 0) {
+    derr << "mkfs failed: " << cpp_strerror(r) << dendl;
+    delete os;
+    return r;
+  }
+  r = os->mount();
+  if (r < 0) {
+    derr << "mount failed: " << cpp_strerror(r) << dendl;
+    delete os;
+    return r;
+  }
+
+  spg_t pg;
+  coll_t cid(pg);
+  ObjectStore::Sequencer osr("apply_bench");
+  vector<ghobject_t> oids;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (int i = 0; i < cfg.objects; ++i) {
+      oids.push_back(ghobject_t(pg.make_temp_object("obj-" + stringify(i))));
+      t.touch(cid, oids.back());
+    }
+    os->apply_transaction(&osr, t);
+  }
+
+  bufferlist bl;
+  bl.append(buffer::create(cfg.block_size));
+  bl.zero();
+
+  Mutex lock("apply_bench::lock");
+  Cond cond;
+  int left = cfg.ops;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < cfg.ops; ++i) {
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->write(cid, oids[i % oids.size()],
+	     (uint64_t)(i / oids.size()) * cfg.block_size, cfg.block_size, bl);
+    os->queue_transaction(&osr, t,
+			  new C_CountOnreadable(&lock, &cond, &left, t));
+  }
+  lock.Lock();
+  while (left > 0)
+    cond.Wait(lock);
+  lock.Unlock();
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+
+  {
+    ObjectStore::Transaction t;
+    for (vector<ghobject_t>::iterator p = oids.begin(); p != oids.end(); ++p)
+      t.remove(cid, *p);
+    t.remove_collection(cid);
+    os->apply_transaction(&osr, t);
+  }
+  os->umount();
+  delete os;
+  return (double)cfg.ops / (double)elapsed;
+}
+
+int main(int argc, const char **argv)
+{
+  Config cfg;
+
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_OSD, CODE_ENVIRONMENT_UTILITY, 0);
+
+  string val;
+  vector<const char*>::iterator i = args.begin();
+  while (i != args.end()) {
+    if (ceph_argparse_double_dash(args, i))
+      break;
+    if (ceph_argparse_witharg(args, i, &val, "--ops", (char*)NULL)) {
+      cfg.ops = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--objects", (char*)NULL)) {
+      cfg.objects = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--block-size", (char*)NULL)) {
+      cfg.block_size = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--threads", (char*)NULL)) {
+      list<string> ls;
+      get_str_list(val, ls);
+      cfg.threads.clear();
+      for (list<string>::iterator p = ls.begin(); p != ls.end(); ++p)
+	cfg.threads.push_back(atoi(p->c_str()));
+    } else {
+      derr << "Error: can't understand argument: " << *i << "\n" << dendl;
+      usage();
+      return 1;
+    }
+  }
+  if (cfg.ops <= 0 || cfg.objects <= 0 || cfg.block_size <= 0 ||
+      cfg.threads.empty()) {
+    usage();
+    return 1;
+  }
+
+  common_init_finish(g_ceph_context);
+
+  cout << "ops " << cfg.ops << " objects " << cfg.objects
+       << " block_size " << cfg.block_size << std::endl;
+  cout << "threads\tserial ops/s\tparallel ops/s" << std::endl;
+  for (vector<int>::iterator p = cfg.threads.begin();
+       p != cfg.threads.end(); ++p) {
+    double serial = run(cfg, *p, false);
+    double parallel = run(cfg, *p, true);
+    if (serial < 0 || parallel < 0)
+      return 1;
+    cout << *p << "\t" << (uint64_t)serial << "\t\t" << (uint64_t)parallel
+	 << std::endl;
+  }
+  return 0;
+}
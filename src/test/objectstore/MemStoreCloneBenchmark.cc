@@ -0,0 +1,216 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+/*
+ * Measures a snapshot-heavy workload on MemStore: every round clones
+ * each object, as the OSD does on the first write after a snapshot, and
+ * then overwrites a small extent of the head.  Runs it with bufferlist
+ * objects, with PageSet objects, and with PageSet objects drawing from
+ * the page pools.  Every run gets a fresh MemStore under --osd-data.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sys/stat.h>
+
+using namespace std;
+
+#include "common/ceph_argparse.h"
+#include "common/debug.h"
+#include "common/errno.h"
+#include "common/Clock.h"
+#include "global/global_init.h"
+#include "include/stringify.h"
+#include "os/ObjectStore.h"
+
+#define dout_subsys ceph_subsys_filestore
+
+struct Config {
+  int objects;
+  uint64_t object_size;
+  int snaps;
+  uint64_t write_size;
+  Config() : objects(16), object_size(4 << 20), snaps(32), write_size(4096) {}
+};
+
+static void usage()
+{
+  derr << "usage: ceph_perf_memstore_clone [flags]\n"
+       << "	 --objects\n"
+       << "	       number of head objects\n"
+       << "	 --object-size\n"
+       << "	       bytes per object\n"
+       << "	 --snaps\n"
+       << "	       rounds of clone-then-write per object\n"
+       << "	 --write-size\n"
+       << "	       bytes written to the head after each clone\n"
+       << dendl;
+  generic_server_usage();
+}
+
+/// resident set size of this process, in bytes
+static uint64_t get_rss()
+{
+  ifstream statm("/proc/self/statm");
+  uint64_t size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+struct Result {
+  double clones_per_sec;
+  int64_t rss_growth;
+};
+
+/// one run of the workload, or negative error code
+static int run(const Config& cfg, bool page_set, bool page_pool, Result *res)
+{
+  g_conf->set_val("memstore_page_set", page_set ? "true" : "false");
+  g_conf->set_val("memstore_page_pool", page_pool ? "true" : "false");
+  g_conf->apply_changes(NULL);
+
+  string dir = g_conf->osd_data + "/clone-" +
+    (page_set ? (page_pool ? "pool" : "pageset") : "bufferlist");
+  int r = ::mkdir(dir.c_str(), 0755);
+  if (r < 0 && errno != EEXIST) {
+    r = -errno;
+    derr << "mkdir " << dir << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ObjectStore *os = ObjectStore::create(g_ceph_context, "memstore", dir, "");
+  if (!os) {
+    derr << "failed to create memstore" << dendl;
+    return -EINVAL;
+  }
+  r = os->mkfs();
+  if (r < 0) {
+    derr << "mkfs failed: " << cpp_strerror(r) << dendl;
+    delete os;
+    return r;
+  }
+  r = os->mount();
+  if (r < 0) {
+    derr << "mount failed: " << cpp_strerror(r) << dendl;
+    delete os;
+    return r;
+  }
+
+  spg_t pg;
+  coll_t cid(pg);
+  ObjectStore::Sequencer osr("clone_bench");
+  vector<ghobject_t> heads;
+  bufferlist bl;
+  bl.append(buffer::create(cfg.object_size));
+  bl.zero();
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    os->apply_transaction(&osr, t);
+  }
+  for (int i = 0; i < cfg.objects; ++i) {
+    heads.push_back(ghobject_t(hobject_t("obj-" + stringify(i), "",
+					 CEPH_NOSNAP, i, 0, "")));
+    ObjectStore::Transaction t;
+    t.write(cid, heads.back(), 0, cfg.object_size, bl);
+    os->apply_transaction(&osr, t);
+  }
+
+  bufferlist wbl;
+  wbl.append(buffer::create(cfg.write_size));
+  memset(wbl.c_str(), 1, cfg.write_size);
+  const uint64_t rss_before = get_rss();
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int snap = 1; snap <= cfg.snaps; ++snap) {
+    for (vector<ghobject_t>::iterator p = heads.begin(); p != heads.end(); ++p) {
+      ghobject_t clone = *p;
+      clone.hobj.snap = snap;
+      uint64_t off = (rand() % (cfg.object_size / cfg.write_size)) *
+	cfg.write_size;
+      ObjectStore::Transaction t;
+      t.clone(cid, *p, clone);
+      t.write(cid, *p, off, cfg.write_size, wbl);
+      os->apply_transaction(&osr, t);
+    }
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context) - start;
+  res->clones_per_sec = (double)(cfg.snaps * cfg.objects) / (double)elapsed;
+  res->rss_growth = (int64_t)get_rss() - (int64_t)rss_before;
+
+  os->umount();
+  delete os;
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+  Config cfg;
+
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_OSD, CODE_ENVIRONMENT_UTILITY, 0);
+
+  string val;
+  vector<const char*>::iterator i = args.begin();
+  while (i != args.end()) {
+    if (ceph_argparse_double_dash(args, i))
+      break;
+    if (ceph_argparse_witharg(args, i, &val, "--objects", (char*)NULL)) {
+      cfg.objects = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--object-size", (char*)NULL)) {
+      cfg.object_size = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--snaps", (char*)NULL)) {
+      cfg.snaps = atoi(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--write-size", (char*)NULL)) {
+      cfg.write_size = strtoull(val.c_str(), NULL, 10);
+    } else {
+      derr << "Error: can't understand argument: " << *i << "\n" << dendl;
+      usage();
+      return 1;
+    }
+  }
+  if (cfg.objects <= 0 || cfg.snaps <= 0 || cfg.write_size == 0 ||
+      cfg.object_size < cfg.write_size) {
+    usage();
+    return 1;
+  }
+
+  common_init_finish(g_ceph_context);
+
+  cout << "objects " << cfg.objects << " object_size " << cfg.object_size
+       << " snaps " << cfg.snaps << " write_size " << cfg.write_size
+       << std::endl;
+  cout << "objects\t\tclones/s\trss growth (MB)" << std::endl;
+  // the pool keeps its memory, so it runs last
+  const struct {
+    const char *name;
+    bool page_set, page_pool;
+  } runs[] = {
+    { "bufferlist", false, false },
+    { "pageset", true, false },
+    { "pageset+pool", true, true },
+  };
+  for (unsigned j = 0; j < sizeof(runs) / sizeof(runs[0]); ++j) {
+    Result res;
+    int r = run(cfg, runs[j].page_set, runs[j].page_pool, &res);
+    if (r < 0)
+      return 1;
+    cout << runs[j].name << "\t" << (uint64_t)res.clones_per_sec << "\t\t"
+	 << res.rss_growth / (1 << 20) << std::endl;
+  }
+  return 0;
+}
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <string>
 #include <iostream>
+#include <new>
 
 using namespace std;
 
@@ -27,6 +28,24 @@ using namespace std;
 #include "global/global_init.h"
 #include "os/ObjectStore.h"
 
+// heap allocations made through operator new; the benchmark is single
+// threaded
+static uint64_t allocations = 0;
+
+void *operator new(size_t size)
+{
+  ++allocations;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
 class Transaction {
  private:
   ObjectStore::Transaction t;
@@ -43,6 +62,7 @@ class Transaction {
   };
   static Tick write_ticks, setattr_ticks, omap_setkeys_ticks, omap_rmkeys_ticks;
   static Tick encode_ticks, decode_ticks, iterate_ticks;
+  static Tick append_ticks, encoded_bytes_ticks;
 
   void write(coll_t cid, const ghobject_t& oid, uint64_t off, uint64_t len,
              const bufferlist& data) {
@@ -70,6 +90,19 @@ class Transaction {
     omap_rmkeys_ticks.add(Cycles::rdtsc() - start_time);
   }
 
+  /// what the primary does with a replicated write: fold it into the
+  /// transaction it queues, and size that for the journal
+  void apply_append() {
+    ObjectStore::Transaction local;
+    uint64_t start_time = Cycles::rdtsc();
+    local.append(t);
+    append_ticks.add(Cycles::rdtsc() - start_time);
+
+    start_time = Cycles::rdtsc();
+    local.get_encoded_bytes();
+    encoded_bytes_ticks.add(Cycles::rdtsc() - start_time);
+  }
+
   void apply_encode_decode() {
     bufferlist bl;
     ObjectStore::Transaction d;
@@ -138,6 +171,8 @@ class Transaction {
     cerr << " encode op: " << Cycles::to_microseconds(Transaction::encode_ticks.ticks) << "us count: " << Transaction::encode_ticks.count << std::endl;
     cerr << " decode op: " << Cycles::to_microseconds(Transaction::decode_ticks.ticks) << "us count: " << Transaction::decode_ticks.count << std::endl;
     cerr << " iterate op: " << Cycles::to_microseconds(Transaction::iterate_ticks.ticks) << "us count: " << Transaction::iterate_ticks.count << std::endl;
+    cerr << " append op: " << Cycles::to_microseconds(Transaction::append_ticks.ticks) << "us count: " << Transaction::append_ticks.count << std::endl;
+    cerr << " encoded_bytes op: " << Cycles::to_microseconds(Transaction::encoded_bytes_ticks.ticks) << "us count: " << Transaction::encoded_bytes_ticks.count << std::endl;
   }
 };
 
@@ -203,6 +238,7 @@ class PerfCase {
         t.write(cid, oid, 0, len, data["4k"]);
         t.setattr(cid, oid, attr, data[attr]);
         t.setattr(cid, oid, snapset_attr, data[snapset_attr]);
+        t.apply_append();
         t.apply_encode_decode();
         t.apply_iterate();
         ticks += Cycles::rdtsc() - start_time;
@@ -220,6 +256,7 @@ class PerfCase {
         t.omap_setkeys(meta_cid, pglog_oid, pglog_attrset);
         t.omap_setkeys(meta_cid, info_oid, info_attrset);
         t.omap_rmkeys(meta_cid, pglog_oid, keys);
+        t.apply_append();
         t.apply_encode_decode();
         t.apply_iterate();
         ticks += Cycles::rdtsc() - start_time;
@@ -239,6 +276,7 @@ const ghobject_t PerfCase::pglog_oid(hobject_t(sobject_t(object_t("cid_pglog"),
 const ghobject_t PerfCase::info_oid(hobject_t(sobject_t(object_t("infos"), 0)));
 Transaction::Tick Transaction::write_ticks, Transaction::setattr_ticks, Transaction::omap_setkeys_ticks, Transaction::omap_rmkeys_ticks;
 Transaction::Tick Transaction::encode_ticks, Transaction::decode_ticks, Transaction::iterate_ticks;
+Transaction::Tick Transaction::append_ticks, Transaction::encoded_bytes_ticks;
 
 void usage(const string &name) {
   cerr << "Usage: " << name << " [times] "
@@ -262,9 +300,12 @@ int main(int argc, char **argv)
 
   uint64_t times = atoi(args[0]);
   PerfCase c;
+  uint64_t start_allocations = allocations;
   uint64_t ticks = c.rados_write_4k(times);
+  uint64_t op_allocations = allocations - start_allocations;
   Transaction::dump_stat();
   cerr << " Total rados op " << times << " run time " << Cycles::to_microseconds(ticks) << "us." << std::endl;
+  cerr << " Allocations per rados op: " << op_allocations / times << std::endl;
 
   return 0;
 }
@@ -17,6 +17,8 @@
 #include <iostream>
 #include <time.h>
 #include <sys/mount.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "os/ObjectStore.h"
 #include "os/filestore/FileStore.h"
 #include "include/Context.h"
@@ -335,6 +337,255 @@ TEST_P(StoreTest, SimpleColPreHashTest) {
   }
 }
 
+/// number of plain files directly under dir
+static int count_files(const string &dir)
+{
+  DIR *d = ::opendir(dir.c_str());
+  if (!d)
+    return -errno;
+  int n = 0;
+  struct dirent *de;
+  while ((de = ::readdir(d)) != NULL) {
+    struct stat st;
+    if (::stat((dir + "/" + de->d_name).c_str(), &st) == 0 &&
+	S_ISREG(st.st_mode))
+      ++n;
+  }
+  ::closedir(d);
+  return n;
+}
+
+TEST_P(StoreTest, BackgroundSplit) {
+  if (string(GetParam()) != "filestore")
+    return;
+  ObjectStore::Sequencer osr("test");
+  md_config_t *conf = g_ceph_context->_conf;
+  const int merge_threshold = conf->filestore_merge_threshold;
+  const int inline_multiple = conf->filestore_split_inline_multiple;
+  const int objects_per_sec = conf->filestore_split_objects_per_sec;
+  const int batch_objects = conf->filestore_split_batch_objects;
+  // split at 32 objects, only ever from the split thread
+  conf->set_val("filestore_split_in_background", "true");
+  conf->set_val("filestore_split_inline_multiple", "0");
+  conf->set_val("filestore_split_objects_per_sec", "0");
+  conf->set_val("filestore_split_batch_objects", "8");
+  conf->set_val("filestore_merge_threshold", "-1");
+  conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+
+  const int num_objs = 300;
+  coll_t cid(spg_t(pg_t(0, 1), shard_id_t::NO_SHARD));
+  string dir = string("store_test_temp_dir/current/") + cid.to_str();
+  set<ghobject_t, ghobject_t::BitwiseComparator> all;
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  for (int i = 0; i < num_objs; ++i) {
+    ghobject_t hoid(hobject_t("obj-" + stringify(i), "", CEPH_NOSNAP,
+			      i * 2654435761u, 1, ""));
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    all.insert(hoid);
+  }
+
+  // every object stays visible while the split runs, and after a remount
+  for (int pass = 0; pass < 3; ++pass) {
+    for (int wait = 0; wait < 300 && count_files(dir) > 32; ++wait)
+      usleep(100000);
+    vector<ghobject_t> objects;
+    r = store->collection_list(cid, ghobject_t(), ghobject_t::get_max(), true,
+			       INT_MAX, &objects, 0);
+    ASSERT_EQ(r, 0);
+    ASSERT_TRUE(sorted(objects, true));
+    ASSERT_EQ(all.size(), objects.size());
+    ASSERT_TRUE(std::equal(objects.begin(), objects.end(), all.begin()));
+    for (set<ghobject_t, ghobject_t::BitwiseComparator>::iterator p =
+	   all.begin(); p != all.end(); ++p)
+      ASSERT_TRUE(store->exists(cid, *p));
+    if (pass == 1) {
+      store->umount();
+      ASSERT_EQ(0, store->mount());
+    }
+  }
+  ASSERT_GE(32, count_files(dir));
+
+  {
+    ObjectStore::Transaction t;
+    for (set<ghobject_t, ghobject_t::BitwiseComparator>::iterator p =
+	   all.begin(); p != all.end(); ++p)
+      t.remove(cid, *p);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  conf->set_val("filestore_split_in_background", "false");
+  conf->set_val("filestore_split_inline_multiple", stringify(inline_multiple));
+  conf->set_val("filestore_split_objects_per_sec", stringify(objects_per_sec));
+  conf->set_val("filestore_split_batch_objects", stringify(batch_objects));
+  conf->set_val("filestore_merge_threshold", stringify(merge_threshold));
+  conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, BackgroundSplitTurnedOff) {
+  if (string(GetParam()) != "filestore")
+    return;
+  ObjectStore::Sequencer osr("test");
+  md_config_t *conf = g_ceph_context->_conf;
+  const int merge_threshold = conf->filestore_merge_threshold;
+  const int inline_multiple = conf->filestore_split_inline_multiple;
+  const int objects_per_sec = conf->filestore_split_objects_per_sec;
+  // a split thread that would take minutes
+  conf->set_val("filestore_split_in_background", "true");
+  conf->set_val("filestore_split_inline_multiple", "0");
+  conf->set_val("filestore_split_objects_per_sec", "1");
+  conf->set_val("filestore_merge_threshold", "-1");
+  conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+
+  coll_t cid(spg_t(pg_t(0, 1), shard_id_t::NO_SHARD));
+  string dir = string("store_test_temp_dir/current/") + cid.to_str();
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+
+  // the collection's index was built for background splits; once the
+  // option is off, writes split inline again
+  conf->set_val("filestore_split_in_background", "false");
+  conf->apply_changes(NULL);
+  set<ghobject_t, ghobject_t::BitwiseComparator> all;
+  for (int i = 0; i < 100; ++i) {
+    ghobject_t hoid(hobject_t("obj-" + stringify(i), "", CEPH_NOSNAP,
+			      i * 2654435761u, 1, ""));
+    ObjectStore::Transaction t;
+    t.touch(cid, hoid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    all.insert(hoid);
+  }
+  int files = count_files(dir);
+
+  {
+    ObjectStore::Transaction t;
+    for (set<ghobject_t, ghobject_t::BitwiseComparator>::iterator p =
+	   all.begin(); p != all.end(); ++p)
+      t.remove(cid, *p);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  conf->set_val("filestore_split_inline_multiple", stringify(inline_multiple));
+  conf->set_val("filestore_split_objects_per_sec", stringify(objects_per_sec));
+  conf->set_val("filestore_merge_threshold", stringify(merge_threshold));
+  conf->apply_changes(NULL);
+  ASSERT_GE(32, files);
+}
+
+/// shallowest and deepest leaf directory under dir, dir itself at depth
+static void leaf_depths(const string &dir, int depth, int *min, int *max)
+{
+  DIR *d = ::opendir(dir.c_str());
+  if (!d)
+    return;
+  bool leaf = true;
+  struct dirent *de;
+  while ((de = ::readdir(d)) != NULL) {
+    string name = de->d_name;
+    struct stat st;
+    if (name == "." || name == ".." ||
+	::stat((dir + "/" + name).c_str(), &st) != 0 ||
+	!S_ISDIR(st.st_mode))
+      continue;
+    leaf = false;
+    leaf_depths(dir + "/" + name, depth + 1, min, max);
+  }
+  ::closedir(d);
+  if (leaf) {
+    *min = std::min(*min, depth);
+    *max = std::max(*max, depth);
+  }
+}
+
+TEST_P(StoreTest, Presplit) {
+  if (string(GetParam()) != "filestore")
+    return;
+  ObjectStore::Sequencer osr("test");
+  md_config_t *conf = g_ceph_context->_conf;
+  FileStore *fs = static_cast<FileStore*>(store.get());
+  const int merge_threshold = conf->filestore_merge_threshold;
+  int r;
+
+  // an index that merges would undo the split
+  conf->set_val("filestore_merge_threshold", "10");
+  conf->apply_changes(NULL);
+  coll_t merging(spg_t(pg_t(1, 1), shard_id_t::NO_SHARD));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(merging, 0);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(-EINVAL, fs->presplit_collection(merging, 4096, 5));
+
+  conf->set_val("filestore_merge_threshold", "-1");
+  conf->apply_changes(NULL);
+  coll_t cid(spg_t(pg_t(2, 1), shard_id_t::NO_SHARD));
+  coll_t full(spg_t(pg_t(3, 1), shard_id_t::NO_SHARD));
+  ghobject_t hoid(hobject_t("obj", "", CEPH_NOSNAP, 3, 1, ""));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.create_collection(full, 0);
+    t.touch(full, hoid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(-ENOENT, fs->presplit_collection(
+	      coll_t(spg_t(pg_t(4, 1), shard_id_t::NO_SHARD)), 4096, 5));
+  ASSERT_EQ(-ENOTEMPTY, fs->presplit_collection(full, 4096, 5));
+  ASSERT_EQ(-EINVAL, fs->presplit_collection(cid, 1, 5));
+  ASSERT_EQ(-EINVAL, fs->presplit_collection(cid, 4096, 0));
+  // with pg_num 4096 the first three levels are fixed by the pg
+  ASSERT_EQ(-ERANGE, fs->presplit_collection(cid, 4096, 3));
+
+  string dir = string("store_test_temp_dir/current/") + cid.to_str();
+  int min = INT_MAX, max = 0;
+  leaf_depths(dir, 0, &min, &max);
+  ASSERT_EQ(0, max);  // the failures left nothing behind
+
+  ASSERT_EQ(0, fs->presplit_collection(cid, 4096, 5));
+  min = INT_MAX;
+  max = 0;
+  leaf_depths(dir, 0, &min, &max);
+  ASSERT_EQ(5, min);
+  ASSERT_EQ(5, max);
+  // only once
+  ASSERT_EQ(-ENOTEMPTY, fs->presplit_collection(cid, 4096, 5));
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(full, hoid);
+    t.remove_collection(full);
+    t.remove_collection(cid);
+    t.remove_collection(merging);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  conf->set_val("filestore_merge_threshold", stringify(merge_threshold));
+  conf->apply_changes(NULL);
+}
+
 TEST_P(StoreTest, SimpleObjectTest) {
   ObjectStore::Sequencer osr("test");
   int r;
@@ -501,6 +752,84 @@ TEST_P(StoreTest, ManySmallWrite) {
   }
 }
 
+struct C_RecordOnreadable : public Context {
+  Mutex *lock;
+  Cond *cond;
+  vector<int> *order;
+  int seq;
+  ObjectStore::Transaction *t;
+  C_RecordOnreadable(Mutex *l, Cond *c, vector<int> *o, int s,
+		     ObjectStore::Transaction *t)
+    : lock(l), cond(c), order(o), seq(s), t(t) {}
+  void finish(int r) {
+    Mutex::Locker l(*lock);
+    order->push_back(seq);
+    cond->Signal();
+    delete t;
+  }
+};
+
+TEST_P(StoreTest, OnreadableOrder) {
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    cerr << "Creating collection " << cid << std::endl;
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  // interleave appends to a few objects; ops on different objects may
+  // apply out of order, but onreadable must still fire in queue order
+  // and each object must see its own writes in order
+  const int num_ops = 400, num_objs = 8;
+  Mutex lock("OnreadableOrder::lock");
+  Cond cond;
+  vector<int> order;
+  for (int i = 0; i < num_ops; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i % num_objs),
+					CEPH_NOSNAP)));
+    bufferlist bl;
+    ::encode((uint32_t)i, bl);
+    ObjectStore::Transaction *t = new ObjectStore::Transaction;
+    t->write(cid, hoid, (i / num_objs) * bl.length(), bl.length(), bl);
+    r = store->queue_transaction(
+      &osr, t, new C_RecordOnreadable(&lock, &cond, &order, i, t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    Mutex::Locker l(lock);
+    while ((int)order.size() < num_ops)
+      cond.Wait(lock);
+  }
+  for (int i = 0; i < num_ops; ++i)
+    ASSERT_EQ(i, order[i]);
+  for (int o = 0; o < num_objs; ++o) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(o),
+					CEPH_NOSNAP)));
+    bufferlist bl;
+    r = store->read(cid, hoid, 0, num_ops / num_objs * 4, bl);
+    ASSERT_EQ(num_ops / num_objs * 4, r);
+    bufferlist::iterator p = bl.begin();
+    for (int i = o; i < num_ops; i += num_objs) {
+      uint32_t v;
+      ::decode(v, p);
+      ASSERT_EQ((uint32_t)i, v);
+    }
+  }
+  {
+    ObjectStore::Transaction t;
+    for (int o = 0; o < num_objs; ++o)
+      t.remove(cid, ghobject_t(hobject_t(sobject_t("Object " + stringify(o),
+						   CEPH_NOSNAP))));
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, SmallSkipFront) {
   ObjectStore::Sequencer osr("test");
   int r;
@@ -548,6 +877,459 @@ TEST_P(StoreTest, SmallSkipFront) {
   }
 }
 
+TEST_P(StoreTest, ReadAfterOverwriteTruncateZero) {
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    cerr << "Creating collection " << cid << std::endl;
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    bufferlist bl;
+    bufferptr bp(65536);
+    memset(bp.c_str(), 1, 65536);
+    bl.append(bp);
+    ObjectStore::Transaction t;
+    t.write(cid, a, 0, bl.length(), bl);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // read twice; the second one may be served from cache
+    for (int n = 0; n < 2; ++n) {
+      bufferlist bl;
+      ASSERT_EQ(65536, store->read(cid, a, 0, 65536, bl));
+      for (unsigned i=0; i<65536; ++i)
+	ASSERT_EQ(1, bl[i]);
+    }
+  }
+  {
+    // overwrite a piece in the middle of (possibly) cached data
+    bufferlist bl;
+    bufferptr bp(5000);
+    memset(bp.c_str(), 2, 5000);
+    bl.append(bp);
+    ObjectStore::Transaction t;
+    t.write(cid, a, 10000, bl.length(), bl);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    bufferlist in;
+    ASSERT_EQ(65536, store->read(cid, a, 0, 65536, in));
+    for (unsigned i=0; i<10000; ++i)
+      ASSERT_EQ(1, in[i]);
+    for (unsigned i=10000; i<15000; ++i)
+      ASSERT_EQ(2, in[i]);
+    for (unsigned i=15000; i<65536; ++i)
+      ASSERT_EQ(1, in[i]);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, a, 12000, 1000);
+    t.truncate(cid, a, 30000);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.truncate(cid, a, 40000);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    bufferlist bl;
+    ASSERT_EQ(40000, store->read(cid, a, 0, 65536, bl));
+    for (unsigned i=0; i<10000; ++i)
+      ASSERT_EQ(1, bl[i]);
+    for (unsigned i=10000; i<12000; ++i)
+      ASSERT_EQ(2, bl[i]);
+    for (unsigned i=12000; i<13000; ++i)
+      ASSERT_EQ(0, bl[i]);
+    for (unsigned i=13000; i<15000; ++i)
+      ASSERT_EQ(2, bl[i]);
+    for (unsigned i=15000; i<30000; ++i)
+      ASSERT_EQ(1, bl[i]);
+    for (unsigned i=30000; i<40000; ++i)
+      ASSERT_EQ(0, bl[i]);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove_collection(cid);
+    cerr << "Cleaning" << std::endl;
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, BlueStoreCompression) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  g_ceph_context->_conf->set_val("bluestore_compression", "force");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  unsigned len = 4 * g_conf->bluestore_min_alloc_size;
+  bufferlist orig;
+  {
+    // compressible first half, incompressible second half
+    bufferptr bp(len);
+    for (unsigned i = 0; i < len / 2; ++i)
+      bp.c_str()[i] = i / 100;
+    for (unsigned i = len / 2; i < len; ++i)
+      bp.c_str()[i] = rand();
+    orig.append(bp);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, a, 0, orig.length(), orig);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    bufferlist in;
+    ASSERT_EQ((int)len, store->read(cid, a, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(orig));
+    in.clear();
+    ASSERT_EQ(1000, store->read(cid, a, 5000, 1000, in));
+    bufferlist exp;
+    exp.substr_of(orig, 5000, 1000);
+    ASSERT_TRUE(in.contents_equal(exp));
+  }
+  {
+    // overwrite the middle of a compressed blob, clone, truncate into one
+    bufferlist bl;
+    bl.append(string(3000, 'x'));
+    ObjectStore::Transaction t;
+    t.write(cid, a, 7000, bl.length(), bl);
+    t.clone(cid, a, b);
+    t.truncate(cid, a, len / 4 + 1234);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    orig.copy_in(7000, bl.length(), bl);
+  }
+  {
+    bufferlist in, exp;
+    ASSERT_EQ((int)len, store->read(cid, b, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(orig));
+    in.clear();
+    ASSERT_EQ((int)len / 4 + 1234, store->read(cid, a, 0, len, in));
+    exp.substr_of(orig, 0, len / 4 + 1234);
+    ASSERT_TRUE(in.contents_equal(exp));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("bluestore_compression", "none");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, BlueStoreCompressionSameTxc) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  g_ceph_context->_conf->set_val("bluestore_compression", "force");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  unsigned len = 4 * g_conf->bluestore_min_alloc_size;
+  bufferlist orig;
+  {
+    bufferptr bp(len);
+    for (unsigned i = 0; i < len; ++i)
+      bp.c_str()[i] = i / 100;
+    orig.append(bp);
+  }
+  {
+    // the blobs are only in the txc's pending aio when we overwrite,
+    // zero and truncate them
+    bufferlist bl;
+    bl.append(string(3000, 'x'));
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, a, 0, orig.length(), orig,
+	    CEPH_OSD_OP_FLAG_FADVISE_DONTNEED);
+    t.write(cid, a, 7000, bl.length(), bl);
+    t.zero(cid, a, len / 2 + 100, 2000);
+    t.truncate(cid, a, len - 1234);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    orig.copy_in(7000, bl.length(), bl);
+    bufferptr z(2000);
+    z.zero();
+    orig.copy_in(len / 2 + 100, z.length(), z.c_str());
+    bufferlist exp;
+    exp.substr_of(orig, 0, len - 1234);
+    orig.swap(exp);
+  }
+  {
+    bufferlist in;
+    ASSERT_EQ((int)orig.length(), store->read(cid, a, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(orig));
+  }
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  {
+    bufferlist in;
+    ASSERT_EQ((int)orig.length(), store->read(cid, a, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(orig));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("bluestore_compression", "none");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, BlueStoreBitmapFreelist) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  g_ceph_context->_conf->set_val("bluestore_freelist_type", "bitmap");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mkfs());
+  ASSERT_EQ(0, store->mount());
+
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  unsigned len = 3 * g_conf->bluestore_min_alloc_size + 4096;
+  bufferlist bl;
+  bl.append(string(len, 'a'));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (int i = 0; i < 10; ++i) {
+      ghobject_t o(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+      t.write(cid, o, 0, bl.length(), bl);
+    }
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // free every other object, leaving holes in the freelist
+    ObjectStore::Transaction t;
+    for (int i = 0; i < 10; i += 2) {
+      ghobject_t o(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+      t.remove(cid, o);
+    }
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  // remount: the allocator is rebuilt from the bitmap (and fsck'd)
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  {
+    ObjectStore::Transaction t;
+    for (int i = 0; i < 10; i += 2) {
+      ghobject_t o(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+      t.write(cid, o, 0, bl.length(), bl);
+    }
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  for (int i = 0; i < 10; ++i) {
+    ghobject_t o(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+    bufferlist in;
+    ASSERT_EQ((int)len, store->read(cid, o, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (int i = 0; i < 10; ++i) {
+      ghobject_t o(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+      t.remove(cid, o);
+    }
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("bluestore_freelist_type", "extent");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, BlueStoreExtentFreelistBlueFS) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  // the defaults: bluefs carves its space out of the fresh freelist
+  g_ceph_context->_conf->set_val("bluestore_freelist_type", "extent");
+  g_ceph_context->_conf->set_val("bluestore_bluefs", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mkfs());
+  ASSERT_EQ(0, store->mount());
+
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  bufferlist bl;
+  bl.append(string(2 * g_conf->bluestore_min_alloc_size, 'a'));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, a, 0, bl.length(), bl);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  {
+    bufferlist in;
+    ASSERT_EQ((int)bl.length(), store->read(cid, a, 0, bl.length(), in));
+    ASSERT_TRUE(in.contents_equal(bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, BlueStoreSyncTransactionRelease) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  // no bluefs, so that only our writes move the free space
+  g_ceph_context->_conf->set_val("bluestore_bluefs", "false");
+  g_ceph_context->_conf->set_val("bluestore_sync_transaction", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(0, store->mkfs());
+  ASSERT_EQ(0, store->mount());
+
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  struct statfs before, after;
+  ASSERT_EQ(0, store->statfs(&before));
+  bufferlist bl;
+  bl.append(string(4 * g_conf->bluestore_min_alloc_size, 'a'));
+  for (unsigned i = 0; i < 3; ++i) {
+    ObjectStore::Transaction t;
+    t.write(cid, a, 0, bl.length(), bl);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+    ObjectStore::Transaction t2;
+    t2.remove(cid, a);
+    r = store->apply_transaction(&osr, t2);
+    ASSERT_EQ(r, 0);
+  }
+  // the kv sync thread hands the released space to the allocator
+  for (unsigned i = 0; i < 100; ++i) {
+    ASSERT_EQ(0, store->statfs(&after));
+    if (after.f_bfree == before.f_bfree)
+      break;
+    usleep(100000);
+  }
+  ASSERT_EQ(before.f_bfree, after.f_bfree);
+  {
+    ObjectStore::Transaction t;
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("bluestore_sync_transaction", "false");
+  g_ceph_context->_conf->set_val("bluestore_bluefs", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST_P(StoreTest, BlueStoreWALBatch) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  // keep the batch open long enough for the overwrites below to share it
+  g_ceph_context->_conf->set_val("bluestore_wal_batch_max_age", "1");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  ObjectStore::Sequencer osr("test");
+  int r;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  unsigned len = 65536;
+  bufferlist expected;
+  expected.append(string(len, 'a'));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, a, 0, expected.length(), expected);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  // small, unaligned, overlapping and adjacent overwrites all go via wal
+  for (unsigned i = 0; i < 32; ++i) {
+    unsigned off = (i * 1500) % (len - 3000);
+    string s(3000, 'b' + (i % 20));
+    bufferlist bl;
+    bl.append(s);
+    ObjectStore::Transaction t;
+    t.write(cid, a, off, bl.length(), bl);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+
+    bufferlist n;
+    n.substr_of(expected, 0, off);
+    n.append(bl);
+    bufferlist tail;
+    tail.substr_of(expected, off + bl.length(),
+		   len - off - bl.length());
+    n.claim_append(tail);
+    expected.swap(n);
+  }
+  {
+    bufferlist in;
+    ASSERT_EQ((int)len, store->read(cid, a, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(expected));
+  }
+  store->umount();
+  ASSERT_EQ(0, store->mount());
+  {
+    bufferlist in;
+    ASSERT_EQ((int)len, store->read(cid, a, 0, len, in));
+    ASSERT_TRUE(in.contents_equal(expected));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove_collection(cid);
+    r = store->apply_transaction(&osr, t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("bluestore_wal_batch_max_age", ".005");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST_P(StoreTest, SmallSequentialUnaligned) {
   ObjectStore::Sequencer osr("test");
   int r;
@@ -3269,6 +4051,7 @@ int main(int argc, char **argv) {
   g_ceph_context->_conf->set_val("filestore_op_thread_suicide_timeout", "10000");
   g_ceph_context->_conf->set_val("filestore_debug_disable_sharded_check", "true");
   g_ceph_context->_conf->set_val("filestore_fiemap", "true");
+  g_ceph_context->_conf->set_val("filestore_parallel_apply", "true");
   g_ceph_context->_conf->set_val("bluestore_fsck_on_mount", "true");
   g_ceph_context->_conf->set_val("bluestore_fsck_on_umount", "true");
   g_ceph_context->_conf->set_val("bluestore_debug_misc", "true");
@@ -11,6 +11,7 @@
 #include "common/ceph_argparse.h"
 #include "include/stringify.h"
 #include "common/errno.h"
+#include "common/Formatter.h"
 #include <gtest/gtest.h>
 
 #include "os/bluestore/BlueFS.h"
@@ -131,6 +132,124 @@ TEST(BlueFS, small_appends) {
   rm_temp_bdev(fn);
 }
 
+static void write_file(BlueFS& fs, const string& dir, const string& name,
+		       unsigned len, char c)
+{
+  BlueFS::FileWriter *h;
+  ASSERT_EQ(0, fs.open_for_write(dir, name, &h, false, BLUEFS_FILE_SST));
+  bufferlist bl;
+  bl.append(string(len, c));
+  h->append(bl);
+  fs.fsync(h);
+  fs.close_writer(h);
+}
+
+static void verify_file(BlueFS& fs, const string& dir, const string& name,
+			unsigned len, char c)
+{
+  BlueFS::FileReader *h;
+  ASSERT_EQ(0, fs.open_for_read(dir, name, &h));
+  BlueFS::FileReaderBuffer buf(1048576);
+  bufferlist bl;
+  ASSERT_EQ((int)len, fs.read(h, &buf, 0, len, &bl, NULL));
+  bufferlist expected;
+  expected.append(string(len, c));
+  ASSERT_TRUE(bl.contents_equal(expected));
+  delete h;
+}
+
+TEST(BlueFS, tier_spill_back) {
+  // no spill-back thread; we drive every pass
+  ASSERT_EQ(0.0, g_conf->bluefs_spill_back_interval);
+  uint64_t db_size = 1048576 * 16;
+  uint64_t slow_size = 1048576 * 128;
+  string db = get_temp_bdev(db_size);
+  string slow = get_temp_bdev(slow_size);
+  uuid_d fsid;
+  {
+    BlueFS fs;
+    ASSERT_EQ(0, fs.add_block_device(0, db, BlueFS::TIER_DB));
+    ASSERT_EQ(0, fs.add_block_device(1, slow, BlueFS::TIER_SLOW));
+    fs.add_block_extent(0, 1048576, db_size - 1048576);
+    fs.add_block_extent(1, 1048576, slow_size - 1048576);
+    ASSERT_EQ(0, fs.mkfs(fsid));
+    ASSERT_EQ(0, fs.mount());
+    ASSERT_EQ(0, fs.mkdir("db"));
+
+    // b does not fit on db any more, and spills to slow
+    uint64_t slow_free = fs.get_free(1);
+    write_file(fs, "db", "a.sst", 1048576 * 12, 'a');
+    write_file(fs, "db", "b.sst", 1048576 * 8, 'b');
+    ASSERT_LE(fs.get_free(1), slow_free - 1048576 * 8);
+    ASSERT_EQ(0u, fs.spill_back(1ull << 30));  // still no room
+
+    JSONFormatter f(true);
+    f.open_object_section("bluefs");
+    fs.dump_usage(&f);
+    f.close_section();
+    stringstream ss;
+    f.flush(ss);
+    ASSERT_NE(string::npos, ss.str().find("\"spilled_files\": 1"));
+
+    // free up db, and b moves back
+    ASSERT_EQ(0, fs.unlink("db", "a.sst"));
+    fs.sync_metadata();
+    uint64_t db_free = fs.get_free(0);
+    ASSERT_EQ(1048576u * 8, fs.spill_back(1ull << 30));
+    fs.sync_metadata();
+    ASSERT_EQ(db_free - 1048576 * 8, fs.get_free(0));
+    verify_file(fs, "db", "b.sst", 1048576 * 8, 'b');
+    fs.umount();
+  }
+  {
+    BlueFS fs;
+    ASSERT_EQ(0, fs.add_block_device(0, db, BlueFS::TIER_DB));
+    ASSERT_EQ(0, fs.add_block_device(1, slow, BlueFS::TIER_SLOW));
+    ASSERT_EQ(0, fs.mount());
+    verify_file(fs, "db", "b.sst", 1048576 * 8, 'b');
+    ASSERT_EQ(0u, fs.spill_back(1ull << 30));
+    fs.umount();
+  }
+  rm_temp_bdev(db);
+  rm_temp_bdev(slow);
+}
+
+TEST(BlueFS, tier_spill_back_thread) {
+  // the thread only runs when we kick it
+  g_ceph_context->_conf->set_val("bluefs_spill_back_interval", "1000");
+  g_ceph_context->_conf->apply_changes(NULL);
+  uint64_t db_size = 1048576 * 16;
+  uint64_t slow_size = 1048576 * 128;
+  string db = get_temp_bdev(db_size);
+  string slow = get_temp_bdev(slow_size);
+  uuid_d fsid;
+  {
+    BlueFS fs;
+    ASSERT_EQ(0, fs.add_block_device(0, db, BlueFS::TIER_DB));
+    ASSERT_EQ(0, fs.add_block_device(1, slow, BlueFS::TIER_SLOW));
+    fs.add_block_extent(0, 1048576, db_size - 1048576);
+    fs.add_block_extent(1, 1048576, slow_size - 1048576);
+    ASSERT_EQ(0, fs.mkfs(fsid));
+    ASSERT_EQ(0, fs.mount());
+    ASSERT_EQ(0, fs.mkdir("db"));
+    write_file(fs, "db", "a.sst", 1048576 * 12, 'a');
+    write_file(fs, "db", "b.sst", 1048576 * 8, 'b');
+    ASSERT_EQ(0, fs.unlink("db", "a.sst"));
+    fs.sync_metadata();
+    uint64_t db_free = fs.get_free(0);
+    fs.wait_for_spill_back();
+    fs.sync_metadata();
+    ASSERT_EQ(db_free - 1048576 * 8, fs.get_free(0));
+    verify_file(fs, "db", "b.sst", 1048576 * 8, 'b');
+    ASSERT_EQ(0u, fs.spill_back(1ull << 30));
+    fs.umount();
+  }
+  rm_temp_bdev(db);
+  rm_temp_bdev(slow);
+  g_ceph_context->_conf->set_val("bluefs_spill_back_interval", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -141,6 +260,8 @@ int main(int argc, char **argv) {
   g_ceph_context->_conf->set_val(
     "enable_experimental_unrecoverable_data_corrupting_features",
     "*");
+  // tests drive spill-back themselves
+  g_ceph_context->_conf->set_val("bluefs_spill_back_interval", "0");
   g_ceph_context->_conf->apply_changes(NULL);
 
   ::testing::InitGoogleTest(&argc, argv);
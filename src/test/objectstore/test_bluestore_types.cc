@@ -155,3 +155,84 @@ TEST(bluestore_extent_ref_map_t, contains)
   ASSERT_FALSE(m.contains(40, 3000));
   ASSERT_FALSE(m.contains(4000, 30));
 }
+
+TEST(bluestore_onode_t, csum)
+{
+  bluestore_onode_t on;
+  ASSERT_FALSE(on.has_csum());
+  ASSERT_EQ(0u, on.get_csum_count());
+  on.csum_clear(0, 100000);  // no-op
+  on.csum_type = BLUESTORE_CSUM_CRC32C;
+  on.csum_chunk_order = 12;
+  on.csum_prepare(4);
+  ASSERT_EQ(4u, on.get_csum_count());
+  for (unsigned i = 0; i < 4; ++i) {
+    ASSERT_EQ(0u, on.get_csum_item(i));
+    on.set_csum_item(i, 100 + i);
+  }
+  ASSERT_EQ(0u, on.get_csum_item(10));
+
+  // prepare never shrinks, and does not share the old buffer
+  bufferptr old = on.csum_data;
+  on.csum_prepare(2);
+  ASSERT_EQ(4u, on.get_csum_count());
+  on.set_csum_item(0, 7);
+  ASSERT_EQ(7u, on.get_csum_item(0));
+  ASSERT_EQ(100, (unsigned char)old.c_str()[0]);
+  on.set_csum_item(0, 100);
+
+  // clear any chunk touching the range
+  on.csum_clear(4095, 2);
+  ASSERT_EQ(0u, on.get_csum_item(0));
+  ASSERT_EQ(0u, on.get_csum_item(1));
+  ASSERT_EQ(102u, on.get_csum_item(2));
+  on.csum_clear(3 * 4096, 100000);
+  ASSERT_EQ(4u, on.get_csum_count());
+  ASSERT_EQ(102u, on.get_csum_item(2));
+  ASSERT_EQ(0u, on.get_csum_item(3));
+
+  // round trip
+  bufferlist bl;
+  ::encode(on, bl);
+  bluestore_onode_t on2;
+  bufferlist::iterator p = bl.begin();
+  ::decode(on2, p);
+  ASSERT_EQ(BLUESTORE_CSUM_CRC32C, on2.csum_type);
+  ASSERT_EQ(4096u, on2.get_csum_chunk_size());
+  ASSERT_EQ(4u, on2.get_csum_count());
+  ASSERT_EQ(102u, on2.get_csum_item(2));
+
+  // keep only chunks wholly below the new size
+  on.csum_truncate(3 * 4096 - 1);
+  ASSERT_EQ(2u, on.get_csum_count());
+  on.csum_truncate(100000);
+  ASSERT_EQ(2u, on.get_csum_count());
+  on.csum_truncate(4000);
+  ASSERT_FALSE(on.has_csum());
+  ASSERT_EQ(0u, on.get_csum_count());
+}
+
+TEST(bluestore_onode_t, csum_types)
+{
+  for (int t = 0; t < BLUESTORE_CSUM_MAX; ++t) {
+    ASSERT_EQ(t, bluestore_csum_type_from_name(bluestore_csum_type_name(t)));
+  }
+  ASSERT_EQ(-EINVAL, bluestore_csum_type_from_name("foo"));
+  ASSERT_EQ(4u, bluestore_csum_value_size(BLUESTORE_CSUM_CRC32C));
+  ASSERT_EQ(8u, bluestore_csum_value_size(BLUESTORE_CSUM_XXHASH64));
+
+  bufferptr bp(4096);
+  memset(bp.c_str(), 1, bp.length());
+  bufferlist bl;
+  bl.push_back(bp);
+  for (int t = BLUESTORE_CSUM_CRC32C; t < BLUESTORE_CSUM_MAX; ++t) {
+    uint64_t v = bluestore_csum_calc(t, bl);
+    ASSERT_NE(0u, v);
+    bl.c_str()[100] ^= 1;
+    bl.invalidate_crc();
+    ASSERT_NE(v, bluestore_csum_calc(t, bl));
+    bl.c_str()[100] ^= 1;
+    bl.invalidate_crc();
+    ASSERT_EQ(v, bluestore_csum_calc(t, bl));
+  }
+}
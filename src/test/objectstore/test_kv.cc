@@ -18,6 +18,7 @@
 #include <time.h>
 #include <sys/mount.h>
 #include "kv/KeyValueDB.h"
+#include "kv/MemDB.h"
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
@@ -32,12 +33,12 @@
 class KVTest : public ::testing::TestWithParam<const char*> {
 public:
   boost::scoped_ptr<KeyValueDB> db;
+  string dir;
 
-  KVTest() : db(0) {}
+  KVTest() : db(0), dir("kv_test_temp_dir") {}
 
   void init() {
-    db.reset(KeyValueDB::create(g_ceph_context, string(GetParam()),
-				string("kv_test_temp_dir")));
+    db.reset(KeyValueDB::create(g_ceph_context, string(GetParam()), dir));
   }
   void fini() {
     db.reset(NULL);
@@ -113,6 +114,388 @@ TEST_P(KVTest, PutReopen) {
   fini();
 }
 
+TEST_P(KVTest, MemDBDumpAfterReopen) {
+  if (string(GetParam()) != "memdb")
+    return;
+  g_ceph_context->_conf->set_val("memdb_dump_interval", ".1");
+  g_ceph_context->_conf->set_val("memdb_dump_on_close", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+  ASSERT_EQ(0, db->create_and_open(cout));
+  static_cast<MemDB*>(db.get())->close();
+
+  // the same instance, opened again, still dumps periodically
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist value;
+    value.append("value");
+    t->set("prefix", "key", value);
+    db->submit_transaction_sync(t);
+  }
+  usleep(1000000);
+  fini();
+
+  g_ceph_context->_conf->set_val("memdb_dump_interval", "0");
+  g_ceph_context->_conf->set_val("memdb_dump_on_close", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  init();
+  ASSERT_EQ(0, db->open(cout));
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("prefix", "key", &v));
+    ASSERT_EQ(v.length(), 5u);
+  }
+  fini();
+}
+
+TEST_P(KVTest, GetMany) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < 100; i += 2) {
+      bufferlist v;
+      v.append(stringify(i));
+      t->set("many", stringify(i), v);
+    }
+    bufferlist v;
+    v.append("other");
+    t->set("manyx", "1", v);
+    db->submit_transaction_sync(t);
+  }
+  {
+    vector<string> keys;
+    for (unsigned i = 0; i < 100; ++i)
+      keys.push_back(stringify(i));
+    vector<bufferlist> values;
+    vector<int> rs;
+    ASSERT_EQ(0, db->get_many("many", keys, &values, &rs));
+    ASSERT_EQ(keys.size(), values.size());
+    ASSERT_EQ(keys.size(), rs.size());
+    for (unsigned i = 0; i < 100; ++i) {
+      if (i % 2) {
+	ASSERT_EQ(-ENOENT, rs[i]);
+	ASSERT_EQ(0u, values[i].length());
+      } else {
+	ASSERT_EQ(0, rs[i]);
+	ASSERT_EQ(stringify(i), string(values[i].c_str(), values[i].length()));
+      }
+    }
+  }
+  {
+    set<string> keys;
+    keys.insert("1");
+    keys.insert("2");
+    keys.insert("98");
+    map<string,bufferlist> out;
+    ASSERT_EQ(0, db->get("many", keys, &out));
+    ASSERT_EQ(2u, out.size());
+    ASSERT_TRUE(out.count("2"));
+    ASSERT_TRUE(out.count("98"));
+  }
+  {
+    // hints don't change what an iterator returns
+    KeyValueDB::Iterator it = db->get_iterator(
+      "many", KeyValueDB::ITERATOR_NOCACHE | KeyValueDB::ITERATOR_PREFETCH);
+    unsigned n = 0;
+    for (it->seek_to_first(); it->valid(); it->next())
+      ++n;
+    ASSERT_EQ(50u, n);
+  }
+  fini();
+}
+
+struct XorMergeOperator : public KeyValueDB::MergeOperator {
+  void merge_nonexistent(
+    const char *rdata, size_t rlen, std::string *new_value) {
+    *new_value = std::string(rdata, rlen);
+  }
+  void merge(
+    const char *ldata, size_t llen,
+    const char *rdata, size_t rlen,
+    std::string *new_value) {
+    assert(llen == rlen);
+    *new_value = std::string(ldata, llen);
+    for (size_t i = 0; i < rlen; ++i)
+      (*new_value)[i] ^= rdata[i];
+  }
+  string name() const {
+    return "xor";
+  }
+};
+
+TEST_P(KVTest, Merge) {
+  ceph::shared_ptr<KeyValueDB::MergeOperator> p(new XorMergeOperator);
+  int r = db->set_merge_operator("P", p);
+  if (r < 0) {
+    cout << "merge operators not supported by " << GetParam() << std::endl;
+    return;
+  }
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v1, v2;
+    v1.append(string("\x0f\x0f", 2));
+    v2.append(string("\x03\x30", 2));
+    t->merge("P", "key", v1);  // nonexistent
+    t->merge("P", "key", v2);  // in the same transaction
+    t->set("p", "key", v1);    // other prefixes are untouched
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("P", "key", &v));
+    ASSERT_EQ(string("\x0c\x3f", 2), string(v.c_str(), v.length()));
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v1;
+    v1.append(string("\x0c\x3f", 2));
+    t->merge("P", "key", v1);
+    db->submit_transaction_sync(t);
+  }
+  fini();
+
+  init();
+  db->set_merge_operator("P", p);
+  ASSERT_EQ(0, db->open(cout));
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("P", "key", &v));
+    ASSERT_EQ(string("\0\0", 2), string(v.c_str(), v.length()));
+    ASSERT_EQ(0, db->get("p", "key", &v));
+    ASSERT_EQ(string("\x0f\x0f", 2), string(v.c_str(), v.length()));
+  }
+  fini();
+}
+
+TEST_P(KVTest, BuiltinMergeOperators) {
+  ASSERT_EQ(0, db->set_merge_operator(
+	      "C", KeyValueDB::create_merge_operator("uint64_add")));
+  ASSERT_EQ(0, db->set_merge_operator(
+	      "X", KeyValueDB::create_merge_operator("bitwise_xor")));
+  ASSERT_EQ(0, db->set_merge_operator(
+	      "A", KeyValueDB::create_merge_operator("append")));
+  ASSERT_FALSE(KeyValueDB::create_merge_operator("nope"));
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    // earlier runs may have left values behind
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkey("C", "n");
+    t->rmkey("X", "b");
+    t->rmkey("A", "s");
+    db->submit_transaction_sync(t);
+  }
+  for (unsigned i = 1; i <= 10; ++i) {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist n, b, s;
+    ::encode((uint64_t)i, n);
+    t->merge("C", "n", n);
+    b.append(string(1, (char)(1 << (i % 8))));
+    t->merge("X", "b", b);
+    s.append(string(1, '0' + i % 10));
+    t->merge("A", "s", s);
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    ASSERT_EQ(0, db->get("C", "n", &v));
+    bufferlist::iterator p = v.begin();
+    uint64_t n;
+    ::decode(n, p);
+    ASSERT_EQ(55u, n);
+    ASSERT_EQ(0, db->get("X", "b", &v));
+    ASSERT_EQ(string("\xf9", 1), string(v.c_str(), v.length()));
+    ASSERT_EQ(0, db->get("A", "s", &v));
+    ASSERT_EQ(string("1234567890"), string(v.c_str(), v.length()));
+  }
+  {
+    // set, rm and merge apply in order within one transaction
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist one, seven;
+    ::encode((uint64_t)1, one);
+    ::encode((uint64_t)7, seven);
+    t->merge("C", "n", one);
+    t->set("C", "n", seven);
+    t->merge("C", "n", one);
+    t->rmkey("C", "m");
+    t->merge("C", "m", seven);
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    uint64_t n;
+    ASSERT_EQ(0, db->get("C", "n", &v));
+    bufferlist::iterator p = v.begin();
+    ::decode(n, p);
+    ASSERT_EQ(8u, n);
+    ASSERT_EQ(0, db->get("C", "m", &v));
+    p = v.begin();
+    ::decode(n, p);
+    ASSERT_EQ(7u, n);
+  }
+  {
+    // a counter that is not 8 bytes counts as 0
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist bad, three;
+    bad.append("bad");
+    ::encode((uint64_t)3, three);
+    t->set("C", "n", bad);
+    t->merge("C", "n", three);
+    db->submit_transaction_sync(t);
+  }
+  {
+    bufferlist v;
+    uint64_t n;
+    ASSERT_EQ(0, db->get("C", "n", &v));
+    bufferlist::iterator p = v.begin();
+    ::decode(n, p);
+    ASSERT_EQ(3u, n);
+  }
+  fini();
+}
+
+TEST_P(KVTest, ColumnFamilies) {
+  // keep the families out of the db the other tests share
+  fini();
+  dir = "kv_test_temp_dir.cf";
+  init();
+  vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(0, KeyValueDB::parse_column_families(
+	      "a=A:bloom_bits=10;block_cache_share=.25 "
+	      "b=B+C:write_buffer_size=1048576", &cfs));
+  int r = db->set_column_families(cfs);
+  if (r < 0) {
+    cout << "column families not supported by " << GetParam() << std::endl;
+    return;
+  }
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    // one transaction across all families
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v;
+    v.append("value");
+    for (auto prefix : { "A", "B", "C", "D" }) {
+      t->set(prefix, "k1", v);
+      t->set(prefix, "k2", v);
+    }
+    db->submit_transaction_sync(t);
+  }
+  {
+    // the whole keyspace iterates in order, in either direction
+    vector<pair<string,string> > expected;
+    for (auto prefix : { "A", "B", "C", "D" }) {
+      expected.push_back(make_pair(prefix, "k1"));
+      expected.push_back(make_pair(prefix, "k2"));
+    }
+    KeyValueDB::WholeSpaceIterator it = db->get_iterator();
+    unsigned n = 0;
+    for (it->seek_to_first(); it->valid(); it->next())
+      ASSERT_EQ(expected[n++], it->raw_key());
+    ASSERT_EQ(expected.size(), n);
+    for (it->seek_to_last(); it->valid(); it->prev())
+      ASSERT_EQ(expected[--n], it->raw_key());
+    ASSERT_EQ(0u, n);
+
+    it->lower_bound("B", "k2");
+    ASSERT_EQ(make_pair(string("B"), string("k2")), it->raw_key());
+    it->prev();
+    ASSERT_EQ(make_pair(string("B"), string("k1")), it->raw_key());
+    it->next();
+    it->next();
+    ASSERT_EQ(make_pair(string("C"), string("k1")), it->raw_key());
+    it->seek_to_last("B");
+    ASSERT_EQ(make_pair(string("B"), string("k2")), it->raw_key());
+  }
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix("B");
+    t->rmkey("A", "k1");
+    db->submit_transaction_sync(t);
+  }
+  fini();
+
+  // the layout is fixed once created
+  init();
+  ASSERT_LT(db->open(cout), 0);
+  fini();
+  init();
+  vector<KeyValueDB::ColumnFamily> more = cfs;
+  more.push_back(KeyValueDB::ColumnFamily("e", vector<string>(1, "E")));
+  ASSERT_EQ(0, db->set_column_families(more));
+  ASSERT_LT(db->open(cout), 0);
+  fini();
+
+  init();
+  cfs[1].options = "compaction_style=kCompactionStyleUniversal";
+  ASSERT_EQ(0, db->set_column_families(cfs));
+  ASSERT_EQ(0, db->open(cout));
+  {
+    bufferlist v;
+    ASSERT_EQ(-ENOENT, db->get("A", "k1", &v));
+    ASSERT_EQ(0, db->get("A", "k2", &v));
+    ASSERT_EQ(-ENOENT, db->get("B", "k1", &v));
+    ASSERT_EQ(0, db->get("C", "k1", &v));
+    ASSERT_EQ(0, db->get("D", "k2", &v));
+    KeyValueDB::Iterator it = db->get_snapshot_iterator("C");
+    unsigned n = 0;
+    for (it->seek_to_first(); it->valid(); it->next())
+      ++n;
+    ASSERT_EQ(2u, n);
+  }
+  fini();
+}
+
+TEST_P(KVTest, SnapshotIterator) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkeys_by_prefix("snap");
+    for (unsigned i = 0; i < 10; ++i) {
+      bufferlist v;
+      v.append("old");
+      t->set("snap", stringify(i), v);
+    }
+    db->submit_transaction_sync(t);
+  }
+  KeyValueDB::Iterator snap = db->get_snapshot_iterator("snap");
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist v;
+    v.append("new");
+    t->rmkey("snap", "0");
+    t->set("snap", "5", v);
+    t->set("snap", "a", v);
+    db->submit_transaction_sync(t);
+  }
+  {
+    unsigned n = 0;
+    for (snap->seek_to_first(); snap->valid(); snap->next()) {
+      ASSERT_EQ(stringify(n), snap->key());
+      bufferlist v = snap->value();
+      ASSERT_EQ(string("old"), string(v.c_str(), v.length()));
+      ++n;
+    }
+    ASSERT_EQ(10u, n);
+  }
+  {
+    KeyValueDB::Iterator it = db->get_iterator("snap");
+    unsigned n = 0;
+    string last;
+    for (it->seek_to_last(); it->valid(); it->prev()) {
+      if (n == 0)
+	last = it->key();
+      ++n;
+    }
+    ASSERT_EQ(10u, n);
+    ASSERT_EQ(string("a"), last);
+    it->lower_bound("5");
+    bufferlist v = it->value();
+    ASSERT_EQ(string("new"), string(v.c_str(), v.length()));
+  }
+  snap.reset();
+  fini();
+}
+
 TEST_P(KVTest, BenchCommit) {
   int n = 1024;
   ASSERT_EQ(0, db->create_and_open(cout));
@@ -150,7 +533,7 @@ TEST_P(KVTest, BenchCommit) {
 INSTANTIATE_TEST_CASE_P(
   KeyValueDB,
   KVTest,
-  ::testing::Values("leveldb", "rocksdb"));
+  ::testing::Values("leveldb", "rocksdb", "memdb"));
 
 #else
 
@@ -164,6 +547,30 @@ TEST(DummyTest, ValueParameterizedTestsAreNotSupportedOnThisPlatform) {}
 
 #endif
 
+TEST(KeyValueDB, parse_column_families) {
+  vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(0, KeyValueDB::parse_column_families("", &cfs));
+  ASSERT_TRUE(cfs.empty());
+  ASSERT_EQ(0, KeyValueDB::parse_column_families(
+	      " omap=M:bloom_bits=10;write_buffer_size=1048576\tmeta=O+C+S ",
+	      &cfs));
+  ASSERT_EQ(2u, cfs.size());
+  ASSERT_EQ("omap", cfs[0].name);
+  ASSERT_EQ(vector<string>(1, "M"), cfs[0].prefixes);
+  ASSERT_EQ("bloom_bits=10;write_buffer_size=1048576", cfs[0].options);
+  ASSERT_EQ("meta", cfs[1].name);
+  ASSERT_EQ(3u, cfs[1].prefixes.size());
+  ASSERT_EQ("S", cfs[1].prefixes[2]);
+  ASSERT_EQ("", cfs[1].options);
+
+  cfs.clear();
+  ASSERT_EQ(-EINVAL, KeyValueDB::parse_column_families("omap", &cfs));
+  cfs.clear();
+  ASSERT_EQ(-EINVAL, KeyValueDB::parse_column_families("=M", &cfs));
+  cfs.clear();
+  ASSERT_EQ(-EINVAL, KeyValueDB::parse_column_families("a=M a=O", &cfs));
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
@@ -0,0 +1,160 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "os/ObjectStore.h"
+#include "include/stringify.h"
+#include <gtest/gtest.h>
+
+static ghobject_t make_oid(int i)
+{
+  return ghobject_t(hobject_t("obj-" + stringify(i), "", CEPH_NOSNAP, i, 0, ""));
+}
+
+/// (op, cid, oid) for every op, plus the data of each write
+static void walk(ObjectStore::Transaction& t,
+		 vector<pair<coll_t, ghobject_t> > *targets,
+		 vector<string> *writes)
+{
+  ObjectStore::Transaction::iterator i = t.begin();
+  while (i.have_op()) {
+    ObjectStore::Transaction::Op *op = i.decode_op();
+    targets->push_back(make_pair(i.get_cid(op->cid), i.get_oid(op->oid)));
+    if (op->op == ObjectStore::Transaction::OP_WRITE) {
+      bufferlist bl;
+      i.decode_bl(bl);
+      writes->push_back(string(bl.c_str(), bl.length()));
+    } else {
+      assert(op->op == ObjectStore::Transaction::OP_TOUCH);
+    }
+  }
+}
+
+static void build(ObjectStore::Transaction& t, const coll_t& cid,
+		  int first, int count)
+{
+  for (int i = first; i < first + count; ++i) {
+    bufferlist bl;
+    bl.append("data-" + stringify(i));
+    t.touch(cid, make_oid(i));
+    t.write(cid, make_oid(i), 0, bl.length(), bl);
+  }
+}
+
+TEST(Transaction, EncodeDecode)
+{
+  coll_t cid(spg_t(pg_t(1, 2), shard_id_t::NO_SHARD));
+  // past both the linear index and the first op arena
+  ObjectStore::Transaction t;
+  build(t, cid, 0, 40);
+  ASSERT_EQ(80, t.get_num_ops());
+
+  bufferlist bl;
+  t.encode(bl);
+  bufferlist::iterator p = bl.begin();
+  ObjectStore::Transaction d(p);
+  ASSERT_EQ(t.get_encoded_bytes(), d.get_encoded_bytes());
+
+  vector<pair<coll_t, ghobject_t> > want, got;
+  vector<string> want_writes, got_writes;
+  walk(t, &want, &want_writes);
+  walk(d, &got, &got_writes);
+  ASSERT_EQ(80u, got.size());
+  ASSERT_EQ(want, got);
+  ASSERT_EQ(want_writes, got_writes);
+  ASSERT_EQ(make_oid(39), got.back().second);
+}
+
+TEST(Transaction, EncodedBytes)
+{
+  coll_t cid(spg_t(pg_t(1, 2), shard_id_t::NO_SHARD));
+  ObjectStore::Transaction t;
+  uint64_t last = t.get_encoded_bytes();
+  for (int i = 0; i < 20; ++i) {
+    build(t, cid, i, 1);
+    uint64_t bytes = t.get_encoded_bytes();
+    ASSERT_LT(last, bytes);
+    last = bytes;
+
+    bufferlist bl;
+    t.encode(bl);
+    // struct_v, compat_v and length, then the lengths of data_bl and op_bl
+    ASSERT_EQ(bl.length(), bytes + 2 * sizeof(__u8) + 3 * sizeof(__u32));
+  }
+}
+
+TEST(Transaction, Append)
+{
+  coll_t cid(spg_t(pg_t(1, 2), shard_id_t::NO_SHARD));
+  coll_t cid2(spg_t(pg_t(3, 4), shard_id_t::NO_SHARD));
+
+  // same ids: shares other's ops
+  ObjectStore::Transaction a, b;
+  build(b, cid, 0, 3);
+  a.append(b);
+  // different ids: ops are copied and renumbered, and b is left alone
+  ObjectStore::Transaction c;
+  build(c, cid2, 10, 2);
+  build(c, cid, 2, 2);
+  a.append(c);
+  ASSERT_EQ(14, a.get_num_ops());
+
+  vector<pair<coll_t, ghobject_t> > got, want;
+  vector<string> got_writes, want_writes;
+  walk(b, &want, &want_writes);
+  walk(c, &want, &want_writes);
+  walk(a, &got, &got_writes);
+  ASSERT_EQ(want, got);
+  ASSERT_EQ(want_writes, got_writes);
+
+  vector<pair<coll_t, ghobject_t> > again;
+  vector<string> again_writes;
+  walk(c, &again, &again_writes);
+  ASSERT_EQ(cid2, again[0].first);
+  ASSERT_EQ(make_oid(10), again[0].second);
+
+  bufferlist bl;
+  a.encode(bl);
+  bufferlist::iterator p = bl.begin();
+  ObjectStore::Transaction d(p);
+  got.clear();
+  got_writes.clear();
+  walk(d, &got, &got_writes);
+  ASSERT_EQ(want, got);
+  ASSERT_EQ(want_writes, got_writes);
+}
+
+TEST(Transaction, DecodeSplitOps)
+{
+  coll_t cid(spg_t(pg_t(1, 2), shard_id_t::NO_SHARD));
+  ObjectStore::Transaction t;
+  build(t, cid, 0, 5);
+  bufferlist bl;
+  t.encode(bl);
+
+  // as if it came off the wire in odd-sized pieces
+  bufferlist split;
+  for (unsigned off = 0; off < bl.length(); off += 7) {
+    bufferlist piece;
+    piece.substr_of(bl, off, MIN(7, bl.length() - off));
+    piece.rebuild();
+    split.append(piece);
+  }
+  bufferlist::iterator p = split.begin();
+  ObjectStore::Transaction d(p);
+
+  vector<pair<coll_t, ghobject_t> > want, got;
+  vector<string> want_writes, got_writes;
+  walk(t, &want, &want_writes);
+  walk(d, &got, &got_writes);
+  ASSERT_EQ(want, got);
+  ASSERT_EQ(want_writes, got_writes);
+}
@@ -57,6 +57,17 @@ int OmapBench::setup(int argc, const char** argv) {
 	}
       } else if (strcmp(args[i], "--name") == 0) {
 	rados_id = args[i+1];
+      } else if (strcmp(args[i], "--test") == 0) {
+	if (strcmp("write", args[i+1]) == 0) {
+	  test = &OmapBench::test_write_objects_in_parallel;
+	} else if (strcmp("get_keys", args[i+1]) == 0) {
+	  test = &OmapBench::test_get_keys;
+	} else if (strcmp("get_range", args[i+1]) == 0) {
+	  test = &OmapBench::test_get_range;
+	} else {
+	  cout << "unknown test " << args[i+1] << std::endl;
+	  exit(1);
+	}
       }
     } else if (strcmp(args[i], "--help") == 0) {
       cout << "\nUsage: ostorebench [options]\n"
@@ -86,7 +97,10 @@ int OmapBench::setup(int argc, const char** argv) {
       	   << " to be specified size.\n"
       	   << "                        (default "<<value_size;
       cout <<"\n  --name          the rados id to use (default "<<rados_id;
-      cout<<")\n";
+      cout << ")\n"
+	   << "	--test          write, or get_keys or get_range to time reading\n"
+	   << "                        the written omaps back by key or as a\n"
+	   << "                        range (default write)\n";
       exit(1);
     }
   }
@@ -168,20 +182,27 @@ void AioWriter::set_aioc(librados::callback_t complete,
 void OmapBench::aio_is_safe(rados_completion_t c, void *arg) {
   AioWriter *aiow = reinterpret_cast<AioWriter *>(arg);
   aiow->stop_time();
-  Mutex * data_lock = &aiow->ob->data_lock;
   Mutex * thread_is_free_lock = &aiow->ob->thread_is_free_lock;
   Cond * thread_is_free = &aiow->ob->thread_is_free;
   int &busythreads_count = aiow->ob->busythreads_count;
-  o_bench_data &data = aiow->ob->data;
-  int INCREMENT = aiow->ob->increment;
   int err = aiow->get_aioc()->get_return_value();
   if (err < 0) {
     cout << "error writing AioCompletion";
     return;
   }
   double time = aiow->get_time();
+  OmapBench *ob = aiow->ob;
   delete aiow;
-  data_lock->Lock();
+  ob->record_latency(time);
+
+  thread_is_free_lock->Lock();
+  busythreads_count--;
+  thread_is_free->Signal();
+  thread_is_free_lock->Unlock();
+}
+
+void OmapBench::record_latency(double time) {
+  Mutex::Locker l(data_lock);
   data.avg_latency = (data.avg_latency * data.completed_ops + time)
       / (data.completed_ops + 1);
   data.completed_ops++;
@@ -192,17 +213,11 @@ void OmapBench::aio_is_safe(rados_completion_t c, void *arg) {
     data.max_latency = time;
   }
   data.total_latency += time;
-  ++(data.freq_map[time / INCREMENT]);
-  if(data.freq_map[time/INCREMENT] > data.mode.second) {
-    data.mode.first = time/INCREMENT;
-    data.mode.second = data.freq_map[time/INCREMENT];
+  ++(data.freq_map[time / increment]);
+  if(data.freq_map[time/increment] > data.mode.second) {
+    data.mode.first = time/increment;
+    data.mode.second = data.freq_map[time/increment];
   }
-  data_lock->Unlock();
-
-  thread_is_free_lock->Lock();
-  busythreads_count--;
-  thread_is_free->Signal();
-  thread_is_free_lock->Unlock();
 }
 
 string OmapBench::random_string(int len) {
@@ -405,6 +420,59 @@ int OmapBench::test_write_objects_in_parallel(omap_generator_t omap_gen) {
   return 0;
 }
 
+int OmapBench::test_get_keys(omap_generator_t omap_gen) {
+  int err = test_write_objects_in_parallel(omap_gen);
+  if (err < 0)
+    return err;
+  data = o_bench_data();
+  for (int i = 1; i <= objects; i++) {
+    std::stringstream objstrm;
+    objstrm << prefix << i;
+    set<string> keys;
+    librados::ObjectReadOperation key_read;
+    key_read.omap_get_keys("", LONG_MAX, &keys, &err);
+    io_ctx.operate(objstrm.str(), &key_read, NULL);
+    if (err < 0)
+      return err;
+
+    map<string, bufferlist> vals;
+    librados::ObjectReadOperation val_read;
+    val_read.omap_get_vals_by_keys(keys, &vals, &err);
+    utime_t start = ceph_clock_now(g_ceph_context);
+    int r = io_ctx.operate(objstrm.str(), &val_read, NULL);
+    utime_t end = ceph_clock_now(g_ceph_context);
+    if (r < 0)
+      return r;
+    if (err < 0)
+      return err;
+    record_latency((end - start) * 1000);
+  }
+  return 0;
+}
+
+int OmapBench::test_get_range(omap_generator_t omap_gen) {
+  int err = test_write_objects_in_parallel(omap_gen);
+  if (err < 0)
+    return err;
+  data = o_bench_data();
+  for (int i = 1; i <= objects; i++) {
+    std::stringstream objstrm;
+    objstrm << prefix << i;
+    map<string, bufferlist> vals;
+    librados::ObjectReadOperation val_read;
+    val_read.omap_get_vals("", LONG_MAX, &vals, &err);
+    utime_t start = ceph_clock_now(g_ceph_context);
+    int r = io_ctx.operate(objstrm.str(), &val_read, NULL);
+    utime_t end = ceph_clock_now(g_ceph_context);
+    if (r < 0)
+      return r;
+    if (err < 0)
+      return err;
+    record_latency((end - start) * 1000);
+  }
+  return 0;
+}
+
 /**
  * runs the specified test with the specified parameters and generates
  * a histogram of latencies
@@ -136,6 +136,11 @@ public:
    */
   static void aio_is_safe(rados_completion_t c, void *arg);
 
+  /**
+   * Adds one op's latency, in ms, to data
+   */
+  void record_latency(double time);
+
   /**
    * Generates a random string len characters long
    */
@@ -200,6 +205,18 @@ public:
    */
   int test_write_objects_in_parallel(omap_generator_t omap_gen);
 
+  /*
+   * Writes the objects as test_write_objects_in_parallel does, then times
+   * reading each object's omap back by key (omap_get_vals_by_keys).
+   */
+  int test_get_keys(omap_generator_t omap_gen);
+
+  /*
+   * Writes the objects as test_write_objects_in_parallel does, then times
+   * reading each object's omap back as a range (omap_get_vals).
+   */
+  int test_get_range(omap_generator_t omap_gen);
+
 };
 
 
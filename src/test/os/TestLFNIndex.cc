@@ -87,6 +87,10 @@ protected:
                                    uint32_t pg_num,
                                    uint64_t expected_num_objs
                                   ) { return 0; }
+  virtual int _presplit(
+			uint32_t pg_num,
+			unsigned depth
+			) { return 0; }
 
 };
 
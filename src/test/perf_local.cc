@@ -53,6 +53,8 @@
 #include "common/Thread.h"
 #include "common/Timer.h"
 #include "msg/async/Event.h"
+#include "os/bluestore/bluestore_types.h"
+#include "os/bluestore/Allocator.h"
 #include "global/global_init.h"
 
 #include "test/perf_helper.h"
@@ -565,6 +567,89 @@ double ceph_str_hash_rjenkins()
   return Cycles::to_seconds(stop - start)/count;
 }
 
+// Benchmark BlueStore data checksums on one csum chunk of cached data.
+template <int csum_type, int chunk_size>
+double bluestore_csum()
+{
+  int count = 10000;
+  bufferptr bp(chunk_size);
+  memset(bp.c_str(), 0x5a, chunk_size);
+  bufferlist bl;
+  bl.push_back(bp);
+  uint64_t total = 0;
+
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i++) {
+    bl.invalidate_crc();  // don't let the bufferlist crc cache help
+    total += bluestore_csum_calc(csum_type, bl);
+  }
+  uint64_t stop = Cycles::rdtsc();
+  discard(&total);
+
+  return Cycles::to_seconds(stop - start)/count;
+}
+
+// Benchmark a BlueStore allocator on a fragmented device: fill 4GB with
+// 64K extents and release a random half of them, then allocate and
+// release 256K at a time so every request is stitched from free holes.
+double bluestore_alloc_frag(const char *type)
+{
+  uint64_t block_size = 4096, unit = 65536, size = 4ull << 30;
+  Allocator *alloc = Allocator::create(type, size, block_size);
+  alloc->init_add_free(0, size);
+
+  vector<uint64_t> extents;
+  uint64_t offset;
+  uint32_t length;
+  alloc->reserve(size);
+  for (uint64_t i = 0; i < size / unit; ++i) {
+    alloc->allocate(unit, unit, 0, &offset, &length);
+    extents.push_back(offset);
+  }
+  srand(0);
+  for (size_t i = 0; i < extents.size(); ++i)
+    std::swap(extents[i], extents[rand() % extents.size()]);
+  for (size_t i = 0; i < extents.size() / 2; ++i)
+    alloc->release(extents[i], unit);
+  alloc->commit_start();
+  alloc->commit_finish();
+
+  int count = 10000;
+  vector<pair<uint64_t,uint32_t> > got;
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i++) {
+    uint64_t need = unit * 4;
+    alloc->reserve(need);
+    while (need) {
+      alloc->allocate(need, unit, 0, &offset, &length);
+      got.push_back(make_pair(offset, length));
+      need -= length;
+    }
+    for (auto& p : got)
+      alloc->release(p.first, p.second);
+    got.clear();
+    if ((i & 15) == 15) {
+      alloc->commit_start();
+      alloc->commit_finish();
+    }
+  }
+  uint64_t stop = Cycles::rdtsc();
+  alloc->shutdown();
+  delete alloc;
+
+  return Cycles::to_seconds(stop - start)/count;
+}
+
+double bluestore_alloc_frag_stupid()
+{
+  return bluestore_alloc_frag("stupid");
+}
+
+double bluestore_alloc_frag_bitmap()
+{
+  return bluestore_alloc_frag("bitmap");
+}
+
 // Measure the cost of reading the fine-grain cycle counter.
 double rdtsc_test()
 {
@@ -955,6 +1040,22 @@ TestInfo tests[] = {
     "rjenkins hash on 16 byte of data"},
   {"ceph_str_hash_rjenkins", ceph_str_hash_rjenkins<256>,
     "rjenkins hash on 256 bytes of data"},
+  {"bluestore_csum_crc32c", bluestore_csum<BLUESTORE_CSUM_CRC32C, 4096>,
+    "BlueStore crc32c csum on 4K chunk"},
+  {"bluestore_csum_crc32c", bluestore_csum<BLUESTORE_CSUM_CRC32C, 65536>,
+    "BlueStore crc32c csum on 64K chunk"},
+  {"bluestore_csum_xxhash32", bluestore_csum<BLUESTORE_CSUM_XXHASH32, 4096>,
+    "BlueStore xxhash32 csum on 4K chunk"},
+  {"bluestore_csum_xxhash32", bluestore_csum<BLUESTORE_CSUM_XXHASH32, 65536>,
+    "BlueStore xxhash32 csum on 64K chunk"},
+  {"bluestore_csum_xxhash64", bluestore_csum<BLUESTORE_CSUM_XXHASH64, 4096>,
+    "BlueStore xxhash64 csum on 4K chunk"},
+  {"bluestore_csum_xxhash64", bluestore_csum<BLUESTORE_CSUM_XXHASH64, 65536>,
+    "BlueStore xxhash64 csum on 64K chunk"},
+  {"bluestore_alloc_frag_stupid", bluestore_alloc_frag_stupid,
+    "StupidAllocator 256K alloc+release, fragmented"},
+  {"bluestore_alloc_frag_bitmap", bluestore_alloc_frag_bitmap,
+    "BitmapAllocator 256K alloc+release, fragmented"},
   {"rdtsc", rdtsc_test,
     "Read the fine-grain cycle counter"},
   {"cycles_to_seconds", perf_cycles_to_seconds,
@@ -256,6 +256,97 @@ TEST(TestFileJournal, WriteManyVecs) {
   }
 }
 
+class C_RecordCommit : public Context {
+  Mutex *lock;
+  Cond *cond;
+  unsigned *inflight;
+  vector<double> *lats;
+  uint64_t *last_seq;
+  bool *in_order;
+  uint64_t seq;
+  utime_t start;
+public:
+  C_RecordCommit(Mutex *l, Cond *c, unsigned *inflight, vector<double> *lats,
+		 uint64_t *last_seq, bool *in_order, uint64_t seq)
+    : lock(l), cond(c), inflight(inflight), lats(lats), last_seq(last_seq),
+      in_order(in_order), seq(seq),
+      start(ceph_clock_now(g_ceph_context)) {}
+  void finish(int r) {
+    utime_t lat = ceph_clock_now(g_ceph_context) - start;
+    Mutex::Locker l(*lock);
+    lats->push_back((double)lat);
+    if (seq <= *last_seq)
+      *in_order = false;
+    *last_seq = seq;
+    --(*inflight);
+    cond->Signal();
+  }
+};
+
+// keeps a fixed number of entries in flight and reports throughput and
+// tail commit latency at each depth
+TEST(TestFileJournal, WriteQueueDepth) {
+  g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
+  g_ceph_context->_conf->set_val("journal_write_header_frequency", "0");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  const unsigned entries = 512;
+  const unsigned entry_size = 64 << 10;
+  const unsigned depths[] = { 1, 4, 16, 64 };
+
+  for (unsigned i = 0 ; i < 3; ++i) {
+    SCOPED_TRACE(subtests[i].description);
+    for (unsigned d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+      fsid.generate_random();
+      FileJournal j(fsid, finisher, &sync_cond, path, subtests[i].directio,
+		    subtests[i].aio, subtests[i].faio);
+      ASSERT_EQ(0, j.create());
+      j.make_writeable();
+
+      Mutex lock("WriteQueueDepth::lock");
+      Cond c;
+      unsigned inflight = 0;
+      vector<double> lats;
+      uint64_t last_seq = 0;
+      bool in_order = true;
+      list<ObjectStore::Transaction*> tls;
+
+      utime_t start = ceph_clock_now(g_ceph_context);
+      for (uint64_t seq = 1; seq <= entries; ++seq) {
+	lock.Lock();
+	while (inflight >= depths[d])
+	  c.Wait(lock);
+	++inflight;
+	lock.Unlock();
+
+	bufferlist bl;
+	bufferptr bp = buffer::create_page_aligned(entry_size);
+	memset(bp.c_str(), (char)seq, entry_size);
+	bl.append(bp);
+	int orig_len = j.prepare_entry(tls, &bl);
+	j.submit_entry(seq, bl, orig_len,
+		       new C_RecordCommit(&lock, &c, &inflight, &lats,
+					  &last_seq, &in_order, seq));
+      }
+      lock.Lock();
+      while (inflight > 0)
+	c.Wait(lock);
+      lock.Unlock();
+      double elapsed = ceph_clock_now(g_ceph_context) - start;
+
+      ASSERT_EQ(entries, lats.size());
+      ASSERT_TRUE(in_order);
+      sort(lats.begin(), lats.end());
+      cout << subtests[i].description << " queue depth " << depths[d]
+	   << ": " << (double)entries * entry_size / elapsed / (1 << 20)
+	   << " MB/s, p99 commit latency "
+	   << lats[lats.size() * 99 / 100] * 1000 << " ms" << std::endl;
+
+      j.close();
+    }
+  }
+}
+
 TEST(TestFileJournal, ReplaySmall) {
   g_ceph_context->_conf->set_val("journal_ignore_corruption", "false");
   g_ceph_context->_conf->set_val("journal_write_header_frequency", "0");
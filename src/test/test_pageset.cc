@@ -269,3 +269,133 @@ TEST(PageSet, FreeHoles)
   pages.get_range(0, 8, range);
   ASSERT_EQ(0u, range.size());
 }
+
+TEST(PageSet, ShareRange)
+{
+  // allocate pages at offsets 0, 1 and 3, with their offset as data
+  PageSet src(1);
+  PageSet::page_vector range;
+  for (uint64_t i : {0, 1, 3}) {
+    src.alloc_range(i, 1, range);
+    range[0]->data[0] = 'a' + i;
+    range.clear();
+  }
+  // and 4 pages of 'x' to be replaced
+  PageSet dst(1);
+  dst.alloc_range(10, 4, range);
+  for (auto &page : range)
+    page->data[0] = 'x';
+  range.clear();
+
+  // pages 0-3 show up at 10-13, with the hole at 12
+  dst.share_range(src, 0, 4, 10);
+  dst.get_range(0, 999, range);
+  ASSERT_EQ(3u, range.size());
+  ASSERT_EQ(10u, range[0]->offset);
+  ASSERT_EQ(11u, range[1]->offset);
+  ASSERT_EQ(13u, range[2]->offset);
+  ASSERT_EQ('a', range[0]->data[0]);
+  ASSERT_EQ('b', range[1]->data[0]);
+  ASSERT_EQ('d', range[2]->data[0]);
+  ASSERT_TRUE(range[0]->is_shared());
+  range.clear();
+}
+
+TEST(PageSet, CopyOnWrite)
+{
+  PageSet src(1);
+  PageSet::page_vector range;
+  src.alloc_range(0, 2, range);
+  range[0]->data[0] = 'a';
+  range[1]->data[0] = 'b';
+  range.clear();
+
+  PageSet dst(1);
+  dst.share_range(src, 0, 2, 0);
+
+  // writing to the clone copies the page it writes to
+  dst.alloc_range(1, 1, range);
+  ASSERT_EQ(1u, range.size());
+  ASSERT_FALSE(range[0]->is_shared());
+  ASSERT_EQ('b', range[0]->data[0]);
+  range[0]->data[0] = 'B';
+  range.clear();
+
+  src.get_range(0, 2, range);
+  ASSERT_EQ('a', range[0]->data[0]);
+  ASSERT_EQ('b', range[1]->data[0]);
+  ASSERT_TRUE(range[0]->is_shared());
+  ASSERT_FALSE(range[1]->is_shared());
+  range.clear();
+
+  // and so does writing to the original
+  src.alloc_range(0, 1, range);
+  ASSERT_FALSE(range[0]->is_shared());
+  range[0]->data[0] = 'A';
+  range.clear();
+
+  dst.get_range(0, 2, range);
+  ASSERT_EQ('a', range[0]->data[0]);
+  ASSERT_EQ('B', range[1]->data[0]);
+  ASSERT_FALSE(range[0]->is_shared());
+  range.clear();
+}
+
+TEST(PageSet, SharedOutlivesOriginal)
+{
+  PageSet::page_vector range;
+  PageSet dst(1);
+  {
+    PageSet src(1);
+    src.alloc_range(0, 1, range);
+    range[0]->data[0] = 'a';
+    range.clear();
+    dst.share_range(src, 0, 1, 0);
+  }
+  dst.get_range(0, 1, range);
+  ASSERT_EQ(1u, range.size());
+  ASSERT_FALSE(range[0]->is_shared());
+  ASSERT_EQ('a', range[0]->data[0]);
+}
+
+TEST(PagePool, Reuse)
+{
+  const size_t page_size = 4096;
+  PagePool *pool = PagePool::get(page_size + sizeof(PageBuffer));
+  ASSERT_EQ(pool, PagePool::get(page_size + sizeof(PageBuffer)));
+
+  PageSet::page_vector range;
+  {
+    PageSet pages(page_size, pool);
+    pages.alloc_range(0, page_size * 100, range);
+    ASSERT_EQ(100u, range.size());
+    range.clear();
+  }
+  const uint64_t bytes = pool->get_bytes();
+  ASSERT_GE(bytes, 100 * (page_size + sizeof(PageBuffer)));
+
+  // the freed pages are used again
+  PageSet pages(page_size, pool);
+  pages.alloc_range(0, page_size * 100, range);
+  range.clear();
+  ASSERT_EQ(bytes, pool->get_bytes());
+}
+
+TEST(PagePool, DecodeOtherPageSize)
+{
+  PageSet::page_vector range;
+  PageSet src(1024);
+  src.alloc_range(0, 4096, range);
+  range[0]->data[0] = 'a';
+  range.clear();
+  bufferlist bl;
+  src.encode(bl);
+
+  // decode into a set pooled for a different page size
+  PageSet dst(4096, PagePool::get(4096 + sizeof(PageBuffer)));
+  auto p = bl.begin();
+  dst.decode(p);
+  dst.get_range(0, 4096, range);
+  ASSERT_EQ(4u, range.size());
+  ASSERT_EQ('a', range[0]->data[0]);
+}
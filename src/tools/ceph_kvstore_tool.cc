@@ -149,8 +149,12 @@ class StoreTool
       return -EINVAL;
     }
 
-    // open or create a leveldb store at @p other_path
+    // open or create a store of @p type at @p other_path
     KeyValueDB *other = KeyValueDB::create(g_ceph_context, type, other_path);
+    if (!other) {
+      std::cerr << "unknown store type '" << type << "'" << std::endl;
+      return -EINVAL;
+    }
     int err = other->create_and_open(std::cerr);
     if (err < 0)
       return err;
@@ -209,7 +213,7 @@ class StoreTool
 
 void usage(const char *pname)
 {
-  std::cerr << "Usage: " << pname << " <leveldb|rocksdb|...> <store path> command [args...]\n"
+  std::cerr << "Usage: " << pname << " <leveldb|rocksdb|memdb|...> <store path> command [args...]\n"
     << "\n"
     << "Commands:\n"
     << "  list [prefix]\n"
@@ -219,7 +223,7 @@ void usage(const char *pname)
     << "  crc <prefix> <key>\n"
     << "  get-size [<prefix> <key>]\n"
     << "  set <prefix> <key> [ver <N>|in <file>]\n"
-    << "  store-copy <path> [num-keys-per-tx]\n"
+    << "  store-copy <path> [num-keys-per-tx] [<leveldb|rocksdb|memdb|...>]\n"
     << "  store-crc <path>\n"
     << std::endl;
 }
@@ -397,10 +401,15 @@ int main(int argc, const char *argv[])
     }
   } else if (cmd == "store-copy") {
     int num_keys_per_tx = 128; // magic number that just feels right.
+    string other_type = argv[1];
     if (argc < 5) {
       usage(argv[0]);
       return 1;
-    } else if (argc > 5) {
+    }
+    if (argc > 6) {
+      other_type = argv[6];
+    }
+    if (argc > 5) {
       string err;
       num_keys_per_tx = strict_strtol(argv[5], 10, &err);
       if (!err.empty()) {
@@ -409,7 +418,7 @@ int main(int argc, const char *argv[])
       }
     }
 
-    int ret = st.copy_store_to(argv[1], argv[4], num_keys_per_tx);
+    int ret = st.copy_store_to(other_type, argv[4], num_keys_per_tx);
     if (ret < 0) {
       std::cerr << "error copying store to path '" << argv[4]
                 << "': " << cpp_strerror(ret) << std::endl;